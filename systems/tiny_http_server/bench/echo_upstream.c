@@ -0,0 +1,194 @@
+/*
+ * echo_upstream.c
+ *
+ * A minimal HTTP/1.1 application server that stands in for the
+ * upstream of a proxied route in tests and benchmarks.
+ *
+ * Runs one thread per connection and keeps connections open, reading
+ * pipelined requests in order. A GET answers with the request line
+ * and headers it received, so forwarded headers can be checked; PUT
+ * and POST echo the request body. Paths ending in "/chunked" answer
+ * with a chunked body of -b bytes, and every response is delayed by
+ * -d milliseconds to model application work.
+ *
+ * Build:
+ *   cc -O2 -o echo_upstream bench/echo_upstream.c -lpthread
+ *
+ * Usage:
+ *   echo_upstream [-p port] [-d delay-ms] [-b chunked-bytes]
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/** milliseconds each response is delayed */
+static long delayMs;
+
+/** bytes of a chunked response */
+static long chunkedBytes = 65536;
+
+/**
+ * Send a buffer completely.
+ *
+ * @return true if sent
+ */
+static bool sendAll(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Serve the requests of one connection until it is closed.
+ */
+static void *serveConnection(void *arg) {
+	int fd = (int)(long)arg;
+	char in[65536];
+	size_t have = 0;
+	char *out = malloc(sizeof(in) + 256);
+	while (true) {
+		// read up to the end of the next request's headers
+		char *end;
+		while ((end = memmem(in, have, "\r\n\r\n", 4)) == NULL) {
+			if (have == sizeof(in)) {
+				goto done;
+			}
+			ssize_t n = recv(fd, in + have, sizeof(in) - have, 0);
+			if (n <= 0) {
+				goto done;
+			}
+			have += n;
+		}
+		size_t headLen = end + 4 - in;
+		char method[16] = "", path[1024] = "";
+		sscanf(in, "%15s %1023s", method, path);
+		const char *cl = strcasestr(in, "\r\nContent-Length:");
+		size_t bodyLen = ((cl != NULL) && (cl < end)) ? strtoul(cl + 17, NULL, 10) : 0;
+		if (headLen + bodyLen > sizeof(in)) {
+			goto done;
+		}
+		while (have < headLen + bodyLen) {
+			ssize_t n = recv(fd, in + have, headLen + bodyLen - have, 0);
+			if (n <= 0) {
+				goto done;
+			}
+			have += n;
+		}
+
+		if (delayMs > 0) {
+			struct timespec delay = { delayMs / 1000, (delayMs % 1000) * 1000000 };
+			nanosleep(&delay, NULL);
+		}
+
+		bool head = (strcmp(method, "HEAD") == 0);
+		size_t pathLen = strlen(path);
+		bool ok;
+		if ((pathLen >= 8) && (strcmp(path + pathLen - 8, "/chunked") == 0)) {
+			int len = sprintf(out, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+							  "Transfer-Encoding: chunked\r\n\r\n");
+			ok = sendAll(fd, out, len);
+			for (long left = chunkedBytes; ok && !head && (left > 0); ) {
+				size_t n = (left < 8192) ? left : 8192;
+				len = sprintf(out, "%zx\r\n", n);
+				memset(out + len, 'c', n);
+				memcpy(out + len + n, "\r\n", 2);
+				ok = sendAll(fd, out, len + n + 2);
+				left -= n;
+			}
+			ok = ok && (head || sendAll(fd, "0\r\n\r\n", 5));
+		} else {
+			// echo the body, or the request head for a request without one
+			const char *body = (bodyLen > 0) ? in + headLen : in;
+			size_t len = (bodyLen > 0) ? bodyLen : headLen;
+			int n = sprintf(out, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n\r\n", len);
+			if (!head) {
+				memcpy(out + n, body, len);
+				n += len;
+			}
+			ok = sendAll(fd, out, n);
+		}
+		if (!ok) {
+			break;
+		}
+		memmove(in, in + headLen + bodyLen, have - headLen - bodyLen);
+		have -= headLen + bodyLen;
+	}
+done:
+	free(out);
+	close(fd);
+	return NULL;
+}
+
+/**
+ * Print usage and exit.
+ */
+static void usage(const char *prog) {
+	fprintf(stderr,
+			"usage: %s [-p port] [-d delay-ms] [-b chunked-bytes]\n"
+			"  -p  port to listen on (default 9000)\n"
+			"  -d  milliseconds to delay each response (default 0)\n"
+			"  -b  bytes of a .../chunked response (default 65536)\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Main program accepts connections and serves each on a thread.
+ */
+int main(int argc, char *argv[]) {
+	int port = 9000;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:d:b:")) != -1) {
+		switch (opt) {
+		case 'p': port = atoi(optarg); break;
+		case 'd': delayMs = atol(optarg); break;
+		case 'b': chunkedBytes = atol(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+
+	int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port),
+								.sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	if ((bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(listenFd, 1024) != 0)) {
+		perror("echo_upstream");
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, "echo_upstream listening on 127.0.0.1:%d\n", port);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (true) {
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			continue;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, serveConnection, (void *)(long)fd) != 0) {
+			close(fd);
+		}
+	}
+	return EXIT_SUCCESS;
+}
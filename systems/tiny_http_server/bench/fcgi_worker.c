@@ -0,0 +1,474 @@
+/*
+ * fcgi_worker.c
+ *
+ * A FastCGI responder that stands in for the workers of a dynamic
+ * handler (fastcgi_N) in tests and benchmarks.
+ *
+ * Accepts connections on the socket passed as standard input, as the
+ * server starts it, or on a Unix socket of its own with -s. Requests
+ * are multiplexed: each connection may carry many at once, and each
+ * is answered on its own thread once its body has arrived, after
+ * -d milliseconds to model application work.
+ *
+ * A form posted as application/x-www-form-urlencoded is answered with
+ * an HTML table of its fields; any other body is echoed with its
+ * content type; a request without a body is answered with its CGI
+ * parameters. The query parameters "status=N" and "bytes=N" set the
+ * response status, and replace the body with N bytes sent without a
+ * Content-Length.
+ *
+ * Build:
+ *   cc -O2 -o fcgi_worker bench/fcgi_worker.c -lpthread
+ *
+ * Usage:
+ *   fcgi_worker [-d delay-ms] [-s socket-path] [-1]
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_ABORT_REQUEST 2
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_GET_VALUES 9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_UNKNOWN_TYPE 11
+#define FCGI_CANT_MPX_CONN 1
+
+/** most requests in flight on a connection */
+#define MAX_REQS 64
+
+/** milliseconds each response is delayed */
+static long delayMs;
+
+/** answer one request at a time per connection */
+static bool single;
+
+/** A growable byte buffer */
+typedef struct Bytes {
+	char *data;
+	size_t len;
+	size_t cap;
+} Bytes;
+
+/** A connection from the server */
+typedef struct Conn {
+	int fd;
+	pthread_mutex_t lock;			/** guards writes, refs and requests */
+	int refs;						/** the reader and the requests answering */
+	struct Request *requests[MAX_REQS + 1];
+} Conn;
+
+/** A request in flight */
+typedef struct Request {
+	Conn *conn;
+	unsigned id;
+	bool aborted;
+	bool answering;
+	Bytes params;
+	Bytes body;
+} Request;
+
+/**
+ * Append bytes to a buffer.
+ */
+static void append(Bytes *b, const void *data, size_t len) {
+	if (b->len + len + 1 > b->cap) {
+		b->cap = (b->len + len + 1) * 2;
+		b->data = realloc(b->data, b->cap);
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	b->data[b->len] = '\0';
+}
+
+/**
+ * Append formatted text to a buffer.
+ */
+static void appendf(Bytes *b, const char *fmt, ...) {
+	char *s;
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vasprintf(&s, fmt, ap);
+	va_end(ap);
+	if (n > 0) {
+		append(b, s, n);
+	}
+	free(s);
+}
+
+/**
+ * Write a record. The connection lock is held.
+ *
+ * @return true if written
+ */
+static bool writeRecord(Conn *conn, int type, unsigned id, const char *content, size_t len) {
+	unsigned char header[8] = { 1, type, id >> 8, id & 0xff, len >> 8, len & 0xff, 0, 0 };
+	if (send(conn->fd, header, sizeof(header), MSG_NOSIGNAL) != sizeof(header)) {
+		return false;
+	}
+	while (len > 0) {
+		ssize_t n = send(conn->fd, content, len, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return false;
+		}
+		content += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Write a request's output as STDOUT records. The connection lock is held.
+ */
+static bool writeStdout(Conn *conn, unsigned id, const char *data, size_t len) {
+	while (len > 0) {
+		size_t n = (len < 65535) ? len : 65535;
+		if (!writeRecord(conn, FCGI_STDOUT, id, data, n)) {
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Release a reference to a connection, closing it with the last.
+ * The connection lock is held, and released.
+ */
+static void releaseConn(Conn *conn) {
+	bool last = (--conn->refs == 0);
+	pthread_mutex_unlock(&conn->lock);
+	if (last) {
+		close(conn->fd);
+		pthread_mutex_destroy(&conn->lock);
+		free(conn);
+	}
+}
+
+/**
+ * Free a request.
+ */
+static void freeRequest(Request *req) {
+	free(req->params.data);
+	free(req->body.data);
+	free(req);
+}
+
+/**
+ * Decode a name-value pair length.
+ */
+static size_t decodeLength(const unsigned char **p) {
+	size_t len = **p;
+	if (len < 0x80) {
+		(*p)++;
+		return len;
+	}
+	len = ((size_t)((*p)[0] & 0x7f) << 24) | ((*p)[1] << 16) | ((*p)[2] << 8) | (*p)[3];
+	*p += 4;
+	return len;
+}
+
+/**
+ * Get a CGI parameter of a request.
+ *
+ * @return the value, or "" if none
+ */
+static const char *param(Request *req, const char *name, char *value, size_t size) {
+	const unsigned char *p = (const unsigned char *)req->params.data;
+	const unsigned char *end = p + req->params.len;
+	while (p < end) {
+		size_t nameLen = decodeLength(&p);
+		size_t valueLen = decodeLength(&p);
+		if ((strlen(name) == nameLen) && (memcmp(p, name, nameLen) == 0)) {
+			snprintf(value, size, "%.*s", (int)valueLen, p + nameLen);
+			return value;
+		}
+		p += nameLen + valueLen;
+	}
+	value[0] = '\0';
+	return value;
+}
+
+/**
+ * Get a number from a query string parameter.
+ *
+ * @return the number, or -1 if none
+ */
+static long queryNumber(const char *query, const char *name) {
+	size_t len = strlen(name);
+	for (const char *p = query; p != NULL; p = strchr(p, '&')) {
+		p += (*p == '&');
+		if ((strncmp(p, name, len) == 0) && (p[len] == '=')) {
+			return atol(p + len + 1);
+		}
+	}
+	return -1;
+}
+
+/**
+ * Append form-urlencoded text decoded and escaped for HTML.
+ */
+static void appendDecoded(Bytes *out, const char *s, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		char c = s[i];
+		if (c == '+') {
+			c = ' ';
+		} else if ((c == '%') && (i + 2 < len) && isxdigit((unsigned char)s[i+1]) && isxdigit((unsigned char)s[i+2])) {
+			char hex[3] = { s[i+1], s[i+2], '\0' };
+			c = (char)strtol(hex, NULL, 16);
+			i += 2;
+		}
+		switch (c) {
+		case '<': append(out, "&lt;", 4); break;
+		case '>': append(out, "&gt;", 4); break;
+		case '&': append(out, "&amp;", 5); break;
+		default: append(out, &c, 1);
+		}
+	}
+}
+
+/**
+ * Answer a request whose body has arrived.
+ */
+static void *respond(void *arg) {
+	Request *req = arg;
+	Conn *conn = req->conn;
+	char method[16], type[256], query[1024];
+	param(req, "REQUEST_METHOD", method, sizeof(method));
+	param(req, "CONTENT_TYPE", type, sizeof(type));
+	param(req, "QUERY_STRING", query, sizeof(query));
+	long status = queryNumber(query, "status");
+	long bytes = queryNumber(query, "bytes");
+
+	if (delayMs > 0) {
+		struct timespec delay = { delayMs / 1000, (delayMs % 1000) * 1000000 };
+		nanosleep(&delay, NULL);
+	}
+
+	Bytes head = { 0 }, body = { 0 };
+	if (status > 0) {
+		appendf(&head, "Status: %ld\r\n", status);
+	}
+	if (bytes >= 0) {
+		appendf(&head, "Content-Type: text/plain\r\n\r\n");
+		body.data = malloc(bytes + 1);
+		memset(body.data, 'f', bytes);
+		body.len = bytes;
+	} else if (strncasecmp(type, "application/x-www-form-urlencoded", 33) == 0) {
+		appendf(&body, "<!DOCTYPE html>\n<html><body>\n<h2>Form fields</h2>\n<table>\n");
+		for (char *field = req->body.data; (field != NULL) && (*field != '\0'); ) {
+			char *amp = strchr(field, '&');
+			size_t len = (amp != NULL) ? (size_t)(amp - field) : strlen(field);
+			char *eq = memchr(field, '=', len);
+			size_t nameLen = (eq != NULL) ? (size_t)(eq - field) : len;
+			appendf(&body, "<tr><th>");
+			appendDecoded(&body, field, nameLen);
+			appendf(&body, "</th><td>");
+			if (eq != NULL) {
+				appendDecoded(&body, eq + 1, len - nameLen - 1);
+			}
+			appendf(&body, "</td></tr>\n");
+			field = (amp != NULL) ? amp + 1 : NULL;
+		}
+		appendf(&body, "</table>\n</body></html>\n");
+		appendf(&head, "Content-Type: text/html\r\nContent-Length: %zu\r\n\r\n", body.len);
+	} else if (req->body.len > 0) {
+		appendf(&head, "Content-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+				(type[0] != '\0') ? type : "application/octet-stream", req->body.len);
+		body = req->body;
+		req->body = (Bytes){ 0 };
+	} else {
+		const unsigned char *p = (const unsigned char *)req->params.data;
+		const unsigned char *end = p + req->params.len;
+		while (p < end) {
+			size_t nameLen = decodeLength(&p);
+			size_t valueLen = decodeLength(&p);
+			appendf(&body, "%.*s=%.*s\n", (int)nameLen, p, (int)valueLen, p + nameLen);
+			p += nameLen + valueLen;
+		}
+		appendf(&head, "Content-Type: text/plain\r\nContent-Length: %zu\r\n\r\n", body.len);
+	}
+	if (strcmp(method, "HEAD") == 0) {
+		body.len = 0;
+	}
+
+	// output is sent in pieces, so answers to concurrent requests interleave
+	pthread_mutex_lock(&conn->lock);
+	bool ok = !req->aborted && writeStdout(conn, req->id, head.data, head.len);
+	pthread_mutex_unlock(&conn->lock);
+	for (size_t sent = 0; ok && (sent < body.len); sent += 16384) {
+		pthread_mutex_lock(&conn->lock);
+		size_t n = (body.len - sent < 16384) ? body.len - sent : 16384;
+		ok = !req->aborted && writeStdout(conn, req->id, body.data + sent, n);
+		pthread_mutex_unlock(&conn->lock);
+	}
+	free(head.data);
+	free(body.data);
+
+	pthread_mutex_lock(&conn->lock);
+	char end[8] = { 0, 0, 0, req->aborted ? 1 : 0, 0, 0, 0, 0 };
+	writeRecord(conn, FCGI_STDOUT, req->id, NULL, 0);
+	writeRecord(conn, FCGI_END_REQUEST, req->id, end, sizeof(end));
+	conn->requests[req->id] = NULL;
+	freeRequest(req);
+	releaseConn(conn);
+	return NULL;
+}
+
+/**
+ * Read the records of a connection until it closes.
+ */
+static void *serveConnection(void *arg) {
+	Conn *conn = arg;
+	unsigned char header[8];
+	char *content = malloc(65535 + 255);
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (recv(conn->fd, header, sizeof(header), MSG_WAITALL) == sizeof(header)) {
+		unsigned type = header[1];
+		unsigned id = (header[2] << 8) | header[3];
+		size_t len = ((header[4] << 8) | header[5]) + header[6];
+		if ((len > 0) && (recv(conn->fd, content, len, MSG_WAITALL) != (ssize_t)len)) {
+			break;
+		}
+		len -= header[6];
+
+		pthread_mutex_lock(&conn->lock);
+		Request *req = (id <= MAX_REQS) ? conn->requests[id] : NULL;
+		if (type == FCGI_GET_VALUES) {
+			char reply[64], maxReqs[16];
+			int m = sprintf(maxReqs, "%d", MAX_REQS);
+			int n = sprintf(reply, "%c%c%s%c", 15, 1, "FCGI_MPXS_CONNS", single ? '0' : '1');
+			n += sprintf(reply + n, "%c%c%s%s", 13, m, "FCGI_MAX_REQS", maxReqs);
+			writeRecord(conn, FCGI_GET_VALUES_RESULT, 0, reply, n);
+		} else if (type == FCGI_BEGIN_REQUEST) {
+			bool busy = false;
+			for (unsigned i = 1; single && (i <= MAX_REQS); i++) {
+				busy |= (conn->requests[i] != NULL);
+			}
+			if ((id == 0) || (id > MAX_REQS) || (req != NULL) || busy) {
+				char end[8] = { 0, 0, 0, 0, FCGI_CANT_MPX_CONN, 0, 0, 0 };
+				writeRecord(conn, FCGI_END_REQUEST, id, end, sizeof(end));
+			} else {
+				conn->requests[id] = calloc(1, sizeof(Request));
+				conn->requests[id]->conn = conn;
+				conn->requests[id]->id = id;
+			}
+		} else if ((type == FCGI_PARAMS) && (req != NULL)) {
+			append(&req->params, content, len);
+		} else if ((type == FCGI_STDIN) && (req != NULL) && (len > 0)) {
+			append(&req->body, content, len);
+		} else if ((type == FCGI_STDIN) && (req != NULL)) {
+			// the body is complete: answer on a thread of its own
+			pthread_t thread;
+			conn->refs++;
+			req->answering = true;
+			if (pthread_create(&thread, &attr, respond, req) != 0) {
+				conn->refs--;
+				conn->requests[id] = NULL;
+				freeRequest(req);
+			}
+		} else if ((type == FCGI_ABORT_REQUEST) && (req != NULL)) {
+			req->aborted = true;
+		} else if (type > FCGI_GET_VALUES_RESULT) {
+			char unknown[8] = { type, 0, 0, 0, 0, 0, 0, 0 };
+			writeRecord(conn, FCGI_UNKNOWN_TYPE, 0, unknown, sizeof(unknown));
+		}
+		pthread_mutex_unlock(&conn->lock);
+	}
+	free(content);
+	pthread_attr_destroy(&attr);
+
+	// requests not yet answering are dropped with the connection
+	pthread_mutex_lock(&conn->lock);
+	for (unsigned id = 1; id <= MAX_REQS; id++) {
+		if ((conn->requests[id] != NULL) && !conn->requests[id]->answering) {
+			freeRequest(conn->requests[id]);
+			conn->requests[id] = NULL;
+		}
+	}
+	shutdown(conn->fd, SHUT_RDWR);
+	releaseConn(conn);
+	return NULL;
+}
+
+/**
+ * Print usage and exit.
+ */
+static void usage(const char *prog) {
+	fprintf(stderr,
+			"usage: %s [-d delay-ms] [-s socket-path] [-1]\n"
+			"  -d  milliseconds to delay each response (default 0)\n"
+			"  -s  listen on a Unix socket instead of standard input\n"
+			"  -1  answer one request at a time per connection\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Main program accepts connections and serves each on a thread.
+ */
+int main(int argc, char *argv[]) {
+	const char *path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:s:1")) != -1) {
+		switch (opt) {
+		case 'd': delayMs = atol(optarg); break;
+		case 's': path = optarg; break;
+		case '1': single = true; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	int listenFd = 0;
+	if (path != NULL) {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+		unlink(path);
+		listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(listenFd, 128) != 0)) {
+			perror(path);
+			return EXIT_FAILURE;
+		}
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (true) {
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			perror("fcgi_worker");
+			return EXIT_FAILURE;
+		}
+		Conn *conn = calloc(1, sizeof(Conn));
+		conn->fd = fd;
+		conn->refs = 1;
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, serveConnection, conn) != 0) {
+			close(fd);
+			free(conn);
+		}
+	}
+	return EXIT_SUCCESS;
+}
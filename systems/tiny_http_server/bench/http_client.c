@@ -0,0 +1,259 @@
+/*
+ * http_client.c
+ *
+ * Minimal blocking HTTP/1.1 client shared by the load generator
+ * and the trace replayer.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "http_client.h"
+
+/**
+ * Open a connection to a server.
+ *
+ * @param conn the connection
+ * @param addr the server address
+ * @return true if connected
+ */
+bool httpConnect(HttpConnection *conn, const struct addrinfo *addr) {
+	conn->pos = conn->len = 0;
+	conn->requests = 0;
+	conn->connects++;
+	conn->fd = socket(addr->ai_family, SOCK_STREAM, 0);
+	if (conn->fd < 0) {
+		return false;
+	}
+	if (connect(conn->fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+		httpClose(conn);
+		return false;
+	}
+	int one = 1;
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	struct timeval tv = { 10, 0 };
+	setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return true;
+}
+
+/**
+ * Close a connection if open.
+ *
+ * @param conn the connection
+ */
+void httpClose(HttpConnection *conn) {
+	if (conn->fd >= 0) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+}
+
+/**
+ * Send bytes, retrying partial writes.
+ *
+ * @param conn the connection
+ * @param data the bytes to send, or NULL to send zero bytes
+ * @param len the number of bytes
+ * @return true if all bytes were sent
+ */
+bool httpSend(HttpConnection *conn, const void *data, size_t len) {
+	static const char zeros[CLIENT_BUFSIZE];
+	const char *p = data;
+	while (len > 0) {
+		size_t n = len;
+		if (data == NULL) {
+			p = zeros;
+			n = (len < sizeof(zeros)) ? len : sizeof(zeros);
+		}
+		ssize_t sent = send(conn->fd, p, n, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			return false;
+		}
+		if (data != NULL) {
+			p += sent;
+		}
+		len -= sent;
+	}
+	return true;
+}
+
+/**
+ * Fill the buffer if empty.
+ *
+ * @return bytes available, 0 at end of stream, -1 if error
+ */
+static ssize_t fill(HttpConnection *conn) {
+	if (conn->pos < conn->len) {
+		return conn->len - conn->pos;
+	}
+	ssize_t n;
+	do {
+		n = recv(conn->fd, conn->buf, sizeof(conn->buf), 0);
+	} while (n < 0 && errno == EINTR);
+	conn->pos = 0;
+	conn->len = (n > 0) ? n : 0;
+	return n;
+}
+
+/**
+ * Read a line terminated by LF, without the line terminator.
+ *
+ * @return true if a line was read
+ */
+static bool readLine(HttpConnection *conn, char *line, size_t size, uint64_t *bytes) {
+	size_t n = 0;
+	while (true) {
+		if (fill(conn) <= 0) {
+			return false;
+		}
+		char c = conn->buf[conn->pos++];
+		(*bytes)++;
+		if (c == '\n') {
+			break;
+		}
+		if (n + 1 < size) {
+			line[n++] = c;
+		}
+	}
+	if (n > 0 && line[n-1] == '\r') {
+		n--;
+	}
+	line[n] = '\0';
+	return true;
+}
+
+/**
+ * Discard n bytes of body.
+ *
+ * @return true if all bytes were read
+ */
+static bool skipBytes(HttpConnection *conn, uint64_t n, uint64_t *bytes) {
+	while (n > 0) {
+		if (fill(conn) <= 0) {
+			return false;
+		}
+		size_t avail = conn->len - conn->pos;
+		size_t take = (avail < n) ? avail : (size_t)n;
+		conn->pos += take;
+		n -= take;
+		*bytes += take;
+	}
+	return true;
+}
+
+/**
+ * Read a response and discard its body.
+ *
+ * @param conn the connection
+ * @param head true if the request was HEAD, so there is no body
+ * @param bytes incremented by the number of response bytes
+ * @param reusable set to true if the connection can carry another request
+ * @return the response status, or -1 if error
+ */
+int httpReadResponse(HttpConnection *conn, bool head, uint64_t *bytes, bool *reusable) {
+	char line[1024];
+	int status;
+	*reusable = false;
+	if (!readLine(conn, line, sizeof(line), bytes) || sscanf(line, "HTTP/%*s %d", &status) != 1) {
+		return -1;
+	}
+	long long contentLength = -1;
+	bool chunked = false;
+	bool closeConn = false;
+	while (readLine(conn, line, sizeof(line), bytes)) {
+		if (line[0] == '\0') {
+			break;
+		}
+		if (strncasecmp(line, "Content-Length:", 15) == 0) {
+			contentLength = atoll(line + 15);
+		} else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strcasestr(line, "chunked")) {
+			chunked = true;
+		} else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line, "close")) {
+			closeConn = true;
+		}
+	}
+
+	bool complete = true;
+	if (head || status == 204 || status == 304 || (status >= 100 && status < 200)) {
+		// no body
+	} else if (chunked) {
+		while ((complete = readLine(conn, line, sizeof(line), bytes))) {
+			long long size = strtoll(line, NULL, 16);
+			if (size == 0) {
+				// trailers end with an empty line
+				while ((complete = readLine(conn, line, sizeof(line), bytes)) && line[0] != '\0') {
+				}
+				break;
+			}
+			if (!(complete = skipBytes(conn, size, bytes) && readLine(conn, line, sizeof(line), bytes))) {
+				break;
+			}
+		}
+	} else if (contentLength >= 0) {
+		complete = skipBytes(conn, contentLength, bytes);
+	} else {
+		// body ends when the server closes the connection
+		while (fill(conn) > 0) {
+			*bytes += conn->len - conn->pos;
+			conn->pos = conn->len;
+		}
+		closeConn = true;
+	}
+	*reusable = complete && !closeConn;
+	return complete ? status : -1;
+}
+
+/**
+ * Send a request with a body of zero bytes and read the response,
+ * connecting first if needed. A request that fails on a reused
+ * connection, which the server may have closed while idle, is
+ * retried once on a new connection.
+ *
+ * @param conn the connection
+ * @param addr the server address
+ * @param request the request line and headers
+ * @param len the length of the request
+ * @param bodyBytes the length of the body
+ * @param head true if the request is HEAD, so there is no body
+ * @param bytes incremented by the number of response bytes
+ * @return the response status, or -1 if error; the connection is
+ *   closed unless it can carry another request
+ */
+int httpRequest(HttpConnection *conn, const struct addrinfo *addr, const char *request,
+				size_t len, uint64_t bodyBytes, bool head, uint64_t *bytes) {
+	while (true) {
+		if (conn->fd < 0 && !httpConnect(conn, addr)) {
+			return -1;
+		}
+		bool reused = (conn->requests > 0);
+		if (httpSend(conn, request, len) && httpSend(conn, NULL, bodyBytes)) {
+			bool reusable;
+			int status = httpReadResponse(conn, head, bytes, &reusable);
+			if (status >= 0) {
+				conn->requests++;
+				if (!reusable) {
+					httpClose(conn);
+				}
+				return status;
+			}
+		}
+		httpClose(conn);
+		if (!reused) {
+			return -1;
+		}
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ * http_client.h
+ *
+ * Minimal blocking HTTP/1.1 client shared by the load generator
+ * and the trace replayer.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef HTTP_CLIENT_H_
+#define HTTP_CLIENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <sys/types.h>
+
+/** reader buffer size */
+#define CLIENT_BUFSIZE 16384
+
+/** Buffered reader over a connection */
+typedef struct HttpConnection {
+	int fd;						/** the socket, or -1 if not connected */
+	char buf[CLIENT_BUFSIZE];	/** received bytes */
+	size_t pos, len;			/** unread bytes are buf[pos..len) */
+	unsigned long requests;		/** responses read on this connection */
+	unsigned long connects;		/** connections opened */
+} HttpConnection;
+
+/**
+ * Open a connection to a server.
+ *
+ * @param conn the connection
+ * @param addr the server address
+ * @return true if connected
+ */
+bool httpConnect(HttpConnection *conn, const struct addrinfo *addr);
+
+/**
+ * Close a connection if open.
+ *
+ * @param conn the connection
+ */
+void httpClose(HttpConnection *conn);
+
+/**
+ * Send bytes, retrying partial writes.
+ *
+ * @param conn the connection
+ * @param data the bytes to send, or NULL to send zero bytes
+ * @param len the number of bytes
+ * @return true if all bytes were sent
+ */
+bool httpSend(HttpConnection *conn, const void *data, size_t len);
+
+/**
+ * Read a response and discard its body.
+ *
+ * @param conn the connection
+ * @param head true if the request was HEAD, so there is no body
+ * @param bytes incremented by the number of response bytes
+ * @param reusable set to true if the connection can carry another request
+ * @return the response status, or -1 if error
+ */
+int httpReadResponse(HttpConnection *conn, bool head, uint64_t *bytes, bool *reusable);
+
+/**
+ * Send a request with a body of zero bytes and read the response,
+ * connecting first if needed. A request that fails on a reused
+ * connection, which the server may have closed while idle, is
+ * retried once on a new connection.
+ *
+ * @param conn the connection
+ * @param addr the server address
+ * @param request the request line and headers
+ * @param len the length of the request
+ * @param bodyBytes the length of the body
+ * @param head true if the request is HEAD, so there is no body
+ * @param bytes incremented by the number of response bytes
+ * @return the response status, or -1 if error; the connection is
+ *   closed unless it can carry another request
+ */
+int httpRequest(HttpConnection *conn, const struct addrinfo *addr, const char *request,
+				size_t len, uint64_t bodyBytes, bool head, uint64_t *bytes);
+
+#endif /* HTTP_CLIENT_H_ */
@@ -0,0 +1,285 @@
+/*
+ * idle_conns.c
+ *
+ * Measures the server memory held by idle keep-alive connections.
+ *
+ * Opens many connections, sends one keep-alive request on each and
+ * reads the response, then leaves them all idle. The growth of the
+ * server's resident set size (read from /proc/<pid>/status) divided
+ * by the number of connections gives the bytes per idle connection.
+ * Source addresses are spread over 127.0.0.x so one client can open
+ * more connections than one address has ephemeral ports.
+ *
+ * Run the server with idle_timeout=0 (or longer than the test) so
+ * connections are not closed while they are counted, and raise the
+ * descriptor limit of both processes (ulimit -n).
+ *
+ * Build:
+ *   cc -O2 -o idle_conns bench/idle_conns.c
+ *
+ * Usage:
+ *   idle_conns -P server-pid [-h host] [-p port] [-n conns] [-s settle-secs] [path]
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+/** connections per source address, below the ephemeral port range */
+#define CONNS_PER_ADDRESS 20000
+
+/**
+ * Read the resident set size of a process.
+ *
+ * @return the size in bytes, or 0 if not available
+ */
+static unsigned long long residentBytes(int pid) {
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return 0;
+	}
+	unsigned long long kb = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "VmRSS: %llu kB", &kb) == 1) {
+			break;
+		}
+	}
+	fclose(f);
+	return kb * 1024;
+}
+
+/**
+ * Connect to the server from a source address on the loopback
+ * network, or from any address if the server is not local.
+ *
+ * @return the socket, or -1 if error
+ */
+static int openConnection(const struct addrinfo *addr, int index) {
+	int fd = socket(addr->ai_family, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (addr->ai_family == AF_INET) {
+		struct sockaddr_in *server = (struct sockaddr_in *)addr->ai_addr;
+		if ((ntohl(server->sin_addr.s_addr) >> 24) == 127) {
+#if defined(IP_BIND_ADDRESS_NO_PORT)
+			// choose the port at connect, so ports are reused across addresses
+			int one = 1;
+			setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+			struct sockaddr_in local = { .sin_family = AF_INET };
+			local.sin_addr.s_addr = htonl((127u << 24) | (1 + index / CONNS_PER_ADDRESS));
+			if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+				close(fd);
+				return -1;
+			}
+		}
+	}
+	if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Send a request and read its response headers and body.
+ *
+ * @param body if not NULL, receives the body (up to bodySize - 1 bytes)
+ * @return true if a complete response was read
+ */
+static bool exchange(int fd, const char *request, char *body, size_t bodySize) {
+	size_t len = strlen(request);
+	if (send(fd, request, len, MSG_NOSIGNAL) != (ssize_t)len) {
+		return false;
+	}
+	char buf[16384];
+	size_t have = 0;
+	char *end = NULL;
+	while (end == NULL) {
+		if (have == sizeof(buf) - 1) {
+			return false;
+		}
+		ssize_t n = recv(fd, buf + have, sizeof(buf) - 1 - have, 0);
+		if (n <= 0) {
+			return false;
+		}
+		have += n;
+		buf[have] = '\0';
+		end = strstr(buf, "\r\n\r\n");
+	}
+	const char *cl = strcasestr(buf, "Content-Length:");
+	bool chunked = (strcasestr(buf, "Transfer-Encoding: chunked") != NULL);
+	size_t headerLen = end + 4 - buf;
+	size_t bodyHave = have - headerLen;
+	size_t copied = 0;
+	if (body != NULL) {
+		copied = (bodyHave < bodySize - 1) ? bodyHave : bodySize - 1;
+		memcpy(body, end + 4, copied);
+	}
+	if (chunked) {
+		// read until the last chunk; enough for a small report
+		while ((bodyHave < 5) || (memcmp(buf + have - 5, "0\r\n\r\n", 5) != 0)) {
+			if (have == sizeof(buf) - 1) {
+				have = headerLen;
+			}
+			ssize_t n = recv(fd, buf + have, sizeof(buf) - 1 - have, 0);
+			if (n <= 0) {
+				return false;
+			}
+			if (body != NULL && copied < bodySize - 1) {
+				size_t c = ((size_t)n < bodySize - 1 - copied) ? (size_t)n : bodySize - 1 - copied;
+				memcpy(body + copied, buf + have, c);
+				copied += c;
+			}
+			have += n;
+			bodyHave += n;
+		}
+	} else if (cl != NULL) {
+		size_t contentLen = strtoul(cl + 15, NULL, 10);
+		while (bodyHave < contentLen) {
+			ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+			if (n <= 0) {
+				return false;
+			}
+			if (body != NULL && copied < bodySize - 1) {
+				size_t c = ((size_t)n < bodySize - 1 - copied) ? (size_t)n : bodySize - 1 - copied;
+				memcpy(body + copied, buf, c);
+				copied += c;
+			}
+			bodyHave += n;
+		}
+	}
+	if (body != NULL) {
+		body[copied] = '\0';
+	}
+	return true;
+}
+
+/**
+ * Print usage and exit.
+ */
+static void usage(const char *prog) {
+	fprintf(stderr,
+			"usage: %s -P server-pid [-h host] [-p port] [-n conns] [-s settle-secs] [path]\n"
+			"  -P  process id of the server, for its resident set size\n"
+			"  -n  idle connections to open (default 10000)\n"
+			"  -s  seconds to wait before measuring (default 2)\n"
+			"  path is requested once on each connection (default /index.html)\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Main program opens the connections and reports the memory they hold.
+ */
+int main(int argc, char *argv[]) {
+	const char *host = "127.0.0.1", *port = "1500";
+	long nconns = 10000;
+	int pid = 0, settle = 2;
+	int opt;
+	while ((opt = getopt(argc, argv, "P:h:p:n:s:")) != -1) {
+		switch (opt) {
+		case 'P': pid = atoi(optarg); break;
+		case 'h': host = optarg; break;
+		case 'p': port = optarg; break;
+		case 'n': nconns = atol(optarg); break;
+		case 's': settle = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if ((pid <= 0) || (nconns <= 0) || (optind < argc - 1)) {
+		usage(argv[0]);
+	}
+	const char *path = (optind < argc) ? argv[optind] : "/index.html";
+
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *addr;
+	int rc = getaddrinfo(host, port, &hints, &addr);
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(rc));
+		return EXIT_FAILURE;
+	}
+
+	// each connection holds a descriptor
+	struct rlimit nofile;
+	if (getrlimit(RLIMIT_NOFILE, &nofile) == 0) {
+		nofile.rlim_cur = nofile.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &nofile);
+		if (nofile.rlim_cur < (rlim_t)nconns + 16) {
+			fprintf(stderr, "warning: descriptor limit %llu may be too low for %ld connections\n",
+					(unsigned long long)nofile.rlim_cur, nconns);
+		}
+	}
+
+	char request[1024];
+	snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", path, host);
+
+	unsigned long long before = residentBytes(pid);
+	if (before == 0) {
+		fprintf(stderr, "cannot read resident set size of process %d\n", pid);
+		return EXIT_FAILURE;
+	}
+
+	int *fds = calloc(nconns, sizeof(int));
+	long opened = 0;
+	for (long i = 0; i < nconns; i++) {
+		int fd = openConnection(addr, (int)i);
+		if ((fd < 0) || !exchange(fd, request, NULL, 0)) {
+			fprintf(stderr, "connection %ld: %s\n", i, strerror(errno));
+			if (fd >= 0) {
+				close(fd);
+			}
+			break;
+		}
+		fds[opened++] = fd;
+		if ((opened % 10000) == 0) {
+			fprintf(stderr, "%ld connections\n", opened);
+		}
+	}
+	sleep(settle);
+	unsigned long long after = residentBytes(pid);
+
+	// the server's own view of its idle connections
+	char stats[65536] = "";
+	int statsFd = openConnection(addr, (int)nconns);
+	if (statsFd >= 0) {
+		exchange(statsFd, "GET /__stats HTTP/1.1\r\nConnection: close\r\n\r\n", stats, sizeof(stats));
+		close(statsFd);
+	}
+
+	printf("idle connections:      %ld\n", opened);
+	printf("server RSS before:     %.1f MB\n", before / 1048576.0);
+	printf("server RSS after:      %.1f MB\n", after / 1048576.0);
+	if (opened > 0) {
+		double perConn = (after > before) ? (double)(after - before) / opened : 0;
+		printf("bytes per idle conn:   %.0f\n", perConn);
+		printf("RSS at 100k idle:      %.1f MB (projected)\n",
+			   (before + perConn * 100000) / 1048576.0);
+	}
+	for (char *line = strtok(stats, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		if ((strncmp(line, "http_idle_connections", 21) == 0)
+			|| (strncmp(line, "http_connection_memory_bytes", 28) == 0)) {
+			printf("server: %s\n", line);
+		}
+	}
+
+	for (long i = 0; i < opened; i++) {
+		close(fds[i]);
+	}
+	free(fds);
+	freeaddrinfo(addr);
+	return EXIT_SUCCESS;
+}
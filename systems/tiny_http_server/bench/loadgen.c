@@ -0,0 +1,381 @@
+/*
+ * loadgen.c
+ *
+ * HTTP load generator for the tiny http server.
+ *
+ * Runs one thread per connection. In closed-loop mode each
+ * connection sends its next request as soon as the previous one
+ * completes. In open-loop mode (-r) requests follow a constant-rate
+ * schedule, and latency is measured from the time a request was
+ * scheduled rather than sent, so a stalled server is charged for
+ * the requests it delayed (coordinated-omission correction).
+ *
+ * Build:
+ *   cc -O2 -o loadgen bench/loadgen.c bench/http_client.c src/histogram.c -lpthread
+ *
+ * Usage:
+ *   loadgen [-h host] [-p port] [-c conns] [-d secs] [-w secs]
+ *           [-r rate] [-k] [-H] [-s scenario] [path]
+ *
+ * A scenario file has one request per line:
+ *   METHOD path [body-bytes] [weight]
+ * Lines starting with '#' are comments. "{n}" in a path is replaced
+ * by a random number from 0 to 99, so PUT/GET/DELETE mixes touch a
+ * shared set of files.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/histogram.h"
+#include "http_client.h"
+
+/** maximum requests in a scenario */
+#define MAX_SCENARIO 64
+
+/** maximum connections */
+#define MAX_CONNS 4096
+
+/** maximum request path */
+#define MAX_PATH 512
+
+/** One request of a scenario */
+typedef struct ScenarioRequest {
+	char method[16];		/** request method */
+	char path[MAX_PATH];	/** request path, may contain {n} */
+	long bodyBytes;			/** request body size */
+	int weight;				/** relative frequency */
+} ScenarioRequest;
+
+/** Per-connection results, merged at the end */
+typedef struct ConnResult {
+	histogram latency;			/** request latency in ns */
+	uint64_t requests;			/** completed requests */
+	uint64_t errors;			/** failed requests */
+	uint64_t connects;			/** connections opened */
+	uint64_t bytesIn;			/** response bytes */
+	uint64_t statuses[6];		/** responses by status class (1xx-5xx, other) */
+} ConnResult;
+
+/** settings */
+static const char *host = "127.0.0.1";
+static const char *port = "1500";
+static int nconns = 16;
+static double duration = 10.0;
+static double warmup = 0.0;
+static double rate = 0.0;
+static bool keepAlive = false;
+static bool printHistogram = false;
+
+/** the scenario */
+static ScenarioRequest scenario[MAX_SCENARIO];
+static int nscenario;
+static int totalWeight;
+
+/** server address */
+static struct addrinfo *serverAddr;
+
+/** start and end of the measured run */
+static uint64_t startNs, warmupEndNs, endNs;
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static uint64_t nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Sleep until a monotonic time.
+ */
+static void sleepUntil(uint64_t when) {
+	struct timespec ts = { (time_t)(when / 1000000000ULL), (long)(when % 1000000000ULL) };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+
+/**
+ * Load a scenario file.
+ *
+ * @param file the scenario file
+ * @return true if at least one request was read
+ */
+static bool loadScenario(const char *file) {
+	FILE *f = fopen(file, "r");
+	if (f == NULL) {
+		perror(file);
+		return false;
+	}
+	char line[MAX_PATH + 64];
+	while (fgets(line, sizeof(line), f) != NULL && nscenario < MAX_SCENARIO) {
+		ScenarioRequest *sr = &scenario[nscenario];
+		sr->bodyBytes = 0;
+		sr->weight = 1;
+		if (line[0] == '#' || sscanf(line, "%15s %511s %ld %d", sr->method, sr->path, &sr->bodyBytes, &sr->weight) < 2) {
+			continue;
+		}
+		if (sr->weight < 1) {
+			sr->weight = 1;
+		}
+		totalWeight += sr->weight;
+		nscenario++;
+	}
+	fclose(f);
+	return nscenario > 0;
+}
+
+/**
+ * Pick the next request of the scenario by weight.
+ */
+static const ScenarioRequest *pickRequest(unsigned *seed) {
+	int w = rand_r(seed) % totalWeight;
+	for (int i = 0; i < nscenario; i++) {
+		if (w < scenario[i].weight) {
+			return &scenario[i];
+		}
+		w -= scenario[i].weight;
+	}
+	return &scenario[0];
+}
+
+/**
+ * Send a request and read its response.
+ *
+ * @param conn the connection
+ * @param sr the request
+ * @param seed the random seed of the connection
+ * @param result results of the connection
+ * @return the response status, or -1 if error
+ */
+static int doRequest(HttpConnection *conn, const ScenarioRequest *sr, unsigned *seed,
+					 ConnResult *result) {
+	// substitute {n} in the path
+	char path[MAX_PATH + 16];
+	const char *p = strstr(sr->path, "{n}");
+	if (p != NULL) {
+		snprintf(path, sizeof(path), "%.*s%d%s", (int)(p - sr->path), sr->path,
+				 rand_r(seed) % 100, p + 3);
+	} else {
+		snprintf(path, sizeof(path), "%s", sr->path);
+	}
+
+	char req[MAX_PATH + 256];
+	int len = snprintf(req, sizeof(req),
+					   "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n",
+					   sr->method, path, host, keepAlive ? "keep-alive" : "close");
+	if (sr->bodyBytes > 0) {
+		len += snprintf(req + len, sizeof(req) - len, "Content-Length: %ld\r\n", sr->bodyBytes);
+	}
+	len += snprintf(req + len, sizeof(req) - len, "\r\n");
+	int status = httpRequest(conn, serverAddr, req, len, sr->bodyBytes,
+							 strcasecmp(sr->method, "HEAD") == 0, &result->bytesIn);
+	if (!keepAlive) {
+		httpClose(conn);
+	}
+	return status;
+}
+
+/**
+ * Run the requests of one connection until the end of the run.
+ */
+static void *connectionThread(void *arg) {
+	ConnResult *result = arg;
+	unsigned seed = (unsigned)(uintptr_t)arg ^ (unsigned)nowNs();
+	HttpConnection *conn = malloc(sizeof(HttpConnection));
+	if (conn == NULL) {
+		return NULL;
+	}
+	conn->fd = -1;
+	conn->connects = 0;
+
+	// open loop: each connection sends at rate/nconns, staggered
+	uint64_t interval = (rate > 0) ? (uint64_t)(1e9 * nconns / rate) : 0;
+	uint64_t next = startNs + ((interval > 0) ? (uint64_t)(rand_r(&seed) % interval) : 0);
+
+	while (true) {
+		uint64_t scheduled;
+		if (interval > 0) {
+			if (next >= endNs) {
+				break;
+			}
+			sleepUntil(next);
+			scheduled = next;
+			next += interval;
+		} else {
+			scheduled = nowNs();
+			if (scheduled >= endNs) {
+				break;
+			}
+		}
+
+		int status = doRequest(conn, pickRequest(&seed), &seed, result);
+		uint64_t done = nowNs();
+		if (scheduled < warmupEndNs) {
+			continue;
+		}
+		if (status < 0) {
+			result->errors++;
+			continue;
+		}
+		result->requests++;
+		result->statuses[(status >= 100 && status < 600) ? status / 100 - 1 : 5]++;
+		hist_record(&result->latency, done - scheduled);
+	}
+	result->connects = conn->connects;
+	httpClose(conn);
+	free(conn);
+	return NULL;
+}
+
+/**
+ * Print the percentile distribution in HdrHistogram's text format.
+ */
+static void printDistribution(const histogram *hist) {
+	printf("\n%12s %14s %10s %14s\n\n", "Value(ms)", "Percentile", "TotalCount", "1/(1-Percentile)");
+	for (double remaining = 100.0; remaining > 0.0005; remaining /= 2.0) {
+		for (int step = 0; step < 5; step++) {
+			double pct = 100.0 - remaining * (1.0 - step / 10.0);
+			uint64_t value = hist_percentile(hist, pct);
+			printf("%12.3f %14.6f %10llu %14.2f\n", value / 1e6, pct / 100.0,
+				   (unsigned long long)(pct / 100.0 * hist->total), 100.0 / (100.0 - pct));
+		}
+	}
+	printf("%12.3f %14.6f %10llu\n", hist->max / 1e6, 1.0, (unsigned long long)hist->total);
+}
+
+/**
+ * Print usage and exit.
+ */
+static void usage(const char *prog) {
+	fprintf(stderr,
+			"usage: %s [-h host] [-p port] [-c conns] [-d secs] [-w secs]\n"
+			"          [-r rate] [-k] [-H] [-s scenario] [path]\n"
+			"  -c  connections (default 16)\n"
+			"  -d  measured duration in seconds (default 10)\n"
+			"  -w  warm-up seconds excluded from results (default 0)\n"
+			"  -r  open-loop rate in requests/sec (default: closed loop)\n"
+			"  -k  keep connections alive (default: new connection per request)\n"
+			"  -H  print the full latency distribution\n"
+			"  -s  scenario file (default: GET of path, or /)\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Main program runs the load and prints a report.
+ */
+int main(int argc, char *argv[]) {
+	int opt;
+	const char *scenarioFile = NULL;
+	while ((opt = getopt(argc, argv, "h:p:c:d:w:r:kHs:")) != -1) {
+		switch (opt) {
+		case 'h': host = optarg; break;
+		case 'p': port = optarg; break;
+		case 'c': nconns = atoi(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'w': warmup = atof(optarg); break;
+		case 'r': rate = atof(optarg); break;
+		case 'k': keepAlive = true; break;
+		case 'H': printHistogram = true; break;
+		case 's': scenarioFile = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (nconns < 1 || nconns > MAX_CONNS || duration <= 0 || warmup < 0 || rate < 0) {
+		usage(argv[0]);
+	}
+	if (scenarioFile != NULL) {
+		if (!loadScenario(scenarioFile)) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		strcpy(scenario[0].method, "GET");
+		snprintf(scenario[0].path, MAX_PATH, "%s", (optind < argc) ? argv[optind] : "/");
+		scenario[0].weight = 1;
+		totalWeight = 1;
+		nscenario = 1;
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	int rc = getaddrinfo(host, port, &hints, &serverAddr);
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(rc));
+		return EXIT_FAILURE;
+	}
+
+	ConnResult *results = calloc(nconns, sizeof(ConnResult));
+	pthread_t *threads = calloc(nconns, sizeof(pthread_t));
+	if (results == NULL || threads == NULL) {
+		perror("loadgen");
+		return EXIT_FAILURE;
+	}
+
+	startNs = nowNs() + 10000000ULL;  // let all threads start first
+	warmupEndNs = startNs + (uint64_t)(warmup * 1e9);
+	endNs = warmupEndNs + (uint64_t)(duration * 1e9);
+	for (int i = 0; i < nconns; i++) {
+		if (pthread_create(&threads[i], NULL, connectionThread, &results[i]) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+
+	static histogram total;
+	hist_init(&total);
+	ConnResult sum;
+	memset(&sum, 0, sizeof(sum));
+	for (int i = 0; i < nconns; i++) {
+		pthread_join(threads[i], NULL);
+		hist_merge(&total, &results[i].latency);
+		sum.requests += results[i].requests;
+		sum.errors += results[i].errors;
+		sum.connects += results[i].connects;
+		sum.bytesIn += results[i].bytesIn;
+		for (int s = 0; s < 6; s++) {
+			sum.statuses[s] += results[i].statuses[s];
+		}
+	}
+
+	printf("%s mode, %d connections (%s), %.1fs measured after %.1fs warm-up\n",
+		   (rate > 0) ? "open-loop" : "closed-loop", nconns,
+		   keepAlive ? "keep-alive" : "new connection per request", duration, warmup);
+	if (rate > 0) {
+		printf("target rate: %.1f req/s (latency from scheduled send time)\n", rate);
+	}
+	printf("requests: %llu  errors: %llu  connections: %llu\n",
+		   (unsigned long long)sum.requests, (unsigned long long)sum.errors,
+		   (unsigned long long)sum.connects);
+	printf("status: 1xx=%llu 2xx=%llu 3xx=%llu 4xx=%llu 5xx=%llu other=%llu\n",
+		   (unsigned long long)sum.statuses[0], (unsigned long long)sum.statuses[1],
+		   (unsigned long long)sum.statuses[2], (unsigned long long)sum.statuses[3],
+		   (unsigned long long)sum.statuses[4], (unsigned long long)sum.statuses[5]);
+	printf("throughput: %.1f req/s, %.2f MB/s\n", sum.requests / duration, sum.bytesIn / duration / 1e6);
+	printf("latency (ms): mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+		   hist_mean(&total) / 1e6, hist_percentile(&total, 50) / 1e6,
+		   hist_percentile(&total, 90) / 1e6, hist_percentile(&total, 99) / 1e6,
+		   hist_percentile(&total, 99.9) / 1e6, total.max / 1e6);
+	if (printHistogram) {
+		printDistribution(&total);
+	}
+
+	freeaddrinfo(serverAddr);
+	free(results);
+	free(threads);
+	return (sum.errors > 0 && sum.requests == 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
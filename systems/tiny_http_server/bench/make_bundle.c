@@ -0,0 +1,331 @@
+/*
+ * make_bundle.c
+ *
+ * Packs a content directory into one bundle file that the server maps
+ * and serves with no file system calls (the bundle property). See
+ * src/content_bundle.h for the format.
+ *
+ * Every regular file of the tree is packed with its precomputed
+ * Content-Type, Last-Modified and ETag headers. The ETag is the XXH64
+ * hash of the file contents, as the server tags files it serves from
+ * content_base, so identical files keep their validators whether
+ * they are packed from different trees, at different times, or not
+ * at all. A sidecar "name.gz" or "name.br" next to a file, smaller
+ * than it, is packed as the gzip or brotli variant of its body; the
+ * sidecars are packed as files too. Links to directories are not
+ * followed.
+ *
+ * The bundle is written to a temporary file and renamed, so a server
+ * reloading it on SIGHUP never maps a partial bundle.
+ *
+ * Build:
+ *   cc -O2 -Isrc -o make_bundle bench/make_bundle.c src/mime_util.c \
+ *      src/properties.c src/time_util.c src/xxh64.c
+ *
+ * Usage:
+ *   make_bundle [-m mime-types] content-dir bundle-file
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "content_bundle.h"
+#include "mime_util.h"
+#include "time_util.h"
+#include "xxh64.h"
+
+/** referenced by the server sources linked in */
+bool debug = false;
+const char *CONTENT_BASE = ".";
+
+/** file name suffixes of the precompressed variants */
+static const char *variantSuffix[BUNDLE_ENCODINGS] = { "", ".gz", ".br" };
+
+/** ETag suffixes of the precompressed variants */
+static const char *etagSuffix[BUNDLE_ENCODINGS] = { "", "-gzip", "-br" };
+
+/** A file to pack */
+typedef struct PackFile {
+	char *path;			/** path from the content root */
+	char *file;			/** path in the file system */
+	struct stat sb;		/** file metadata */
+} PackFile;
+
+/** the files to pack */
+static PackFile *files;
+static size_t nfiles, filesSize;
+
+/** the string table */
+static char *strings;
+static size_t stringsLen, stringsSize;
+
+/**
+ * Add a string to the string table.
+ *
+ * @param s the string
+ * @return its offset
+ */
+static uint32_t addString(const char *s) {
+	size_t len = strlen(s) + 1;
+	while (stringsLen + len > stringsSize) {
+		stringsSize = (stringsSize == 0) ? 65536 : stringsSize * 2;
+		strings = realloc(strings, stringsSize);
+		if (strings == NULL) {
+			perror("make_bundle");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (stringsLen + len > UINT32_MAX) {
+		fprintf(stderr, "make_bundle: string table too large\n");
+		exit(EXIT_FAILURE);
+	}
+	uint32_t offset = (uint32_t)stringsLen;
+	memcpy(strings + stringsLen, s, len);
+	stringsLen += len;
+	return offset;
+}
+
+/**
+ * Collect the regular files of a directory tree.
+ *
+ * @param dir the directory in the file system
+ * @param prefix the path of the directory from the content root
+ */
+static void collectFiles(const char *dir, const char *prefix) {
+	DIR *d = opendir(dir);
+	if (d == NULL) {
+		perror(dir);
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL) {
+		if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+			continue;
+		}
+		char file[PATH_MAX], path[PATH_MAX];
+		if ((snprintf(file, sizeof(file), "%s/%s", dir, entry->d_name) >= (int)sizeof(file))
+			|| (snprintf(path, sizeof(path), "%s/%s", prefix, entry->d_name) >= (int)sizeof(path))) {
+			fprintf(stderr, "make_bundle: %s/%s: name too long\n", dir, entry->d_name);
+			continue;
+		}
+		struct stat sb;
+		if (stat(file, &sb) != 0) {
+			perror(file);
+			continue;
+		}
+		if (S_ISDIR(sb.st_mode)) {
+			if (entry->d_type != DT_LNK) {
+				collectFiles(file, path);
+			}
+		} else if (S_ISREG(sb.st_mode)) {
+			if (nfiles == filesSize) {
+				filesSize = (filesSize == 0) ? 1024 : filesSize * 2;
+				files = realloc(files, filesSize * sizeof(PackFile));
+				if (files == NULL) {
+					perror("make_bundle");
+					exit(EXIT_FAILURE);
+				}
+			}
+			files[nfiles].path = strdup(path);
+			files[nfiles].file = strdup(file);
+			files[nfiles].sb = sb;
+			nfiles++;
+		}
+	}
+	closedir(d);
+}
+
+/**
+ * Order files by path, as the server searches the index.
+ */
+static int comparePaths(const void *a, const void *b) {
+	return strcmp(((const PackFile *)a)->path, ((const PackFile *)b)->path);
+}
+
+/**
+ * Find a file to pack by path.
+ *
+ * @param path the path from the content root
+ * @return the file, or NULL if none
+ */
+static PackFile *findFile(const char *path) {
+	PackFile key = { .path = (char *)path };
+	return bsearch(&key, files, nfiles, sizeof(PackFile), comparePaths);
+}
+
+/**
+ * Copy a file to the bundle, hashing its contents with XXH64.
+ *
+ * @param file the file in the file system
+ * @param out the bundle
+ * @param length the number of bytes copied
+ * @param hash the hash of the contents
+ * @return true if copied
+ */
+static bool copyFile(const char *file, FILE *out, uint64_t *length, uint64_t *hash) {
+	FILE *in = fopen(file, "r");
+	if (in == NULL) {
+		perror(file);
+		return false;
+	}
+	static char buf[65536];
+	Xxh64State state;
+	xxh64Init(&state, 0);
+	uint64_t n = 0;
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+		xxh64Update(&state, buf, len);
+		if (fwrite(buf, 1, len, out) != len) {
+			fclose(in);
+			return false;
+		}
+		n += len;
+	}
+	bool ok = !ferror(in);
+	fclose(in);
+	*length = n;
+	*hash = xxh64Digest(&state);
+	return ok;
+}
+
+/**
+ * Round an offset up to an alignment.
+ *
+ * @param offset the offset
+ * @param align the alignment, a power of 2
+ * @return the aligned offset
+ */
+static uint64_t alignUp(uint64_t offset, uint64_t align) {
+	return (offset + align - 1) & ~(align - 1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *mimeTypes = "mime.types";
+	int opt;
+	while ((opt = getopt(argc, argv, "m:")) != -1) {
+		if (opt == 'm') {
+			mimeTypes = optarg;
+		} else {
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "usage: make_bundle [-m mime-types] content-dir bundle-file\n");
+		return EXIT_FAILURE;
+	}
+	const char *root = argv[optind];
+	const char *bundleFile = argv[optind + 1];
+	readMimeTypes(mimeTypes);
+
+	collectFiles(root, "");
+	qsort(files, nfiles, sizeof(PackFile), comparePaths);
+	BundleRecord *records = calloc((nfiles > 0) ? nfiles : 1, sizeof(BundleRecord));
+	if (records == NULL) {
+		perror("make_bundle");
+		return EXIT_FAILURE;
+	}
+
+	char tmpFile[PATH_MAX];
+	if (snprintf(tmpFile, sizeof(tmpFile), "%s.tmp", bundleFile) >= (int)sizeof(tmpFile)) {
+		fprintf(stderr, "make_bundle: %s: name too long\n", bundleFile);
+		return EXIT_FAILURE;
+	}
+	FILE *out = fopen(tmpFile, "w");
+	if (out == NULL) {
+		perror(tmpFile);
+		return EXIT_FAILURE;
+	}
+
+	// offset 0 of the string table is the empty string, for
+	// the ETags of variants a file does not have
+	addString("");
+
+	// the bodies, each on a page boundary past the header
+	uint64_t offset = BUNDLE_ALIGN;
+	size_t variants = 0;
+	for (size_t i = 0; i < nfiles; i++) {
+		PackFile *pf = &files[i];
+		BundleRecord *record = &records[i];
+		char buf[PATH_MAX];
+		record->path = addString(pf->path);
+		record->contentType = addString(getMimeType(pf->path, buf));
+		record->lastModified = addString(milliTimeToRFC_1123_Date_Time(pf->sb.st_mtim.tv_sec, buf));
+
+		uint64_t hash = 0;
+		for (int e = 0; e < BUNDLE_ENCODINGS; e++) {
+			const char *file = pf->file;
+			if (e != BUNDLE_IDENTITY) {
+				// a variant only if it saves bytes
+				snprintf(buf, sizeof(buf), "%s%s", pf->path, variantSuffix[e]);
+				PackFile *variant = findFile(buf);
+				if ((variant == NULL) || (variant->sb.st_size >= pf->sb.st_size)) {
+					continue;
+				}
+				file = variant->file;
+			}
+			uint64_t length, h;
+			if ((fseeko(out, (off_t)offset, SEEK_SET) != 0) || !copyFile(file, out, &length, &h)) {
+				if (e == BUNDLE_IDENTITY) {
+					perror(tmpFile);
+					fclose(out);
+					unlink(tmpFile);
+					return EXIT_FAILURE;
+				}
+				continue;
+			}
+			if (e == BUNDLE_IDENTITY) {
+				hash = h;
+			} else {
+				variants++;
+			}
+			record->body[e].offset = offset;
+			record->body[e].length = length;
+			sprintf(buf, "\"%016llx%s\"", (unsigned long long)hash, etagSuffix[e]);
+			record->etag[e] = addString(buf);
+			offset = alignUp(offset + length, BUNDLE_ALIGN);
+		}
+	}
+
+	// the index and the string table follow the bodies
+	BundleHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+	header.version = BUNDLE_VERSION;
+	header.count = (uint32_t)nfiles;
+	header.indexOffset = offset;
+	header.stringsOffset = offset + nfiles * sizeof(BundleRecord);
+	header.stringsSize = stringsLen;
+	header.size = header.stringsOffset + stringsLen;
+	if ((fseeko(out, (off_t)header.indexOffset, SEEK_SET) != 0)
+		|| (fwrite(records, sizeof(BundleRecord), nfiles, out) != nfiles)
+		|| (fwrite(strings, 1, stringsLen, out) != stringsLen)
+		|| (fseeko(out, 0, SEEK_SET) != 0)
+		|| (fwrite(&header, sizeof(header), 1, out) != 1)
+		|| (fflush(out) != 0) || (fsync(fileno(out)) != 0)) {
+		perror(tmpFile);
+		fclose(out);
+		unlink(tmpFile);
+		return EXIT_FAILURE;
+	}
+	fclose(out);
+	if (rename(tmpFile, bundleFile) != 0) {
+		perror(bundleFile);
+		unlink(tmpFile);
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, "%s: %zu files, %zu precompressed variants, %llu bytes\n",
+			bundleFile, nfiles, variants, (unsigned long long)header.size);
+	return EXIT_SUCCESS;
+}
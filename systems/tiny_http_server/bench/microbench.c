@@ -0,0 +1,324 @@
+/*
+ * microbench.c
+ *
+ * Microbenchmarks for the primitives on the request path.
+ *
+ * Each benchmark is warmed up, calibrated to an iteration count that
+ * runs for the target time (or run a fixed count with -n), then timed
+ * over several runs. The report gives the median and minimum ns/op,
+ * the spread across runs, and heap allocations per operation, counted
+ * by interposing malloc, calloc and realloc over glibc.
+ *
+ * Build (from the tiny_http_server directory):
+ *   cc -O2 -o microbench bench/microbench.c \
+ *      $(ls src/[a-z]*.c | grep -v http_server.c) -lpthread
+ *
+ * Usage:
+ *   microbench [-t ms] [-w ms] [-r runs] [-n iterations] [-m mime.types] [filter]
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/file_util.h"
+#include "../src/http_server.h"
+#include "../src/http_util.h"
+#include "../src/mime_util.h"
+#include "../src/properties.h"
+#include "../src/time_util.h"
+
+/** maximum runs per benchmark */
+#define MAX_RUNS 100
+
+/** size of the copyFileStreamBytes transfer */
+#define COPY_BYTES 65536
+
+/** debug flag of the server code */
+bool debug = false;
+
+/** content base of the server code */
+const char *CONTENT_BASE = "content";
+
+/** heap allocations so far */
+static unsigned long long allocations;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/** count allocations; glibc routes its own internal allocations here too */
+void *malloc(size_t size) {
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+/**
+ * Keep the compiler from optimizing away a result.
+ */
+static inline void keep(const void *p) {
+	__asm__ volatile("" : : "g"(p) : "memory");
+}
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static uint64_t nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/** a typical browser request */
+static const char requestHeaders[] =
+	"Host: localhost:1500\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Referer: http://localhost:1500/forms/\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"Sec-Fetch-Dest: document\r\n"
+	"Sec-Fetch-Mode: navigate\r\n"
+	"If-Modified-Since: Sun, 19 Oct 2026 08:00:00 GMT\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+/** fixtures */
+static Properties *headerProps;
+static FILE *headerStream;
+static FILE *copyIn, *copyOut;
+static char copyInBuf[COPY_BYTES], copyOutBuf[COPY_BYTES + 1];
+
+static void setupHeaders(void) {
+	if (headerStream == NULL) {
+		headerStream = fmemopen((void *)requestHeaders, sizeof(requestHeaders) - 1, "r");
+	}
+	if (headerProps == NULL) {
+		headerProps = newProperties();
+		readRequestHeaders(headerStream, headerProps);
+	}
+}
+
+static void setupCopy(void) {
+	if (copyIn == NULL) {
+		memset(copyInBuf, 'x', sizeof(copyInBuf));
+		copyIn = fmemopen(copyInBuf, sizeof(copyInBuf), "r");
+		copyOut = fmemopen(copyOutBuf, sizeof(copyOutBuf), "w");
+	}
+}
+
+static void benchUnescapeUri(uint64_t n) {
+	char uri[MAXBUF];
+	for (uint64_t i = 0; i < n; i++) {
+		keep(unescapeUri("/forms/a%20file%2Bname%21%28v2%29.html", uri));
+	}
+}
+
+static void benchResolveUri(uint64_t n) {
+	char path[MAXBUF];
+	for (uint64_t i = 0; i < n; i++) {
+		keep(resolveUri("/forms/form-post-multipart.html", path));
+	}
+}
+
+static void benchGetMimeType(uint64_t n) {
+	static const char *names[] = {
+		"index.html", "northeastern.png", "style.css", "data.json",
+		"archive.tar.gz", "favicon.ico", "README", "video.mp4"
+	};
+	char mimeType[MAXBUF];
+	for (uint64_t i = 0; i < n; i++) {
+		keep(getMimeType(names[i & 7], mimeType));
+	}
+}
+
+static void benchFindProperty(uint64_t n) {
+	char val[MAX_PROP_VAL];
+	for (uint64_t i = 0; i < n; i++) {
+		keep((void *)findProperty(headerProps, 0, (i & 1) ? "Cache-Control" : "Content-Length", val));
+	}
+}
+
+static void benchPutProperty(uint64_t n) {
+	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
+	for (uint64_t i = 0; i < n; i++) {
+		Properties *props = newProperties();
+		for (size_t p = 0; getProperty(headerProps, p, name, val); p++) {
+			putProperty(props, name, val);
+		}
+		keep(props);
+		deleteProperties(props);
+	}
+}
+
+static void benchReadRequestHeaders(uint64_t n) {
+	for (uint64_t i = 0; i < n; i++) {
+		rewind(headerStream);
+		Properties *props = newProperties();
+		readRequestHeaders(headerStream, props);
+		keep(props);
+		deleteProperties(props);
+	}
+}
+
+static void benchRFC1123Date(uint64_t n) {
+	char buf[MAXBUF];
+	time_t t = time(NULL);
+	for (uint64_t i = 0; i < n; i++) {
+		keep(milliTimeToRFC_1123_Date_Time(t + (time_t)i, buf));
+	}
+}
+
+static void benchCopyFileStreamBytes(uint64_t n) {
+	for (uint64_t i = 0; i < n; i++) {
+		rewind(copyIn);
+		rewind(copyOut);
+		copyFileStreamBytes(copyIn, copyOut, COPY_BYTES);
+		keep(copyOutBuf);
+	}
+}
+
+/** A benchmark */
+typedef struct Benchmark {
+	const char *name;			/** benchmark name */
+	void (*setup)(void);		/** one-time fixture setup, or NULL */
+	void (*run)(uint64_t n);	/** run n operations */
+	size_t bytesPerOp;			/** bytes processed per operation, or 0 */
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+	{ "unescapeUri", NULL, benchUnescapeUri, 0 },
+	{ "resolveUri", NULL, benchResolveUri, 0 },
+	{ "getMimeType", NULL, benchGetMimeType, 0 },
+	{ "findProperty", setupHeaders, benchFindProperty, 0 },
+	{ "putProperty/12", setupHeaders, benchPutProperty, 0 },
+	{ "readRequestHeaders/12", setupHeaders, benchReadRequestHeaders, sizeof(requestHeaders) - 1 },
+	{ "milliTimeToRFC_1123_Date_Time", NULL, benchRFC1123Date, 0 },
+	{ "copyFileStreamBytes/64K", setupCopy, benchCopyFileStreamBytes, COPY_BYTES },
+};
+
+/**
+ * Time n operations.
+ *
+ * @return elapsed nanoseconds
+ */
+static uint64_t timeRun(const Benchmark *b, uint64_t n) {
+	uint64_t start = nowNs();
+	b->run(n);
+	return nowNs() - start;
+}
+
+static int compareDouble(const void *a, const void *b) {
+	double da = *(const double *)a, db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+/**
+ * Print usage and exit.
+ */
+static void usage(const char *prog) {
+	fprintf(stderr,
+			"usage: %s [-t ms] [-w ms] [-r runs] [-n iterations] [-m mime.types] [filter]\n"
+			"  -t  target time per run (default 200)\n"
+			"  -w  warm-up time per benchmark (default 100)\n"
+			"  -r  timed runs per benchmark (default 5)\n"
+			"  -n  fixed iterations per run instead of calibrating\n"
+			"  -m  mime types file (default mime.types)\n"
+			"  filter runs only benchmarks whose name contains it\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Main program runs the benchmarks and prints a report.
+ */
+int main(int argc, char *argv[]) {
+	double targetMs = 200, warmupMs = 100;
+	int runs = 5;
+	uint64_t fixedIters = 0;
+	const char *mimeTypes = "mime.types";
+	int opt;
+	while ((opt = getopt(argc, argv, "t:w:r:n:m:")) != -1) {
+		switch (opt) {
+		case 't': targetMs = atof(optarg); break;
+		case 'w': warmupMs = atof(optarg); break;
+		case 'r': runs = atoi(optarg); break;
+		case 'n': fixedIters = strtoull(optarg, NULL, 10); break;
+		case 'm': mimeTypes = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (targetMs <= 0 || warmupMs < 0 || runs < 1 || runs > MAX_RUNS || optind < argc - 1) {
+		usage(argv[0]);
+	}
+	const char *filter = (optind < argc) ? argv[optind] : NULL;
+	readMimeTypes(mimeTypes);
+
+	printf("%-32s %12s %10s %10s %7s %10s %10s\n",
+		   "benchmark", "iterations", "ns/op", "min ns/op", "spread", "allocs/op", "MB/s");
+	for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+		const Benchmark *b = &benchmarks[i];
+		if (filter != NULL && strstr(b->name, filter) == NULL) {
+			continue;
+		}
+		if (b->setup != NULL) {
+			b->setup();
+		}
+
+		// warm up caches and branch predictors while calibrating
+		uint64_t n = 1, elapsed = 0, warmupStart = nowNs();
+		while (true) {
+			elapsed = timeRun(b, n);
+			if (elapsed >= 10000000ULL && nowNs() - warmupStart >= (uint64_t)(warmupMs * 1e6)) {
+				break;
+			}
+			if (elapsed < 10000000ULL) {
+				n *= 2;
+			}
+		}
+		uint64_t iters = fixedIters;
+		if (iters == 0) {
+			iters = (uint64_t)(n * (targetMs * 1e6) / elapsed);
+			iters = (iters > 0) ? iters : 1;
+		}
+
+		double nsPerOp[MAX_RUNS];
+		unsigned long long allocs = 0;
+		for (int r = 0; r < runs; r++) {
+			unsigned long long before = allocations;
+			nsPerOp[r] = (double)timeRun(b, iters) / iters;
+			allocs += allocations - before;
+		}
+		qsort(nsPerOp, runs, sizeof(double), compareDouble);
+		double median = (runs % 2) ? nsPerOp[runs / 2]
+								   : (nsPerOp[runs / 2 - 1] + nsPerOp[runs / 2]) / 2;
+		double spread = (median > 0) ? 100.0 * (nsPerOp[runs - 1] - nsPerOp[0]) / median : 0;
+
+		printf("%-32s %12llu %10.1f %10.1f %6.1f%% %10.2f", b->name, (unsigned long long)iters,
+			   median, nsPerOp[0], spread, (double)allocs / ((double)iters * runs));
+		if (b->bytesPerOp > 0) {
+			printf(" %10.1f", b->bytesPerOp * 1e3 / median);
+		}
+		printf("\n");
+	}
+	return EXIT_SUCCESS;
+}
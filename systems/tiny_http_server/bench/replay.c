@@ -0,0 +1,537 @@
+/*
+ * replay.c
+ *
+ * Replays captured traffic against the tiny http server.
+ *
+ * Reads a binary trace written by the server's capture mode (see
+ * src/traffic_capture.h), or a Common Log Format access log, and
+ * sends the requests at their original inter-arrival times scaled
+ * by a speed factor, or as fast as possible. Paced latency is
+ * measured from each request's scheduled time, so a stall is
+ * charged to every request it delayed. Latency is reported per
+ * URI class next to the server-side time recorded in the trace.
+ *
+ * Build:
+ *   cc -O2 -o replay bench/replay.c bench/http_client.c src/histogram.c -lpthread
+ *
+ * Usage:
+ *   replay [-h host] [-p port] [-c conns] [-x speed] [-k]
+ *          [-g ext|dir|method|status] [-l] trace
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/histogram.h"
+#include "../src/traffic_capture.h"
+#include "http_client.h"
+
+/** maximum number of URI classes */
+#define MAX_CLASSES 64
+
+/** maximum connections */
+#define MAX_CONNS 4096
+
+/** One request to replay */
+typedef struct TraceRecord {
+	uint64_t offsetUs;		/** arrival time from start of trace */
+	uint64_t durationUs;	/** captured server time, 0 if unknown */
+	uint64_t bodyBytes;		/** request body bytes */
+	uint64_t latencyNs;		/** replayed latency */
+	int status;				/** captured status, 0 if unknown */
+	int replayStatus;		/** replayed status, -1 if error */
+	int cls;				/** URI class */
+	bool head;				/** HEAD request */
+	char *request;			/** request line and headers */
+} TraceRecord;
+
+/** URI grouping */
+typedef enum Grouping { BY_EXTENSION, BY_DIRECTORY, BY_METHOD, BY_STATUS } Grouping;
+
+/** settings */
+static const char *host = "127.0.0.1";
+static const char *port = "1500";
+static int nconns = 16;
+static double speed = 1.0;
+static bool keepAlive = false;
+static Grouping grouping = BY_EXTENSION;
+
+/** the trace */
+static TraceRecord *records;
+static size_t nrecords;
+static size_t nextRecord;
+
+/** URI class names */
+static char *classNames[MAX_CLASSES];
+static int nclasses;
+
+/** server address */
+static struct addrinfo *serverAddr;
+
+/** start of the replay */
+static uint64_t startNs;
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static uint64_t nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Sleep until a monotonic time.
+ */
+static void sleepUntil(uint64_t when) {
+	struct timespec ts = { (time_t)(when / 1000000000ULL), (long)(when % 1000000000ULL) };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+
+/**
+ * Get the id of a class name, adding it if new. Classes past
+ * MAX_CLASSES are reported as "other".
+ */
+static int classId(const char *name) {
+	for (int i = 0; i < nclasses; i++) {
+		if (strcmp(classNames[i], name) == 0) {
+			return i;
+		}
+	}
+	if (nclasses == MAX_CLASSES - 1) {
+		name = "other";
+	}
+	if (nclasses == MAX_CLASSES) {
+		return MAX_CLASSES - 1;
+	}
+	classNames[nclasses] = strdup(name);
+	return nclasses++;
+}
+
+/**
+ * Classify a request by the grouping.
+ *
+ * @param method the request method
+ * @param target the request target
+ * @param status the captured status
+ * @return the class id
+ */
+static int classify(const char *method, const char *target, int status) {
+	char name[128];
+	size_t len = strcspn(target, "?");
+	if (grouping == BY_METHOD) {
+		snprintf(name, sizeof(name), "%s", method);
+	} else if (grouping == BY_STATUS) {
+		snprintf(name, sizeof(name), "%dxx", status / 100);
+	} else if (grouping == BY_DIRECTORY) {
+		// first path segment
+		const char *slash = memchr(target + 1, '/', (len > 0) ? len - 1 : 0);
+		snprintf(name, sizeof(name), "%.*s", (int)((slash != NULL) ? slash - target + 1 : (long)len), target);
+	} else if (len > 0 && target[len-1] == '/') {
+		snprintf(name, sizeof(name), "dir/");
+	} else {
+		const char *slash = memrchr(target, '/', len);
+		const char *dot = memrchr(target, '.', len);
+		if (dot != NULL && (slash == NULL || dot > slash)) {
+			snprintf(name, sizeof(name), "*%.*s", (int)(target + len - dot), dot);
+		} else {
+			snprintf(name, sizeof(name), "(none)");
+		}
+	}
+	return classId(name);
+}
+
+/**
+ * Add a request to the trace.
+ *
+ * @param requestLine the request line
+ * @param headers request headers as "Name: value\r\n" lines, without
+ *   Connection and Content-Length
+ * @param rec the record with its offset, duration, status and body size
+ */
+static bool addRecord(const char *requestLine, const char *headers, TraceRecord *rec) {
+	char method[16], target[1024];
+	if (sscanf(requestLine, "%15s %1023s", method, target) != 2) {
+		return false;
+	}
+	char *request;
+	int len = asprintf(&request, "%s\r\n%sConnection: %s\r\n", requestLine, headers,
+					   keepAlive ? "keep-alive" : "close");
+	if (len < 0) {
+		return false;
+	}
+	// always send a length with a body method: access logs do not record it
+	if (rec->bodyBytes > 0 || strcasecmp(method, "PUT") == 0 || strcasecmp(method, "POST") == 0) {
+		char *withLength;
+		if (asprintf(&withLength, "%sContent-Length: %llu\r\n\r\n", request,
+					 (unsigned long long)rec->bodyBytes) < 0) {
+			free(request);
+			return false;
+		}
+		free(request);
+		request = withLength;
+	} else {
+		char *end = realloc(request, len + 3);
+		if (end == NULL) {
+			free(request);
+			return false;
+		}
+		request = strcat(end, "\r\n");
+	}
+
+	if (nrecords % 4096 == 0) {
+		TraceRecord *more = realloc(records, (nrecords + 4096) * sizeof(TraceRecord));
+		if (more == NULL) {
+			free(request);
+			return false;
+		}
+		records = more;
+	}
+	rec->request = request;
+	rec->head = (strcasecmp(method, "HEAD") == 0);
+	rec->cls = classify(method, target, rec->status);
+	records[nrecords++] = *rec;
+	return true;
+}
+
+/**
+ * Read an unsigned LEB128 varint.
+ */
+static bool getVarint(FILE *f, uint64_t *value) {
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = getc(f);
+		if (c == EOF) {
+			return false;
+		}
+		*value |= (uint64_t)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Read a length-prefixed string.
+ */
+static bool getString(FILE *f, char *buf, size_t size) {
+	uint64_t len;
+	if (!getVarint(f, &len) || len >= size || fread(buf, 1, len, f) != len) {
+		return false;
+	}
+	buf[len] = '\0';
+	return true;
+}
+
+/**
+ * Load a binary trace.
+ *
+ * @param f the trace file, positioned after the magic
+ * @return true if the trace was read
+ */
+static bool loadTrace(FILE *f) {
+	uint8_t wall[8];
+	if (fread(wall, sizeof(wall), 1, f) != 1) {
+		return false;
+	}
+	char line[8192], name[256], value[256];
+	char *headers = malloc(1 << 16);
+	if (headers == NULL) {
+		return false;
+	}
+	while (true) {
+		TraceRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		uint64_t status, bytesOut, count;
+		if (!getVarint(f, &rec.offsetUs)) {
+			break;
+		}
+		if (!getVarint(f, &rec.durationUs) || !getVarint(f, &status) || !getVarint(f, &rec.bodyBytes)
+			|| !getVarint(f, &bytesOut) || !getString(f, line, sizeof(line)) || !getVarint(f, &count)) {
+			fprintf(stderr, "truncated trace after %zu records\n", nrecords);
+			break;
+		}
+		rec.status = (int)status;
+		size_t hlen = 0;
+		bool ok = true;
+		for (uint64_t i = 0; ok && i < count; i++) {
+			ok = getString(f, name, sizeof(name)) && getString(f, value, sizeof(value));
+			if (ok && strcasecmp(name, "Connection") != 0 && strcasecmp(name, "Content-Length") != 0
+				&& hlen + strlen(name) + strlen(value) + 5 < (1 << 16)) {
+				hlen += sprintf(headers + hlen, "%s: %s\r\n", name, value);
+			}
+		}
+		if (!ok) {
+			fprintf(stderr, "truncated trace after %zu records\n", nrecords);
+			break;
+		}
+		headers[hlen] = '\0';
+		if (strcmp(line, "-") != 0) {
+			addRecord(line, headers, &rec);
+		}
+	}
+	free(headers);
+	return nrecords > 0;
+}
+
+/**
+ * Load a Common Log Format access log. Timestamps have one second
+ * resolution, so requests within a second are spread evenly over it.
+ *
+ * @param f the log file
+ * @return true if the log was read
+ */
+static bool loadAccessLog(FILE *f) {
+	char line[8192], when[64], requestLine[4096];
+	time_t first = 0;
+	char hostHeader[300];
+	snprintf(hostHeader, sizeof(hostHeader), "Host: %s\r\n", host);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		int status;
+		if (sscanf(line, "%*s %*s %*s [%63[^]]] \"%4095[^\"]\" %d", when, requestLine, &status) != 3) {
+			continue;
+		}
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		if (strptime(when, "%d/%b/%Y:%H:%M:%S", &tm) == NULL) {
+			continue;
+		}
+		time_t t = timegm(&tm);
+		if (nrecords == 0) {
+			first = t;
+		}
+		TraceRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.offsetUs = (t > first) ? (uint64_t)(t - first) * 1000000ULL : 0;
+		rec.status = status;
+		addRecord(requestLine, hostHeader, &rec);
+	}
+
+	// spread each second's requests across the second
+	for (size_t i = 0; i < nrecords; ) {
+		size_t j = i;
+		while (j < nrecords && records[j].offsetUs == records[i].offsetUs) {
+			j++;
+		}
+		for (size_t k = i; k < j; k++) {
+			records[k].offsetUs += (k - i) * 1000000ULL / (j - i);
+		}
+		i = j;
+	}
+	return nrecords > 0;
+}
+
+/**
+ * Order records by arrival.
+ */
+static int compareOffset(const void *a, const void *b) {
+	const TraceRecord *ra = a, *rb = b;
+	return (ra->offsetUs > rb->offsetUs) - (ra->offsetUs < rb->offsetUs);
+}
+
+/**
+ * Replay records until the trace is exhausted. Each thread owns one
+ * connection and takes the next record in arrival order.
+ */
+static void *replayThread(void *arg) {
+	(void)arg;
+	HttpConnection *conn = malloc(sizeof(HttpConnection));
+	if (conn == NULL) {
+		return NULL;
+	}
+	conn->fd = -1;
+	conn->connects = 0;
+	while (true) {
+		size_t i = __atomic_fetch_add(&nextRecord, 1, __ATOMIC_RELAXED);
+		if (i >= nrecords) {
+			break;
+		}
+		TraceRecord *rec = &records[i];
+		uint64_t scheduled;
+		if (speed > 0) {
+			scheduled = startNs + (uint64_t)(rec->offsetUs * 1000.0 / speed);
+			sleepUntil(scheduled);
+		} else {
+			scheduled = nowNs();
+		}
+
+		uint64_t bytes = 0;
+		rec->replayStatus = httpRequest(conn, serverAddr, rec->request, strlen(rec->request),
+										rec->bodyBytes, rec->head, &bytes);
+		rec->latencyNs = nowNs() - scheduled;
+		if (!keepAlive) {
+			httpClose(conn);
+		}
+	}
+	httpClose(conn);
+	free(conn);
+	return NULL;
+}
+
+/**
+ * Print one line of the report.
+ */
+static void printClass(const char *name, const histogram *replayed, const histogram *captured,
+					   uint64_t errors, uint64_t mismatched) {
+	printf("%-20s %8llu %6llu %6llu %9.3f %9.3f %9.3f %9.3f %9.3f %11.3f\n", name,
+		   (unsigned long long)replayed->total, (unsigned long long)errors,
+		   (unsigned long long)mismatched,
+		   hist_percentile(replayed, 50) / 1e6, hist_percentile(replayed, 90) / 1e6,
+		   hist_percentile(replayed, 99) / 1e6, hist_percentile(replayed, 99.9) / 1e6,
+		   replayed->max / 1e6, hist_percentile(captured, 99) / 1e6);
+}
+
+/**
+ * Print usage and exit.
+ */
+static void usage(const char *prog) {
+	fprintf(stderr,
+			"usage: %s [-h host] [-p port] [-c conns] [-x speed] [-k]\n"
+			"          [-g ext|dir|method|status] [-l] trace\n"
+			"  -c  connections (default 16)\n"
+			"  -x  speed factor; 1 is the captured rate, 0 is as fast as possible\n"
+			"  -k  keep connections alive\n"
+			"  -g  group latency by file extension (default), first directory,\n"
+			"      method or captured status class\n"
+			"  -l  the trace is a Common Log Format access log\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Main program replays a trace and prints a report.
+ */
+int main(int argc, char *argv[]) {
+	int opt;
+	bool accessLog = false;
+	while ((opt = getopt(argc, argv, "h:p:c:x:kg:l")) != -1) {
+		switch (opt) {
+		case 'h': host = optarg; break;
+		case 'p': port = optarg; break;
+		case 'c': nconns = atoi(optarg); break;
+		case 'x': speed = atof(optarg); break;
+		case 'k': keepAlive = true; break;
+		case 'l': accessLog = true; break;
+		case 'g':
+			if (strcmp(optarg, "ext") == 0) grouping = BY_EXTENSION;
+			else if (strcmp(optarg, "dir") == 0) grouping = BY_DIRECTORY;
+			else if (strcmp(optarg, "method") == 0) grouping = BY_METHOD;
+			else if (strcmp(optarg, "status") == 0) grouping = BY_STATUS;
+			else usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nconns < 1 || nconns > MAX_CONNS || speed < 0) {
+		usage(argv[0]);
+	}
+
+	FILE *f = fopen(argv[optind], "rb");
+	if (f == NULL) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	char magic[TRACE_MAGIC_LEN];
+	bool loaded;
+	if (accessLog) {
+		loaded = loadAccessLog(f);
+	} else if (fread(magic, TRACE_MAGIC_LEN, 1, f) == 1 && memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+		loaded = loadTrace(f);
+	} else {
+		fprintf(stderr, "%s: not a trace file (use -l for an access log)\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+	if (!loaded) {
+		fprintf(stderr, "%s: no requests\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	qsort(records, nrecords, sizeof(TraceRecord), compareOffset);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	int rc = getaddrinfo(host, port, &hints, &serverAddr);
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(rc));
+		return EXIT_FAILURE;
+	}
+
+	pthread_t *threads = calloc(nconns, sizeof(pthread_t));
+	if (threads == NULL) {
+		perror("replay");
+		return EXIT_FAILURE;
+	}
+	startNs = nowNs() + 10000000ULL;  // let all threads start first
+	for (int i = 0; i < nconns; i++) {
+		if (pthread_create(&threads[i], NULL, replayThread, NULL) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	for (int i = 0; i < nconns; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	double elapsed = (nowNs() - startNs) / 1e9;
+
+	// build the per-class histograms from the per-record results
+	histogram *replayed = calloc(nclasses + 1, sizeof(histogram));
+	histogram *captured = calloc(nclasses + 1, sizeof(histogram));
+	uint64_t *errors = calloc(nclasses + 1, sizeof(uint64_t));
+	uint64_t *mismatched = calloc(nclasses + 1, sizeof(uint64_t));
+	if (replayed == NULL || captured == NULL || errors == NULL || mismatched == NULL) {
+		perror("replay");
+		return EXIT_FAILURE;
+	}
+	for (int c = 0; c <= nclasses; c++) {
+		hist_init(&replayed[c]);
+		hist_init(&captured[c]);
+	}
+	for (size_t i = 0; i < nrecords; i++) {
+		const TraceRecord *rec = &records[i];
+		for (int c = rec->cls; ; c = nclasses) {
+			hist_record(&replayed[c], rec->latencyNs);
+			if (rec->durationUs > 0) {
+				hist_record(&captured[c], rec->durationUs * 1000);
+			}
+			errors[c] += (rec->replayStatus < 0);
+			mismatched[c] += (rec->replayStatus >= 0 && rec->status != 0 && rec->replayStatus != rec->status);
+			if (c == nclasses) {
+				break;
+			}
+		}
+	}
+
+	printf("replayed %zu requests in %.2fs (%.1f req/s) at %s over %d connections (%s)\n",
+		   nrecords, elapsed, nrecords / elapsed,
+		   (speed > 0) ? "paced speed" : "maximum speed", nconns,
+		   keepAlive ? "keep-alive" : "new connection per request");
+	if (speed > 0) {
+		printf("speed %.2fx; latency measured from scheduled send time\n", speed);
+	}
+	printf("\n%-20s %8s %6s %6s %9s %9s %9s %9s %9s %11s\n", "class", "requests", "errors",
+		   "status", "p50(ms)", "p90(ms)", "p99(ms)", "p99.9(ms)", "max(ms)", "capt.p99");
+	for (int c = 0; c < nclasses; c++) {
+		printClass(classNames[c], &replayed[c], &captured[c], errors[c], mismatched[c]);
+	}
+	printClass("all", &replayed[nclasses], &captured[nclasses], errors[nclasses], mismatched[nclasses]);
+	printf("\n\"status\" counts responses whose status differs from the capture;\n"
+		   "\"capt.p99\" is the server-side p99 recorded in the trace.\n");
+
+	freeaddrinfo(serverAddr);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# run_benchmarks.sh
+#
+# Builds the server and the load generator, serves a scratch copy of
+# content/ and runs every scenario in bench/scenarios, closed-loop with
+# new connections and with keep-alive, then open-loop at a fixed rate.
+# Results go to bench/results/<scenario>.txt as a baseline to compare
+# performance changes against.
+#
+# Usage: bench/run_benchmarks.sh [duration-secs] [connections] [rate]
+#
+#  @since 2026-10-19
+#
+
+set -e
+
+DURATION=${1:-10}
+CONNS=${2:-16}
+RATE=${3:-2000}
+PORT=${PORT:-18081}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BENCH="$ROOT/bench"
+WORK=$(mktemp -d)
+RESULTS="$BENCH/results"
+trap 'kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT INT TERM
+
+cc -std=gnu11 -O2 -o "$WORK/http_server" "$ROOT"/src/*.c -lpthread
+cc -std=gnu11 -O2 -o "$WORK/loadgen" "$BENCH/loadgen.c" "$BENCH/http_client.c" "$ROOT/src/histogram.c" -lpthread
+
+# scratch content tree with large files and a PUT area
+cp -r "$ROOT/content" "$WORK/content"
+mkdir -p "$WORK/content/bench/put"
+head -c 1048576 /dev/urandom > "$WORK/content/bench/large-1m.bin"
+head -c 16777216 /dev/urandom > "$WORK/content/bench/large-16m.bin"
+
+cat > "$WORK/bench.properties" <<EOP
+content_base=$WORK/content
+mime_types=$ROOT/mime.types
+debug=false
+EOP
+
+"$WORK/http_server" "$PORT" "$WORK/bench.properties" > "$WORK/server.log" 2>&1 &
+SERVER=$!
+sleep 1
+
+mkdir -p "$RESULTS"
+for scenario in "$BENCH"/scenarios/*.txt; do
+	name=$(basename "$scenario" .txt)
+	out="$RESULTS/$name.txt"
+	echo "== $name"
+	{
+		echo "# $name $(date -u +%Y-%m-%dT%H:%M:%SZ) $(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null)"
+		echo
+		"$WORK/loadgen" -p "$PORT" -c "$CONNS" -d "$DURATION" -w 1 -s "$scenario"
+		echo
+		"$WORK/loadgen" -p "$PORT" -c "$CONNS" -d "$DURATION" -w 1 -k -s "$scenario"
+		echo
+		"$WORK/loadgen" -p "$PORT" -c "$CONNS" -d "$DURATION" -w 1 -r "$RATE" -H -s "$scenario"
+	} > "$out"
+	grep -E '^(closed|open)-loop|^throughput|^latency' "$out"
+done
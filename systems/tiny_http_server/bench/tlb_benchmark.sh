@@ -0,0 +1,87 @@
+#!/bin/sh
+#
+# tlb_benchmark.sh
+#
+# Measures the TLB misses the cache arena saves. Builds the server and
+# the load generator, fills a scratch content tree with 100 files of
+# about 1 MB, and serves them all from the file cache, once with the
+# contents in malloc memory and once in the huge-page cache arena.
+# While keep-alive load runs, perf stat counts the server's TLB loads,
+# misses and page walk cycles. The results and the arena statistics
+# go to bench/results/tlb.txt.
+#
+# perf needs kernel.perf_event_paranoid <= 1 or root; without perf the
+# runs still report throughput and huge page coverage.
+#
+# Usage: bench/tlb_benchmark.sh [duration-secs] [connections]
+#
+#  @since 2026-10-19
+#
+
+set -e
+
+DURATION=${1:-10}
+CONNS=${2:-16}
+PORT=${PORT:-18082}
+EVENTS=${EVENTS:-dTLB-loads,dTLB-load-misses,dTLB-store-misses,dtlb_load_misses.walk_active,cycles}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BENCH="$ROOT/bench"
+WORK=$(mktemp -d)
+RESULTS="$BENCH/results"
+SERVER=
+trap 'kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT INT TERM
+
+cc -std=gnu11 -O2 -o "$WORK/http_server" "$ROOT"/src/*.c -lpthread
+cc -std=gnu11 -O2 -o "$WORK/loadgen" "$BENCH/loadgen.c" "$BENCH/http_client.c" "$ROOT/src/histogram.c" -lpthread
+
+# a working set far beyond the reach of a TLB of 4 KB pages
+mkdir -p "$WORK/content/tlb"
+for n in $(seq 0 99); do
+	head -c $((1000000 + n * 997)) /dev/urandom > "$WORK/content/tlb/$n.bin"
+done
+echo "GET /tlb/{n}.bin 0 1" > "$WORK/tlb.txt"
+
+PERF=$(command -v perf || true)
+if [ -z "$PERF" ]; then
+	echo "perf not found: reporting throughput only" >&2
+fi
+
+mkdir -p "$RESULTS"
+out="$RESULTS/tlb.txt"
+echo "# tlb $(date -u +%Y-%m-%dT%H:%M:%SZ) $(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null)" > "$out"
+
+for arena in false true; do
+	cat > "$WORK/tlb.properties" <<EOP
+content_base=$WORK/content
+mime_types=$ROOT/mime.types
+debug=false
+file_cache_size=268435456
+file_cache_max_file=2097152
+file_cache_arena=$arena
+EOP
+	"$WORK/http_server" "$PORT" "$WORK/tlb.properties" > "$WORK/server.log" 2>&1 &
+	SERVER=$!
+	sleep 1
+	echo "== file_cache_arena=$arena"
+	{
+		echo
+		echo "## file_cache_arena=$arena"
+		# load every file into the cache before measuring
+		"$WORK/loadgen" -p "$PORT" -c "$CONNS" -d 2 -k -s "$WORK/tlb.txt" > /dev/null
+		if [ -n "$PERF" ]; then
+			"$PERF" stat -e "$EVENTS" -p "$SERVER" -o "$WORK/perf.txt" -- sleep "$DURATION" &
+			PERFSTAT=$!
+		fi
+		"$WORK/loadgen" -p "$PORT" -c "$CONNS" -d "$DURATION" -k -s "$WORK/tlb.txt"
+		if [ -n "$PERF" ]; then
+			wait $PERFSTAT || true
+			grep -E '[0-9]' "$WORK/perf.txt" | grep -v '^#' || true
+		fi
+		curl -s "http://localhost:$PORT/__stats" | grep -E '^http_cache_arena' || true
+	} >> "$out"
+	kill $SERVER
+	wait $SERVER 2>/dev/null || true
+	SERVER=
+done
+grep -E '^##|^throughput|TLB|dtlb|^http_cache_arena_bytes' "$out"
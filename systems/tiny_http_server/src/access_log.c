@@ -0,0 +1,375 @@
+/*
+ * access_log.c
+ *
+ * Functions for asynchronous access logging.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "access_log.h"
+
+/** maximum number of threads with rings */
+#define MAX_LOG_RINGS 1024
+
+/** size of the writer's output batch */
+#define LOG_BATCH_SIZE 65536
+
+/** writer sleep when all rings are empty */
+#define LOG_IDLE_NS 20000000L
+
+/** One access log record; fixed size so rings are plain arrays */
+typedef struct AccessRecord {
+	uint64_t timeNs;			/** wall-clock time of completion */
+	uint64_t durationNs;		/** processing time */
+	uint64_t bytesIn;			/** bytes received */
+	uint64_t bytesOut;			/** bytes sent */
+	uint8_t addr[16];			/** peer IPv4 or IPv6 address */
+	uint16_t family;			/** AF_INET, AF_INET6 or 0 (e.g. a Unix socket) */
+	uint16_t status;			/** response status */
+	char method[12];			/** request method */
+	char version[12];			/** request protocol version */
+	char uri[180];				/** request URI, truncated */
+} AccessRecord;
+
+/** Ring of one producer thread */
+typedef struct AccessRing {
+	uint64_t head;				/** next slot to write (producer) */
+	char pad1[56];				/** keep head and tail on separate cache lines */
+	uint64_t tail;				/** next slot to read (consumer) */
+	char pad2[56];
+	uint64_t dropped;			/** records dropped when full (producer) */
+	uint32_t mask;				/** capacity - 1 */
+	AccessRecord records[];		/** the records */
+} AccessRing;
+
+/** rings of all threads that logged */
+static AccessRing *logRings[MAX_LOG_RINGS];
+static int nLogRings;
+static pthread_mutex_t logRingsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** ring of the calling thread */
+static __thread AccessRing *myRing;
+
+/** log file descriptor, or -1 if not logging */
+static int logFd = -1;
+
+/** output format */
+static AccessLogFormat logFormat;
+
+/** records per ring */
+static uint32_t logRingSize;
+
+/** passes the writer has completed over the rings */
+static unsigned long writerPasses;
+
+/**
+ * Get the ring of the calling thread, creating it on first use.
+ *
+ * @return the ring, or NULL if none available
+ */
+static AccessRing *getRing(void) {
+	if (myRing == NULL) {
+		AccessRing *ring = calloc(1, sizeof(AccessRing) + logRingSize * sizeof(AccessRecord));
+		if (ring == NULL) {
+			return NULL;
+		}
+		ring->mask = logRingSize - 1;
+		pthread_mutex_lock(&logRingsLock);
+		if (nLogRings < MAX_LOG_RINGS) {
+			__atomic_store_n(&logRings[nLogRings], ring, __ATOMIC_RELEASE);
+			__atomic_store_n(&nLogRings, nLogRings+1, __ATOMIC_RELEASE);
+			myRing = ring;
+		} else {
+			free(ring);
+		}
+		pthread_mutex_unlock(&logRingsLock);
+	}
+	return myRing;
+}
+
+/**
+ * Copy a string into a fixed field, truncating if needed.
+ */
+static void copyField(char *dst, size_t size, const char *src) {
+	size_t len = strlen(src);
+	if (len >= size) {
+		len = size - 1;
+	}
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+/**
+ * Log a completed request. Never blocks: if the calling
+ * thread's ring is full the record is dropped.
+ *
+ * @param sock_fd the client socket (for the peer address)
+ * @param method the request method
+ * @param uri the request URI as sent
+ * @param version the request protocol version
+ * @param status the response status
+ * @param bytesIn bytes received
+ * @param bytesOut bytes sent
+ * @param durationNs time to process the request in nanoseconds
+ */
+void logAccess(int sock_fd, const char *method, const char *uri, const char *version,
+			   int status, unsigned long long bytesIn, unsigned long long bytesOut,
+			   unsigned long long durationNs) {
+	if (logFd < 0) {
+		return;
+	}
+	AccessRing *ring = getRing();
+	if (ring == NULL) {
+		return;
+	}
+
+	uint64_t head = ring->head;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail > ring->mask) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	AccessRecord *rec = &ring->records[head & ring->mask];
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec->timeNs = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+	rec->durationNs = durationNs;
+	rec->bytesIn = bytesIn;
+	rec->bytesOut = bytesOut;
+	rec->status = (uint16_t)status;
+	copyField(rec->method, sizeof(rec->method), method);
+	copyField(rec->version, sizeof(rec->version), version);
+	copyField(rec->uri, sizeof(rec->uri), uri);
+
+	struct sockaddr_storage addr;
+	socklen_t size = sizeof(addr);
+	rec->family = 0;
+	if (getpeername(sock_fd, (struct sockaddr *)&addr, &size) == 0) {
+		if (addr.ss_family == AF_INET) {
+			rec->family = AF_INET;
+			memcpy(rec->addr, &((struct sockaddr_in *)&addr)->sin_addr, 4);
+		} else if (addr.ss_family == AF_INET6) {
+			// a dual-stack listener sees IPv4 clients as mapped addresses
+			const struct in6_addr *in6 = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+			if (IN6_IS_ADDR_V4MAPPED(in6)) {
+				rec->family = AF_INET;
+				memcpy(rec->addr, &in6->s6_addr[12], 4);
+			} else {
+				rec->family = AF_INET6;
+				memcpy(rec->addr, in6, 16);
+			}
+		}
+	}
+
+	// publish the record to the writer
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Append a string to a JSON line with escaping.
+ */
+static size_t jsonEscape(char *out, size_t size, const char *s) {
+	size_t n = 0;
+	for (; *s != '\0' && n + 7 < size; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			out[n++] = '\\';
+			out[n++] = c;
+		} else if (c < 0x20) {
+			n += snprintf(out + n, size - n, "\\u%04x", c);
+		} else {
+			out[n++] = c;
+		}
+	}
+	out[n] = '\0';
+	return n;
+}
+
+/**
+ * Format one record as a line of text.
+ *
+ * @param rec the record
+ * @param line the output buffer
+ * @param size size of the output buffer
+ * @return the length of the line
+ */
+static int formatRecord(const AccessRecord *rec, char *line, size_t size) {
+	char host[INET6_ADDRSTRLEN] = "-";
+	if (rec->family != 0) {
+		inet_ntop(rec->family, rec->addr, host, sizeof(host));
+	}
+	time_t secs = (time_t)(rec->timeNs / 1000000000ULL);
+	struct tm tm;
+	gmtime_r(&secs, &tm);
+
+	if (logFormat == ACCESS_LOG_JSON) {
+		char when[32];
+		strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+		char method[2*sizeof(rec->method)], uri[2*sizeof(rec->uri)], version[2*sizeof(rec->version)];
+		jsonEscape(method, sizeof(method), rec->method);
+		jsonEscape(uri, sizeof(uri), rec->uri);
+		jsonEscape(version, sizeof(version), rec->version);
+		return snprintf(line, size,
+			"{\"time\": \"%s.%03uZ\", \"remote\": \"%s\", \"method\": \"%s\", "
+			"\"uri\": \"%s\", \"protocol\": \"%s\", \"status\": %u, "
+			"\"bytes_in\": %llu, \"bytes_out\": %llu, \"duration_us\": %llu}\n",
+			when, (unsigned)((rec->timeNs / 1000000ULL) % 1000), host, method, uri, version,
+			rec->status, (unsigned long long)rec->bytesIn,
+			(unsigned long long)rec->bytesOut, (unsigned long long)(rec->durationNs / 1000));
+	}
+
+	// host ident authuser [date] "request" status bytes
+	char when[40];
+	strftime(when, sizeof(when), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+	return snprintf(line, size, "%s - - [%s] \"%s %s %s\" %u %llu\n",
+					host, when, rec->method, rec->uri, rec->version,
+					rec->status, (unsigned long long)rec->bytesOut);
+}
+
+/**
+ * Write a batch to the log, retrying partial writes.
+ */
+static void writeBatch(const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(logFd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/**
+ * Background writer: drains all rings, formats records into
+ * a batch buffer and writes it with one system call.
+ */
+static void *accessLogWriter(void *arg) {
+	(void)arg;
+	char *batch = malloc(LOG_BATCH_SIZE);
+	if (batch == NULL) {
+		return NULL;
+	}
+	while (true) {
+		size_t len = 0;
+		int n = __atomic_load_n(&nLogRings, __ATOMIC_ACQUIRE);
+		for (int i = 0; i < n; i++) {
+			AccessRing *ring = __atomic_load_n(&logRings[i], __ATOMIC_ACQUIRE);
+			uint64_t tail = ring->tail;
+			uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			while (tail != head) {
+				if (LOG_BATCH_SIZE - len < 1024) {
+					writeBatch(batch, len);
+					len = 0;
+				}
+				int linelen = formatRecord(&ring->records[tail & ring->mask], batch + len, LOG_BATCH_SIZE - len);
+				if (linelen > 0) {
+					len += ((size_t)linelen < LOG_BATCH_SIZE - len) ? (size_t)linelen : LOG_BATCH_SIZE - len - 1;
+				}
+				tail++;
+				// release the slot to the producer
+				__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+			}
+		}
+		bool idle = (len == 0);
+		if (!idle) {
+			writeBatch(batch, len);
+		}
+		__atomic_add_fetch(&writerPasses, 1, __ATOMIC_RELEASE);
+		if (idle) {
+			struct timespec interval = { 0, LOG_IDLE_NS };
+			nanosleep(&interval, NULL);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Open the access log and start the background writer.
+ *
+ * @param path the log file, or "-" for stderr
+ * @param format the output format
+ * @param ringSize records per thread ring (rounded up to a power of 2)
+ * @return true if the log was opened
+ */
+bool openAccessLog(const char *path, AccessLogFormat format, int ringSize) {
+	int fd = (strcmp(path, "-") == 0)
+		? STDERR_FILENO : open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	logRingSize = 16;
+	while (logRingSize < (uint32_t)ringSize && logRingSize < (1u << 20)) {
+		logRingSize <<= 1;
+	}
+	logFormat = format;
+	logFd = fd;
+
+	pthread_t writer;
+	if (pthread_create(&writer, NULL, accessLogWriter, NULL) != 0) {
+		logFd = -1;
+		if (fd != STDERR_FILENO) {
+			close(fd);
+		}
+		return false;
+	}
+	pthread_detach(writer);
+	return true;
+}
+
+/**
+ * Return whether the access log is open.
+ *
+ * @return true if logging
+ */
+bool accessLogEnabled(void) {
+	return logFd >= 0;
+}
+
+/**
+ * Return the number of records dropped because a ring was full.
+ *
+ * @return the number of dropped records
+ */
+unsigned long long accessLogDropped(void) {
+	unsigned long long dropped = 0;
+	int n = __atomic_load_n(&nLogRings, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < n; i++) {
+		AccessRing *ring = __atomic_load_n(&logRings[i], __ATOMIC_ACQUIRE);
+		dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	}
+	return dropped;
+}
+
+/**
+ * Wait until the records logged so far are written, such as
+ * before the server exits. Waits at most a second.
+ */
+void flushAccessLog(void) {
+	if (logFd < 0) {
+		return;
+	}
+	// a pass that starts after this one has seen every record
+	unsigned long pass = __atomic_load_n(&writerPasses, __ATOMIC_ACQUIRE);
+	struct timespec interval = { 0, LOG_IDLE_NS / 4 };
+	for (int i = 0; (i < 200) && (__atomic_load_n(&writerPasses, __ATOMIC_ACQUIRE) < pass + 2); i++) {
+		nanosleep(&interval, NULL);
+	}
+}
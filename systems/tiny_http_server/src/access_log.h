@@ -0,0 +1,73 @@
+/*
+ * access_log.h
+ *
+ * Functions for asynchronous access logging.
+ *
+ * Each request thread writes fixed-size binary records into its own
+ * single-producer/single-consumer ring. A background thread drains
+ * the rings, formats the records and writes them in batches, so
+ * request threads never format text or contend on a stdio lock.
+ * When a ring is full the record is dropped and counted.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef ACCESS_LOG_H_
+#define ACCESS_LOG_H_
+
+#include <stdbool.h>
+
+/** Access log output formats */
+typedef enum AccessLogFormat {
+	ACCESS_LOG_COMMON,	/** NCSA Common Log Format */
+	ACCESS_LOG_JSON		/** one JSON object per line */
+} AccessLogFormat;
+
+/**
+ * Open the access log and start the background writer.
+ *
+ * @param path the log file, or "-" for stderr
+ * @param format the output format
+ * @param ringSize records per thread ring (rounded up to a power of 2)
+ * @return true if the log was opened
+ */
+bool openAccessLog(const char *path, AccessLogFormat format, int ringSize);
+
+/**
+ * Log a completed request. Never blocks: if the calling
+ * thread's ring is full the record is dropped.
+ *
+ * @param sock_fd the client socket (for the peer address)
+ * @param method the request method
+ * @param uri the request URI as sent
+ * @param version the request protocol version
+ * @param status the response status
+ * @param bytesIn bytes received
+ * @param bytesOut bytes sent
+ * @param durationNs time to process the request in nanoseconds
+ */
+void logAccess(int sock_fd, const char *method, const char *uri, const char *version,
+			   int status, unsigned long long bytesIn, unsigned long long bytesOut,
+			   unsigned long long durationNs);
+
+/**
+ * Return whether the access log is open.
+ *
+ * @return true if logging
+ */
+bool accessLogEnabled(void);
+
+/**
+ * Return the number of records dropped because a ring was full.
+ *
+ * @return the number of dropped records
+ */
+unsigned long long accessLogDropped(void);
+
+/**
+ * Wait until the records logged so far are written, such as
+ * before the server exits. Waits at most a second.
+ */
+void flushAccessLog(void);
+
+#endif /* ACCESS_LOG_H_ */
@@ -0,0 +1,120 @@
+/*
+ * buffer_pool.c
+ *
+ * Pool of I/O buffers shared by all connections.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "buffer_pool.h"
+#include "thpool.h"
+
+/** A buffer kept for reuse, linked through its first bytes */
+typedef struct IdleBuffer {
+	struct IdleBuffer *next;
+} IdleBuffer;
+
+/** guards the pool */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** buffers kept for reuse */
+static IdleBuffer *idleBuffers;
+static size_t nIdle;
+
+/** most buffers kept for reuse */
+static size_t maxIdleBuffers = 64;
+
+/** buffers borrowed and kept by workers, counted atomically */
+static size_t nBorrowed, nKept;
+
+/**
+ * Initialize the pool.
+ *
+ * @param maxIdle the most returned buffers kept for reuse
+ * @return true if successful
+ */
+bool initBufferPool(size_t maxIdle) {
+	pthread_mutex_lock(&poolLock);
+	maxIdleBuffers = maxIdle;
+	pthread_mutex_unlock(&poolLock);
+	return true;
+}
+
+/**
+ * Borrow a buffer of POOL_BUFFER_SIZE bytes.
+ *
+ * @return the buffer, or NULL if out of memory
+ */
+char *borrowBuffer(void) {
+	WorkerBuffers *kept = thpool_thread_local();
+	if ((kept != NULL) && (kept->count > 0)) {
+		__atomic_sub_fetch(&nKept, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&nBorrowed, 1, __ATOMIC_RELAXED);
+		return kept->buffers[--kept->count];
+	}
+
+	pthread_mutex_lock(&poolLock);
+	IdleBuffer *buf = idleBuffers;
+	if (buf != NULL) {
+		idleBuffers = buf->next;
+		nIdle--;
+	}
+	pthread_mutex_unlock(&poolLock);
+
+	if (buf == NULL) {
+		// on a worker, from the memory of its node
+		buf = malloc(POOL_BUFFER_SIZE);
+		if (buf == NULL) {
+			return NULL;
+		}
+	}
+	__atomic_add_fetch(&nBorrowed, 1, __ATOMIC_RELAXED);
+	return (char *)buf;
+}
+
+/**
+ * Return a borrowed buffer.
+ *
+ * @param buf the buffer from borrowBuffer()
+ */
+void returnBuffer(char *buf) {
+	if (buf == NULL) {
+		return;
+	}
+	__atomic_sub_fetch(&nBorrowed, 1, __ATOMIC_RELAXED);
+	WorkerBuffers *kept = thpool_thread_local();
+	if ((kept != NULL) && (kept->count < WORKER_BUFFERS)) {
+		kept->buffers[kept->count++] = buf;
+		__atomic_add_fetch(&nKept, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	IdleBuffer *idle = (IdleBuffer *)buf;
+	pthread_mutex_lock(&poolLock);
+	if (nIdle < maxIdleBuffers) {
+		idle->next = idleBuffers;
+		idleBuffers = idle;
+		nIdle++;
+		idle = NULL;
+	}
+	pthread_mutex_unlock(&poolLock);
+	free(idle);
+}
+
+/**
+ * Get the usage of the pool.
+ *
+ * @param borrowed the number of buffers borrowed
+ * @param idle the number of buffers kept for reuse, by the pool
+ *  and by workers
+ */
+void bufferPoolUsage(size_t *borrowed, size_t *idle) {
+	pthread_mutex_lock(&poolLock);
+	*idle = nIdle;
+	pthread_mutex_unlock(&poolLock);
+	*borrowed = __atomic_load_n(&nBorrowed, __ATOMIC_RELAXED);
+	*idle += __atomic_load_n(&nKept, __ATOMIC_RELAXED);
+}
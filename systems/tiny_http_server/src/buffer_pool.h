@@ -0,0 +1,69 @@
+/*
+ * buffer_pool.h
+ *
+ * Pool of I/O buffers shared by all connections.
+ *
+ * A connection borrows a buffer only while a request is in flight
+ * and returns it before going idle, so idle connections hold no
+ * buffer memory. Returned buffers are kept for reuse up to a limit;
+ * beyond it they are freed.
+ *
+ * A pool worker created with WorkerBuffers as its per-worker state
+ * (see thpool_init_affinity()) first keeps up to WORKER_BUFFERS of
+ * the buffers it returns for itself. They were allocated and first
+ * touched by the pinned worker, so they stay in the memory of its
+ * NUMA node, and the worker borrows them back without the pool lock.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** size of a pooled buffer */
+#define POOL_BUFFER_SIZE 8192
+
+/** most buffers a worker keeps for itself */
+#define WORKER_BUFFERS 4
+
+/** The buffers a worker keeps for itself; its per-worker state */
+typedef struct WorkerBuffers {
+	char *buffers[WORKER_BUFFERS];		/** the buffers kept */
+	size_t count;						/** number of buffers kept */
+} WorkerBuffers;
+
+/**
+ * Initialize the pool.
+ *
+ * @param maxIdle the most returned buffers kept for reuse
+ * @return true if successful
+ */
+bool initBufferPool(size_t maxIdle);
+
+/**
+ * Borrow a buffer of POOL_BUFFER_SIZE bytes.
+ *
+ * @return the buffer, or NULL if out of memory
+ */
+char *borrowBuffer(void);
+
+/**
+ * Return a borrowed buffer.
+ *
+ * @param buf the buffer from borrowBuffer()
+ */
+void returnBuffer(char *buf);
+
+/**
+ * Get the usage of the pool.
+ *
+ * @param borrowed the number of buffers borrowed
+ * @param idle the number of buffers kept for reuse, by the pool
+ *  and by workers
+ */
+void bufferPoolUsage(size_t *borrowed, size_t *idle);
+
+#endif /* BUFFER_POOL_H_ */
@@ -0,0 +1,498 @@
+/*
+ * cache_arena.c
+ *
+ * Huge-page backed arena for the contents of cached files.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "cache_arena.h"
+
+/** page table mark of a page in no run */
+#define ARENA_FREE UINT32_MAX
+
+/** class of a run holding one large allocation */
+#define ARENA_LARGE UINT32_MAX
+
+/** most pages in the run of a size class */
+#define MAX_RUN_PAGES 16
+
+/** room for the size classes, four per power of 2 */
+#define MAX_CLASSES 80
+
+/** A free slot, linked through its first bytes */
+typedef struct FreeSlot {
+	struct FreeSlot *next;
+} FreeSlot;
+
+/** A run of pages, kept by its first page */
+typedef struct ArenaRun {
+	struct ArenaRun *next, *prev;	/** links in the list of runs with free slots */
+	FreeSlot *free;					/** slots freed */
+	uint32_t pages;					/** pages in the run */
+	uint32_t cls;					/** size class, or ARENA_LARGE */
+	uint32_t carved;				/** slots ever allocated */
+	uint32_t used;					/** slots allocated */
+	uint32_t capacity;				/** slots in the run */
+} ArenaRun;
+
+/** A size class */
+typedef struct SizeClass {
+	size_t size;			/** bytes of a slot */
+	uint32_t pages;			/** pages in a run */
+	uint32_t slots;			/** slots in a run */
+	ArenaRun *partial;		/** runs with free slots */
+} SizeClass;
+
+/** the arena, or NULL if disabled */
+static char *arenaBase;
+
+/** number of pages and bytes of the arena */
+static size_t arenaPages, arenaBytes;
+
+/** true if mapped from the hugetlbfs pool */
+static bool arenaHugetlb;
+
+/** guards the arena */
+static pthread_mutex_t arenaLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** the first page of the run of each page, or ARENA_FREE */
+static uint32_t *pageRuns;
+
+/** the runs, by first page */
+static ArenaRun *arenaRuns;
+
+/** the size classes, smallest first */
+static SizeClass sizeClasses[MAX_CLASSES];
+static int nSizeClasses;
+
+/** usage counts */
+static size_t pagesInUse, bytesAllocated, bytesRequested;
+static unsigned long fallbacks;
+
+/**
+ * Choose the number of pages in a run of a slot size: the fewest
+ * that leave less than 1/8 of the run unused, or else the fewest
+ * that leave the smallest share unused.
+ *
+ * @param size the slot size
+ * @return the number of pages
+ */
+static uint32_t runPages(size_t size) {
+	uint32_t minPages = (uint32_t)((size + ARENA_PAGE_SIZE - 1) / ARENA_PAGE_SIZE);
+	uint32_t best = minPages;
+	size_t bestWaste = SIZE_MAX, bestBytes = 1;
+	for (uint32_t n = minPages; n <= MAX_RUN_PAGES; n++) {
+		size_t bytes = (size_t)n * ARENA_PAGE_SIZE;
+		size_t waste = bytes % size;
+		if (waste * 8 <= bytes) {
+			return n;
+		}
+		if ((bestWaste == SIZE_MAX) || (waste * bestBytes < bestWaste * bytes)) {
+			best = n;
+			bestWaste = waste;
+			bestBytes = bytes;
+		}
+	}
+	return best;
+}
+
+/**
+ * Build the size classes: four per power of 2, 25% apart.
+ */
+static void initSizeClasses(void) {
+	nSizeClasses = 0;
+	for (size_t base = ARENA_MIN_SLOT; base <= ARENA_MAX_SLOT; base *= 2) {
+		for (size_t step = 0; step < 4; step++) {
+			size_t size = base + step * (base / 4);
+			if (size > ARENA_MAX_SLOT) {
+				break;
+			}
+			SizeClass *sc = &sizeClasses[nSizeClasses++];
+			sc->size = size;
+			sc->pages = runPages(size);
+			sc->slots = (uint32_t)((size_t)sc->pages * ARENA_PAGE_SIZE / size);
+			sc->partial = NULL;
+		}
+	}
+}
+
+/**
+ * Find the smallest size class of an allocation.
+ *
+ * @param size the number of bytes
+ * @return the class, or -1 if larger than the largest
+ */
+static int classOf(size_t size) {
+	int low = 0, high = nSizeClasses;
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		if (sizeClasses[mid].size < size) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return (low < nSizeClasses) ? low : -1;
+}
+
+/**
+ * Get the memory of a run.
+ */
+static char *runBase(const ArenaRun *run) {
+	return arenaBase + (size_t)(run - arenaRuns) * ARENA_PAGE_SIZE;
+}
+
+/**
+ * Link a run at the head of the runs of its class with free slots.
+ */
+static void pushPartial(SizeClass *sc, ArenaRun *run) {
+	run->prev = NULL;
+	run->next = sc->partial;
+	if (sc->partial != NULL) {
+		sc->partial->prev = run;
+	}
+	sc->partial = run;
+}
+
+/**
+ * Unlink a run from the runs of its class with free slots.
+ */
+static void unlinkPartial(SizeClass *sc, ArenaRun *run) {
+	if (run->prev != NULL) {
+		run->prev->next = run->next;
+	} else {
+		sc->partial = run->next;
+	}
+	if (run->next != NULL) {
+		run->next->prev = run->prev;
+	}
+	run->next = run->prev = NULL;
+}
+
+/**
+ * Take the first free pages that fit a run. The caller holds the lock.
+ *
+ * @param pages the number of pages
+ * @param cls the size class of the run, or ARENA_LARGE
+ * @return the run, or NULL if the arena has no room
+ */
+static ArenaRun *newRun(uint32_t pages, uint32_t cls) {
+	if (pagesInUse + pages > arenaPages) {
+		return NULL;
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < arenaPages; i++) {
+		if (pageRuns[i] != ARENA_FREE) {
+			count = 0;
+		} else if (++count == pages) {
+			size_t first = i + 1 - pages;
+			for (size_t p = first; p <= i; p++) {
+				pageRuns[p] = (uint32_t)first;
+			}
+			ArenaRun *run = &arenaRuns[first];
+			memset(run, 0, sizeof(ArenaRun));
+			run->pages = pages;
+			run->cls = cls;
+			pagesInUse += pages;
+			return run;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Return the pages of a run to the arena, and their memory to the
+ * kernel. The caller holds the lock, so no other run takes the
+ * pages before they are released.
+ */
+static void releaseRun(ArenaRun *run) {
+	size_t first = (size_t)(run - arenaRuns);
+	madvise(runBase(run), (size_t)run->pages * ARENA_PAGE_SIZE, MADV_DONTNEED);
+	for (size_t p = first; p < first + run->pages; p++) {
+		pageRuns[p] = ARENA_FREE;
+	}
+	pagesInUse -= run->pages;
+	run->pages = 0;
+}
+
+/**
+ * Allocate a slot from the arena. The caller holds the lock.
+ *
+ * @param size the number of bytes
+ * @param slotSize the bytes of the slot
+ * @return the slot, or NULL if the arena has no room
+ */
+static void *allocSlot(size_t size, size_t *slotSize) {
+	int c = classOf(size);
+	if (c < 0) {
+		uint32_t pages = (uint32_t)((size + ARENA_PAGE_SIZE - 1) / ARENA_PAGE_SIZE);
+		ArenaRun *run = newRun(pages, ARENA_LARGE);
+		if (run == NULL) {
+			return NULL;
+		}
+		run->capacity = run->used = 1;
+		*slotSize = (size_t)pages * ARENA_PAGE_SIZE;
+		return runBase(run);
+	}
+
+	SizeClass *sc = &sizeClasses[c];
+	ArenaRun *run = sc->partial;
+	if (run == NULL) {
+		run = newRun(sc->pages, (uint32_t)c);
+		if (run == NULL) {
+			return NULL;
+		}
+		run->capacity = sc->slots;
+		pushPartial(sc, run);
+	}
+	void *slot;
+	if (run->free != NULL) {
+		slot = run->free;
+		run->free = run->free->next;
+	} else {
+		slot = runBase(run) + (size_t)run->carved++ * sc->size;
+	}
+	if (++run->used == run->capacity) {
+		unlinkPartial(sc, run);
+	}
+	*slotSize = sc->size;
+	return slot;
+}
+
+/**
+ * Free a slot of the arena. The caller holds the lock.
+ *
+ * @param p the slot
+ * @return the bytes of the slot
+ */
+static size_t freeSlot(void *p) {
+	size_t page = (size_t)((char *)p - arenaBase) / ARENA_PAGE_SIZE;
+	ArenaRun *run = &arenaRuns[pageRuns[page]];
+	if (run->cls == ARENA_LARGE) {
+		size_t bytes = (size_t)run->pages * ARENA_PAGE_SIZE;
+		releaseRun(run);
+		return bytes;
+	}
+
+	SizeClass *sc = &sizeClasses[run->cls];
+	FreeSlot *slot = p;
+	slot->next = run->free;
+	run->free = slot;
+	if (run->used-- == run->capacity) {
+		pushPartial(sc, run);
+	}
+	if (run->used == 0) {
+		unlinkPartial(sc, run);
+		releaseRun(run);
+	}
+	return sc->size;
+}
+
+/**
+ * Allocate memory from the arena, or with malloc if the arena
+ * is disabled or full.
+ *
+ * @param size the number of bytes
+ * @return the memory, or NULL if out of memory
+ */
+void *cacheArenaAlloc(size_t size) {
+	if ((arenaBase != NULL) && (size > 0)) {
+		pthread_mutex_lock(&arenaLock);
+		size_t slotSize;
+		void *p = allocSlot(size, &slotSize);
+		if (p != NULL) {
+			bytesAllocated += slotSize;
+			bytesRequested += size;
+		} else {
+			fallbacks++;
+		}
+		pthread_mutex_unlock(&arenaLock);
+		if (p != NULL) {
+			return p;
+		}
+	}
+	return malloc(size);
+}
+
+/**
+ * Release memory from cacheArenaAlloc().
+ *
+ * @param p the memory, or NULL
+ * @param size the number of bytes allocated
+ */
+void cacheArenaFree(void *p, size_t size) {
+	if ((arenaBase == NULL) || ((char *)p < arenaBase) || ((char *)p >= arenaBase + arenaBytes)) {
+		free(p);
+		return;
+	}
+	pthread_mutex_lock(&arenaLock);
+	bytesAllocated -= freeSlot(p);
+	bytesRequested -= size;
+	pthread_mutex_unlock(&arenaLock);
+}
+
+/**
+ * Sum the resident and huge page bytes of the arena mapping
+ * from /proc/self/smaps.
+ *
+ * @param resident the resident bytes
+ * @param huge the bytes in huge pages
+ */
+static void readArenaSmaps(size_t *resident, size_t *huge) {
+	*resident = *huge = 0;
+	FILE *in = fopen("/proc/self/smaps", "r");
+	if (in == NULL) {
+		return;
+	}
+	uintptr_t arenaStart = (uintptr_t)arenaBase, arenaEnd = arenaStart + arenaBytes;
+	bool inArena = false;
+	char line[256];
+	while (fgets(line, sizeof(line), in) != NULL) {
+		unsigned long start, end;
+		size_t kb;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			// a mapping; its fields follow
+			inArena = (start < arenaEnd) && (end > arenaStart);
+		} else if (!inArena) {
+			continue;
+		} else if (sscanf(line, "Rss: %zu kB", &kb) == 1) {
+			*resident += kb * 1024;
+		} else if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+			*huge += kb * 1024;
+		} else if ((sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1)
+				   || (sscanf(line, "Shared_Hugetlb: %zu kB", &kb) == 1)) {
+			// hugetlbfs pages are not counted in Rss
+			*resident += kb * 1024;
+			*huge += kb * 1024;
+		}
+	}
+	fclose(in);
+}
+
+/**
+ * Get the usage of the arena. Its residency and huge page coverage
+ * come from /proc/self/smaps.
+ *
+ * @param usage the usage
+ */
+void cacheArenaUsage(ArenaUsage *usage) {
+	memset(usage, 0, sizeof(ArenaUsage));
+	if (arenaBase == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&arenaLock);
+	usage->reserved = arenaBytes;
+	usage->pages = pagesInUse * ARENA_PAGE_SIZE;
+	usage->allocated = bytesAllocated;
+	usage->requested = bytesRequested;
+	usage->fallbacks = fallbacks;
+	pthread_mutex_unlock(&arenaLock);
+	usage->hugetlb = arenaHugetlb;
+	readArenaSmaps(&usage->resident, &usage->huge);
+}
+
+/**
+ * Determine whether the arena is enabled.
+ *
+ * @return true if enabled
+ */
+bool cacheArenaEnabled(void) {
+	return arenaBase != NULL;
+}
+
+/**
+ * Reserve an arena of transparent huge pages: map a page more than
+ * needed, trim the ends to align it to a huge page, and advise it.
+ *
+ * @param bytes the size of the arena
+ * @return the arena, or NULL if error
+ */
+static char *mapTransparentArena(size_t bytes) {
+	char *raw = mmap(NULL, bytes + ARENA_PAGE_SIZE, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (raw == MAP_FAILED) {
+		return NULL;
+	}
+	char *base = (char *)(((uintptr_t)raw + ARENA_PAGE_SIZE - 1) & ~(uintptr_t)(ARENA_PAGE_SIZE - 1));
+	size_t head = (size_t)(base - raw), tail = ARENA_PAGE_SIZE - head;
+	if (head > 0) {
+		munmap(raw, head);
+	}
+	if (tail > 0) {
+		munmap(base + bytes, tail);
+	}
+	if (madvise(base, bytes, MADV_HUGEPAGE) != 0) {
+		// still an arena, of small pages
+		perror("initCacheArena: MADV_HUGEPAGE");
+	}
+	return base;
+}
+
+/**
+ * Initialize the arena.
+ *
+ * @param size bytes of address space to reserve, rounded up to
+ *  arena pages; 0 disables the arena
+ * @param hugetlb true to map the arena from the hugetlbfs pool,
+ *  falling back to transparent huge pages if the pool is too small
+ * @return true if successful
+ */
+bool initCacheArena(size_t size, bool hugetlb) {
+	if (size == 0) {
+		return true;
+	}
+	size_t pages = (size + ARENA_PAGE_SIZE - 1) / ARENA_PAGE_SIZE;
+	if (pages >= ARENA_FREE) {
+		errno = EINVAL;
+		return false;
+	}
+	size_t bytes = pages * ARENA_PAGE_SIZE;
+	pageRuns = malloc(pages * sizeof(uint32_t));
+	arenaRuns = calloc(pages, sizeof(ArenaRun));
+	if ((pageRuns == NULL) || (arenaRuns == NULL)) {
+		free(pageRuns);
+		free(arenaRuns);
+		errno = ENOMEM;
+		return false;
+	}
+	for (size_t p = 0; p < pages; p++) {
+		pageRuns[p] = ARENA_FREE;
+	}
+
+	char *base = NULL;
+	if (hugetlb) {
+		// reserved from the pool up front, so no fault finds it empty
+		base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base == MAP_FAILED) {
+			perror("initCacheArena: MAP_HUGETLB");
+			base = NULL;
+		} else {
+			arenaHugetlb = true;
+		}
+	}
+	if (base == NULL) {
+		base = mapTransparentArena(bytes);
+	}
+	if (base == NULL) {
+		free(pageRuns);
+		free(arenaRuns);
+		return false;
+	}
+	initSizeClasses();
+	arenaPages = pages;
+	arenaBytes = bytes;
+	arenaBase = base;
+	return true;
+}
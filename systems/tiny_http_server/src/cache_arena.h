@@ -0,0 +1,93 @@
+/*
+ * cache_arena.h
+ *
+ * Huge-page backed arena for the contents of cached files.
+ *
+ * The arena reserves one region of address space, aligned to huge
+ * pages, and asks the kernel to back it with transparent huge pages
+ * (MADV_HUGEPAGE), or maps it from the hugetlbfs pool. A cache of
+ * many megabytes of contents then takes a TLB entry per 2 MB instead
+ * of per 4 KB, so copying bodies to sockets misses the TLB far less.
+ *
+ * Allocations are rounded up to one of four size classes per power
+ * of 2, from ARENA_MIN_SLOT to ARENA_MAX_SLOT bytes. Each class carves
+ * its slots from runs of whole arena pages, as many pages as keep the
+ * slack at the end of a run under 1/8 of it; larger allocations take
+ * a run of their own. A run whose slots are all free goes back to the
+ * arena, and its pages back to the kernel. An allocation the arena
+ * cannot hold comes from malloc instead.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CACHE_ARENA_H_
+#define CACHE_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** size of an arena page: a huge page on x86-64 and arm64 */
+#define ARENA_PAGE_SIZE (2*1024*1024)
+
+/** smallest size class */
+#define ARENA_MIN_SLOT 64
+
+/** largest size class; larger allocations take whole pages */
+#define ARENA_MAX_SLOT (8*1024*1024)
+
+/** Usage of the arena */
+typedef struct ArenaUsage {
+	size_t reserved;		/** bytes of address space reserved */
+	size_t pages;			/** bytes of the pages in runs */
+	size_t allocated;		/** bytes of the slots allocated */
+	size_t requested;		/** bytes requested by the allocations */
+	size_t resident;		/** bytes of the arena in memory */
+	size_t huge;			/** bytes of the arena in huge pages */
+	unsigned long fallbacks;	/** allocations that came from malloc */
+	bool hugetlb;			/** mapped from the hugetlbfs pool */
+} ArenaUsage;
+
+/**
+ * Initialize the arena.
+ *
+ * @param size bytes of address space to reserve, rounded up to
+ *  arena pages; 0 disables the arena
+ * @param hugetlb true to map the arena from the hugetlbfs pool,
+ *  falling back to transparent huge pages if the pool is too small
+ * @return true if successful
+ */
+bool initCacheArena(size_t size, bool hugetlb);
+
+/**
+ * Determine whether the arena is enabled.
+ *
+ * @return true if enabled
+ */
+bool cacheArenaEnabled(void);
+
+/**
+ * Allocate memory from the arena, or with malloc if the arena
+ * is disabled or full.
+ *
+ * @param size the number of bytes
+ * @return the memory, or NULL if out of memory
+ */
+void *cacheArenaAlloc(size_t size);
+
+/**
+ * Release memory from cacheArenaAlloc().
+ *
+ * @param p the memory, or NULL
+ * @param size the number of bytes allocated
+ */
+void cacheArenaFree(void *p, size_t size);
+
+/**
+ * Get the usage of the arena. Its residency and huge page coverage
+ * come from /proc/self/smaps.
+ *
+ * @param usage the usage
+ */
+void cacheArenaUsage(ArenaUsage *usage);
+
+#endif /* CACHE_ARENA_H_ */
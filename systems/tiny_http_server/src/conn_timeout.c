@@ -0,0 +1,163 @@
+/*
+ * conn_timeout.c
+ *
+ * Deadlines for client connections.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "conn_timeout.h"
+
+/** the wheel, or NULL if no deadlines are enforced */
+static TimerWheel *connWheel;
+
+/** timeout of each phase in milliseconds; 0 for none */
+static unsigned long connTimeoutMs[TIMEOUT_KINDS];
+
+/** names of the phases */
+static const char *timeoutNames[TIMEOUT_KINDS] = { "none", "header", "body", "idle", "write" };
+
+/**
+ * Shut down the socket of a connection whose deadline passed.
+ * Runs on the wheel thread with the wheel locked, so the owner
+ * cannot close the socket concurrently.
+ */
+static void connTimeoutExpire(WheelTimer *timer) {
+	ConnTimeout *ct = (ConnTimeout *)timer;
+	TimeoutKind kind = __atomic_load_n(&ct->kind, __ATOMIC_RELAXED);
+	__atomic_store_n(&ct->expired, kind, __ATOMIC_RELEASE);
+	shutdown(ct->sock_fd, (kind == TIMEOUT_HEADER) ? SHUT_RD : SHUT_RDWR);
+}
+
+/**
+ * Set the deadline of each phase and start the timer wheel.
+ * A timeout of 0 disables the deadline of its phase.
+ *
+ * @param tickMs the timer resolution in milliseconds
+ * @param headerMs time allowed to read the request line and headers
+ * @param bodyMs time allowed between reads of the request body
+ * @param idleMs time a kept-alive connection may wait for a request
+ * @param writeMs time allowed between writes of the response
+ * @return true if successful
+ */
+bool initConnTimeouts(unsigned tickMs, unsigned long headerMs, unsigned long bodyMs,
+					  unsigned long idleMs, unsigned long writeMs) {
+	connTimeoutMs[TIMEOUT_HEADER] = headerMs;
+	connTimeoutMs[TIMEOUT_BODY] = bodyMs;
+	connTimeoutMs[TIMEOUT_IDLE] = idleMs;
+	connTimeoutMs[TIMEOUT_WRITE] = writeMs;
+	if ((headerMs | bodyMs | idleMs | writeMs) == 0) {
+		return true;
+	}
+	connWheel = newTimerWheel(tickMs);
+	return connWheel != NULL;
+}
+
+/**
+ * Initialize the deadline of a connection; nothing is armed.
+ *
+ * @param ct the deadline
+ * @param sock_fd the socket of the connection
+ */
+void initConnTimeout(ConnTimeout *ct, int sock_fd) {
+	initWheelTimer(&ct->timer, connTimeoutExpire);
+	ct->sock_fd = sock_fd;
+	ct->kind = TIMEOUT_NONE;
+	ct->expired = TIMEOUT_NONE;
+	ct->armedTick = 0;
+}
+
+/**
+ * Arm the deadline for a phase, replacing any other.
+ *
+ * @param ct the deadline
+ * @param kind the phase
+ */
+void armConnTimeout(ConnTimeout *ct, TimeoutKind kind) {
+	if (connWheel == NULL) {
+		return;
+	}
+	if (connTimeoutMs[kind] == 0) {
+		cancelConnTimeout(ct);
+		return;
+	}
+	// re-arming within the same tick would not move the deadline
+	uint64_t tick = wheelExpiry(connWheel, connTimeoutMs[kind]);
+	if ((ct->kind == kind) && (ct->armedTick == tick)) {
+		return;
+	}
+	__atomic_store_n(&ct->kind, kind, __ATOMIC_RELAXED);
+	ct->armedTick = tick;
+	armWheelTimer(connWheel, &ct->timer, connTimeoutMs[kind]);
+}
+
+/**
+ * Cancel the deadline. Must be called before the socket is closed.
+ *
+ * @param ct the deadline
+ */
+void cancelConnTimeout(ConnTimeout *ct) {
+	if (connWheel != NULL) {
+		cancelWheelTimer(connWheel, &ct->timer);
+	}
+	__atomic_store_n(&ct->kind, TIMEOUT_NONE, __ATOMIC_RELAXED);
+	ct->armedTick = 0;
+}
+
+/**
+ * Note that bytes were read from the connection: re-arms a
+ * body-read deadline and ends an idle deadline.
+ *
+ * @param ct the deadline
+ */
+void connReadProgress(ConnTimeout *ct) {
+	if (ct->kind == TIMEOUT_BODY) {
+		armConnTimeout(ct, TIMEOUT_BODY);
+	} else if (ct->kind == TIMEOUT_IDLE) {
+		armConnTimeout(ct, TIMEOUT_HEADER);
+	}
+}
+
+/**
+ * Note that the connection is about to send, or has sent, bytes:
+ * arms or re-arms the write-stall deadline.
+ *
+ * @param ct the deadline
+ */
+void connWriteProgress(ConnTimeout *ct) {
+	armConnTimeout(ct, TIMEOUT_WRITE);
+}
+
+/**
+ * Return the phase that timed out.
+ *
+ * @param ct the deadline
+ * @return the phase, or TIMEOUT_NONE
+ */
+TimeoutKind connTimeoutExpired(const ConnTimeout *ct) {
+	return __atomic_load_n(&ct->expired, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Return the timeout of a phase.
+ *
+ * @param kind the phase
+ * @return the timeout in milliseconds, or 0 if none
+ */
+unsigned long connTimeoutLimit(TimeoutKind kind) {
+	return ((kind > TIMEOUT_NONE) && (kind < TIMEOUT_KINDS)) ? connTimeoutMs[kind] : 0;
+}
+
+/**
+ * Return the name of a phase for reporting.
+ *
+ * @param kind the phase
+ * @return the name
+ */
+const char *timeoutKindName(TimeoutKind kind) {
+	return ((kind >= 0) && (kind < TIMEOUT_KINDS)) ? timeoutNames[kind] : "unknown";
+}
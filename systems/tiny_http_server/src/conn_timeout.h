@@ -0,0 +1,122 @@
+/*
+ * conn_timeout.h
+ *
+ * Deadlines for client connections.
+ *
+ * Every connection carries one deadline on a shared timer wheel.
+ * The request path arms it for the phase the connection is in;
+ * socket streams re-arm body-read and write-stall deadlines as
+ * bytes move, so a slow but progressing transfer is not cut off.
+ * When a deadline passes, the connection's socket is shut down,
+ * which wakes the worker blocked on it: a header-read timeout
+ * shuts down only the read side so the worker can still send
+ * 408 Request Timeout, any other timeout shuts down both sides.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONN_TIMEOUT_H_
+#define CONN_TIMEOUT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer_wheel.h"
+
+/** Connection phases that have deadlines */
+typedef enum TimeoutKind {
+	TIMEOUT_NONE = 0,	/** no deadline */
+	TIMEOUT_HEADER,		/** reading the request line and headers */
+	TIMEOUT_BODY,		/** reading the request body, re-armed on progress */
+	TIMEOUT_IDLE,		/** waiting for the next request on a kept-alive connection */
+	TIMEOUT_WRITE,		/** sending the response, re-armed on progress */
+	TIMEOUT_KINDS
+} TimeoutKind;
+
+/** Deadline of a connection */
+typedef struct ConnTimeout {
+	WheelTimer timer;		/** the timer; first member */
+	int sock_fd;			/** the socket */
+	TimeoutKind kind;		/** phase the deadline is for */
+	TimeoutKind expired;	/** phase that timed out, or TIMEOUT_NONE */
+	uint64_t armedTick;		/** expiry tick last armed by the owner */
+} ConnTimeout;
+
+/**
+ * Set the deadline of each phase and start the timer wheel.
+ * A timeout of 0 disables the deadline of its phase.
+ *
+ * @param tickMs the timer resolution in milliseconds
+ * @param headerMs time allowed to read the request line and headers
+ * @param bodyMs time allowed between reads of the request body
+ * @param idleMs time a kept-alive connection may wait for a request
+ * @param writeMs time allowed between writes of the response
+ * @return true if successful
+ */
+bool initConnTimeouts(unsigned tickMs, unsigned long headerMs, unsigned long bodyMs,
+					  unsigned long idleMs, unsigned long writeMs);
+
+/**
+ * Initialize the deadline of a connection; nothing is armed.
+ *
+ * @param ct the deadline
+ * @param sock_fd the socket of the connection
+ */
+void initConnTimeout(ConnTimeout *ct, int sock_fd);
+
+/**
+ * Arm the deadline for a phase, replacing any other.
+ *
+ * @param ct the deadline
+ * @param kind the phase
+ */
+void armConnTimeout(ConnTimeout *ct, TimeoutKind kind);
+
+/**
+ * Cancel the deadline. Must be called before the socket is closed.
+ *
+ * @param ct the deadline
+ */
+void cancelConnTimeout(ConnTimeout *ct);
+
+/**
+ * Note that bytes were read from the connection: re-arms a
+ * body-read deadline and ends an idle deadline.
+ *
+ * @param ct the deadline
+ */
+void connReadProgress(ConnTimeout *ct);
+
+/**
+ * Note that the connection is about to send, or has sent, bytes:
+ * arms or re-arms the write-stall deadline.
+ *
+ * @param ct the deadline
+ */
+void connWriteProgress(ConnTimeout *ct);
+
+/**
+ * Return the phase that timed out.
+ *
+ * @param ct the deadline
+ * @return the phase, or TIMEOUT_NONE
+ */
+TimeoutKind connTimeoutExpired(const ConnTimeout *ct);
+
+/**
+ * Return the timeout of a phase.
+ *
+ * @param kind the phase
+ * @return the timeout in milliseconds, or 0 if none
+ */
+unsigned long connTimeoutLimit(TimeoutKind kind);
+
+/**
+ * Return the name of a phase for reporting.
+ *
+ * @param kind the phase
+ * @return the name
+ */
+const char *timeoutKindName(TimeoutKind kind);
+
+#endif /* CONN_TIMEOUT_H_ */
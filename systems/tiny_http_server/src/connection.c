@@ -0,0 +1,240 @@
+/*
+ * connection.c
+ *
+ * Client connections and the idle connection poller.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#include "connection.h"
+#include "server_stats.h"
+#include "slab.h"
+
+/** connections allocated together */
+#define CONNECTIONS_PER_CHUNK 1024
+
+/** slab of connections */
+static Slab *connectionSlab;
+
+/** pool and lane that serve resumed connections */
+static threadpool resumePool;
+static int resumeLane;
+static ConnectionHandler resumeHandler;
+
+/** number of parked connections */
+static size_t nParked;
+
+/** epoll descriptor of the poller, or -1 if none */
+static int pollFd = -1;
+
+/** connections close after their request in flight */
+static bool draining;
+
+/**
+ * Create a connection for an accepted socket.
+ *
+ * @param sock_fd the socket descriptor
+ * @return the connection, or NULL if out of memory
+ */
+Connection *newConnection(int sock_fd) {
+	Connection *conn = slabAlloc(connectionSlab);
+	if (conn != NULL) {
+		conn->sock_fd = sock_fd;
+		initConnTimeout(&conn->timeout, sock_fd);
+
+		// a kept-alive client waits for each response, so its last
+		// segment must not wait for the ACK of the one before it
+		int optval = 1;
+		setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+	}
+	return conn;
+}
+
+/**
+ * Close a connection and its socket, and free the connection.
+ *
+ * @param conn the connection
+ */
+void closeConnection(Connection *conn) {
+	// the deadline must not fire once the descriptor can be reused
+	cancelConnTimeout(&conn->timeout);
+	TimeoutKind expired = connTimeoutExpired(&conn->timeout);
+	if (expired != TIMEOUT_NONE) {
+		recordTimeout(expired);
+	}
+
+	// discard input already queued, such as an unread body, so the
+	// close does not reset the connection and destroy a response
+	// the client has yet to read
+	char buf[4096];
+	for (int i = 0; (i < 16) && (recv(conn->sock_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0); i++) {
+		continue;
+	}
+	close(conn->sock_fd);
+	recordConnectionClosed();
+	slabFree(connectionSlab, conn);
+}
+
+#if defined(__linux__)
+
+/** most events taken per wait */
+#define POLL_EVENTS 256
+
+/**
+ * Poller thread: hands parked connections that become readable,
+ * or are closed by their idle deadline, back to the pool.
+ */
+static void *connectionPoller(void *arg) {
+	(void)arg;
+	struct epoll_event events[POLL_EVENTS];
+	while (true) {
+		int n = epoll_wait(pollFd, events, POLL_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("connectionPoller");
+			return NULL;
+		}
+		for (int i = 0; i < n; i++) {
+			Connection *conn = events[i].data.ptr;
+			__atomic_sub_fetch(&nParked, 1, __ATOMIC_RELAXED);
+			cancelConnTimeout(&conn->timeout);
+			if (thpool_add_work_lane(resumePool, resumeLane, (void *)resumeHandler, conn) != 0) {
+				closeConnection(conn);
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Park a connection until its next request arrives, under the
+ * idle deadline. The caller must hold nothing else of the
+ * connection, which may be resumed on another thread at once.
+ *
+ * @param conn the connection
+ * @return true if parked, false if parking is not available
+ */
+bool parkConnection(Connection *conn) {
+	if (pollFd < 0) {
+		return false;
+	}
+	armConnTimeout(&conn->timeout, TIMEOUT_IDLE);
+	__atomic_add_fetch(&nParked, 1, __ATOMIC_RELAXED);
+
+	// one-shot, so the connection is resumed once per request
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+		.data.ptr = conn
+	};
+	int op = conn->polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	conn->polled = true;
+	if (epoll_ctl(pollFd, op, conn->sock_fd, &ev) != 0) {
+		__atomic_sub_fetch(&nParked, 1, __ATOMIC_RELAXED);
+		cancelConnTimeout(&conn->timeout);
+		conn->polled = false;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Start the poller thread.
+ */
+static bool startPoller(void) {
+	pollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (pollFd < 0) {
+		return false;
+	}
+	pthread_t poller;
+	if (pthread_create(&poller, NULL, connectionPoller, NULL) != 0) {
+		close(pollFd);
+		pollFd = -1;
+		return false;
+	}
+	pthread_detach(poller);
+	return true;
+}
+
+#else
+
+/**
+ * No poller: connections are closed rather than parked.
+ */
+bool parkConnection(Connection *conn) {
+	(void)conn;
+	return false;
+}
+
+static bool startPoller(void) {
+	return true;
+}
+
+#endif
+
+/**
+ * Initialize connections and start the idle connection poller.
+ * Parked connections that become readable are queued to the pool.
+ *
+ * @param pool the thread pool serving connections
+ * @param lane the pool lane for resumed connections
+ * @param resume the function that serves a resumed connection
+ * @return true if successful
+ */
+bool initConnections(threadpool pool, int lane, ConnectionHandler resume) {
+	connectionSlab = newSlab(sizeof(Connection), CONNECTIONS_PER_CHUNK);
+	if (connectionSlab == NULL) {
+		return false;
+	}
+	resumePool = pool;
+	resumeLane = lane;
+	resumeHandler = resume;
+	return startPoller();
+}
+
+/**
+ * Drain connections when the server stops: each connection
+ * closes once its request in flight is answered, and parked
+ * connections when their next request is answered or their
+ * idle deadline passes.
+ */
+void drainConnections(void) {
+	__atomic_store_n(&draining, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Determine whether connections are draining.
+ *
+ * @return true if connections close after their request in flight
+ */
+bool connectionsDraining(void) {
+	return __atomic_load_n(&draining, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Get the usage of connections.
+ *
+ * @param open the number of open connections
+ * @param idle the number of parked connections
+ * @param bytes the bytes of memory reserved for connections
+ */
+void connectionUsage(size_t *open, size_t *idle, size_t *bytes) {
+	*open = *bytes = 0;
+	if (connectionSlab != NULL) {
+		slabUsage(connectionSlab, open, bytes);
+	}
+	*idle = __atomic_load_n(&nParked, __ATOMIC_RELAXED);
+}
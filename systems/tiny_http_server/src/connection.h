@@ -0,0 +1,96 @@
+/*
+ * connection.h
+ *
+ * Client connections and the idle connection poller.
+ *
+ * A connection is a small object from a slab that lives as long as
+ * the socket. Everything a request needs beyond it, including the
+ * stream buffer and the request itself, is borrowed while the request
+ * is in flight. Between requests a kept-alive connection is parked
+ * with the poller: it holds no worker and no buffer until the next
+ * request arrives or its idle deadline closes it.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONNECTION_H_
+#define CONNECTION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "conn_timeout.h"
+#include "thpool.h"
+
+/** A client connection */
+typedef struct Connection {
+	ConnTimeout timeout;		/** deadline of the connection */
+	int sock_fd;				/** the socket */
+	bool polled;				/** registered with the poller */
+	unsigned long requests;		/** requests served */
+} Connection;
+
+/** Function that serves a connection with data to read */
+typedef void (*ConnectionHandler)(Connection *conn);
+
+/**
+ * Initialize connections and start the idle connection poller.
+ * Parked connections that become readable are queued to the pool.
+ *
+ * @param pool the thread pool serving connections
+ * @param lane the pool lane for resumed connections
+ * @param resume the function that serves a resumed connection
+ * @return true if successful
+ */
+bool initConnections(threadpool pool, int lane, ConnectionHandler resume);
+
+/**
+ * Create a connection for an accepted socket.
+ *
+ * @param sock_fd the socket descriptor
+ * @return the connection, or NULL if out of memory
+ */
+Connection *newConnection(int sock_fd);
+
+/**
+ * Close a connection and its socket, and free the connection.
+ *
+ * @param conn the connection
+ */
+void closeConnection(Connection *conn);
+
+/**
+ * Park a connection until its next request arrives, under the
+ * idle deadline. The caller must hold nothing else of the
+ * connection, which may be resumed on another thread at once.
+ *
+ * @param conn the connection
+ * @return true if parked, false if parking is not available
+ */
+bool parkConnection(Connection *conn);
+
+/**
+ * Drain connections when the server stops: each connection
+ * closes once its request in flight is answered, and parked
+ * connections when their next request is answered or their
+ * idle deadline passes.
+ */
+void drainConnections(void);
+
+/**
+ * Determine whether connections are draining.
+ *
+ * @return true if connections close after their request in flight
+ */
+bool connectionsDraining(void);
+
+/**
+ * Get the usage of connections.
+ *
+ * @param open the number of open connections
+ * @param idle the number of parked connections
+ * @param bytes the bytes of memory reserved for connections
+ */
+void connectionUsage(size_t *open, size_t *idle, size_t *bytes);
+
+#endif /* CONNECTION_H_ */
@@ -0,0 +1,305 @@
+/*
+ * content_bundle.c
+ *
+ * Serve the content tree from one packed, memory-mapped bundle file.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "content_bundle.h"
+
+/** A mapped bundle */
+struct ContentBundle {
+	const char *base;				/** the mapping */
+	size_t size;					/** size of the mapping */
+	const BundleRecord *records;	/** the file records */
+	size_t count;					/** number of file records */
+	const char *strings;			/** the string table */
+	size_t stringsSize;				/** size of the string table */
+	unsigned refs;					/** references, one while current */
+	bool unmapped;					/** set once unmapped */
+};
+
+/** the current bundle, or NULL if none */
+static ContentBundle *currentBundle;
+
+/** the bundle file */
+static char bundlePath[PATH_MAX];
+
+/** serializes opening and reloading */
+static pthread_mutex_t reloadLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Determine whether a range lies within a bundle of a size.
+ *
+ * @param offset the offset of the range
+ * @param length the length of the range
+ * @param size the bundle size
+ * @return true if within
+ */
+static bool inBundle(uint64_t offset, uint64_t length, size_t size) {
+	return (offset <= size) && (length <= size - offset);
+}
+
+/**
+ * Validate a mapped bundle, so requests may trust its offsets.
+ *
+ * @param bundle the bundle, with its mapping set
+ * @return true if valid
+ */
+static bool validateBundle(ContentBundle *bundle) {
+	const BundleHeader *header = (const BundleHeader *)bundle->base;
+	if ((bundle->size < sizeof(BundleHeader))
+		|| (memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) != 0)
+		|| (header->version != BUNDLE_VERSION)
+		|| (header->size != bundle->size)
+		|| ((header->indexOffset % sizeof(uint64_t)) != 0)
+		|| (header->count > bundle->size / sizeof(BundleRecord))
+		|| !inBundle(header->indexOffset, header->count * sizeof(BundleRecord), bundle->size)
+		|| (header->stringsSize == 0)
+		|| !inBundle(header->stringsOffset, header->stringsSize, bundle->size)) {
+		return false;
+	}
+	bundle->records = (const BundleRecord *)(bundle->base + header->indexOffset);
+	bundle->count = header->count;
+	bundle->strings = bundle->base + header->stringsOffset;
+	bundle->stringsSize = header->stringsSize;
+	if (bundle->strings[bundle->stringsSize - 1] != '\0') {
+		return false;
+	}
+
+	for (size_t i = 0; i < bundle->count; i++) {
+		const BundleRecord *record = &bundle->records[i];
+		if ((record->path >= bundle->stringsSize)
+			|| (record->contentType >= bundle->stringsSize)
+			|| (record->lastModified >= bundle->stringsSize)) {
+			return false;
+		}
+		for (int e = 0; e < BUNDLE_ENCODINGS; e++) {
+			if ((record->etag[e] >= bundle->stringsSize)
+				|| !inBundle(record->body[e].offset, record->body[e].length, bundle->size)) {
+				return false;
+			}
+		}
+		// binary search relies on the order
+		if ((i > 0) && (strcmp(bundle->strings + record[-1].path, bundle->strings + record->path) >= 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Map and validate a bundle file.
+ *
+ * @param path the bundle file
+ * @return the bundle, or NULL with errno set if not a valid bundle
+ */
+static ContentBundle *mapBundle(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)sb.st_size < sizeof(BundleHeader)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	void *base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+
+	ContentBundle *bundle = calloc(1, sizeof(ContentBundle));
+	if (bundle == NULL) {
+		munmap(base, (size_t)sb.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	bundle->base = base;
+	bundle->size = (size_t)sb.st_size;
+	bundle->refs = 1;
+	if (!validateBundle(bundle)) {
+		munmap(base, bundle->size);
+		free(bundle);
+		errno = EINVAL;
+		return NULL;
+	}
+	return bundle;
+}
+
+/**
+ * Release a reference to a bundle, unmapping it with the last one.
+ * The bundle itself is not freed: a request may still read its
+ * count while acquiring it after it was swapped out.
+ *
+ * @param bundle the bundle
+ */
+static void unrefBundle(ContentBundle *bundle) {
+	if (__atomic_sub_fetch(&bundle->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		bool mapped = false;
+		if (__atomic_compare_exchange_n(&bundle->unmapped, &mapped, true, false,
+										__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			munmap((void *)bundle->base, bundle->size);
+		}
+	}
+}
+
+/**
+ * Map a bundle file and swap it in for the current bundle.
+ *
+ * @param path the bundle file
+ * @return true if swapped in
+ */
+static bool swapBundle(const char *path) {
+	ContentBundle *bundle = mapBundle(path);
+	if (bundle == NULL) {
+		return false;
+	}
+	ContentBundle *old = __atomic_exchange_n(&currentBundle, bundle, __ATOMIC_ACQ_REL);
+	if (old != NULL) {
+		unrefBundle(old);
+	}
+	return true;
+}
+
+/**
+ * Open a bundle file and make it the current bundle.
+ *
+ * @param path the bundle file
+ * @return true if the bundle was opened
+ */
+bool openContentBundle(const char *path) {
+	if (strlen(path) >= sizeof(bundlePath)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	pthread_mutex_lock(&reloadLock);
+	strcpy(bundlePath, path);
+	bool opened = swapBundle(bundlePath);
+	pthread_mutex_unlock(&reloadLock);
+	return opened;
+}
+
+/**
+ * Map the bundle file anew and swap it in for the current bundle.
+ * The current bundle is kept if the file is not a valid bundle.
+ *
+ * @return true if the bundle was reloaded
+ */
+bool reloadContentBundle(void) {
+	pthread_mutex_lock(&reloadLock);
+	bool reloaded = (bundlePath[0] != '\0') && swapBundle(bundlePath);
+	pthread_mutex_unlock(&reloadLock);
+	return reloaded;
+}
+
+/**
+ * Determine whether content is served from a bundle.
+ *
+ * @return true if a bundle was opened
+ */
+bool contentBundleEnabled(void) {
+	return __atomic_load_n(&currentBundle, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/**
+ * Acquire the current bundle. Release it with releaseContentBundle().
+ *
+ * @return the bundle, or NULL if none
+ */
+ContentBundle *acquireContentBundle(void) {
+	while (true) {
+		ContentBundle *bundle = __atomic_load_n(&currentBundle, __ATOMIC_ACQUIRE);
+		if (bundle == NULL) {
+			return NULL;
+		}
+		// the reference holds the mapping only if the bundle was
+		// still current when taken; otherwise try the new one
+		__atomic_add_fetch(&bundle->refs, 1, __ATOMIC_ACQ_REL);
+		if (__atomic_load_n(&currentBundle, __ATOMIC_ACQUIRE) == bundle) {
+			return bundle;
+		}
+		unrefBundle(bundle);
+	}
+}
+
+/**
+ * Release a bundle from acquireContentBundle().
+ *
+ * @param bundle the bundle
+ */
+void releaseContentBundle(ContentBundle *bundle) {
+	unrefBundle(bundle);
+}
+
+/**
+ * Find the record of a file in a bundle.
+ *
+ * @param bundle the bundle
+ * @param path the path from the content root, starting with '/'
+ * @return the record, or NULL if not found
+ */
+const BundleRecord *findBundleFile(const ContentBundle *bundle, const char *path) {
+	size_t low = 0, high = bundle->count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		int cmp = strcmp(path, bundle->strings + bundle->records[mid].path);
+		if (cmp == 0) {
+			return &bundle->records[mid];
+		} else if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Get a string of the string table of a bundle.
+ *
+ * @param bundle the bundle
+ * @param offset the offset of the string
+ * @return the string
+ */
+const char *bundleString(const ContentBundle *bundle, uint32_t offset) {
+	return bundle->strings + offset;
+}
+
+/**
+ * Get a body of a file in a bundle.
+ *
+ * @param bundle the bundle
+ * @param record the file record
+ * @param encoding the encoding of the body
+ * @param length the length of the body
+ * @return the body, or NULL if the file has no body of the encoding
+ */
+const char *bundleBody(const ContentBundle *bundle, const BundleRecord *record, int encoding, size_t *length) {
+	const BundleBody *body = &record->body[encoding];
+	if ((encoding != BUNDLE_IDENTITY) && (body->offset == 0)) {
+		return NULL;
+	}
+	*length = (size_t)body->length;
+	return bundle->base + body->offset;
+}
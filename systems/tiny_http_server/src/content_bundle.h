@@ -0,0 +1,145 @@
+/*
+ * content_bundle.h
+ *
+ * Serve the content tree from one packed, memory-mapped bundle file.
+ *
+ * A bundle, made by bench/make_bundle.c from a content directory,
+ * holds every file of the tree: an index of file records sorted by
+ * path, a table of the precomputed header strings of each file (its
+ * Content-Type, Last-Modified and ETag), and the file bodies, each
+ * starting on a page boundary. A file may carry precompressed gzip
+ * and brotli variants of its body, packed from the sidecar ".gz" and
+ * ".br" files next to it.
+ *
+ * The bundle is mapped read-only, so a request is answered from the
+ * page cache by a binary search of the index, with no file system
+ * calls at all. Reloading maps the bundle file anew and swaps it in
+ * atomically; requests in flight keep the bundle they acquired, which
+ * is unmapped when the last of them releases it.
+ *
+ * The bundle is in the byte order of the host that packed it.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONTENT_BUNDLE_H_
+#define CONTENT_BUNDLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** magic number at the start of a bundle */
+#define BUNDLE_MAGIC "TINYBNDL"
+
+/** the bundle format version */
+#define BUNDLE_VERSION 1
+
+/** alignment of file bodies in a bundle */
+#define BUNDLE_ALIGN 4096
+
+/** encodings of a file body */
+enum {
+	BUNDLE_IDENTITY = 0,
+	BUNDLE_GZIP = 1,
+	BUNDLE_BR = 2,
+	BUNDLE_ENCODINGS
+};
+
+/** The bundle header, at offset 0 */
+typedef struct BundleHeader {
+	char magic[8];				/** BUNDLE_MAGIC */
+	uint32_t version;			/** BUNDLE_VERSION */
+	uint32_t count;				/** number of file records */
+	uint64_t indexOffset;		/** offset of the file records */
+	uint64_t stringsOffset;		/** offset of the string table */
+	uint64_t stringsSize;		/** size of the string table */
+	uint64_t size;				/** size of the bundle file */
+} BundleHeader;
+
+/** A file body in a bundle */
+typedef struct BundleBody {
+	uint64_t offset;			/** offset of the body, or 0 if none */
+	uint64_t length;			/** length of the body */
+} BundleBody;
+
+/** A file record of the index, sorted by path */
+typedef struct BundleRecord {
+	uint32_t path;							/** path from the content root, starting with '/' */
+	uint32_t contentType;					/** Content-Type header */
+	uint32_t lastModified;					/** Last-Modified header */
+	uint32_t etag[BUNDLE_ENCODINGS];		/** ETag header of each body */
+	uint32_t reserved;
+	BundleBody body[BUNDLE_ENCODINGS];		/** the body of each encoding */
+} BundleRecord;
+
+/** A mapped bundle */
+typedef struct ContentBundle ContentBundle;
+
+/**
+ * Open a bundle file and make it the current bundle.
+ *
+ * @param path the bundle file
+ * @return true if the bundle was opened
+ */
+bool openContentBundle(const char *path);
+
+/**
+ * Map the bundle file anew and swap it in for the current bundle.
+ * The current bundle is kept if the file is not a valid bundle.
+ *
+ * @return true if the bundle was reloaded
+ */
+bool reloadContentBundle(void);
+
+/**
+ * Determine whether content is served from a bundle.
+ *
+ * @return true if a bundle was opened
+ */
+bool contentBundleEnabled(void);
+
+/**
+ * Acquire the current bundle. Release it with releaseContentBundle().
+ *
+ * @return the bundle, or NULL if none
+ */
+ContentBundle *acquireContentBundle(void);
+
+/**
+ * Release a bundle from acquireContentBundle().
+ *
+ * @param bundle the bundle
+ */
+void releaseContentBundle(ContentBundle *bundle);
+
+/**
+ * Find the record of a file in a bundle.
+ *
+ * @param bundle the bundle
+ * @param path the path from the content root, starting with '/'
+ * @return the record, or NULL if not found
+ */
+const BundleRecord *findBundleFile(const ContentBundle *bundle, const char *path);
+
+/**
+ * Get a string of the string table of a bundle.
+ *
+ * @param bundle the bundle
+ * @param offset the offset of the string
+ * @return the string
+ */
+const char *bundleString(const ContentBundle *bundle, uint32_t offset);
+
+/**
+ * Get a body of a file in a bundle.
+ *
+ * @param bundle the bundle
+ * @param record the file record
+ * @param encoding the encoding of the body
+ * @param length the length of the body
+ * @return the body, or NULL if the file has no body of the encoding
+ */
+const char *bundleBody(const ContentBundle *bundle, const BundleRecord *record, int encoding, size_t *length);
+
+#endif /* CONTENT_BUNDLE_H_ */
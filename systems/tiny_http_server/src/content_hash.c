@@ -0,0 +1,497 @@
+/*
+ * content_hash.c
+ *
+ * Cache of file content hashes, for entity tags that identify the
+ * contents of a file rather than its inode and times.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "content_hash.h"
+#include "xxh64.h"
+
+/** magic number at the start of a sidecar file */
+#define SIDECAR_MAGIC "TINYHASH"
+
+/** the sidecar format version */
+#define SIDECAR_VERSION 1
+
+/** bytes read at a time while hashing */
+#define HASH_CHUNK (256*1024)
+
+/** A cached hash */
+typedef struct HashEntry {
+	struct HashEntry *chain;			/** next entry in the hash bucket */
+	struct HashEntry *newer, *older;	/** LRU list links */
+	dev_t dev;							/** device of the file */
+	ino_t ino;							/** inode of the file */
+	off_t size;							/** size of the file */
+	struct timespec mtime;				/** modification time of the file */
+	uint64_t hash;						/** the content hash, if ready */
+	bool ready;							/** hashed, or still queued */
+} HashEntry;
+
+/** One independently locked part of the cache */
+typedef struct HashShard {
+	pthread_mutex_t lock;		/** guards the shard */
+	HashEntry **buckets;		/** hash buckets */
+	size_t mask;				/** number of buckets - 1 */
+	size_t count;				/** number of entries */
+	size_t capacity;			/** maximum number of entries */
+	HashEntry lru;				/** list head: lru.older is newest, lru.newer oldest */
+	char pad[64];				/** keep shard locks on separate cache lines */
+} HashShard;
+
+/** The sidecar file header */
+typedef struct SidecarHeader {
+	char magic[8];				/** SIDECAR_MAGIC */
+	uint32_t version;			/** SIDECAR_VERSION */
+	uint32_t recordSize;		/** size of a record */
+} SidecarHeader;
+
+/** A hash in the sidecar file */
+typedef struct SidecarRecord {
+	uint64_t dev;				/** device of the file */
+	uint64_t ino;				/** inode of the file */
+	int64_t size;				/** size of the file */
+	int64_t mtimeSec;			/** modification time of the file */
+	int64_t mtimeNsec;
+	uint64_t hash;				/** the content hash */
+} SidecarRecord;
+
+/** A file queued to be hashed */
+typedef struct HashJob {
+	dev_t dev;					/** device of the file */
+	ino_t ino;					/** inode of the file */
+	off_t size;					/** size of the file */
+	struct timespec mtime;		/** modification time of the file */
+	char path[];				/** the file path */
+} HashJob;
+
+/** the shards, or NULL if the cache is disabled */
+static HashShard *hashShards;
+
+/** pool and lane running hashing jobs */
+static threadpool hashPool;
+static int hashLane;
+
+/** files queued or being hashed, and the most at once */
+static size_t pendingJobs;
+static size_t maxPendingJobs;
+
+/** the sidecar file, and its descriptor open for appending */
+static char sidecarPath[PATH_MAX];
+static int sidecarFd = -1;
+static pthread_mutex_t sidecarLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Hash a file identity to pick a shard and bucket.
+ */
+static uint64_t hashIdentity(dev_t dev, ino_t ino) {
+	uint64_t h = ((uint64_t)ino * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)dev * 0xc2b2ae3d27d4eb4fULL);
+	return h ^ (h >> 29);
+}
+
+/**
+ * Get the shard of a file identity.
+ */
+static HashShard *shardOf(uint64_t h) {
+	return &hashShards[h & (CONTENT_HASH_SHARDS - 1)];
+}
+
+/**
+ * Unlink an entry from the LRU list.
+ */
+static void lruUnlink(HashEntry *e) {
+	e->newer->older = e->older;
+	e->older->newer = e->newer;
+}
+
+/**
+ * Link an entry at the newest end of the LRU list.
+ */
+static void lruPushNewest(HashShard *shard, HashEntry *e) {
+	e->older = shard->lru.older;
+	e->newer = &shard->lru;
+	shard->lru.older->newer = e;
+	shard->lru.older = e;
+}
+
+/**
+ * Find the bucket link that points to the entry of a file identity.
+ *
+ * @return the link; *link is NULL if not found
+ */
+static HashEntry **findEntry(HashShard *shard, dev_t dev, ino_t ino, uint64_t h) {
+	HashEntry **link = &shard->buckets[(h >> 4) & shard->mask];
+	while ((*link != NULL) && (((*link)->ino != ino) || ((*link)->dev != dev))) {
+		link = &(*link)->chain;
+	}
+	return link;
+}
+
+/**
+ * Remove and free the entry a bucket link points to.
+ */
+static void removeEntry(HashShard *shard, HashEntry **link) {
+	HashEntry *e = *link;
+	*link = e->chain;
+	lruUnlink(e);
+	shard->count--;
+	free(e);
+}
+
+/**
+ * Determine whether an entry is current for metadata.
+ */
+static bool entryMatches(const HashEntry *e, off_t size, const struct timespec *mtime) {
+	return (e->size == size) && (e->mtime.tv_sec == mtime->tv_sec) && (e->mtime.tv_nsec == mtime->tv_nsec);
+}
+
+/**
+ * Add an entry for a file, replacing one of an older version of
+ * the file and evicting the oldest entry if the shard is full.
+ * The caller holds the lock.
+ *
+ * @return the entry, or NULL if out of memory
+ */
+static HashEntry *addEntry(HashShard *shard, dev_t dev, ino_t ino, uint64_t h, off_t size, const struct timespec *mtime) {
+	HashEntry *e = calloc(1, sizeof(HashEntry));
+	if (e == NULL) {
+		return NULL;
+	}
+	e->dev = dev;
+	e->ino = ino;
+	e->size = size;
+	e->mtime = *mtime;
+	HashEntry **link = findEntry(shard, dev, ino, h);
+	if (*link != NULL) {
+		removeEntry(shard, link);
+	} else if (shard->count >= shard->capacity) {
+		HashEntry *oldest = shard->lru.newer;
+		removeEntry(shard, findEntry(shard, oldest->dev, oldest->ino, hashIdentity(oldest->dev, oldest->ino)));
+		link = findEntry(shard, dev, ino, h);
+	}
+	*link = e;
+	lruPushNewest(shard, e);
+	shard->count++;
+	return e;
+}
+
+/**
+ * Append a hash to the sidecar file.
+ */
+static void appendSidecar(const HashJob *job, uint64_t hash) {
+	SidecarRecord record = {
+		.dev = job->dev, .ino = job->ino, .size = job->size,
+		.mtimeSec = job->mtime.tv_sec, .mtimeNsec = job->mtime.tv_nsec, .hash = hash
+	};
+	pthread_mutex_lock(&sidecarLock);
+	if (sidecarFd >= 0) {
+		// one write, so a crash leaves no partial record
+		if (write(sidecarFd, &record, sizeof(record)) != sizeof(record)) {
+			perror(sidecarPath);
+		}
+	}
+	pthread_mutex_unlock(&sidecarLock);
+}
+
+/**
+ * Hash the contents of a file, if it is still the version queued.
+ *
+ * @param job the file
+ * @param hash the hash
+ * @return true if hashed
+ */
+static bool hashContents(const HashJob *job, uint64_t *hash) {
+	int fd = open(job->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat sb;
+	char *buf = malloc(HASH_CHUNK);
+	bool ok = (buf != NULL) && (fstat(fd, &sb) == 0) && (sb.st_dev == job->dev) && (sb.st_ino == job->ino);
+	if (ok) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		Xxh64State state;
+		xxh64Init(&state, 0);
+		off_t total = 0;
+		ssize_t n;
+		while ((n = read(fd, buf, HASH_CHUNK)) != 0) {
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				ok = false;
+				break;
+			}
+			xxh64Update(&state, buf, (size_t)n);
+			total += n;
+		}
+		*hash = xxh64Digest(&state);
+
+		// the file may have changed while it was read
+		ok = ok && (total == job->size) && (fstat(fd, &sb) == 0)
+			&& (sb.st_size == job->size) && (sb.st_mtim.tv_sec == job->mtime.tv_sec)
+			&& (sb.st_mtim.tv_nsec == job->mtime.tv_nsec);
+	}
+	free(buf);
+	close(fd);
+	return ok;
+}
+
+/**
+ * Hashing job: hash a file and make its hash ready, or drop its
+ * entry if the file changed, so a later request queues it again.
+ *
+ * @param job the file, freed when done
+ */
+static void hashFile(HashJob *job) {
+	uint64_t hash = 0;
+	bool hashed = hashContents(job, &hash);
+
+	uint64_t h = hashIdentity(job->dev, job->ino);
+	HashShard *shard = shardOf(h);
+	bool stored = false;
+	pthread_mutex_lock(&shard->lock);
+	HashEntry **link = findEntry(shard, job->dev, job->ino, h);
+	if ((*link != NULL) && !(*link)->ready && entryMatches(*link, job->size, &job->mtime)) {
+		if (hashed) {
+			(*link)->hash = hash;
+			(*link)->ready = true;
+			stored = true;
+		} else {
+			removeEntry(shard, link);
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	if (stored) {
+		appendSidecar(job, hash);
+	}
+	__atomic_sub_fetch(&pendingJobs, 1, __ATOMIC_RELAXED);
+	free(job);
+}
+
+/**
+ * Queue a file to be hashed, within the limit of pending files.
+ *
+ * @return true if queued
+ */
+static bool queueHash(const char *path, const struct stat *sb) {
+	if (__atomic_add_fetch(&pendingJobs, 1, __ATOMIC_RELAXED) > maxPendingJobs) {
+		__atomic_sub_fetch(&pendingJobs, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	HashJob *job = malloc(sizeof(HashJob) + strlen(path) + 1);
+	if (job == NULL) {
+		__atomic_sub_fetch(&pendingJobs, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	job->dev = sb->st_dev;
+	job->ino = sb->st_ino;
+	job->size = sb->st_size;
+	job->mtime = sb->st_mtim;
+	strcpy(job->path, path);
+	if (thpool_add_work_lane(hashPool, hashLane, (void *)hashFile, job) != 0) {
+		free(job);
+		__atomic_sub_fetch(&pendingJobs, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Get the content hash of a file, if known. If not, the file is
+ * queued to be hashed in the background.
+ *
+ * @param path the file path
+ * @param sb the current metadata of the file
+ * @param hash the hash if known
+ * @return true if the hash is known
+ */
+bool lookupContentHash(const char *path, const struct stat *sb, uint64_t *hash) {
+	if (hashShards == NULL) {
+		return false;
+	}
+	uint64_t h = hashIdentity(sb->st_dev, sb->st_ino);
+	HashShard *shard = shardOf(h);
+	pthread_mutex_lock(&shard->lock);
+	HashEntry **link = findEntry(shard, sb->st_dev, sb->st_ino, h);
+	HashEntry *e = *link;
+	if ((e != NULL) && entryMatches(e, sb->st_size, &sb->st_mtim)) {
+		bool ready = e->ready;
+		if (ready) {
+			*hash = e->hash;
+		}
+		lruUnlink(e);
+		lruPushNewest(shard, e);
+		pthread_mutex_unlock(&shard->lock);
+		return ready;
+	}
+
+	// the entry marks the file queued, so it is queued once
+	e = addEntry(shard, sb->st_dev, sb->st_ino, h, sb->st_size, &sb->st_mtim);
+	if ((e != NULL) && !queueHash(path, sb)) {
+		removeEntry(shard, findEntry(shard, sb->st_dev, sb->st_ino, h));
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return false;
+}
+
+/**
+ * Load the hashes of the sidecar file into the cache.
+ *
+ * @return the number of hashes read
+ */
+static size_t loadSidecar(void) {
+	FILE *in = fopen(sidecarPath, "r");
+	if (in == NULL) {
+		if (errno != ENOENT) {
+			perror(sidecarPath);
+		}
+		return 0;
+	}
+	SidecarHeader header;
+	if ((fread(&header, sizeof(header), 1, in) != 1)
+		|| (memcmp(header.magic, SIDECAR_MAGIC, sizeof(header.magic)) != 0)
+		|| (header.version != SIDECAR_VERSION) || (header.recordSize != sizeof(SidecarRecord))) {
+		fprintf(stderr, "%s: not a hash sidecar file, ignored\n", sidecarPath);
+		fclose(in);
+		return 0;
+	}
+	size_t n = 0;
+	SidecarRecord record;
+	while (fread(&record, sizeof(record), 1, in) == 1) {
+		uint64_t h = hashIdentity((dev_t)record.dev, (ino_t)record.ino);
+		HashShard *shard = shardOf(h);
+		struct timespec mtime = { .tv_sec = record.mtimeSec, .tv_nsec = record.mtimeNsec };
+		HashEntry *e = addEntry(shard, (dev_t)record.dev, (ino_t)record.ino, h, (off_t)record.size, &mtime);
+		if (e != NULL) {
+			e->hash = record.hash;
+			e->ready = true;
+		}
+		n++;
+	}
+	fclose(in);
+	return n;
+}
+
+/**
+ * Save the cached hashes to the sidecar file, replacing the hashes
+ * appended to it. The file is written to a temporary file and
+ * renamed, so it is always complete.
+ *
+ * @return true if saved, or if there is no sidecar file
+ */
+bool saveContentHashes(void) {
+	if ((hashShards == NULL) || (sidecarPath[0] == '\0')) {
+		return true;
+	}
+	char tmpPath[PATH_MAX + 8];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", sidecarPath);
+	FILE *out = fopen(tmpPath, "w");
+	if (out == NULL) {
+		return false;
+	}
+	SidecarHeader header = { .version = SIDECAR_VERSION, .recordSize = sizeof(SidecarRecord) };
+	memcpy(header.magic, SIDECAR_MAGIC, sizeof(header.magic));
+	fwrite(&header, sizeof(header), 1, out);
+
+	// appends go to the new file once it replaces the old one
+	pthread_mutex_lock(&sidecarLock);
+	for (int s = 0; s < CONTENT_HASH_SHARDS; s++) {
+		HashShard *shard = &hashShards[s];
+		pthread_mutex_lock(&shard->lock);
+		// oldest first, so loading restores the LRU order
+		for (HashEntry *e = shard->lru.newer; e != &shard->lru; e = e->newer) {
+			if (e->ready) {
+				SidecarRecord record = {
+					.dev = e->dev, .ino = e->ino, .size = e->size,
+					.mtimeSec = e->mtime.tv_sec, .mtimeNsec = e->mtime.tv_nsec, .hash = e->hash
+				};
+				fwrite(&record, sizeof(record), 1, out);
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+	bool saved = (fflush(out) == 0) && (fsync(fileno(out)) == 0) && !ferror(out);
+	if ((fclose(out) != 0) || !saved || (rename(tmpPath, sidecarPath) != 0)) {
+		unlink(tmpPath);
+		pthread_mutex_unlock(&sidecarLock);
+		return false;
+	}
+	if (sidecarFd >= 0) {
+		close(sidecarFd);
+	}
+	sidecarFd = open(sidecarPath, O_WRONLY | O_APPEND | O_CLOEXEC);
+	pthread_mutex_unlock(&sidecarLock);
+	return sidecarFd >= 0;
+}
+
+/**
+ * Initialize the cache, loading the hashes of a sidecar file.
+ *
+ * @param capacity maximum number of hashes; 0 disables the cache
+ * @param pool the thread pool that hashes files
+ * @param lane the pool lane for hashing jobs
+ * @param maxPending the most files queued to be hashed at once
+ * @param sidecar the sidecar file, or NULL to keep hashes in memory only
+ * @return true if successful
+ */
+bool initContentHashes(size_t capacity, threadpool pool, int lane, size_t maxPending, const char *sidecar) {
+	if (capacity == 0) {
+		return true;
+	}
+	if ((sidecar != NULL) && (strlen(sidecar) >= sizeof(sidecarPath))) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	HashShard *shards = calloc(CONTENT_HASH_SHARDS, sizeof(HashShard));
+	if (shards == NULL) {
+		return false;
+	}
+	size_t perShard = (capacity + CONTENT_HASH_SHARDS - 1) / CONTENT_HASH_SHARDS;
+	size_t nbuckets = 16;
+	while (nbuckets < perShard) {
+		nbuckets <<= 1;
+	}
+	for (int s = 0; s < CONTENT_HASH_SHARDS; s++) {
+		HashShard *shard = &shards[s];
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->buckets = calloc(nbuckets, sizeof(HashEntry *));
+		if (shard->buckets == NULL) {
+			return false;
+		}
+		shard->mask = nbuckets - 1;
+		shard->capacity = perShard;
+		shard->lru.newer = shard->lru.older = &shard->lru;
+	}
+	hashPool = pool;
+	hashLane = lane;
+	maxPendingJobs = maxPending;
+	hashShards = shards;
+
+	// compact the hashes appended in the last run
+	if (sidecar != NULL) {
+		strcpy(sidecarPath, sidecar);
+		loadSidecar();
+		if (!saveContentHashes()) {
+			perror(sidecarPath);
+		}
+	}
+	return true;
+}
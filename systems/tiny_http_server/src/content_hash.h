@@ -0,0 +1,70 @@
+/*
+ * content_hash.h
+ *
+ * Cache of file content hashes, for entity tags that identify the
+ * contents of a file rather than its inode and times.
+ *
+ * A hash is kept by the device, inode, size and modification time of
+ * its file, and is current while they match the metadata of the
+ * request. A file not hashed yet is queued to be hashed with XXH64 on
+ * the thread pool, so no request waits for it; until then its
+ * responses carry a weak entity tag. A copy of a file with new times,
+ * as a deploy may make, hashes to the same tag, so caches downstream
+ * keep their copies.
+ *
+ * Hashes persist across restarts in a sidecar file. Each hash is
+ * appended to it as it is computed, and the file is compacted to the
+ * cached hashes when the cache starts and when the server stops.
+ *
+ * Lookups hash to one of CONTENT_HASH_SHARDS independently locked
+ * shards, each an LRU-ordered hash table.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CONTENT_HASH_H_
+#define CONTENT_HASH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "thpool.h"
+
+/** number of independently locked shards */
+#define CONTENT_HASH_SHARDS 16
+
+/**
+ * Initialize the cache, loading the hashes of a sidecar file.
+ *
+ * @param capacity maximum number of hashes; 0 disables the cache
+ * @param pool the thread pool that hashes files
+ * @param lane the pool lane for hashing jobs
+ * @param maxPending the most files queued to be hashed at once
+ * @param sidecar the sidecar file, or NULL to keep hashes in memory only
+ * @return true if successful
+ */
+bool initContentHashes(size_t capacity, threadpool pool, int lane, size_t maxPending, const char *sidecar);
+
+/**
+ * Get the content hash of a file, if known. If not, the file is
+ * queued to be hashed in the background.
+ *
+ * @param path the file path
+ * @param sb the current metadata of the file
+ * @param hash the hash if known
+ * @return true if the hash is known
+ */
+bool lookupContentHash(const char *path, const struct stat *sb, uint64_t *hash);
+
+/**
+ * Save the cached hashes to the sidecar file, replacing the hashes
+ * appended to it. The file is written to a temporary file and
+ * renamed, so it is always complete.
+ *
+ * @return true if saved, or if there is no sidecar file
+ */
+bool saveContentHashes(void);
+
+#endif /* CONTENT_HASH_H_ */
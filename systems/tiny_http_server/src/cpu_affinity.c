@@ -0,0 +1,303 @@
+/*
+ * cpu_affinity.c
+ *
+ * Functions for CPU affinity and NUMA-aware thread placement.
+ *
+ * NUMA topology is read from /sys/devices/system/node on Linux.
+ * Memory placement relies on the kernel's first-touch policy:
+ * a thread that is pinned before it allocates and touches its
+ * buffers gets them from its own node, so no libnuma is needed.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cpu_affinity.h"
+
+/** NUMA node of each CPU */
+static int cpu_node[MAX_AFFINITY_CPUS];
+
+/** CPUs the process may run on */
+static bool cpu_allowed[MAX_AFFINITY_CPUS];
+
+/** number of NUMA nodes (highest node number + 1) */
+static int num_nodes = 1;
+
+/** initializes topology once */
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Parse a CPU list of the form "0-3,8,10-11".
+ *
+ * @param list the CPU list
+ * @param cpuset flags set for each CPU in the list
+ * @return 0 if successful, -1 if list is invalid
+ */
+static int parse_cpu_list(const char *list, bool *cpuset) {
+	const char *p = list;
+	while (*p != '\0' && *p != '\n') {
+		char *end;
+		long first = strtol(p, &end, 10);
+		if (end == p || first < 0 || first >= MAX_AFFINITY_CPUS) {
+			return -1;
+		}
+		long last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first || last >= MAX_AFFINITY_CPUS) {
+				return -1;
+			}
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			cpuset[cpu] = true;
+		}
+		p = end;
+		if (*p == ',') {
+			p++;
+		} else if (*p != '\0' && *p != '\n') {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read the allowed CPUs and their NUMA nodes.
+ */
+static void init_topology(void) {
+#if defined(__linux__)
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+		for (int cpu = 0; cpu < MAX_AFFINITY_CPUS && cpu < CPU_SETSIZE; cpu++) {
+			cpu_allowed[cpu] = CPU_ISSET(cpu, &mask);
+		}
+	}
+
+	DIR *dir = opendir("/sys/devices/system/node");
+	if (dir == NULL) {
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		int node;
+		if (sscanf(entry->d_name, "node%d", &node) != 1) {
+			continue;
+		}
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *f = fopen(path, "r");
+		if (f == NULL) {
+			continue;
+		}
+		char list[4096];
+		bool cpuset[MAX_AFFINITY_CPUS] = {false};
+		if (fgets(list, sizeof(list), f) != NULL && parse_cpu_list(list, cpuset) == 0) {
+			for (int cpu = 0; cpu < MAX_AFFINITY_CPUS; cpu++) {
+				if (cpuset[cpu]) {
+					cpu_node[cpu] = node;
+				}
+			}
+			if (node + 1 > num_nodes) {
+				num_nodes = node + 1;
+			}
+		}
+		fclose(f);
+	}
+	closedir(dir);
+#else
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int cpu = 0; cpu < ncpus && cpu < MAX_AFFINITY_CPUS; cpu++) {
+		cpu_allowed[cpu] = true;
+	}
+#endif
+}
+
+/**
+ * Get the ordered list of CPUs for a placement specification.
+ *
+ * @param spec the placement specification
+ * @param cpus storage for the CPU numbers
+ * @param max_cpus capacity of cpus
+ * @return the number of CPUs, 0 for no placement, or -1 if spec is invalid
+ */
+int get_affinity_cpus(const char *spec, int *cpus, int max_cpus) {
+	pthread_once(&topology_once, init_topology);
+
+	if (spec == NULL || *spec == '\0' || strcmp(spec, "none") == 0) {
+		return 0;
+	}
+
+	int n = 0;
+	if (strcmp(spec, "compact") == 0) {
+		// node by node, lowest CPU first
+		for (int node = 0; node < num_nodes; node++) {
+			for (int cpu = 0; cpu < MAX_AFFINITY_CPUS && n < max_cpus; cpu++) {
+				if (cpu_allowed[cpu] && cpu_node[cpu] == node) {
+					cpus[n++] = cpu;
+				}
+			}
+		}
+	} else if (strcmp(spec, "scatter") == 0) {
+		// take the next unused CPU from each node in turn
+		int next[num_nodes];
+		memset(next, 0, sizeof(next));
+		bool added = true;
+		while (added && n < max_cpus) {
+			added = false;
+			for (int node = 0; node < num_nodes && n < max_cpus; node++) {
+				while (next[node] < MAX_AFFINITY_CPUS) {
+					int cpu = next[node]++;
+					if (cpu_allowed[cpu] && cpu_node[cpu] == node) {
+						cpus[n++] = cpu;
+						added = true;
+						break;
+					}
+				}
+			}
+		}
+	} else {
+		bool cpuset[MAX_AFFINITY_CPUS] = {false};
+		if (parse_cpu_list(spec, cpuset) != 0) {
+			return -1;
+		}
+		for (int cpu = 0; cpu < MAX_AFFINITY_CPUS && n < max_cpus; cpu++) {
+			if (cpuset[cpu] && cpu_allowed[cpu]) {
+				cpus[n++] = cpu;
+			}
+		}
+		if (n == 0) {
+			return -1;  // none of the listed CPUs is usable
+		}
+	}
+	return n;
+}
+
+/**
+ * Get the NUMA node of a CPU.
+ *
+ * @param cpu the CPU number
+ * @return the node number, or 0 if unknown
+ */
+int get_cpu_node(int cpu) {
+	pthread_once(&topology_once, init_topology);
+	return (cpu >= 0 && cpu < MAX_AFFINITY_CPUS) ? cpu_node[cpu] : 0;
+}
+
+/**
+ * Pin the calling thread to a single CPU.
+ *
+ * @param cpu the CPU number
+ * @return 0 if successful, -1 if error or not supported
+ */
+int pin_thread_to_cpu(int cpu) {
+#if defined(__linux__)
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	return (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0) ? 0 : -1;
+#else
+	(void)cpu;
+	return -1;
+#endif
+}
+
+/**
+ * Pin the calling thread to all allowed CPUs of a NUMA node.
+ *
+ * @param node the node number
+ * @return 0 if successful, -1 if error or not supported
+ */
+int pin_thread_to_node(int node) {
+	pthread_once(&topology_once, init_topology);
+#if defined(__linux__)
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	int n = 0;
+	for (int cpu = 0; cpu < MAX_AFFINITY_CPUS && cpu < CPU_SETSIZE; cpu++) {
+		if (cpu_allowed[cpu] && cpu_node[cpu] == node) {
+			CPU_SET(cpu, &mask);
+			n++;
+		}
+	}
+	if (n == 0) {
+		return -1;
+	}
+	return (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0) ? 0 : -1;
+#else
+	(void)node;
+	return -1;
+#endif
+}
+
+#if defined(__linux__)
+/**
+ * Get the mask of the CPUs the process was allowed.
+ *
+ * @param mask the mask
+ * @return the number of CPUs in the mask
+ */
+static int allowed_mask(cpu_set_t *mask) {
+	pthread_once(&topology_once, init_topology);
+	CPU_ZERO(mask);
+	int n = 0;
+	for (int cpu = 0; cpu < MAX_AFFINITY_CPUS && cpu < CPU_SETSIZE; cpu++) {
+		if (cpu_allowed[cpu]) {
+			CPU_SET(cpu, mask);
+			n++;
+		}
+	}
+	return n;
+}
+#endif
+
+/**
+ * Let the calling thread run on every CPU the process was
+ * allowed when the topology was first read, undoing a pin.
+ *
+ * @return 0 if successful, -1 if error or not supported
+ */
+int unpin_thread(void) {
+#if defined(__linux__)
+	cpu_set_t mask;
+	if (allowed_mask(&mask) == 0) {
+		return -1;
+	}
+	return (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0) ? 0 : -1;
+#else
+	return -1;
+#endif
+}
+
+/**
+ * Let threads created with the attributes run on every CPU the
+ * process was allowed, rather than inherit the creator's pin.
+ *
+ * @param attr the thread attributes
+ * @return 0 if successful, -1 if error or not supported
+ */
+int unpin_thread_attr(pthread_attr_t *attr) {
+#if defined(__linux__)
+	cpu_set_t mask;
+	if (allowed_mask(&mask) == 0) {
+		return -1;
+	}
+	return (pthread_attr_setaffinity_np(attr, sizeof(mask), &mask) == 0) ? 0 : -1;
+#else
+	(void)attr;
+	return -1;
+#endif
+}
@@ -0,0 +1,76 @@
+/*
+ * cpu_affinity.h
+ *
+ * Functions for CPU affinity and NUMA-aware thread placement.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef CPU_AFFINITY_H_
+#define CPU_AFFINITY_H_
+
+#include <pthread.h>
+
+/** maximum number of CPUs handled by the placement functions */
+#define MAX_AFFINITY_CPUS 1024
+
+/**
+ * Get the ordered list of CPUs for a placement specification.
+ *
+ * The specification is one of:
+ *   "none"     -- no placement (returns 0)
+ *   "compact"  -- fill the CPUs of one NUMA node before the next
+ *   "scatter"  -- round-robin across NUMA nodes
+ *   a CPU list -- explicit CPUs, e.g. "0-3,8,10-11"
+ *
+ * Only CPUs the process is allowed to run on are returned.
+ *
+ * @param spec the placement specification
+ * @param cpus storage for the CPU numbers
+ * @param max_cpus capacity of cpus
+ * @return the number of CPUs, 0 for no placement, or -1 if spec is invalid
+ */
+int get_affinity_cpus(const char *spec, int *cpus, int max_cpus);
+
+/**
+ * Get the NUMA node of a CPU.
+ *
+ * @param cpu the CPU number
+ * @return the node number, or 0 if unknown
+ */
+int get_cpu_node(int cpu);
+
+/**
+ * Pin the calling thread to a single CPU.
+ *
+ * @param cpu the CPU number
+ * @return 0 if successful, -1 if error or not supported
+ */
+int pin_thread_to_cpu(int cpu);
+
+/**
+ * Pin the calling thread to all allowed CPUs of a NUMA node.
+ *
+ * @param node the node number
+ * @return 0 if successful, -1 if error or not supported
+ */
+int pin_thread_to_node(int node);
+
+/**
+ * Let the calling thread run on every CPU the process was
+ * allowed when the topology was first read, undoing a pin.
+ *
+ * @return 0 if successful, -1 if error or not supported
+ */
+int unpin_thread(void);
+
+/**
+ * Let threads created with the attributes run on every CPU the
+ * process was allowed, rather than inherit the creator's pin.
+ *
+ * @param attr the thread attributes
+ * @return 0 if successful, -1 if error or not supported
+ */
+int unpin_thread_attr(pthread_attr_t *attr);
+
+#endif /* CPU_AFFINITY_H_ */
@@ -0,0 +1,678 @@
+/*
+ * dir_listing.c
+ *
+ * Rendering and caching of HTML directory listings.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "dir_listing.h"
+#include "http_server.h"
+#include "server_stats.h"
+#include "single_flight.h"
+#include "time_util.h"
+
+/** A directory entry to list */
+typedef struct ListEntry {
+	union {
+		size_t offset;		/** offset of the name while reading */
+		const char *name;	/** the name once read */
+	};
+	mode_t mode;			/** file mode */
+	off_t size;				/** file size */
+	time_t mtime;			/** last-modified time */
+} ListEntry;
+
+/** The entries of a directory */
+typedef struct EntryList {
+	ListEntry *entries;		/** the entries */
+	size_t count;			/** number of entries */
+	size_t capacity;		/** allocated entries */
+	char *names;			/** the entry names */
+	size_t namesLen;		/** bytes of names used */
+	size_t namesCapacity;	/** bytes of names allocated */
+} EntryList;
+
+/** A rendered listing, shared by the cache and requests sending it */
+typedef struct RenderedListing {
+	char *content;			/** the HTML */
+	size_t contentLen;		/** length of the HTML */
+	int refs;				/** references held */
+} RenderedListing;
+
+/** A cached listing */
+typedef struct ListingSlot {
+	char *uri;						/** the directory URI */
+	size_t page;					/** the page */
+	dev_t dev;						/** device of the directory */
+	ino_t ino;						/** inode of the directory */
+	struct timespec mtime;			/** mtime of the directory when rendered */
+	unsigned long long expiresNs;	/** monotonic time the listing expires */
+	RenderedListing *rendered;		/** the listing, or NULL if empty */
+} ListingSlot;
+
+/** An open directory listing */
+struct DirListing {
+	char *uri;						/** the directory URI */
+	size_t page;					/** the page */
+	size_t pages;					/** number of pages */
+	struct stat dirSb;				/** metadata of the directory */
+	RenderedListing *rendered;		/** the cached listing, or NULL to render */
+	ListingSlot *slot;				/** cache slot to fill, or NULL */
+	EntryList list;					/** the sorted entries to render */
+	size_t first;					/** number of entries shown on every page */
+	size_t start, end;				/** range of entries on the page */
+};
+
+/** the cached listings */
+static ListingSlot *listingSlots;
+static size_t nListingSlots;
+static pthread_mutex_t listingLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** entries per page, or 0 for all */
+static size_t listingPageSize;
+
+/** largest listing that is cached */
+#define MAX_CACHED_LISTING (8*1024*1024)
+
+/** most rows of a listing rendered before it is sent */
+#define MAX_PRERENDERED_ROWS (MAX_CACHED_LISTING / (8*MAXBUF) - 4)
+
+/** listings being read and rendered after a miss */
+static FlightGroup listingFlights = FLIGHT_GROUP_INITIALIZER;
+
+/** maximum age of a cached listing in nanoseconds */
+static unsigned long long listingTtlNs;
+
+/** cache id for statistics */
+static int listingCacheId = -1;
+
+/**
+ * Add an entry to a list.
+ *
+ * @return true if successful
+ */
+static bool addEntry(EntryList *list, const char *name, const struct stat *sb) {
+	size_t nameLen = strlen(name) + 1;
+	if (list->namesLen + nameLen > list->namesCapacity) {
+		size_t n = (list->namesCapacity == 0) ? 4096 : list->namesCapacity * 2;
+		while (n < list->namesLen + nameLen) {
+			n *= 2;
+		}
+		char *names = realloc(list->names, n);
+		if (names == NULL) {
+			return false;
+		}
+		list->names = names;
+		list->namesCapacity = n;
+	}
+	if (list->count == list->capacity) {
+		size_t n = (list->capacity == 0) ? 64 : list->capacity * 2;
+		ListEntry *entries = realloc(list->entries, n * sizeof(ListEntry));
+		if (entries == NULL) {
+			return false;
+		}
+		list->entries = entries;
+		list->capacity = n;
+	}
+	ListEntry *e = &list->entries[list->count++];
+	e->offset = list->namesLen;
+	e->mode = sb->st_mode;
+	e->size = sb->st_size;
+	e->mtime = sb->st_mtim.tv_sec;
+	memcpy(list->names + list->namesLen, name, nameLen);
+	list->namesLen += nameLen;
+	return true;
+}
+
+/**
+ * Look up an entry relative to its directory and add it to a list.
+ * Entries that vanish or cannot be read are skipped.
+ *
+ * @return true if successful
+ */
+static bool listEntry(EntryList *list, int dirfd, const char *name, bool isRoot) {
+	if ((strcmp(name, ".") == 0) || (isRoot && (strcmp(name, "..") == 0))) {
+		return true;
+	}
+	struct stat sb;
+	if (fstatat(dirfd, name, &sb, 0) != 0) {
+		return true;
+	}
+	return addEntry(list, name, &sb);
+}
+
+#if defined(__linux__)
+
+/** A getdents64 record */
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/**
+ * Read the entries of an open directory with getdents64.
+ *
+ * @return true if successful
+ */
+static bool readEntries(int dirfd, EntryList *list, bool isRoot) {
+	char buf[32768] __attribute__((aligned(8)));
+	while (true) {
+		long n = syscall(SYS_getdents64, dirfd, buf, sizeof(buf));
+		if (n < 0) {
+			return false;
+		}
+		if (n == 0) {
+			return true;
+		}
+		for (long off = 0; off < n; ) {
+			struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+			off += d->d_reclen;
+			if (!listEntry(list, dirfd, d->d_name, isRoot)) {
+				return false;
+			}
+		}
+	}
+}
+
+#else
+
+/**
+ * Read the entries of an open directory with readdir.
+ *
+ * @return true if successful
+ */
+static bool readEntries(int dirfd, EntryList *list, bool isRoot) {
+	int fd = dup(dirfd);
+	DIR *dir = (fd < 0) ? NULL : fdopendir(fd);
+	if (dir == NULL) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+	bool ok = true;
+	struct dirent *d;
+	while (ok && ((d = readdir(dir)) != NULL)) {
+		ok = listEntry(list, dirfd, d->d_name, isRoot);
+	}
+	closedir(dir);
+	return ok;
+}
+
+#endif
+
+/**
+ * Order entries by name, with the parent directory first.
+ */
+static int compareEntries(const void *a, const void *b) {
+	const char *na = ((const ListEntry *)a)->name, *nb = ((const ListEntry *)b)->name;
+	bool pa = (strcmp(na, "..") == 0), pb = (strcmp(nb, "..") == 0);
+	if (pa || pb) {
+		return pb - pa;
+	}
+	return strcmp(na, nb);
+}
+
+
+/**
+ * Release a reference to a rendered listing.
+ */
+static void releaseRendered(RenderedListing *rendered) {
+	if ((rendered != NULL) && (__atomic_sub_fetch(&rendered->refs, 1, __ATOMIC_ACQ_REL) == 0)) {
+		free(rendered->content);
+		free(rendered);
+	}
+}
+
+/**
+ * Find the cache slot of a listing.
+ */
+static ListingSlot *findSlot(const char *uri, size_t page) {
+	uint64_t h = 0xcbf29ce484222325ULL ^ page;
+	for (const char *p = uri; *p != '\0'; p++) {
+		h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+	}
+	return &listingSlots[h % nListingSlots];
+}
+
+/**
+ * Find the cached listing of a directory page, if current.
+ *
+ * @param listing the listing, with its page and directory metadata
+ * @return the rendered listing, referenced, or NULL if none
+ */
+static RenderedListing *findRendered(DirListing *listing) {
+	ListingSlot *slot = findSlot(listing->uri, listing->page);
+	const struct stat *dirSb = &listing->dirSb;
+	unsigned long long now = monotonicTimeNs();
+	RenderedListing *rendered = NULL;
+	pthread_mutex_lock(&listingLock);
+	if ((slot->rendered != NULL) && (slot->page == listing->page) && (strcmp(slot->uri, listing->uri) == 0)
+		&& (slot->dev == dirSb->st_dev) && (slot->ino == dirSb->st_ino)
+		&& (slot->mtime.tv_sec == dirSb->st_mtim.tv_sec)
+		&& (slot->mtime.tv_nsec == dirSb->st_mtim.tv_nsec) && (now < slot->expiresNs)) {
+		rendered = slot->rendered;
+		__atomic_add_fetch(&rendered->refs, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&listingLock);
+	return rendered;
+}
+
+/**
+ * Store a rendered listing in the cache slot of its listing. The
+ * slot takes over a reference to the rendered listing.
+ *
+ * @param listing the listing
+ * @param rendered the rendered listing
+ * @return true if stored
+ */
+static bool storeListing(DirListing *listing, RenderedListing *rendered) {
+	char *slotUri = strdup(listing->uri);
+	if (slotUri == NULL) {
+		return false;
+	}
+	ListingSlot *slot = listing->slot;
+	pthread_mutex_lock(&listingLock);
+	RenderedListing *old = slot->rendered;
+	free(slot->uri);
+	slot->uri = slotUri;
+	slot->page = listing->page;
+	slot->dev = listing->dirSb.st_dev;
+	slot->ino = listing->dirSb.st_ino;
+	slot->mtime = listing->dirSb.st_mtim;
+	slot->expiresNs = monotonicTimeNs() + listingTtlNs;
+	slot->rendered = rendered;
+	pthread_mutex_unlock(&listingLock);
+	releaseRendered(old);
+	return true;
+}
+
+static bool renderListing(DirListing *listing, FILE *out, FILE *copy);
+
+/**
+ * Render a listing in memory and cache it before it is sent, so
+ * requests waiting for it need not wait for it to be sent.
+ *
+ * @param listing the listing, with its cache slot
+ */
+static void prerenderListing(DirListing *listing) {
+	RenderedListing *rendered = calloc(1, sizeof(RenderedListing));
+	if (rendered == NULL) {
+		return;
+	}
+	FILE *out = open_memstream(&rendered->content, &rendered->contentLen);
+	if (out == NULL) {
+		free(rendered);
+		return;
+	}
+	bool ok = renderListing(listing, out, NULL);
+	fclose(out);
+	if (!ok) {
+		free(rendered->content);
+		free(rendered);
+		return;
+	}
+	// one reference for the listing, one for the cache
+	rendered->refs = 2;
+	if (!storeListing(listing, rendered)) {
+		rendered->refs = 1;
+	}
+	listing->rendered = rendered;
+}
+
+/**
+ * Close a listing returned by openDirListing().
+ *
+ * @param listing the listing
+ */
+void closeDirListing(DirListing *listing) {
+	if (listing != NULL) {
+		releaseRendered(listing->rendered);
+		free(listing->list.entries);
+		free(listing->list.names);
+		free(listing->uri);
+		free(listing);
+	}
+}
+
+/**
+ * Open the listing of a directory page. A cached listing is used
+ * if current; otherwise the entries are read and sorted, ready to
+ * be rendered as the listing is written.
+ *
+ * @param uri the directory URI shown in the listing
+ * @param dirPath the directory path
+ * @param page the page number starting with 1, or 0 for the first
+ * @return the listing, or NULL with errno set if error (ENOENT
+ *   if the page is past the end); close with closeDirListing()
+ */
+DirListing *openDirListing(const char *uri, const char *dirPath, size_t page) {
+	DirListing *listing = calloc(1, sizeof(DirListing));
+	if ((listing == NULL) || ((listing->uri = strdup(uri)) == NULL)) {
+		free(listing);
+		return NULL;
+	}
+	listing->page = (page == 0) ? 1 : page;
+
+	int dirfd = open(dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if ((dirfd < 0) || (fstat(dirfd, &listing->dirSb) != 0)) {
+		int error = errno;
+		if (dirfd >= 0) {
+			close(dirfd);
+		}
+		closeDirListing(listing);
+		errno = error;
+		return NULL;
+	}
+	struct stat *dirSb = &listing->dirSb;
+
+	// a listing is current while its directory is unchanged
+	Flight flight;
+	char key[PATH_MAX + 24];
+	bool leader = false;
+	if (listingSlots != NULL) {
+		listing->rendered = findRendered(listing);
+		recordCacheLookup(listingCacheId, listing->rendered != NULL);
+		if (listing->rendered != NULL) {
+			close(dirfd);
+			return listing;
+		}
+
+		// a directory changed within the last second may change again
+		// without a visible mtime change, so do not trust its listing
+		struct timespec wall;
+		clock_gettime(CLOCK_REALTIME, &wall);
+		if (wall.tv_sec > dirSb->st_mtim.tv_sec + 1) {
+			listing->slot = findSlot(uri, listing->page);
+		}
+
+		// concurrent misses of a listing wait for one to read and
+		// render it, unless it is too long to render before sending
+		int keyLen = snprintf(key, sizeof(key), "%zu %s", listing->page, uri);
+		if ((listing->slot != NULL) && (keyLen < (int)sizeof(key))) {
+			leader = boardFlight(&listingFlights, key, (size_t)keyLen, &flight);
+			if (!leader) {
+				recordCacheCoalesced(listingCacheId);
+				if ((listing->rendered = findRendered(listing)) != NULL) {
+					close(dirfd);
+					return listing;
+				}
+			}
+		}
+	}
+
+	EntryList *list = &listing->list;
+	bool ok = readEntries(dirfd, list, strcmp(uri, "/") == 0);
+	int error = errno;
+	close(dirfd);
+	if (!ok) {
+		if (leader) {
+			landFlight(&listingFlights, &flight);
+		}
+		closeDirListing(listing);
+		errno = error;
+		return NULL;
+	}
+	for (size_t i = 0; i < list->count; i++) {
+		list->entries[i].name = list->names + list->entries[i].offset;
+	}
+	qsort(list->entries, list->count, sizeof(ListEntry), compareEntries);
+
+	// the parent directory is shown on every page
+	listing->first = ((list->count > 0) && (strcmp(list->entries[0].name, "..") == 0)) ? 1 : 0;
+	size_t nfiles = list->count - listing->first;
+	listing->pages = 1;
+	listing->start = listing->first;
+	listing->end = list->count;
+	if ((listingPageSize > 0) && (nfiles > listingPageSize)) {
+		listing->pages = (nfiles + listingPageSize - 1) / listingPageSize;
+		listing->start = listing->first + (listing->page - 1) * listingPageSize;
+		if (listing->start + listingPageSize < list->count) {
+			listing->end = listing->start + listingPageSize;
+		}
+	}
+	if (listing->page > listing->pages) {
+		if (leader) {
+			landFlight(&listingFlights, &flight);
+		}
+		closeDirListing(listing);
+		errno = ENOENT;
+		return NULL;
+	}
+
+	// the requests waiting for this listing find it in the cache
+	if (leader) {
+		if (listing->end - listing->start <= MAX_PRERENDERED_ROWS) {
+			prerenderListing(listing);
+		}
+		landFlight(&listingFlights, &flight);
+	}
+	return listing;
+}
+
+/**
+ * Get the length of a listing, if known before it is written.
+ *
+ * @param listing the listing
+ * @param len the length of the listing
+ * @return true if the length is known (the listing was cached)
+ */
+bool dirListingLength(const DirListing *listing, size_t *len) {
+	if (listing->rendered == NULL) {
+		return false;
+	}
+	*len = listing->rendered->contentLen;
+	return true;
+}
+
+/**
+ * Get the last-modified time of a listing.
+ *
+ * @param listing the listing
+ * @return the last-modified time of the directory
+ */
+time_t dirListingModified(const DirListing *listing) {
+	return listing->dirSb.st_mtim.tv_sec;
+}
+
+/**
+ * Format part of a listing to a stream, and to a copy being
+ * rendered for the cache.
+ *
+ * @return true if successful
+ */
+static bool emit(FILE *out, FILE *copy, const char *fmt, ...) {
+	char buf[8*MAXBUF];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (n < 0) {
+		return false;
+	}
+	if ((size_t)n >= sizeof(buf)) {
+		n = sizeof(buf) - 1;
+	}
+	if (fwrite(buf, 1, n, out) != (size_t)n) {
+		return false;
+	}
+	if (copy != NULL) {
+		fwrite(buf, 1, n, copy);
+	}
+	return true;
+}
+
+/**
+ * Render the table row of an entry.
+ *
+ * @return true if successful
+ */
+static bool renderEntry(FILE *out, FILE *copy, const ListEntry *e) {
+	bool isParent = (strcmp(e->name, "..") == 0);
+
+	char timebuf[MAXBUF];
+	milliTimeToShortHM_Date_Time(e->mtime, timebuf);
+
+	const char *icon = "";
+	if (isParent) {
+		icon = "&#x23ce";
+	} else if (S_ISDIR(e->mode)) {
+		icon = "&#x1F4c1;";
+	}
+
+	return emit(out, copy, "<tr>\n"
+				"<td>%s</td>\n"
+				"<td><a href=\"%s%s\">%s</a></td>\n"
+				"<td align=\"right\">%s</td>\n"
+				"<td align=\"right\">%lu</td>\n"
+				"<td>%s</td>\n"
+				"</tr>\n",
+				icon, e->name, S_ISDIR(e->mode) ? "/" : "",
+				isParent ? "Parent Directory" : e->name,
+				timebuf, (unsigned long)e->size, "");
+}
+
+/**
+ * Render a listing to a stream, row by row.
+ *
+ * @return true if successful
+ */
+static bool renderListing(DirListing *listing, FILE *out, FILE *copy) {
+	const char *uri = listing->uri;
+	if (!emit(out, copy,
+			  "<html>"
+			  "<head><title>index of %s</title></head>"
+			  "<body>"
+			  "<h1>Index of %s</h1>\n"
+			  "<table>\n"
+			  "<tr>\n"
+			  "<th valign=\"top\"></th>"
+			  "<th>Name</th>"
+			  "<th>Last modified</th>"
+			  "<th>Size</th>"
+			  "<th>Description</th>"
+			  "\n</tr>\n<tr>"
+			  "<td colspan=\"5\"><hr></td></tr>\n"
+			  , uri, uri)) {
+		return false;
+	}
+
+	EntryList *list = &listing->list;
+	for (size_t i = 0; i < listing->first; i++) {
+		if (!renderEntry(out, copy, &list->entries[i])) {
+			return false;
+		}
+	}
+	for (size_t i = listing->start; i < listing->end; i++) {
+		if (!renderEntry(out, copy, &list->entries[i])) {
+			return false;
+		}
+		// stop copying a listing too large to cache
+		if ((copy != NULL) && (ftell(copy) > MAX_CACHED_LISTING)) {
+			copy = NULL;
+			listing->slot = NULL;
+		}
+	}
+
+	size_t page = listing->page, pages = listing->pages;
+	if (pages > 1) {
+		char prev[MAXBUF] = "", next[MAXBUF] = "";
+		if (page > 1) {
+			sprintf(prev, "<a href=\"?page=%zu\">&laquo; Previous</a> ", page - 1);
+		}
+		if (page < pages) {
+			sprintf(next, " <a href=\"?page=%zu\">Next &raquo;</a>", page + 1);
+		}
+		if (!emit(out, copy, "<tr><td colspan=\"5\">%sPage %zu of %zu%s</td></tr>\n",
+				  prev, page, pages, next)) {
+			return false;
+		}
+	}
+
+	return emit(out, copy, "<tr>"
+				" <td colspan=\"5\"><hr></td>\n"
+				"</tr>\n"
+				"</body>\n"
+				"</html>\n"
+				);
+}
+
+/**
+ * Write a listing to a stream. A listing that was not cached is
+ * rendered as it is written, so memory use and time to the first
+ * byte do not grow with the size of the listing.
+ *
+ * @param listing the listing
+ * @param out the stream
+ * @return true if successful
+ */
+bool writeDirListing(DirListing *listing, FILE *out) {
+	if (listing->rendered != NULL) {
+		RenderedListing *rendered = listing->rendered;
+		return fwrite(rendered->content, 1, rendered->contentLen, out) == rendered->contentLen;
+	}
+
+	// keep a copy for the cache while rendering
+	RenderedListing *rendered = NULL;
+	FILE *copy = NULL;
+	if ((listing->slot != NULL) && ((rendered = calloc(1, sizeof(RenderedListing))) != NULL)) {
+		copy = open_memstream(&rendered->content, &rendered->contentLen);
+	}
+	bool ok = renderListing(listing, out, copy);
+	if (copy != NULL) {
+		fclose(copy);
+	}
+	// the slot is dropped if the listing grew too large for the cache
+	if (rendered != NULL) {
+		rendered->refs = 1;
+		if (!ok || (copy == NULL) || (listing->slot == NULL) || !storeListing(listing, rendered)) {
+			releaseRendered(rendered);
+		}
+	}
+	return ok;
+}
+
+/**
+ * Initialize listings.
+ *
+ * @param cacheSize number of cached listings; 0 disables the cache
+ * @param pageSize entries per page; 0 lists all entries on one page
+ * @param ttlMs maximum age of a cached listing
+ * @return true if successful
+ */
+bool initDirListings(size_t cacheSize, size_t pageSize, long ttlMs) {
+	listingPageSize = pageSize;
+	listingTtlNs = (unsigned long long)ttlMs * 1000000ULL;
+	if (cacheSize > 0) {
+		listingSlots = calloc(cacheSize, sizeof(ListingSlot));
+		if (listingSlots == NULL) {
+			return false;
+		}
+		nListingSlots = cacheSize;
+		listingCacheId = registerStatsCache("dir_listing");
+	}
+	return true;
+}
@@ -0,0 +1,91 @@
+/*
+ * dir_listing.h
+ *
+ * Rendering and caching of HTML directory listings.
+ *
+ * A listing reads the directory once with getdents64 and looks up
+ * each entry relative to the open directory with fstatat, then sorts
+ * the entries by name. The HTML is rendered row by row as it is
+ * written, and a copy is cached by URI and page. A cached listing
+ * stays valid while the directory's mtime is unchanged, so a repeat
+ * listing costs one fstat. Because changing a file in place does not
+ * touch its directory's mtime, cached listings also expire after a TTL.
+ *
+ * Concurrent misses of a listing wait for one of them to read the
+ * directory. That one renders the listing in memory and caches it
+ * before sending it, unless it has too many rows, so the others
+ * find it in the cache however slowly it is sent.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef DIR_LISTING_H_
+#define DIR_LISTING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+/** An open directory listing */
+typedef struct DirListing DirListing;
+
+/**
+ * Initialize listings.
+ *
+ * @param cacheSize number of cached listings; 0 disables the cache
+ * @param pageSize entries per page; 0 lists all entries on one page
+ * @param ttlMs maximum age of a cached listing
+ * @return true if successful
+ */
+bool initDirListings(size_t cacheSize, size_t pageSize, long ttlMs);
+
+/**
+ * Open the listing of a directory page. A cached listing is used
+ * if current; otherwise the entries are read and sorted, ready to
+ * be rendered as the listing is written.
+ *
+ * @param uri the directory URI shown in the listing
+ * @param dirPath the directory path
+ * @param page the page number starting with 1, or 0 for the first
+ * @return the listing, or NULL with errno set if error (ENOENT
+ *   if the page is past the end); close with closeDirListing()
+ */
+DirListing *openDirListing(const char *uri, const char *dirPath, size_t page);
+
+/**
+ * Get the length of a listing, if known before it is written.
+ *
+ * @param listing the listing
+ * @param len the length of the listing
+ * @return true if the length is known (the listing was cached)
+ */
+bool dirListingLength(const DirListing *listing, size_t *len);
+
+/**
+ * Get the last-modified time of a listing.
+ *
+ * @param listing the listing
+ * @return the last-modified time of the directory
+ */
+time_t dirListingModified(const DirListing *listing);
+
+/**
+ * Write a listing to a stream. A listing that was not cached is
+ * rendered as it is written, so memory use and time to the first
+ * byte do not grow with the size of the listing.
+ *
+ * @param listing the listing
+ * @param out the stream
+ * @return true if successful
+ */
+bool writeDirListing(DirListing *listing, FILE *out);
+
+/**
+ * Close a listing returned by openDirListing().
+ *
+ * @param listing the listing
+ */
+void closeDirListing(DirListing *listing);
+
+#endif /* DIR_LISTING_H_ */
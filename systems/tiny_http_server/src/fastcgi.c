@@ -0,0 +1,1070 @@
+/*
+ * fastcgi.c
+ *
+ * Dynamic handlers served by pools of long-lived FastCGI worker
+ * processes.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "cpu_affinity.h"
+#include "fastcgi.h"
+#include "properties.h"
+#include "time_util.h"
+
+/** FastCGI protocol version, record types, role and flags */
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_ABORT_REQUEST 2
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_GET_VALUES 9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+
+/** protocol status of a request the worker cannot multiplex */
+#define FCGI_CANT_MPX_CONN 1
+
+/** bytes of a record header */
+#define FCGI_HEADER_LEN 8
+
+/** most content bytes of a record */
+#define FCGI_MAX_CONTENT 65535
+
+/** the socket descriptor a worker accepts connections on */
+#define FCGI_LISTENSOCK_FILENO 0
+
+/** most output bytes queued for a request before its worker waits */
+#define FCGI_QUEUE_LIMIT (256*1024)
+
+/** most words of a worker command */
+#define MAX_FCGI_ARGS 16
+
+/** shortest run of a worker restarted at once */
+#define FCGI_RESTART_NS 1000000000ULL
+
+/** Output received for a request and not yet read */
+typedef struct FcgiChunk {
+	struct FcgiChunk *next;				/** next output */
+	size_t start;						/** first unread byte */
+	size_t len;							/** end of the bytes */
+	char data[];						/** the bytes */
+} FcgiChunk;
+
+typedef struct FcgiConn FcgiConn;
+
+/** A worker process of a handler */
+typedef struct FcgiWorker {
+	FcgiHandler *handler;				/** the handler */
+	unsigned index;						/** position in the handler */
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];	/** the socket path */
+	pid_t pid;							/** the process, or 0 if not running */
+	unsigned long long startNs;			/** time the process started */
+	unsigned long served;				/** requests since it started */
+	bool retiring;						/** takes no further requests */
+	bool stopped;						/** told to exit */
+	FcgiConn *conn;						/** the connection, or NULL if none */
+} FcgiWorker;
+
+/** A connection to a worker */
+struct FcgiConn {
+	FcgiWorker *worker;					/** the worker */
+	int fd;								/** the socket */
+	pthread_mutex_t writeLock;			/** held while a record is written */
+	unsigned refs;						/** the reader and the requests using it */
+	unsigned active;					/** requests in flight */
+	unsigned maxRequests;				/** most requests in flight */
+	bool broken;						/** takes no further requests */
+	FcgiRequest *requests[MAX_FCGI_REQUESTS + 1];	/** requests in flight by id */
+};
+
+/** A request in flight */
+struct FcgiRequest {
+	FcgiConn *conn;						/** the connection */
+	unsigned id;						/** the request id */
+	pthread_cond_t ready;				/** signaled when output arrives or the request ends */
+	pthread_cond_t drained;				/** signaled when queued output is read */
+	FcgiChunk *head;					/** first output not yet read */
+	FcgiChunk *tail;					/** last output */
+	size_t queued;						/** output bytes not yet read */
+	bool ended;							/** the worker finished the request */
+	bool refused;						/** the worker refused the request */
+	bool abandoned;						/** the caller gave up on the request */
+	bool paramsSent;					/** the parameters have been sent */
+	size_t paramsLen;					/** bytes of params */
+	unsigned char params[FCGI_PARAMS_SIZE];	/** parameters not yet sent */
+};
+
+/** A URI prefix or extension served by workers */
+struct FcgiHandler {
+	char pattern[MAX_PROP_VAL];			/** the prefix, or the extension with its '.' */
+	size_t patternLen;					/** length of the pattern */
+	bool extension;						/** the pattern is an extension */
+	char command[MAX_PROP_VAL];			/** the words of the command */
+	char *argv[MAX_FCGI_ARGS + 1];		/** the command arguments */
+	pthread_mutex_t lock;				/** guards the workers, connections and requests */
+	pthread_cond_t space;				/** signaled when a worker can take a request */
+	FcgiWorker workers[MAX_FCGI_WORKERS];	/** the workers */
+	unsigned nworkers;					/** number of workers */
+	unsigned next;						/** first worker considered by the next request */
+};
+
+/** the handlers */
+static FcgiHandler handlers[MAX_FCGI_HANDLERS];
+static unsigned nhandlers;
+
+/** requests served before a worker is restarted, or 0 for no limit */
+static unsigned long workerMaxRequests;
+
+/** wait for a worker in milliseconds, or 0 for no limit */
+static long fcgiTimeoutMs;
+
+/**
+ * Get the time a wait of a number of milliseconds from now ends.
+ *
+ * @param deadline the end of the wait
+ * @param ms the wait, or 0 for no limit
+ * @return true if the wait has a limit
+ */
+static bool fcgiDeadline(struct timespec *deadline, long ms) {
+	if (ms <= 0) {
+		return false;
+	}
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += ms / 1000;
+	deadline->tv_nsec += (ms % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+	return true;
+}
+
+/**
+ * Write a record to a worker. Records of concurrent requests
+ * interleave whole.
+ *
+ * @param conn the connection
+ * @param type the record type
+ * @param id the request id
+ * @param content the content
+ * @param len the content length (at most FCGI_MAX_CONTENT)
+ * @return true if written
+ */
+static bool writeRecord(FcgiConn *conn, int type, unsigned id, const void *content, size_t len) {
+	unsigned char header[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, type, id >> 8, id & 0xff, len >> 8, len & 0xff, 0, 0
+	};
+	struct iovec iov[2] = {
+		{ .iov_base = header, .iov_len = sizeof(header) },
+		{ .iov_base = (void *)content, .iov_len = len }
+	};
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+	bool ok = true;
+	pthread_mutex_lock(&conn->writeLock);
+	while (msg.msg_iovlen > 0) {
+		ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ok = false;
+			break;
+		}
+		while ((msg.msg_iovlen > 0) && ((size_t)n >= msg.msg_iov->iov_len)) {
+			n -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+			msg.msg_iov->iov_len -= n;
+		}
+	}
+	pthread_mutex_unlock(&conn->writeLock);
+	return ok;
+}
+
+/**
+ * Read exactly a number of bytes from a worker.
+ *
+ * @return true if read, false at end of file or error
+ */
+static bool readFully(int fd, void *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = recv(fd, buf, len, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		buf = (char *)buf + n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Encode a name-value pair length.
+ *
+ * @return the number of bytes
+ */
+static size_t encodeLength(unsigned char *p, size_t len) {
+	if (len < 0x80) {
+		p[0] = len;
+		return 1;
+	}
+	p[0] = 0x80 | (len >> 24);
+	p[1] = len >> 16;
+	p[2] = len >> 8;
+	p[3] = len;
+	return 4;
+}
+
+/**
+ * Decode a name-value pair length.
+ *
+ * @return the number of bytes, or 0 if truncated
+ */
+static size_t decodeLength(const unsigned char *p, const unsigned char *end, size_t *len) {
+	if ((p < end) && (p[0] < 0x80)) {
+		*len = p[0];
+		return 1;
+	}
+	if (end - p < 4) {
+		return 0;
+	}
+	*len = ((size_t)(p[0] & 0x7f) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	return 4;
+}
+
+/**
+ * Release a reference to a connection, closing it with the last.
+ * The handler lock is held.
+ */
+static void releaseConn(FcgiConn *conn) {
+	if (--conn->refs == 0) {
+		close(conn->fd);
+		pthread_mutex_destroy(&conn->writeLock);
+		free(conn);
+	}
+}
+
+/**
+ * Stop a worker that has finished its last request: its connection
+ * is closed and the process told to exit, to be restarted. The
+ * handler lock is held.
+ */
+static void retireWorker(FcgiWorker *worker) {
+	FcgiConn *conn = worker->conn;
+	if (conn != NULL) {
+		worker->conn = NULL;
+		conn->broken = true;
+		shutdown(conn->fd, SHUT_RDWR);
+	}
+	if ((worker->pid > 0) && !worker->stopped) {
+		worker->stopped = true;
+		fprintf(stderr, "FastCGI worker %s.%u retired after %lu requests\n",
+				worker->handler->argv[0], worker->index, worker->served);
+		kill(worker->pid, SIGTERM);
+	}
+}
+
+/**
+ * Free the output queued for a request.
+ */
+static void freeChunks(FcgiRequest *req) {
+	while (req->head != NULL) {
+		FcgiChunk *chunk = req->head;
+		req->head = chunk->next;
+		free(chunk);
+	}
+	req->tail = NULL;
+	req->queued = 0;
+}
+
+/**
+ * Remove a request from its connection and free it. The handler
+ * lock is held.
+ */
+static void releaseRequest(FcgiRequest *req) {
+	FcgiConn *conn = req->conn;
+	FcgiWorker *worker = conn->worker;
+	conn->requests[req->id] = NULL;
+	conn->active--;
+	freeChunks(req);
+	pthread_cond_destroy(&req->ready);
+	pthread_cond_destroy(&req->drained);
+	free(req);
+	if (worker->retiring && ((worker->conn == NULL) || ((worker->conn == conn) && (conn->active == 0)))) {
+		retireWorker(worker);
+	}
+	pthread_cond_broadcast(&worker->handler->space);
+	releaseConn(conn);
+}
+
+/**
+ * Note the capacity a worker reports in reply to FCGI_GET_VALUES.
+ * The handler lock is held.
+ */
+static void setConnCapacity(FcgiConn *conn, const unsigned char *p, const unsigned char *end) {
+	bool multiplexed = false;
+	unsigned long maxReqs = MAX_FCGI_REQUESTS;
+	while (p < end) {
+		size_t nameLen, valueLen, n;
+		if ((n = decodeLength(p, end, &nameLen)) == 0) {
+			break;
+		}
+		p += n;
+		if ((n = decodeLength(p, end, &valueLen)) == 0) {
+			break;
+		}
+		p += n;
+		if ((size_t)(end - p) < nameLen + valueLen) {
+			break;
+		}
+		char value[32];
+		snprintf(value, sizeof(value), "%.*s", (int)valueLen, p + nameLen);
+		if ((nameLen == 15) && (memcmp(p, "FCGI_MPXS_CONNS", 15) == 0)) {
+			multiplexed = (atoi(value) != 0);
+		} else if ((nameLen == 13) && (memcmp(p, "FCGI_MAX_REQS", 13) == 0) && (atol(value) > 0)) {
+			maxReqs = atol(value);
+		}
+		p += nameLen + valueLen;
+	}
+	conn->maxRequests = !multiplexed ? 1 : (maxReqs < MAX_FCGI_REQUESTS) ? maxReqs : MAX_FCGI_REQUESTS;
+	pthread_cond_broadcast(&conn->worker->handler->space);
+}
+
+/**
+ * Read the records of a worker connection, passing the output of
+ * each request to it. When the connection closes, the requests in
+ * flight fail.
+ */
+static void *fcgiConnReader(void *arg) {
+	FcgiConn *conn = arg;
+	FcgiWorker *worker = conn->worker;
+	FcgiHandler *handler = worker->handler;
+	unsigned char header[FCGI_HEADER_LEN];
+	unsigned char *content = malloc(FCGI_MAX_CONTENT + 256);
+
+	while ((content != NULL) && readFully(conn->fd, header, sizeof(header)) && (header[0] == FCGI_VERSION_1)) {
+		unsigned type = header[1];
+		unsigned id = (header[2] << 8) | header[3];
+		size_t len = (header[4] << 8) | header[5];
+		if (!readFully(conn->fd, content, len + header[6])) {
+			break;
+		}
+		if (type == FCGI_STDERR) {
+			fprintf(stderr, "FastCGI worker %s.%u: %.*s", handler->argv[0], worker->index, (int)len, content);
+			continue;
+		}
+
+		pthread_mutex_lock(&handler->lock);
+		FcgiRequest *req = (id <= MAX_FCGI_REQUESTS) ? conn->requests[id] : NULL;
+		if (type == FCGI_GET_VALUES_RESULT) {
+			setConnCapacity(conn, content, content + len);
+		} else if ((type == FCGI_STDOUT) && (req != NULL) && (len > 0)) {
+			// a client slow to read holds back the worker, not memory
+			while ((req->queued >= FCGI_QUEUE_LIMIT) && !req->abandoned) {
+				pthread_cond_wait(&req->drained, &handler->lock);
+			}
+			FcgiChunk *chunk = req->abandoned ? NULL : malloc(sizeof(FcgiChunk) + len);
+			if (chunk != NULL) {
+				memcpy(chunk->data, content, len);
+				chunk->next = NULL;
+				chunk->start = 0;
+				chunk->len = len;
+				if (req->tail == NULL) {
+					req->head = chunk;
+				} else {
+					req->tail->next = chunk;
+				}
+				req->tail = chunk;
+				req->queued += len;
+				pthread_cond_signal(&req->ready);
+			}
+		} else if ((type == FCGI_END_REQUEST) && (req != NULL) && (len >= 8)) {
+			if (content[4] != 0) {
+				req->refused = true;
+				if (content[4] == FCGI_CANT_MPX_CONN) {
+					conn->maxRequests = 1;
+				}
+			}
+			req->ended = true;
+			if (req->abandoned) {
+				releaseRequest(req);
+			} else {
+				pthread_cond_signal(&req->ready);
+			}
+		}
+		pthread_mutex_unlock(&handler->lock);
+	}
+	free(content);
+
+	// the worker closed the connection or exited
+	pthread_mutex_lock(&handler->lock);
+	conn->broken = true;
+	if (worker->conn == conn) {
+		worker->conn = NULL;
+	}
+	for (unsigned id = 1; id <= MAX_FCGI_REQUESTS; id++) {
+		FcgiRequest *req = conn->requests[id];
+		if (req == NULL) {
+			continue;
+		}
+		if (req->abandoned) {
+			releaseRequest(req);
+		} else {
+			pthread_cond_signal(&req->ready);
+		}
+	}
+	pthread_cond_broadcast(&handler->space);
+	releaseConn(conn);
+	pthread_mutex_unlock(&handler->lock);
+	return NULL;
+}
+
+/**
+ * Open a connection to a worker and ask its capacity. Until the
+ * worker replies, it is sent one request at a time. The handler
+ * lock is held.
+ *
+ * @return the connection, or NULL with errno set if error
+ */
+static FcgiConn *connectWorker(FcgiWorker *worker) {
+	FcgiConn *conn = calloc(1, sizeof(FcgiConn));
+	if (conn == NULL) {
+		return NULL;
+	}
+	conn->worker = worker;
+	conn->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strcpy(addr.sun_path, worker->path);
+	if ((conn->fd < 0) || (connect(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+		int err = errno;
+		if (conn->fd >= 0) {
+			close(conn->fd);
+		}
+		free(conn);
+		errno = err;
+		return NULL;
+	}
+	if (fcgiTimeoutMs > 0) {
+		struct timeval tv = { .tv_sec = fcgiTimeoutMs / 1000, .tv_usec = (fcgiTimeoutMs % 1000) * 1000 };
+		setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+	pthread_mutex_init(&conn->writeLock, NULL);
+	conn->maxRequests = 1;
+	conn->refs = 1;
+
+	// the reader runs on any CPU, not on that of the worker connecting
+	pthread_t reader;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	unpin_thread_attr(&attr);
+	int rc = pthread_create(&reader, &attr, fcgiConnReader, conn);
+	pthread_attr_destroy(&attr);
+	if (rc != 0) {
+		close(conn->fd);
+		pthread_mutex_destroy(&conn->writeLock);
+		free(conn);
+		errno = EAGAIN;
+		return NULL;
+	}
+	pthread_detach(reader);
+
+	static const unsigned char query[] = "\x0f\x00" "FCGI_MPXS_CONNS" "\x0d\x00" "FCGI_MAX_REQS";
+	writeRecord(conn, FCGI_GET_VALUES, 0, query, sizeof(query) - 1);
+	worker->conn = conn;
+	return conn;
+}
+
+/**
+ * Start a worker process listening on a new socket.
+ *
+ * @return true if started
+ */
+static bool spawnWorker(FcgiWorker *worker) {
+	unlink(worker->path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strcpy(addr.sun_path, worker->path);
+	if ((fd < 0) || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, SOMAXCONN) != 0)) {
+		perror(worker->path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+
+	char **argv = worker->handler->argv;
+	pid_t pid = fork();
+	if (pid == 0) {
+		// the worker gets only its socket, and exits with the server
+		if (fd == FCGI_LISTENSOCK_FILENO) {
+			fcntl(fd, F_SETFD, 0);
+		} else {
+			dup2(fd, FCGI_LISTENSOCK_FILENO);
+		}
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 34))
+		close_range(3, ~0U, 0);
+#endif
+		sigset_t none;
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	close(fd);
+	if (pid < 0) {
+		perror(argv[0]);
+		return false;
+	}
+	worker->pid = pid;
+	worker->startNs = monotonicTimeNs();
+	worker->served = 0;
+	worker->retiring = false;
+	worker->stopped = false;
+	return true;
+}
+
+/**
+ * Find the worker of a process.
+ *
+ * @return the worker, or NULL if none
+ */
+static FcgiWorker *findWorker(pid_t pid) {
+	for (unsigned h = 0; h < nhandlers; h++) {
+		for (unsigned w = 0; w < handlers[h].nworkers; w++) {
+			if (handlers[h].workers[w].pid == pid) {
+				return &handlers[h].workers[w];
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Restart workers as they exit. A worker that exits soon after
+ * starting is restarted after a pause, so a broken program does not
+ * spin; the other workers of its handler keep serving meanwhile.
+ */
+static void *fcgiSupervisor(void *arg) {
+	(void)arg;
+	while (true) {
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == ECHILD) {
+				sleep(1);
+			}
+			continue;
+		}
+		FcgiWorker *worker = findWorker(pid);
+		if (worker == NULL) {
+			continue;
+		}
+		FcgiHandler *handler = worker->handler;
+		pthread_mutex_lock(&handler->lock);
+		worker->pid = 0;
+		if (worker->conn != NULL) {
+			worker->conn->broken = true;
+			shutdown(worker->conn->fd, SHUT_RDWR);
+			worker->conn = NULL;
+		}
+		bool stopped = worker->stopped;
+		bool early = !stopped && ((monotonicTimeNs() - worker->startNs) < FCGI_RESTART_NS);
+		pthread_mutex_unlock(&handler->lock);
+
+		if (!stopped) {
+			if (WIFSIGNALED(status)) {
+				fprintf(stderr, "FastCGI worker %s.%u killed by signal %d\n",
+						handler->argv[0], worker->index, WTERMSIG(status));
+			} else {
+				fprintf(stderr, "FastCGI worker %s.%u exited with status %d\n",
+						handler->argv[0], worker->index, WEXITSTATUS(status));
+			}
+		}
+		bool started = false;
+		while (!started) {
+			if (early) {
+				sleep(1);
+			}
+			pthread_mutex_lock(&handler->lock);
+			started = spawnWorker(worker);
+			pthread_cond_broadcast(&handler->space);
+			pthread_mutex_unlock(&handler->lock);
+			early = true;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Add a FastCGI handler: a URI prefix or "*." extension followed by
+ * the worker command and its arguments, separated by spaces, such as
+ * "*.fcgi /usr/local/bin/app --quiet". Workers accept connections on
+ * the socket passed as their standard input, as FastCGI specifies.
+ *
+ * @param handler the handler
+ * @return true if successful, false with errno set if invalid
+ */
+bool addFcgiHandler(const char *handler) {
+	FcgiHandler *h = &handlers[nhandlers];
+	if ((nhandlers == MAX_FCGI_HANDLERS) || (strlen(handler) >= sizeof(h->command))) {
+		errno = EINVAL;
+		return false;
+	}
+	memset(h, 0, sizeof(FcgiHandler));
+	strcpy(h->command, handler);
+
+	char *save;
+	char *pattern = strtok_r(h->command, " \t", &save);
+	if ((pattern == NULL) || ((*pattern != '/') && (strncmp(pattern, "*.", 2) != 0))) {
+		errno = EINVAL;
+		return false;
+	}
+	h->extension = (*pattern == '*');
+	strcpy(h->pattern, h->extension ? pattern+1 : pattern);
+	h->patternLen = strlen(h->pattern);
+
+	unsigned argc = 0;
+	for (char *word = strtok_r(NULL, " \t", &save); word != NULL; word = strtok_r(NULL, " \t", &save)) {
+		if (argc == MAX_FCGI_ARGS) {
+			errno = EINVAL;
+			return false;
+		}
+		h->argv[argc++] = word;
+	}
+	if (argc == 0) {
+		errno = EINVAL;
+		return false;
+	}
+	pthread_mutex_init(&h->lock, NULL);
+	pthread_cond_init(&h->space, NULL);
+	nhandlers++;
+	return true;
+}
+
+/**
+ * Start the workers of the handlers added, and the thread that
+ * restarts them when they exit.
+ *
+ * @param workers the number of worker processes per handler
+ * @param maxRequests requests served before a worker is restarted (0 for no limit)
+ * @param timeoutMs the wait for a worker to take or answer a request (0 for none)
+ * @param socketDir directory of the worker sockets
+ * @return true if successful
+ */
+bool initFastCgi(unsigned workers, unsigned long maxRequests, long timeoutMs, const char *socketDir) {
+	workerMaxRequests = maxRequests;
+	fcgiTimeoutMs = timeoutMs;
+	if (nhandlers == 0) {
+		return true;
+	}
+	if (workers == 0) {
+		workers = 1;
+	} else if (workers > MAX_FCGI_WORKERS) {
+		workers = MAX_FCGI_WORKERS;
+	}
+	for (unsigned h = 0; h < nhandlers; h++) {
+		FcgiHandler *handler = &handlers[h];
+		for (unsigned w = 0; w < workers; w++) {
+			FcgiWorker *worker = &handler->workers[w];
+			worker->handler = handler;
+			worker->index = w;
+			if (snprintf(worker->path, sizeof(worker->path), "%s/fcgi-%d-%u-%u.sock",
+						 socketDir, (int)getpid(), h, w) >= (int)sizeof(worker->path)) {
+				errno = ENAMETOOLONG;
+				return false;
+			}
+			if (!spawnWorker(worker)) {
+				return false;
+			}
+			handler->nworkers++;
+		}
+	}
+	pthread_t supervisor;
+	if (pthread_create(&supervisor, NULL, fcgiSupervisor, NULL) != 0) {
+		return false;
+	}
+	pthread_detach(supervisor);
+	return true;
+}
+
+/**
+ * Find the handler of a request: the longest matching prefix
+ * or extension.
+ *
+ * @param uri the decoded request URI
+ * @return the handler, or NULL if the request is not dynamic
+ */
+FcgiHandler *findFcgiHandler(const char *uri) {
+	FcgiHandler *found = NULL;
+	size_t uriLen = strlen(uri);
+	for (unsigned i = 0; i < nhandlers; i++) {
+		FcgiHandler *h = &handlers[i];
+		bool matches = h->extension
+			? ((uriLen > h->patternLen) && (strcmp(uri + uriLen - h->patternLen, h->pattern) == 0))
+			: (strncmp(uri, h->pattern, h->patternLen) == 0);
+		if (matches && ((found == NULL) || (h->patternLen > found->patternLen))) {
+			found = h;
+		}
+	}
+	return found;
+}
+
+/**
+ * Get the length of the part of a URI that names the script of
+ * a handler. The rest of the URI is its path info.
+ *
+ * @param handler the handler
+ * @param uri the decoded request URI
+ * @return the length of the script name
+ */
+size_t fcgiScriptLength(FcgiHandler *handler, const char *uri) {
+	if (handler->extension) {
+		return strlen(uri);
+	}
+	size_t len = handler->patternLen;
+	return ((len > 1) && (handler->pattern[len-1] == '/')) ? len-1 : len;
+}
+
+/**
+ * Choose the running worker with the fewest requests in flight that
+ * can take another, starting from the next worker in turn. The
+ * handler lock is held.
+ *
+ * @param handler the handler
+ * @param failed workers that could not be reached
+ * @return the worker, or NULL if none can take a request now
+ */
+static FcgiWorker *pickWorker(FcgiHandler *handler, const bool failed[]) {
+	FcgiWorker *best = NULL;
+	unsigned bestActive = 0;
+	for (unsigned i = 0; i < handler->nworkers; i++) {
+		unsigned w = (handler->next + i) % handler->nworkers;
+		FcgiWorker *worker = &handler->workers[w];
+		if ((worker->pid == 0) || worker->retiring || failed[w]) {
+			continue;
+		}
+		FcgiConn *conn = worker->conn;
+		unsigned active = (conn != NULL) ? conn->active : 0;
+		if ((conn != NULL) && (conn->broken || (active >= conn->maxRequests))) {
+			continue;
+		}
+		if ((best == NULL) || (active < bestActive)) {
+			best = worker;
+			bestActive = active;
+		}
+	}
+	if (best != NULL) {
+		handler->next = (best->index + 1) % handler->nworkers;
+	}
+	return best;
+}
+
+/**
+ * Begin a request to the worker of a handler with the fewest
+ * requests in flight, waiting for one to take it if all are busy.
+ *
+ * @param handler the handler
+ * @return the request, or NULL with errno set: EAGAIN if no
+ *  worker took it in time, otherwise no worker could be reached
+ */
+FcgiRequest *beginFcgiRequest(FcgiHandler *handler) {
+	FcgiRequest *req = calloc(1, sizeof(FcgiRequest));
+	if (req == NULL) {
+		return NULL;
+	}
+	pthread_cond_init(&req->ready, NULL);
+	pthread_cond_init(&req->drained, NULL);
+
+	struct timespec deadline;
+	bool timed = fcgiDeadline(&deadline, fcgiTimeoutMs);
+	bool failed[MAX_FCGI_WORKERS] = { false };
+	unsigned nfailed = 0;
+	int err = 0;
+	FcgiConn *conn = NULL;
+
+	pthread_mutex_lock(&handler->lock);
+	while (conn == NULL) {
+		FcgiWorker *worker = pickWorker(handler, failed);
+		if (worker != NULL) {
+			conn = worker->conn;
+			if ((conn == NULL) && ((conn = connectWorker(worker)) == NULL)) {
+				err = errno;
+				failed[worker->index] = true;
+				nfailed++;
+			}
+			continue;
+		}
+		if ((nfailed == handler->nworkers)
+			|| (timed && (pthread_cond_timedwait(&handler->space, &handler->lock, &deadline) == ETIMEDOUT))) {
+			err = (nfailed > 0) ? err : EAGAIN;
+			break;
+		}
+		if (!timed) {
+			pthread_cond_wait(&handler->space, &handler->lock);
+		}
+	}
+	if (conn == NULL) {
+		pthread_mutex_unlock(&handler->lock);
+		pthread_cond_destroy(&req->ready);
+		pthread_cond_destroy(&req->drained);
+		free(req);
+		errno = err;
+		return NULL;
+	}
+
+	unsigned id = 1;
+	while (conn->requests[id] != NULL) {
+		id++;
+	}
+	req->conn = conn;
+	req->id = id;
+	conn->requests[id] = req;
+	conn->active++;
+	conn->refs++;
+	FcgiWorker *worker = conn->worker;
+	worker->served++;
+	if ((workerMaxRequests > 0) && (worker->served >= workerMaxRequests)) {
+		worker->retiring = true;
+	}
+	pthread_mutex_unlock(&handler->lock);
+
+	unsigned char body[8] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+	writeRecord(conn, FCGI_BEGIN_REQUEST, id, body, sizeof(body));
+	return req;
+}
+
+/**
+ * Add a parameter of a request. Parameters are sent ahead of the
+ * first request body bytes.
+ *
+ * @param req the request
+ * @param name the parameter name
+ * @param value the parameter value
+ * @return true if added, false if it could not be sent
+ */
+bool addFcgiParam(FcgiRequest *req, const char *name, const char *value) {
+	size_t nameLen = strlen(name), valueLen = strlen(value);
+	size_t len = nameLen + valueLen + 8;
+	if (len > sizeof(req->params)) {
+		return false;
+	}
+	if (req->paramsLen + len > sizeof(req->params)) {
+		if (!writeRecord(req->conn, FCGI_PARAMS, req->id, req->params, req->paramsLen)) {
+			return false;
+		}
+		req->paramsLen = 0;
+	}
+	unsigned char *p = req->params + req->paramsLen;
+	p += encodeLength(p, nameLen);
+	p += encodeLength(p, valueLen);
+	memcpy(p, name, nameLen);
+	memcpy(p + nameLen, value, valueLen);
+	req->paramsLen = p + nameLen + valueLen - req->params;
+	return true;
+}
+
+/**
+ * Send request body bytes to the worker.
+ *
+ * @param req the request
+ * @param buf the bytes
+ * @param len the number of bytes, or 0 to end the body
+ * @return true if sent
+ */
+bool sendFcgiStdin(FcgiRequest *req, const char *buf, size_t len) {
+	if (!req->paramsSent) {
+		if (((req->paramsLen > 0) && !writeRecord(req->conn, FCGI_PARAMS, req->id, req->params, req->paramsLen))
+			|| !writeRecord(req->conn, FCGI_PARAMS, req->id, NULL, 0)) {
+			return false;
+		}
+		req->paramsSent = true;
+	}
+	if (len == 0) {
+		return writeRecord(req->conn, FCGI_STDIN, req->id, NULL, 0);
+	}
+	while (len > 0) {
+		size_t n = (len < FCGI_MAX_CONTENT) ? len : FCGI_MAX_CONTENT;
+		if (!writeRecord(req->conn, FCGI_STDIN, req->id, buf, n)) {
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Take queued output of a request, waiting for it to arrive.
+ *
+ * @param req the request
+ * @param buf storage for the bytes
+ * @param size the most bytes to take
+ * @param line true to stop after a newline
+ * @return the number of bytes taken, 0 at the end of the output,
+ *  or -1 with errno set if error
+ */
+static ssize_t takeOutput(FcgiRequest *req, char *buf, size_t size, bool line) {
+	FcgiHandler *handler = req->conn->worker->handler;
+	struct timespec deadline;
+	bool timed = fcgiDeadline(&deadline, fcgiTimeoutMs);
+	ssize_t n = 0;
+
+	pthread_mutex_lock(&handler->lock);
+	while ((req->head == NULL) && !req->ended && !req->conn->broken) {
+		if (timed) {
+			if (pthread_cond_timedwait(&req->ready, &handler->lock, &deadline) == ETIMEDOUT) {
+				break;
+			}
+		} else {
+			pthread_cond_wait(&req->ready, &handler->lock);
+		}
+	}
+	if (req->head == NULL) {
+		if (!req->ended) {
+			errno = req->conn->broken ? ECONNRESET : EAGAIN;
+			n = -1;
+		} else if (req->refused) {
+			errno = EBUSY;
+			n = -1;
+		}
+	}
+	while (((size_t)n < size) && (req->head != NULL)) {
+		FcgiChunk *chunk = req->head;
+		size_t len = chunk->len - chunk->start;
+		if (len > size - n) {
+			len = size - n;
+		}
+		const char *nl = line ? memchr(chunk->data + chunk->start, '\n', len) : NULL;
+		if (nl != NULL) {
+			len = nl + 1 - (chunk->data + chunk->start);
+		}
+		memcpy(buf + n, chunk->data + chunk->start, len);
+		chunk->start += len;
+		n += len;
+		if (chunk->start == chunk->len) {
+			req->head = chunk->next;
+			if (req->head == NULL) {
+				req->tail = NULL;
+			}
+			free(chunk);
+		}
+		if (nl != NULL) {
+			break;
+		}
+	}
+	if (n > 0) {
+		req->queued -= n;
+		pthread_cond_signal(&req->drained);
+	}
+	pthread_mutex_unlock(&handler->lock);
+	return n;
+}
+
+/**
+ * Read a line of the worker output, without its line terminator.
+ * A line too long for the storage is truncated.
+ *
+ * @param req the request
+ * @param line storage for the line
+ * @param size the size of the storage
+ * @return true if a line was read
+ */
+bool readFcgiLine(FcgiRequest *req, char *line, size_t size) {
+	size_t len = 0;
+	char discard[256];
+	while (true) {
+		bool full = (len == size-1);
+		char *into = full ? discard : line + len;
+		ssize_t n = takeOutput(req, into, full ? sizeof(discard) : size-1 - len, true);
+		if (n <= 0) {
+			return false;
+		}
+		bool eol = (into[n-1] == '\n');
+		if (!full) {
+			len += n;
+		}
+		if (eol) {
+			break;
+		}
+	}
+	while ((len > 0) && ((line[len-1] == '\n') || (line[len-1] == '\r'))) {
+		len--;
+	}
+	line[len] = '\0';
+	return true;
+}
+
+/**
+ * Read worker output bytes.
+ *
+ * @param req the request
+ * @param buf storage for the bytes
+ * @param size the most bytes to read
+ * @return the number of bytes read, 0 at the end of the output, or -1
+ *  with errno set: EAGAIN on timeout, EBUSY if the worker refused the
+ *  request, otherwise the worker failed
+ */
+ssize_t readFcgi(FcgiRequest *req, char *buf, size_t size) {
+	return takeOutput(req, buf, size, false);
+}
+
+/**
+ * End a request. A request the worker has not finished is aborted.
+ *
+ * @param req the request
+ */
+void endFcgiRequest(FcgiRequest *req) {
+	FcgiConn *conn = req->conn;
+	FcgiHandler *handler = conn->worker->handler;
+	unsigned id = req->id;
+
+	pthread_mutex_lock(&handler->lock);
+	bool abort = !req->ended && !conn->broken;
+	if (abort) {
+		// the reader frees the request when the worker ends it
+		req->abandoned = true;
+		freeChunks(req);
+		pthread_cond_signal(&req->drained);
+		conn->refs++;
+	} else {
+		releaseRequest(req);
+	}
+	pthread_mutex_unlock(&handler->lock);
+
+	if (abort) {
+		writeRecord(conn, FCGI_ABORT_REQUEST, id, NULL, 0);
+		pthread_mutex_lock(&handler->lock);
+		releaseConn(conn);
+		pthread_mutex_unlock(&handler->lock);
+	}
+}
@@ -0,0 +1,143 @@
+/*
+ * fastcgi.h
+ *
+ * Dynamic handlers served by pools of long-lived FastCGI worker
+ * processes.
+ *
+ * A handler maps a URI prefix ("/app/") or extension ("*.fcgi") to a
+ * worker program. The server starts a number of workers for each
+ * handler, each listening on its own Unix domain socket, and keeps
+ * one connection open to each worker. When a worker reports that it
+ * multiplexes connections, many requests are in flight on its
+ * connection at once; otherwise it is sent one at a time. A worker
+ * that exits is restarted on its own while the others keep serving,
+ * and a worker may be retired after a number of requests.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef FASTCGI_H_
+#define FASTCGI_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** most FastCGI handlers */
+#define MAX_FCGI_HANDLERS 16
+
+/** most worker processes of a handler */
+#define MAX_FCGI_WORKERS 16
+
+/** most requests in flight on one worker connection */
+#define MAX_FCGI_REQUESTS 64
+
+/** size of the request parameters sent in one record */
+#define FCGI_PARAMS_SIZE 16384
+
+typedef struct FcgiHandler FcgiHandler;
+typedef struct FcgiRequest FcgiRequest;
+
+/**
+ * Add a FastCGI handler: a URI prefix or "*." extension followed by
+ * the worker command and its arguments, separated by spaces, such as
+ * "*.fcgi /usr/local/bin/app --quiet". Workers accept connections on
+ * the socket passed as their standard input, as FastCGI specifies.
+ *
+ * @param handler the handler
+ * @return true if successful, false with errno set if invalid
+ */
+bool addFcgiHandler(const char *handler);
+
+/**
+ * Start the workers of the handlers added, and the thread that
+ * restarts them when they exit.
+ *
+ * @param workers the number of worker processes per handler
+ * @param maxRequests requests served before a worker is restarted (0 for no limit)
+ * @param timeoutMs the wait for a worker to take or answer a request (0 for none)
+ * @param socketDir directory of the worker sockets
+ * @return true if successful
+ */
+bool initFastCgi(unsigned workers, unsigned long maxRequests, long timeoutMs, const char *socketDir);
+
+/**
+ * Find the handler of a request: the longest matching prefix
+ * or extension.
+ *
+ * @param uri the decoded request URI
+ * @return the handler, or NULL if the request is not dynamic
+ */
+FcgiHandler *findFcgiHandler(const char *uri);
+
+/**
+ * Get the length of the part of a URI that names the script of
+ * a handler. The rest of the URI is its path info.
+ *
+ * @param handler the handler
+ * @param uri the decoded request URI
+ * @return the length of the script name
+ */
+size_t fcgiScriptLength(FcgiHandler *handler, const char *uri);
+
+/**
+ * Begin a request to the worker of a handler with the fewest
+ * requests in flight, waiting for one to take it if all are busy.
+ *
+ * @param handler the handler
+ * @return the request, or NULL with errno set: EAGAIN if no
+ *  worker took it in time, otherwise no worker could be reached
+ */
+FcgiRequest *beginFcgiRequest(FcgiHandler *handler);
+
+/**
+ * Add a parameter of a request. Parameters are sent ahead of the
+ * first request body bytes.
+ *
+ * @param req the request
+ * @param name the parameter name
+ * @param value the parameter value
+ * @return true if added, false if it could not be sent
+ */
+bool addFcgiParam(FcgiRequest *req, const char *name, const char *value);
+
+/**
+ * Send request body bytes to the worker.
+ *
+ * @param req the request
+ * @param buf the bytes
+ * @param len the number of bytes, or 0 to end the body
+ * @return true if sent
+ */
+bool sendFcgiStdin(FcgiRequest *req, const char *buf, size_t len);
+
+/**
+ * Read a line of the worker output, without its line terminator.
+ * A line too long for the storage is truncated.
+ *
+ * @param req the request
+ * @param line storage for the line
+ * @param size the size of the storage
+ * @return true if a line was read
+ */
+bool readFcgiLine(FcgiRequest *req, char *line, size_t size);
+
+/**
+ * Read worker output bytes.
+ *
+ * @param req the request
+ * @param buf storage for the bytes
+ * @param size the most bytes to read
+ * @return the number of bytes read, 0 at the end of the output, or -1
+ *  with errno set: EAGAIN on timeout, EBUSY if the worker refused the
+ *  request, otherwise the worker failed
+ */
+ssize_t readFcgi(FcgiRequest *req, char *buf, size_t size);
+
+/**
+ * End a request. A request the worker has not finished is aborted.
+ *
+ * @param req the request
+ */
+void endFcgiRequest(FcgiRequest *req);
+
+#endif /* FASTCGI_H_ */
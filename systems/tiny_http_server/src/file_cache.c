@@ -0,0 +1,440 @@
+/*
+ * file_cache.c
+ *
+ * Cache of file response headers and contents by path.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache_arena.h"
+#include "file_cache.h"
+#include "file_util.h"
+#include "http_server.h"
+#include "mime_util.h"
+#include "server_stats.h"
+#include "single_flight.h"
+#include "time_util.h"
+
+/** A cached file with its bookkeeping */
+typedef struct CachedFile {
+	FileEntry entry;					/** the headers and contents */
+	struct CachedFile *chain;			/** next file in the hash bucket */
+	struct CachedFile *newer, *older;	/** LRU list links */
+	uint64_t hash;						/** hash of the path */
+	dev_t dev;							/** device of the file */
+	ino_t ino;							/** inode of the file */
+	struct timespec mtime;				/** modification time of the file */
+	unsigned refs;						/** references, including the table's */
+	bool linked;						/** in the table */
+	unsigned long hits;					/** times served */
+	char *bodyBuf;						/** the contents, owned */
+	char path[];						/** the path */
+} CachedFile;
+
+/** One independently locked part of the cache */
+typedef struct FileShard {
+	pthread_mutex_t lock;		/** guards the shard */
+	CachedFile **buckets;		/** hash buckets */
+	size_t mask;				/** number of buckets - 1 */
+	size_t count;				/** number of files */
+	size_t capacity;			/** maximum number of files */
+	size_t bytes;				/** bytes of contents cached */
+	size_t maxBytes;			/** maximum bytes of contents */
+	CachedFile lru;				/** list head: lru.older is newest, lru.newer oldest */
+	FlightGroup flights;		/** reads of missed contents in progress */
+	char pad[64];				/** keep shard locks on separate cache lines */
+} FileShard;
+
+/** the shards, or NULL if the cache is disabled */
+static FileShard *fileShards;
+
+/** the largest file whose contents are cached */
+static size_t maxCachedFile;
+
+/** cache id for statistics */
+static int fileCacheId = -1;
+
+/**
+ * Hash a path with FNV-1a.
+ */
+static uint64_t hashPath(const char *path, size_t len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)path[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/**
+ * Get the shard of a hash.
+ */
+static FileShard *shardOf(uint64_t hash) {
+	return &fileShards[hash & (FILE_CACHE_SHARDS - 1)];
+}
+
+/**
+ * Unlink a file from the LRU list.
+ */
+static void lruUnlink(CachedFile *f) {
+	f->newer->older = f->older;
+	f->older->newer = f->newer;
+}
+
+/**
+ * Link a file at the newest end of the LRU list.
+ */
+static void lruPushNewest(FileShard *shard, CachedFile *f) {
+	f->older = shard->lru.older;
+	f->newer = &shard->lru;
+	shard->lru.older->newer = f;
+	shard->lru.older = f;
+}
+
+/**
+ * Find the bucket link that points to the file of a path.
+ *
+ * @return the link; *link is NULL if not found
+ */
+static CachedFile **findFile(FileShard *shard, const char *path, size_t len, uint64_t hash) {
+	CachedFile **link = &shard->buckets[(hash >> 4) & shard->mask];
+	while (*link != NULL) {
+		CachedFile *f = *link;
+		if ((f->hash == hash) && (strncmp(f->path, path, len) == 0) && (f->path[len] == '\0')) {
+			break;
+		}
+		link = &f->chain;
+	}
+	return link;
+}
+
+/**
+ * Drop a reference to a file, freeing it with the last.
+ * The caller holds the shard lock.
+ */
+static void unrefFile(CachedFile *f) {
+	if (--f->refs == 0) {
+		cacheArenaFree(f->bodyBuf, f->entry.size);
+		free(f);
+	}
+}
+
+/**
+ * Remove the file a bucket link points to from the table.
+ * It is freed once no longer in use.
+ */
+static void removeFile(FileShard *shard, CachedFile **link) {
+	CachedFile *f = *link;
+	*link = f->chain;
+	lruUnlink(f);
+	f->linked = false;
+	shard->count--;
+	if (f->bodyBuf != NULL) {
+		shard->bytes -= f->entry.size;
+	}
+	unrefFile(f);
+}
+
+/**
+ * Remove the least recently used files, except one, until
+ * another file and its contents fit.
+ *
+ * @param shard the shard
+ * @param keep a file not to remove, or NULL
+ * @param files the number of files to fit
+ * @param bytes the number of bytes to fit
+ */
+static void evictFiles(FileShard *shard, CachedFile *keep, size_t files, size_t bytes) {
+	while ((shard->count + files > shard->capacity) || (shard->bytes + bytes > shard->maxBytes)) {
+		CachedFile *oldest = shard->lru.newer;
+		if ((oldest == &shard->lru) || (oldest == keep)) {
+			break;
+		}
+		removeFile(shard, findFile(shard, oldest->path, strlen(oldest->path), oldest->hash));
+	}
+}
+
+/**
+ * Determine whether a cached file is current for metadata.
+ */
+static bool fileMatches(const CachedFile *f, const struct stat *sb) {
+	return (f->ino == sb->st_ino) && (f->dev == sb->st_dev) && (f->entry.size == (size_t)sb->st_size)
+		&& (f->mtime.tv_sec == sb->st_mtim.tv_sec) && (f->mtime.tv_nsec == sb->st_mtim.tv_nsec);
+}
+
+/**
+ * Create a file with its headers built from its metadata.
+ */
+static CachedFile *newCachedFile(const char *path, size_t len, uint64_t hash, const struct stat *sb) {
+	CachedFile *f = calloc(1, sizeof(CachedFile) + len + 1);
+	if (f == NULL) {
+		return NULL;
+	}
+	memcpy(f->path, path, len);
+	f->hash = hash;
+	f->dev = sb->st_dev;
+	f->ino = sb->st_ino;
+	f->mtime = sb->st_mtim;
+	f->entry.size = (size_t)sb->st_size;
+	f->entry.body = (f->entry.size == 0) ? "" : NULL;
+
+	char buf[MAXBUF];
+	snprintf(f->entry.contentLength, sizeof(f->entry.contentLength), "%zu", f->entry.size);
+	snprintf(f->entry.lastModified, FILE_HEADER_SIZE, "%s",
+			 milliTimeToRFC_1123_Date_Time(sb->st_mtim.tv_sec, buf));
+	snprintf(f->entry.contentType, FILE_HEADER_SIZE, "%s", getMimeType(path, buf));
+	return f;
+}
+
+/**
+ * Read the contents of a file into the cache, if the file is still
+ * the one the entry describes and the contents fit.
+ *
+ * @param shard the shard of the file
+ * @param f the file, referenced by the caller
+ */
+static void loadFile(FileShard *shard, CachedFile *f) {
+	size_t size = f->entry.size;
+	char *buf = cacheArenaAlloc(size);
+	bool loaded = false;
+	int fd = (buf != NULL) ? open(f->path, O_RDONLY | O_CLOEXEC) : -1;
+	if (fd >= 0) {
+		size_t got = 0;
+		while (got < size) {
+			ssize_t n = read(fd, buf + got, size - got);
+			if ((n < 0) && (errno == EINTR)) {
+				continue;
+			}
+			if (n <= 0) {
+				break;
+			}
+			got += n;
+		}
+		// the file may have been replaced since its stat
+		struct stat sb;
+		loaded = (got == size) && (fstat(fd, &sb) == 0) && fileMatches(f, &sb);
+		close(fd);
+	}
+
+	pthread_mutex_lock(&shard->lock);
+	if (loaded && f->linked && (f->entry.body == NULL)) {
+		evictFiles(shard, f, 0, size);
+		if (shard->bytes + size <= shard->maxBytes) {
+			f->bodyBuf = buf;
+			__atomic_store_n(&f->entry.body, buf, __ATOMIC_RELEASE);
+			shard->bytes += size;
+			buf = NULL;
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+	cacheArenaFree(buf, size);
+}
+
+/**
+ * Get the entry of a file, building its headers if not cached.
+ * Release the entry with releaseFile().
+ *
+ * @param path the file path
+ * @param sb the current metadata of the file
+ * @param load true to read the file contents into the cache if
+ *  not cached and small enough
+ * @return the entry, or NULL if the cache is disabled or out of memory
+ */
+FileEntry *acquireFile(const char *path, const struct stat *sb, bool load) {
+	if (fileShards == NULL) {
+		return NULL;
+	}
+	size_t len = strlen(path);
+	uint64_t hash = hashPath(path, len);
+	FileShard *shard = shardOf(hash);
+
+	pthread_mutex_lock(&shard->lock);
+	CachedFile **link = findFile(shard, path, len, hash);
+	if ((*link != NULL) && !fileMatches(*link, sb)) {
+		removeFile(shard, link);
+	}
+	CachedFile *f = *link;
+	if (f == NULL) {
+		// build the headers without holding the lock
+		pthread_mutex_unlock(&shard->lock);
+		CachedFile *created = newCachedFile(path, len, hash, sb);
+		if (created == NULL) {
+			return NULL;
+		}
+		pthread_mutex_lock(&shard->lock);
+		link = findFile(shard, path, len, hash);
+		if ((*link != NULL) && fileMatches(*link, sb)) {
+			free(created);
+		} else {
+			if (*link != NULL) {
+				removeFile(shard, link);
+			}
+			evictFiles(shard, NULL, 1, 0);
+			created->refs = 1;
+			created->linked = true;
+			created->chain = NULL;
+			link = findFile(shard, path, len, hash);
+			*link = created;
+			lruPushNewest(shard, created);
+			shard->count++;
+		}
+		f = *link;
+	} else {
+		lruUnlink(f);
+		lruPushNewest(shard, f);
+	}
+	f->refs++;
+	bool cached = (f->entry.body != NULL);
+	pthread_mutex_unlock(&shard->lock);
+
+	if (load) {
+		recordCacheLookup(fileCacheId, cached);
+	}
+	if (load && !cached && (f->entry.size <= maxCachedFile)) {
+		// concurrent misses of a file wait for one read; one that
+		// still finds no contents sends the file from disk
+		Flight flight;
+		if (boardFlight(&shard->flights, path, len, &flight)) {
+			if (__atomic_load_n(&f->entry.body, __ATOMIC_ACQUIRE) == NULL) {
+				loadFile(shard, f);
+			}
+			landFlight(&shard->flights, &flight);
+		} else {
+			recordCacheCoalesced(fileCacheId);
+		}
+	}
+	return &f->entry;
+}
+
+/**
+ * Release an entry from acquireFile().
+ *
+ * @param entry the entry
+ */
+void releaseFile(FileEntry *entry) {
+	CachedFile *f = (CachedFile *)entry;
+	FileShard *shard = shardOf(f->hash);
+	pthread_mutex_lock(&shard->lock);
+	unrefFile(f);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Count a hit of a cached file.
+ *
+ * @param entry the entry
+ */
+void countFileHit(FileEntry *entry) {
+	CachedFile *f = (CachedFile *)entry;
+	__atomic_add_fetch(&f->hits, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Set the hits of a cached file, such as from a saved snapshot.
+ *
+ * @param entry the entry
+ * @param hits the number of hits
+ */
+void setFileHits(FileEntry *entry, unsigned long hits) {
+	CachedFile *f = (CachedFile *)entry;
+	__atomic_store_n(&f->hits, hits, __ATOMIC_RELAXED);
+}
+
+/**
+ * Save the hits of the cached files that have any, one file per
+ * line: the count, a space, and the path. The snapshot is written
+ * to a temporary file and renamed, so it is always complete.
+ *
+ * @param path the snapshot file
+ * @return true if saved
+ */
+bool saveFileHits(const char *path) {
+	if (fileShards == NULL) {
+		return true;
+	}
+	char tmpPath[MAXBUF + 8];
+	if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path) >= (int)sizeof(tmpPath)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	FILE *out = fopen(tmpPath, "w");
+	if (out == NULL) {
+		return false;
+	}
+	for (int s = 0; s < FILE_CACHE_SHARDS; s++) {
+		FileShard *shard = &fileShards[s];
+		pthread_mutex_lock(&shard->lock);
+		for (CachedFile *f = shard->lru.older; f != &shard->lru; f = f->older) {
+			unsigned long hits = __atomic_load_n(&f->hits, __ATOMIC_RELAXED);
+			if (hits > 0) {
+				fprintf(out, "%lu %s\n", hits, f->path);
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+	if ((fclose(out) != 0) || (rename(tmpPath, path) != 0)) {
+		unlink(tmpPath);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Determine whether the cache is enabled.
+ *
+ * @return true if enabled
+ */
+bool fileCacheEnabled(void) {
+	return fileShards != NULL;
+}
+
+/**
+ * Initialize the cache.
+ *
+ * @param capacity maximum number of entries; 0 disables the cache
+ * @param maxBytes maximum bytes of file contents cached
+ * @param maxFileSize the largest file whose contents are cached
+ * @return true if successful
+ */
+bool initFileCache(size_t capacity, size_t maxBytes, size_t maxFileSize) {
+	if (capacity == 0) {
+		return true;
+	}
+	FileShard *shards = calloc(FILE_CACHE_SHARDS, sizeof(FileShard));
+	if (shards == NULL) {
+		return false;
+	}
+	size_t perShard = (capacity + FILE_CACHE_SHARDS - 1) / FILE_CACHE_SHARDS;
+	size_t nbuckets = 16;
+	while (nbuckets < perShard) {
+		nbuckets <<= 1;
+	}
+	for (int s = 0; s < FILE_CACHE_SHARDS; s++) {
+		FileShard *shard = &shards[s];
+		pthread_mutex_init(&shard->lock, NULL);
+		initFlightGroup(&shard->flights);
+		shard->buckets = calloc(nbuckets, sizeof(CachedFile *));
+		if (shard->buckets == NULL) {
+			return false;
+		}
+		shard->mask = nbuckets - 1;
+		shard->capacity = perShard;
+		shard->maxBytes = maxBytes / FILE_CACHE_SHARDS;
+		shard->lru.newer = shard->lru.older = &shard->lru;
+	}
+	// a file must fit the contents budget of its shard
+	maxCachedFile = (maxFileSize < maxBytes / FILE_CACHE_SHARDS) ? maxFileSize : maxBytes / FILE_CACHE_SHARDS;
+	fileCacheId = registerStatsCache("file");
+	fileShards = shards;
+	return true;
+}
@@ -0,0 +1,109 @@
+/*
+ * file_cache.h
+ *
+ * Cache of file response headers and contents by path.
+ *
+ * An entry holds the headers of a file response, built once: its
+ * Content-Length, Last-Modified and Content-Type. The body of a file
+ * no larger than the largest cached file is read into memory too,
+ * within a budget of bytes, in the cache arena if it is enabled (see
+ * cache_arena.h). An entry is current while the inode, size and
+ * modification time of its file match the metadata of the request,
+ * as the stat cache reports them. Concurrent requests that
+ * miss the contents of a file wait for one of them to read it.
+ *
+ * Lookups hash to one of FILE_CACHE_SHARDS independently locked
+ * shards, each an LRU-ordered hash table. An entry in use is counted,
+ * so its body is written without holding a lock, and outlives its
+ * replacement until released.
+ *
+ * Entries count their hits. A snapshot of the counts, saved when the
+ * server stops, tells warm-up which files to load on the next start.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/** number of independently locked shards */
+#define FILE_CACHE_SHARDS 16
+
+/** size of a header value of an entry */
+#define FILE_HEADER_SIZE 128
+
+/** The response headers and contents of a cached file; read-only */
+typedef struct FileEntry {
+	size_t size;								/** the file size */
+	char contentLength[24];						/** Content-Length header */
+	char lastModified[FILE_HEADER_SIZE];		/** Last-Modified header */
+	char contentType[FILE_HEADER_SIZE];			/** Content-Type header */
+	const char *body;							/** the file contents, or NULL if not cached */
+} FileEntry;
+
+/**
+ * Initialize the cache.
+ *
+ * @param capacity maximum number of entries; 0 disables the cache
+ * @param maxBytes maximum bytes of file contents cached
+ * @param maxFileSize the largest file whose contents are cached
+ * @return true if successful
+ */
+bool initFileCache(size_t capacity, size_t maxBytes, size_t maxFileSize);
+
+/**
+ * Determine whether the cache is enabled.
+ *
+ * @return true if enabled
+ */
+bool fileCacheEnabled(void);
+
+/**
+ * Get the entry of a file, building its headers if not cached.
+ * Release the entry with releaseFile().
+ *
+ * @param path the file path
+ * @param sb the current metadata of the file
+ * @param load true to read the file contents into the cache if
+ *  not cached and small enough
+ * @return the entry, or NULL if the cache is disabled or out of memory
+ */
+FileEntry *acquireFile(const char *path, const struct stat *sb, bool load);
+
+/**
+ * Release an entry from acquireFile().
+ *
+ * @param entry the entry
+ */
+void releaseFile(FileEntry *entry);
+
+/**
+ * Count a hit of a cached file.
+ *
+ * @param entry the entry
+ */
+void countFileHit(FileEntry *entry);
+
+/**
+ * Set the hits of a cached file, such as from a saved snapshot.
+ *
+ * @param entry the entry
+ * @param hits the number of hits
+ */
+void setFileHits(FileEntry *entry, unsigned long hits);
+
+/**
+ * Save the hits of the cached files that have any, one file per
+ * line: the count, a space, and the path. The snapshot is written
+ * to a temporary file and renamed, so it is always complete.
+ *
+ * @param path the snapshot file
+ * @return true if saved
+ */
+bool saveFileHits(const char *path);
+
+#endif /* FILE_CACHE_H_ */
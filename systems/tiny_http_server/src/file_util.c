@@ -50,7 +50,7 @@ int fileStat(FILE *stream, struct stat *buf) {
  */
 int copyFileStreamBytes(FILE *istream, FILE *ostream, int nbytes) {
 	char *buf[MAXBUF];
-    while ((nbytes > 0) && !feof(istream)) {
+    while ((nbytes > 0) && !feof(istream) && !ferror(istream)) {
     	int ntoread = (nbytes < MAXBUF) ? nbytes : MAXBUF;
         size_t nread = fread(buf, sizeof(char), ntoread, istream);
         if (nread > 0) {
@@ -0,0 +1,167 @@
+/*
+ * histogram.c
+ *
+ * Log-linear (HDR-style) histograms of 64-bit values.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+/** number of buckets per power of two above the exact range */
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+
+/**
+ * Get the bucket of a value.
+ *
+ * @param value the value
+ * @return the bucket index
+ */
+static int hist_index(uint64_t value) {
+	if (value < (1u << HIST_SUB_BITS)) {
+		return (int)value;
+	}
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - HIST_SUB_BITS + 1;
+	return (shift * HIST_HALF) + (int)(value >> shift);
+}
+
+/**
+ * Get the highest value that falls in a bucket.
+ *
+ * @param index the bucket index
+ * @return the highest value of the bucket
+ */
+static uint64_t hist_value(int index) {
+	if (index < (1 << HIST_SUB_BITS)) {
+		return (uint64_t)index;
+	}
+	int shift = (index / HIST_HALF) - 1;
+	uint64_t mantissa = (uint64_t)(index - shift * HIST_HALF);
+	return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * Add to a counter that only the calling thread writes.
+ */
+static inline void hist_add(uint64_t *counter, uint64_t n) {
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Initialize a histogram to empty.
+ *
+ * @param hist the histogram
+ */
+void hist_init(histogram *hist) {
+	memset(hist, 0, sizeof(histogram));
+}
+
+/**
+ * Record a value. Only the owner of the histogram may record.
+ *
+ * @param hist the histogram
+ * @param value the value
+ */
+void hist_record(histogram *hist, uint64_t value) {
+	hist_record_n(hist, value, 1);
+}
+
+/**
+ * Record a value count times.
+ *
+ * @param hist the histogram
+ * @param value the value
+ * @param count the number of times to record it
+ */
+void hist_record_n(histogram *hist, uint64_t value, uint64_t count) {
+	hist_add(&hist->counts[hist_index(value)], count);
+	hist_add(&hist->total, count);
+	hist_add(&hist->sum, value * count);
+	if (value > __atomic_load_n(&hist->max, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Record a latency measured against a fixed send schedule, and
+ * back-fill the samples a stalled sender would have taken.
+ *
+ * @param hist the histogram
+ * @param value the measured value
+ * @param interval the expected interval between samples (0 for none)
+ */
+void hist_record_corrected(histogram *hist, uint64_t value, uint64_t interval) {
+	hist_record(hist, value);
+	if (interval == 0) {
+		return;
+	}
+	for (uint64_t missed = value; missed > interval; ) {
+		missed -= interval;
+		hist_record(hist, missed);
+	}
+}
+
+/**
+ * Add the counts of one histogram to another.
+ *
+ * @param dst the destination histogram
+ * @param src the source histogram
+ */
+void hist_merge(histogram *dst, const histogram *src) {
+	uint64_t total = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		uint64_t n = __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+		dst->counts[i] += n;
+		total += n;
+	}
+	// use the bucket sum so total always matches the counts read
+	dst->total += total;
+	dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+	if (max > dst->max) {
+		dst->max = max;
+	}
+}
+
+/**
+ * Get the value at a percentile.
+ *
+ * @param hist the histogram
+ * @param percentile the percentile (0.0 to 100.0)
+ * @return the highest value equivalent to the percentile bucket,
+ *   or 0 if the histogram is empty
+ */
+uint64_t hist_percentile(const histogram *hist, double percentile) {
+	if (hist->total == 0) {
+		return 0;
+	}
+	if (percentile > 100.0) {
+		percentile = 100.0;
+	}
+	uint64_t rank = (uint64_t)((percentile / 100.0) * (double)hist->total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			uint64_t value = hist_value(i);
+			return (value < hist->max) ? value : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+/**
+ * Get the mean of the recorded values.
+ *
+ * @param hist the histogram
+ * @return the mean, or 0 if the histogram is empty
+ */
+double hist_mean(const histogram *hist) {
+	return (hist->total == 0) ? 0.0 : (double)hist->sum / (double)hist->total;
+}
@@ -0,0 +1,101 @@
+/*
+ * histogram.h
+ *
+ * Log-linear (HDR-style) histograms of 64-bit values.
+ *
+ * Values below 2^HIST_SUB_BITS are counted exactly; larger values
+ * fall in buckets whose width is 1/2^(HIST_SUB_BITS-1) of their
+ * magnitude, so every recorded value is known to within ~3% over
+ * the full 64-bit range with a fixed-size array.
+ *
+ * A histogram has a single writer. Counts are updated with relaxed
+ * atomic stores, so other threads may merge or read it at any time
+ * without a lock; a reader may just miss the most recent values.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+
+/** bits of exact precision */
+#define HIST_SUB_BITS 6
+
+/** number of buckets needed to cover 64-bit values */
+#define HIST_BUCKETS ((66 - HIST_SUB_BITS) << (HIST_SUB_BITS - 1))
+
+/** A histogram */
+typedef struct histogram {
+	uint64_t counts[HIST_BUCKETS];	/** count of values per bucket */
+	uint64_t total;					/** number of values */
+	uint64_t sum;					/** sum of values */
+	uint64_t max;					/** largest value */
+} histogram;
+
+/**
+ * Initialize a histogram to empty.
+ *
+ * @param hist the histogram
+ */
+void hist_init(histogram *hist);
+
+/**
+ * Record a value. Only the owner of the histogram may record.
+ *
+ * @param hist the histogram
+ * @param value the value
+ */
+void hist_record(histogram *hist, uint64_t value);
+
+/**
+ * Record a value count times.
+ *
+ * @param hist the histogram
+ * @param value the value
+ * @param count the number of times to record it
+ */
+void hist_record_n(histogram *hist, uint64_t value, uint64_t count);
+
+/**
+ * Record a latency measured against a fixed send schedule, and
+ * back-fill the samples a stalled open-loop sender would have
+ * taken (coordinated-omission correction): for a value larger
+ * than the interval, also record value-interval, value-2*interval,
+ * and so on down to the interval.
+ *
+ * @param hist the histogram
+ * @param value the measured value
+ * @param interval the expected interval between samples (0 for none)
+ */
+void hist_record_corrected(histogram *hist, uint64_t value, uint64_t interval);
+
+/**
+ * Add the counts of one histogram to another.
+ * The source may be concurrently recorded by its owner.
+ *
+ * @param dst the destination histogram
+ * @param src the source histogram
+ */
+void hist_merge(histogram *dst, const histogram *src);
+
+/**
+ * Get the value at a percentile.
+ *
+ * @param hist the histogram
+ * @param percentile the percentile (0.0 to 100.0)
+ * @return the highest value equivalent to the percentile bucket,
+ *   or 0 if the histogram is empty
+ */
+uint64_t hist_percentile(const histogram *hist, double percentile);
+
+/**
+ * Get the mean of the recorded values.
+ *
+ * @param hist the histogram
+ * @return the mean, or 0 if the histogram is empty
+ */
+double hist_mean(const histogram *hist);
+
+#endif /* HISTOGRAM_H_ */
@@ -0,0 +1,679 @@
+/*
+ * hpack.c
+ *
+ * HPACK header compression for HTTP/2 (RFC 7541).
+ *
+ *  @since 2026-10-19
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+/** size overhead of a table entry (RFC 7541 4.1) */
+#define ENTRY_OVERHEAD 32
+
+/** A field of the static table */
+typedef struct StaticField {
+	const char *name;
+	const char *value;
+} StaticField;
+
+/** the static table (RFC 7541 Appendix A), indexed from 1 */
+static const StaticField staticTable[] = {
+	{ ":authority", "" }, { ":method", "GET" }, { ":method", "POST" },
+	{ ":path", "/" }, { ":path", "/index.html" }, { ":scheme", "http" },
+	{ ":scheme", "https" }, { ":status", "200" }, { ":status", "204" },
+	{ ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+	{ ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" }, { "accept-language", "" },
+	{ "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+	{ "age", "" }, { "allow", "" }, { "authorization", "" },
+	{ "cache-control", "" }, { "content-disposition", "" }, { "content-encoding", "" },
+	{ "content-language", "" }, { "content-length", "" }, { "content-location", "" },
+	{ "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+	{ "date", "" }, { "etag", "" }, { "expect", "" },
+	{ "expires", "" }, { "from", "" }, { "host", "" },
+	{ "if-match", "" }, { "if-modified-since", "" }, { "if-none-match", "" },
+	{ "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+	{ "link", "" }, { "location", "" }, { "max-forwards", "" },
+	{ "proxy-authenticate", "" }, { "proxy-authorization", "" }, { "range", "" },
+	{ "referer", "" }, { "refresh", "" }, { "retry-after", "" },
+	{ "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+	{ "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" },
+	{ "via", "" }, { "www-authenticate", "" }
+};
+
+/** number of static table entries */
+#define STATIC_ENTRIES (sizeof(staticTable) / sizeof(staticTable[0]))
+
+/** 256 octets and end-of-string */
+#define HUFFMAN_SYMBOLS 257
+
+/** end-of-string symbol */
+#define HUFFMAN_EOS 256
+
+/** longest Huffman code */
+#define HUFFMAN_MAX_BITS 30
+
+/** the Huffman code (RFC 7541 Appendix B) */
+static const uint32_t huffmanCodes[HUFFMAN_SYMBOLS] = {
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	0x3fffffff,
+};
+
+static const uint8_t huffmanLengths[HUFFMAN_SYMBOLS] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+
+/*
+ * The code is canonical: codes of one length are consecutive and
+ * in symbol order. A code is decoded bit by bit, checking at each
+ * length whether the bits so far fall in that length's range.
+ */
+
+/** first code of each length */
+static uint32_t firstCode[HUFFMAN_MAX_BITS + 1];
+
+/** number of codes of each length */
+static uint16_t codeCount[HUFFMAN_MAX_BITS + 1];
+
+/** position in codeSymbols of the first code of each length */
+static uint16_t firstSymbol[HUFFMAN_MAX_BITS + 1];
+
+/** symbols in code order */
+static uint16_t codeSymbols[HUFFMAN_SYMBOLS];
+
+/** builds the decoding tables once */
+static pthread_once_t huffmanOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Build the decoding tables.
+ */
+static void initHuffmanDecoder(void) {
+	for (int s = 0; s < HUFFMAN_SYMBOLS; s++) {
+		codeCount[huffmanLengths[s]]++;
+	}
+	uint16_t pos = 0;
+	for (int len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+		firstSymbol[len] = pos;
+		pos += codeCount[len];
+	}
+	uint16_t next[HUFFMAN_MAX_BITS + 1];
+	memcpy(next, firstSymbol, sizeof(next));
+	for (int s = 0; s < HUFFMAN_SYMBOLS; s++) {
+		int len = huffmanLengths[s];
+		if (next[len] == firstSymbol[len]) {
+			firstCode[len] = huffmanCodes[s];
+		}
+		codeSymbols[next[len]++] = (uint16_t)s;
+	}
+}
+
+/**
+ * Huffman-code a string.
+ *
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @param in the string
+ * @param len the length of the string
+ * @return the coded length, or SIZE_MAX if out of room
+ */
+size_t huffmanEncode(uint8_t *out, size_t size, const char *in, size_t len) {
+	uint64_t bits = 0;
+	int nbits = 0;
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)in[i];
+		bits = (bits << huffmanLengths[c]) | huffmanCodes[c];
+		nbits += huffmanLengths[c];
+		while (nbits >= 8) {
+			if (n == size) {
+				return SIZE_MAX;
+			}
+			nbits -= 8;
+			out[n++] = (uint8_t)(bits >> nbits);
+		}
+	}
+	// pad with the most significant bits of end-of-string
+	if (nbits > 0) {
+		if (n == size) {
+			return SIZE_MAX;
+		}
+		out[n++] = (uint8_t)((bits << (8 - nbits)) | (0xff >> nbits));
+	}
+	return n;
+}
+
+/**
+ * Get the Huffman-coded length of a string.
+ */
+static size_t huffmanLength(const char *in, size_t len) {
+	size_t nbits = 0;
+	for (size_t i = 0; i < len; i++) {
+		nbits += huffmanLengths[(unsigned char)in[i]];
+	}
+	return (nbits + 7) / 8;
+}
+
+/**
+ * Decode a Huffman-coded string.
+ *
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @param in the coded string
+ * @param len the length of the coded string
+ * @return the decoded length, or SIZE_MAX if malformed or out of room
+ */
+size_t huffmanDecode(char *out, size_t size, const uint8_t *in, size_t len) {
+	pthread_once(&huffmanOnce, initHuffmanDecoder);
+	uint32_t code = 0;
+	int nbits = 0;
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++) {
+		for (int b = 7; b >= 0; b--) {
+			code = (code << 1) | ((in[i] >> b) & 1);
+			nbits++;
+			uint32_t offset = code - firstCode[nbits];
+			if (offset < codeCount[nbits]) {
+				uint16_t s = codeSymbols[firstSymbol[nbits] + offset];
+				if ((s == HUFFMAN_EOS) || (n == size)) {
+					return SIZE_MAX;
+				}
+				out[n++] = (char)s;
+				code = 0;
+				nbits = 0;
+			} else if (nbits == HUFFMAN_MAX_BITS) {
+				return SIZE_MAX;
+			}
+		}
+	}
+	// padding is fewer than 8 bits, all ones
+	if ((nbits > 7) || (code != (1u << nbits) - 1)) {
+		return SIZE_MAX;
+	}
+	return n;
+}
+
+/**
+ * Encode an integer with a prefix of N bits (RFC 7541 5.1).
+ *
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @param pattern the bits above the prefix in the first octet
+ * @param prefixBits the prefix size N
+ * @param value the integer
+ * @return the bytes written, or SIZE_MAX if out of room
+ */
+static size_t encodeInt(uint8_t *out, size_t size, uint8_t pattern, int prefixBits, uint64_t value) {
+	uint64_t max = (1u << prefixBits) - 1;
+	if (size == 0) {
+		return SIZE_MAX;
+	}
+	if (value < max) {
+		out[0] = pattern | (uint8_t)value;
+		return 1;
+	}
+	out[0] = pattern | (uint8_t)max;
+	value -= max;
+	size_t n = 1;
+	while (true) {
+		if (n == size) {
+			return SIZE_MAX;
+		}
+		if (value < 128) {
+			out[n++] = (uint8_t)value;
+			return n;
+		}
+		out[n++] = (uint8_t)((value & 127) | 128);
+		value >>= 7;
+	}
+}
+
+/**
+ * Decode an integer with a prefix of N bits.
+ *
+ * @param p the input position, advanced past the integer
+ * @param end the end of the input
+ * @param prefixBits the prefix size N
+ * @param value the integer
+ * @return true if successful
+ */
+static bool decodeInt(const uint8_t **p, const uint8_t *end, int prefixBits, uint64_t *value) {
+	if (*p == end) {
+		return false;
+	}
+	uint64_t max = (1u << prefixBits) - 1;
+	uint64_t v = *(*p)++ & max;
+	if (v == max) {
+		for (int shift = 0; ; shift += 7) {
+			if ((*p == end) || (shift > 28)) {
+				return false;
+			}
+			uint8_t b = *(*p)++;
+			v += (uint64_t)(b & 127) << shift;
+			if ((b & 128) == 0) {
+				break;
+			}
+		}
+	}
+	*value = v;
+	return true;
+}
+
+/**
+ * Encode a string literal, Huffman-coded if shorter.
+ */
+static size_t encodeString(uint8_t *out, size_t size, const char *s, size_t len) {
+	size_t hlen = huffmanLength(s, len);
+	bool huffman = (hlen < len);
+	size_t n = encodeInt(out, size, huffman ? 0x80 : 0, 7, huffman ? hlen : len);
+	if ((n == SIZE_MAX) || (size - n < (huffman ? hlen : len))) {
+		return SIZE_MAX;
+	}
+	if (huffman) {
+		huffmanEncode(out + n, size - n, s, len);
+		return n + hlen;
+	}
+	memcpy(out + n, s, len);
+	return n + len;
+}
+
+/**
+ * Decode a string literal into a NUL-terminated buffer.
+ */
+static bool decodeString(const uint8_t **p, const uint8_t *end, char *out, size_t size) {
+	if (*p == end) {
+		return false;
+	}
+	bool huffman = ((**p & 0x80) != 0);
+	uint64_t len;
+	if (!decodeInt(p, end, 7, &len) || (len > (uint64_t)(end - *p))) {
+		return false;
+	}
+	size_t n;
+	if (huffman) {
+		n = huffmanDecode(out, size - 1, *p, len);
+		if (n == SIZE_MAX) {
+			return false;
+		}
+	} else {
+		if (len >= size) {
+			return false;
+		}
+		memcpy(out, *p, len);
+		n = len;
+	}
+	out[n] = '\0';
+	*p += len;
+	return true;
+}
+
+/**
+ * Initialize a dynamic table.
+ *
+ * @param table the table
+ * @param settingsMax the largest size limit allowed
+ * @return true if successful
+ */
+bool initHpackTable(HpackTable *table, size_t settingsMax) {
+	memset(table, 0, sizeof(HpackTable));
+	// every entry takes at least ENTRY_OVERHEAD
+	table->slots = settingsMax / ENTRY_OVERHEAD + 1;
+	table->entries = calloc(table->slots, sizeof(HpackEntry));
+	table->maxSize = settingsMax;
+	table->minSize = settingsMax;
+	table->settingsMax = settingsMax;
+	return (table->entries != NULL);
+}
+
+/**
+ * Get a dynamic table entry.
+ *
+ * @param table the table
+ * @param i the position, 0 for the newest
+ * @return the entry
+ */
+static HpackEntry *tableEntry(HpackTable *table, size_t i) {
+	return &table->entries[(table->newest + table->slots - i) % table->slots];
+}
+
+/**
+ * Evict the oldest dynamic table entry.
+ */
+static void evictOldest(HpackTable *table) {
+	HpackEntry *e = tableEntry(table, table->count - 1);
+	table->size -= ENTRY_OVERHEAD + e->nameLen + e->valueLen;
+	free(e->name);
+	e->name = e->value = NULL;
+	table->count--;
+}
+
+/**
+ * Change the size limit of a dynamic table, evicting entries to fit.
+ */
+static void resizeTable(HpackTable *table, size_t maxSize) {
+	table->maxSize = maxSize;
+	while (table->size > maxSize) {
+		evictOldest(table);
+	}
+}
+
+/**
+ * Add an entry to a dynamic table, evicting entries to make room.
+ * An entry larger than the table empties it and is not added.
+ */
+static void addEntry(HpackTable *table, const char *name, size_t nameLen, const char *value, size_t valueLen) {
+	size_t entrySize = ENTRY_OVERHEAD + nameLen + valueLen;
+	while ((table->count > 0) && (table->size + entrySize > table->maxSize)) {
+		evictOldest(table);
+	}
+	if (entrySize > table->maxSize) {
+		return;
+	}
+	char *buf = malloc(nameLen + valueLen + 2);
+	if (buf == NULL) {
+		return;
+	}
+	memcpy(buf, name, nameLen);
+	buf[nameLen] = '\0';
+	memcpy(buf + nameLen + 1, value, valueLen);
+	buf[nameLen + 1 + valueLen] = '\0';
+
+	table->newest = (table->newest + 1) % table->slots;
+	HpackEntry *e = &table->entries[table->newest];
+	e->name = buf;
+	e->value = buf + nameLen + 1;
+	e->nameLen = nameLen;
+	e->valueLen = valueLen;
+	table->count++;
+	table->size += entrySize;
+}
+
+/**
+ * Free the entries of a dynamic table.
+ *
+ * @param table the table
+ */
+void freeHpackTable(HpackTable *table) {
+	while (table->count > 0) {
+		evictOldest(table);
+	}
+	free(table->entries);
+	table->entries = NULL;
+}
+
+/**
+ * Set the size limit of an encoder's table, such as from the
+ * peer's SETTINGS_HEADER_TABLE_SIZE. The limit is capped at the
+ * table's settingsMax, and announced in the next header block.
+ *
+ * @param table the encoder table
+ * @param maxSize the size limit
+ */
+void hpackSetEncoderSize(HpackTable *table, size_t maxSize) {
+	if (maxSize > table->settingsMax) {
+		maxSize = table->settingsMax;
+	}
+	if (maxSize == table->maxSize) {
+		return;
+	}
+	resizeTable(table, maxSize);
+	if (!table->sizeUpdate || (maxSize < table->minSize)) {
+		table->minSize = maxSize;
+	}
+	table->sizeUpdate = true;
+}
+
+/**
+ * Look up a field by index in the static and dynamic tables.
+ *
+ * @return true if the index is valid
+ */
+static bool lookupIndex(HpackTable *table, uint64_t index, const char **name, const char **value) {
+	if ((index >= 1) && (index <= STATIC_ENTRIES)) {
+		*name = staticTable[index - 1].name;
+		*value = staticTable[index - 1].value;
+		return true;
+	}
+	if ((index > STATIC_ENTRIES) && (index - STATIC_ENTRIES <= table->count)) {
+		HpackEntry *e = tableEntry(table, index - STATIC_ENTRIES - 1);
+		*name = e->name;
+		*value = e->value;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Decode a header block.
+ *
+ * @param table the decoder table
+ * @param in the header block
+ * @param len the length of the header block
+ * @param handler called for each field
+ * @param arg argument for the handler
+ * @return true if successful, false if the block is malformed
+ *   (a connection error), or the handler stopped decoding
+ */
+bool hpackDecode(HpackTable *table, const uint8_t *in, size_t len, HpackFieldHandler handler, void *arg) {
+	const uint8_t *p = in, *end = in + len;
+	char nameBuf[HPACK_MAX_STRING], valueBuf[HPACK_MAX_STRING];
+	bool fieldSeen = false;
+	while (p < end) {
+		uint8_t b = *p;
+		uint64_t index;
+		const char *name, *value;
+		if (b & 0x80) {
+			// indexed field
+			if (!decodeInt(&p, end, 7, &index) || !lookupIndex(table, index, &name, &value)) {
+				return false;
+			}
+			fieldSeen = true;
+			if (!handler(arg, name, value)) {
+				return false;
+			}
+			continue;
+		}
+		if ((b & 0xe0) == 0x20) {
+			// dynamic table size update, only before the first field
+			if (fieldSeen || !decodeInt(&p, end, 5, &index) || (index > table->settingsMax)) {
+				return false;
+			}
+			resizeTable(table, index);
+			continue;
+		}
+
+		// literal with incremental indexing (6-bit prefix), or
+		// without indexing or never indexed (4-bit prefix)
+		bool indexing = ((b & 0xc0) == 0x40);
+		if (!decodeInt(&p, end, indexing ? 6 : 4, &index)) {
+			return false;
+		}
+		if (index == 0) {
+			if (!decodeString(&p, end, nameBuf, sizeof(nameBuf))) {
+				return false;
+			}
+			name = nameBuf;
+		} else {
+			if (!lookupIndex(table, index, &name, &value)) {
+				return false;
+			}
+			// the name may be evicted by adding this field
+			size_t nameLen = strlen(name);
+			if (nameLen >= sizeof(nameBuf)) {
+				return false;
+			}
+			memcpy(nameBuf, name, nameLen + 1);
+			name = nameBuf;
+		}
+		if (!decodeString(&p, end, valueBuf, sizeof(valueBuf))) {
+			return false;
+		}
+		if (indexing) {
+			addEntry(table, name, strlen(name), valueBuf, strlen(valueBuf));
+		}
+		fieldSeen = true;
+		if (!handler(arg, name, valueBuf)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Begin a header block: announces a pending table size change.
+ *
+ * @param table the encoder table
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @return the bytes written, or SIZE_MAX if out of room
+ */
+size_t hpackBeginBlock(HpackTable *table, uint8_t *out, size_t size) {
+	if (!table->sizeUpdate) {
+		return 0;
+	}
+	size_t n = 0;
+	// a limit lowered and raised again is announced at its lowest first
+	if (table->minSize < table->maxSize) {
+		n = encodeInt(out, size, 0x20, 5, table->minSize);
+		if (n == SIZE_MAX) {
+			return SIZE_MAX;
+		}
+	}
+	size_t m = encodeInt(out + n, size - n, 0x20, 5, table->maxSize);
+	if (m == SIZE_MAX) {
+		return SIZE_MAX;
+	}
+	table->sizeUpdate = false;
+	table->minSize = table->maxSize;
+	return n + m;
+}
+
+/**
+ * Determine whether a field is worth adding to the dynamic table.
+ * Lengths and validators differ for every response.
+ */
+static bool worthIndexing(const char *name) {
+	return (strcmp(name, "content-length") != 0) && (strcmp(name, "etag") != 0)
+		&& (strcmp(name, "last-modified") != 0);
+}
+
+/**
+ * Determine whether a field must never be indexed by intermediaries.
+ */
+static bool neverIndexed(const char *name) {
+	return (strcmp(name, "set-cookie") == 0) || (strcmp(name, "authorization") == 0);
+}
+
+/**
+ * Encode a header field.
+ *
+ * @param table the encoder table
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @param name the name, in lower case
+ * @param value the value
+ * @return the bytes written, or SIZE_MAX if out of room
+ */
+size_t hpackEncode(HpackTable *table, uint8_t *out, size_t size, const char *name, const char *value) {
+	size_t nameLen = strlen(name), valueLen = strlen(value);
+	uint64_t nameIndex = 0;
+
+	// an exact match is sent as its index alone
+	for (size_t i = 0; i < STATIC_ENTRIES; i++) {
+		if (strcmp(staticTable[i].name, name) == 0) {
+			if (strcmp(staticTable[i].value, value) == 0) {
+				return encodeInt(out, size, 0x80, 7, i + 1);
+			}
+			if (nameIndex == 0) {
+				nameIndex = i + 1;
+			}
+		}
+	}
+	for (size_t i = 0; i < table->count; i++) {
+		HpackEntry *e = tableEntry(table, i);
+		if ((e->nameLen == nameLen) && (memcmp(e->name, name, nameLen) == 0)) {
+			if ((e->valueLen == valueLen) && (memcmp(e->value, value, valueLen) == 0)) {
+				return encodeInt(out, size, 0x80, 7, STATIC_ENTRIES + 1 + i);
+			}
+			if (nameIndex == 0) {
+				nameIndex = STATIC_ENTRIES + 1 + i;
+			}
+		}
+	}
+
+	// otherwise a literal, naming the field by index if possible
+	bool never = neverIndexed(name);
+	bool indexing = !never && worthIndexing(name)
+		&& (ENTRY_OVERHEAD + nameLen + valueLen <= table->maxSize / 2);
+	size_t n = indexing ? encodeInt(out, size, 0x40, 6, nameIndex)
+						: encodeInt(out, size, never ? 0x10 : 0, 4, nameIndex);
+	if (n == SIZE_MAX) {
+		return SIZE_MAX;
+	}
+	if (nameIndex == 0) {
+		size_t m = encodeString(out + n, size - n, name, nameLen);
+		if (m == SIZE_MAX) {
+			return SIZE_MAX;
+		}
+		n += m;
+	}
+	size_t m = encodeString(out + n, size - n, value, valueLen);
+	if (m == SIZE_MAX) {
+		return SIZE_MAX;
+	}
+	if (indexing) {
+		addEntry(table, name, nameLen, value, valueLen);
+	}
+	return n + m;
+}
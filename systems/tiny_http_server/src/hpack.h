@@ -0,0 +1,144 @@
+/*
+ * hpack.h
+ *
+ * HPACK header compression for HTTP/2 (RFC 7541).
+ *
+ * Each direction of a connection has its own table: the static
+ * table of common fields followed by a dynamic table of fields
+ * recently sent, evicted oldest first to stay within a size limit.
+ * The decoder accepts every representation, including Huffman-coded
+ * strings. The encoder sends indexed fields where the tables have a
+ * match, adds fields to its dynamic table except those unlikely to
+ * repeat, and Huffman-codes strings when that makes them shorter.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef HPACK_H_
+#define HPACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** default size limit of a dynamic table */
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+
+/** longest decoded name or value */
+#define HPACK_MAX_STRING 8192
+
+/** An entry of a dynamic table */
+typedef struct HpackEntry {
+	char *name;				/** the name, followed by the value in one allocation */
+	char *value;			/** the value */
+	size_t nameLen;			/** length of the name */
+	size_t valueLen;		/** length of the value */
+} HpackEntry;
+
+/** A dynamic table, for the encoder or decoder of one direction */
+typedef struct HpackTable {
+	HpackEntry *entries;	/** ring of entries */
+	size_t slots;			/** number of ring slots */
+	size_t newest;			/** slot of the newest entry */
+	size_t count;			/** number of entries */
+	size_t size;			/** size of the entries as defined by RFC 7541 */
+	size_t maxSize;			/** current size limit */
+	size_t settingsMax;		/** largest size limit allowed */
+	bool sizeUpdate;		/** encoder must announce maxSize */
+	size_t minSize;			/** smallest limit since the last announcement */
+} HpackTable;
+
+/**
+ * Called for each decoded header field.
+ *
+ * @param arg the argument passed to hpackDecode()
+ * @param name the name, NUL-terminated
+ * @param value the value, NUL-terminated
+ * @return true to continue, false to stop decoding with an error
+ */
+typedef bool (*HpackFieldHandler)(void *arg, const char *name, const char *value);
+
+/**
+ * Initialize a dynamic table.
+ *
+ * @param table the table
+ * @param settingsMax the largest size limit allowed
+ * @return true if successful
+ */
+bool initHpackTable(HpackTable *table, size_t settingsMax);
+
+/**
+ * Free the entries of a dynamic table.
+ *
+ * @param table the table
+ */
+void freeHpackTable(HpackTable *table);
+
+/**
+ * Set the size limit of an encoder's table, such as from the
+ * peer's SETTINGS_HEADER_TABLE_SIZE. The limit is capped at the
+ * table's settingsMax, and announced in the next header block.
+ *
+ * @param table the encoder table
+ * @param maxSize the size limit
+ */
+void hpackSetEncoderSize(HpackTable *table, size_t maxSize);
+
+/**
+ * Decode a header block.
+ *
+ * @param table the decoder table
+ * @param in the header block
+ * @param len the length of the header block
+ * @param handler called for each field
+ * @param arg argument for the handler
+ * @return true if successful, false if the block is malformed
+ *   (a connection error), or the handler stopped decoding
+ */
+bool hpackDecode(HpackTable *table, const uint8_t *in, size_t len, HpackFieldHandler handler, void *arg);
+
+/**
+ * Begin a header block: announces a pending table size change.
+ *
+ * @param table the encoder table
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @return the bytes written, or SIZE_MAX if out of room
+ */
+size_t hpackBeginBlock(HpackTable *table, uint8_t *out, size_t size);
+
+/**
+ * Encode a header field.
+ *
+ * @param table the encoder table
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @param name the name, in lower case
+ * @param value the value
+ * @return the bytes written, or SIZE_MAX if out of room
+ */
+size_t hpackEncode(HpackTable *table, uint8_t *out, size_t size, const char *name, const char *value);
+
+/**
+ * Huffman-code a string.
+ *
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @param in the string
+ * @param len the length of the string
+ * @return the coded length, or SIZE_MAX if out of room
+ */
+size_t huffmanEncode(uint8_t *out, size_t size, const char *in, size_t len);
+
+/**
+ * Decode a Huffman-coded string.
+ *
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @param in the coded string
+ * @param len the length of the coded string
+ * @return the decoded length, or SIZE_MAX if malformed or out of room
+ */
+size_t huffmanDecode(char *out, size_t size, const uint8_t *in, size_t len);
+
+#endif /* HPACK_H_ */
@@ -0,0 +1,1796 @@
+/*
+ * http2.c
+ *
+ * HTTP/2 over cleartext TCP ("h2c", RFC 9113).
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "buffer_pool.h"
+#include "conn_timeout.h"
+#include "cpu_affinity.h"
+#include "hpack.h"
+#include "http2.h"
+#include "http_server.h"
+#include "rate_limit.h"
+
+// MacOS has no MSG_NOSIGNAL: SIGPIPE is disabled per socket instead
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+/** size of a frame header */
+#define FRAME_HEADER_SIZE 9
+
+/** largest frame payload received; the RFC 9113 default, not raised */
+#define MAX_FRAME_SIZE 16384
+
+/** largest frame payload the peer may allow */
+#define MAX_FRAME_SIZE_LIMIT 16777215
+
+/** largest request header block */
+#define MAX_HEADER_BLOCK 65536
+
+/** largest response header block */
+#define RESPONSE_BLOCK_SIZE 8192
+
+/** largest flow-control window */
+#define MAX_WINDOW 0x7fffffff
+
+/** the connection preface */
+static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/** length of the connection preface */
+#define PREFACE_LEN (sizeof(preface) - 1)
+
+/** length of the preface through the blank line after the first line */
+#define PREFACE_LINE_LEN 18
+
+/** Frame types */
+enum {
+	FRAME_DATA = 0x0,
+	FRAME_HEADERS = 0x1,
+	FRAME_PRIORITY = 0x2,
+	FRAME_RST_STREAM = 0x3,
+	FRAME_SETTINGS = 0x4,
+	FRAME_PUSH_PROMISE = 0x5,
+	FRAME_PING = 0x6,
+	FRAME_GOAWAY = 0x7,
+	FRAME_WINDOW_UPDATE = 0x8,
+	FRAME_CONTINUATION = 0x9,
+	FRAME_PRIORITY_UPDATE = 0x10	/** RFC 9218 */
+};
+
+/** Frame flags */
+enum {
+	FLAG_END_STREAM = 0x1,
+	FLAG_ACK = 0x1,
+	FLAG_END_HEADERS = 0x4,
+	FLAG_PADDED = 0x8,
+	FLAG_PRIORITY = 0x20
+};
+
+/** Settings */
+enum {
+	SETTINGS_HEADER_TABLE_SIZE = 0x1,
+	SETTINGS_ENABLE_PUSH = 0x2,
+	SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+	SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+	SETTINGS_MAX_FRAME_SIZE = 0x5
+};
+
+/** Error codes */
+enum {
+	NO_ERROR = 0x0,
+	PROTOCOL_ERROR = 0x1,
+	INTERNAL_ERROR = 0x2,
+	FLOW_CONTROL_ERROR = 0x3,
+	STREAM_CLOSED = 0x5,
+	FRAME_SIZE_ERROR = 0x6,
+	REFUSED_STREAM = 0x7,
+	CANCEL = 0x8,
+	COMPRESSION_ERROR = 0x9,
+	ENHANCE_YOUR_CALM = 0xb
+};
+
+/** default urgency of a response (RFC 9218) */
+#define DEFAULT_URGENCY 3
+
+typedef struct Http2Session Http2Session;
+
+/** A stream: one request and its response */
+typedef struct Http2Stream {
+	struct Http2Stream *next;	/** next open stream of the session */
+	Http2Session *session;		/** the session */
+	uint32_t id;				/** the stream identifier */
+	FILE *file;					/** stream opened for the handler */
+	SocketCounters counters;	/** bytes received and sent */
+	char method[MAXBUF];		/** the request method */
+	char target[MAXBUF];		/** the request target */
+	Properties *requestHeaders;	/** request headers until handed to the handler */
+	bool head;					/** HEAD request: the response has no body */
+	int status;					/** the response status, 0 until set */
+	bool headersSent;			/** response headers sent */
+	bool endSent;				/** response ended */
+	bool reset;					/** reset by either side */
+	int urgency;				/** priority urgency, 0 most urgent */
+	bool incremental;			/** response is useful in parts */
+	bool waiting;				/** the handler has DATA waiting to send */
+	uint64_t lastSent;			/** sequence number of the last DATA frame sent */
+	int64_t sendWindow;			/** stream send window */
+	int64_t recvWindow;			/** stream receive window */
+	bool inputEnded;			/** request body complete */
+	uint8_t *in;				/** ring of request body bytes received */
+	size_t inCap;				/** size of the ring */
+	size_t inStart;				/** start of the bytes in the ring */
+	size_t inLen;				/** number of bytes in the ring */
+	size_t consumed;			/** bytes read since the last WINDOW_UPDATE */
+	pthread_cond_t inReady;		/** request body bytes arrived or input ended */
+} Http2Stream;
+
+/** A connection speaking HTTP/2 */
+struct Http2Session {
+	Connection *conn;				/** the connection */
+	int sock_fd;					/** the socket */
+	pthread_mutex_t lock;			/** guards streams, windows and settings */
+	pthread_cond_t sendReady;		/** a waiting DATA frame may be able to go */
+	pthread_cond_t streamsDone;		/** the last open stream closed */
+	Http2Stream *streams;			/** open streams */
+	unsigned openStreams;			/** number of open streams */
+	uint32_t lastStreamId;			/** highest stream opened by the client */
+	bool upgraded;					/** upgraded from HTTP/1.1 */
+	bool sending;					/** a DATA frame is being written */
+	bool closed;					/** no more frames will be read */
+	uint64_t sendSeq;				/** DATA frames sent */
+	int64_t sendWindow;				/** connection send window */
+	int64_t peerWindow;				/** the peer's initial stream window */
+	uint32_t peerMaxFrame;			/** largest frame the peer accepts */
+	pthread_mutex_t writeLock;		/** serializes frames and encoder use */
+	pthread_mutex_t timeoutLock;	/** guards the connection deadline; taken last */
+	HpackTable encoder;				/** table of header fields sent */
+	HpackTable decoder;				/** table of header fields received */
+	uint32_t connWindow;			/** connection receive window advertised */
+	uint32_t recvUnacked;			/** bytes received since the last connection WINDOW_UPDATE */
+	uint32_t error;					/** the connection error */
+	bool continuing;				/** a header block continues */
+	uint32_t blockStream;			/** stream of the header block */
+	bool blockEndStream;			/** the header block ends its stream */
+	uint8_t *block;					/** the header block */
+	size_t blockLen;				/** length of the header block */
+	size_t blockCap;				/** capacity of the header block */
+	size_t inPos;					/** position in the input buffer */
+	size_t inLen;					/** bytes in the input buffer */
+	uint8_t in[FRAME_HEADER_SIZE + MAX_FRAME_SIZE];	/** input buffer */
+	uint8_t frame[MAX_FRAME_SIZE];	/** payload of the frame being handled */
+};
+
+/** A frame header */
+typedef struct FrameHeader {
+	uint32_t length;			/** payload length */
+	uint8_t type;				/** frame type */
+	uint8_t flags;				/** frame flags */
+	uint32_t streamId;			/** stream identifier */
+} FrameHeader;
+
+/** Request fields collected from a header block */
+typedef struct RequestFields {
+	Properties *headers;		/** regular header fields */
+	char method[MAXBUF];		/** :method */
+	char path[MAXBUF];			/** :path */
+	char authority[MAX_PROP_VAL];	/** :authority */
+	bool host;					/** a host field was seen */
+	bool regular;				/** a regular field was seen */
+	bool malformed;				/** the request is malformed */
+	int urgency;				/** priority urgency */
+	bool incremental;			/** priority incremental */
+} RequestFields;
+
+/** HTTP/2 is enabled */
+static bool enabled;
+
+/** thread pool running stream requests */
+static threadpool streamPool;
+
+/** chooses the pool lane of stream requests */
+static Http2StreamClassifier streamClassifier;
+
+/** serves stream requests */
+static Http2StreamHandler streamHandler;
+
+/** most concurrent streams per connection */
+static unsigned maxStreams;
+
+/** most concurrent sessions */
+static unsigned maxSessions;
+
+/** sessions running or reserved */
+static unsigned sessions;
+
+/** receive window of each stream */
+static uint32_t streamWindow;
+
+/** the stream whose request this thread is serving */
+static __thread Http2Stream *currentStream;
+
+/**
+ * Enable HTTP/2.
+ *
+ * @param pool the thread pool running stream requests
+ * @param classify the function that chooses the lane of a stream request
+ * @param handler the function that serves a stream request
+ * @param maxStreams the most concurrent streams per connection
+ * @param sessionLimit the most concurrent HTTP/2 connections
+ * @param window the flow-control window of each stream's request body
+ *   (at least HTTP2_DEFAULT_WINDOW)
+ * @return true if successful
+ */
+bool initHttp2(threadpool pool, Http2StreamClassifier classify, Http2StreamHandler handler,
+			   unsigned maxConcurrent, unsigned sessionLimit, unsigned long window) {
+	if ((maxConcurrent == 0) || (sessionLimit == 0)
+		|| (window < HTTP2_DEFAULT_WINDOW) || (window > MAX_WINDOW)) {
+		errno = EINVAL;
+		return false;
+	}
+	streamPool = pool;
+	streamClassifier = classify;
+	streamHandler = handler;
+	maxStreams = maxConcurrent;
+	maxSessions = sessionLimit;
+	streamWindow = (uint32_t)window;
+	enabled = true;
+	return true;
+}
+
+/**
+ * Determine whether HTTP/2 is enabled.
+ *
+ * @return true if enabled
+ */
+bool http2Enabled(void) {
+	return enabled;
+}
+
+/**
+ * Reserve one of the concurrent sessions for a connection about to
+ * become HTTP/2. startHttp2() takes over the reservation.
+ *
+ * @return true if reserved, false if the most sessions are running
+ */
+bool reserveHttp2Session(void) {
+	unsigned n = __atomic_load_n(&sessions, __ATOMIC_RELAXED);
+	do {
+		if (n >= maxSessions) {
+			return false;
+		}
+	} while (!__atomic_compare_exchange_n(&sessions, &n, n + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return true;
+}
+
+/**
+ * Release a session reserved with reserveHttp2Session() that was
+ * not started.
+ */
+void releaseHttp2Session(void) {
+	__atomic_sub_fetch(&sessions, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Arm the idle deadline of a session that has no open streams,
+ * or end an idle deadline once streams open. The caller holds
+ * the session lock.
+ */
+static void syncSessionIdle(Http2Session *session) {
+	ConnTimeout *ct = &session->conn->timeout;
+	pthread_mutex_lock(&session->timeoutLock);
+	if ((session->openStreams == 0) && !session->closed) {
+		armConnTimeout(ct, TIMEOUT_IDLE);
+	} else if (ct->kind == TIMEOUT_IDLE) {
+		cancelConnTimeout(ct);
+	}
+	pthread_mutex_unlock(&session->timeoutLock);
+}
+
+/**
+ * Get a 32-bit big-endian value.
+ */
+static uint32_t getUint32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/**
+ * Put a 32-bit big-endian value.
+ */
+static void putUint32(uint8_t *p, uint32_t value) {
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+}
+
+/**
+ * Write a frame. The caller holds the write lock. Each write arms
+ * the write-stall deadline, ended once the frame is out. If the
+ * write fails the connection is shut down, which ends the session.
+ *
+ * @param session the session
+ * @param type the frame type
+ * @param flags the frame flags
+ * @param streamId the stream identifier
+ * @param payload the payload
+ * @param len the payload length
+ * @return true if successful
+ */
+static bool writeFrame(Http2Session *session, uint8_t type, uint8_t flags, uint32_t streamId,
+					   const void *payload, size_t len) {
+	uint8_t header[FRAME_HEADER_SIZE];
+	header[0] = (uint8_t)(len >> 16);
+	header[1] = (uint8_t)(len >> 8);
+	header[2] = (uint8_t)len;
+	header[3] = type;
+	header[4] = flags;
+	putUint32(header + 5, streamId & MAX_WINDOW);
+
+	struct iovec iov[2] = {
+		{ .iov_base = header, .iov_len = FRAME_HEADER_SIZE },
+		{ .iov_base = (void *)payload, .iov_len = len }
+	};
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = (len > 0) ? 2 : 1 };
+	size_t left = FRAME_HEADER_SIZE + len;
+	ConnTimeout *ct = &session->conn->timeout;
+	while (left > 0) {
+		pthread_mutex_lock(&session->timeoutLock);
+		connWriteProgress(ct);
+		pthread_mutex_unlock(&session->timeoutLock);
+		ssize_t n = sendmsg(session->sock_fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			shutdown(session->sock_fd, SHUT_RDWR);
+			return false;
+		}
+		left -= n;
+		// skip what was written
+		while ((n > 0) && (msg.msg_iovlen > 0)) {
+			size_t part = ((size_t)n < msg.msg_iov->iov_len) ? (size_t)n : msg.msg_iov->iov_len;
+			msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + part;
+			msg.msg_iov->iov_len -= part;
+			n -= part;
+			if (msg.msg_iov->iov_len == 0) {
+				msg.msg_iov++;
+				msg.msg_iovlen--;
+			}
+		}
+	}
+	pthread_mutex_lock(&session->timeoutLock);
+	if (ct->kind == TIMEOUT_WRITE) {
+		cancelConnTimeout(ct);
+	}
+	pthread_mutex_unlock(&session->timeoutLock);
+	return true;
+}
+
+/**
+ * Send a frame, taking the write lock.
+ *
+ * @return true if successful
+ */
+static bool sendFrame(Http2Session *session, uint8_t type, uint8_t flags, uint32_t streamId,
+					  const void *payload, size_t len) {
+	pthread_mutex_lock(&session->writeLock);
+	bool ok = writeFrame(session, type, flags, streamId, payload, len);
+	pthread_mutex_unlock(&session->writeLock);
+	return ok;
+}
+
+/**
+ * Send a WINDOW_UPDATE frame.
+ */
+static bool sendWindowUpdate(Http2Session *session, uint32_t streamId, uint32_t increment) {
+	uint8_t payload[4];
+	putUint32(payload, increment);
+	return sendFrame(session, FRAME_WINDOW_UPDATE, 0, streamId, payload, sizeof(payload));
+}
+
+/**
+ * Send a GOAWAY frame.
+ */
+static void sendGoaway(Http2Session *session, uint32_t error) {
+	uint8_t payload[8];
+	putUint32(payload, session->lastStreamId);
+	putUint32(payload + 4, error);
+	sendFrame(session, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+/**
+ * Find an open stream. The caller holds the session lock.
+ *
+ * @return the stream, or NULL if not open
+ */
+static Http2Stream *findStream(Http2Session *session, uint32_t streamId) {
+	for (Http2Stream *stream = session->streams; stream != NULL; stream = stream->next) {
+		if (stream->id == streamId) {
+			return stream;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Reset a stream: wakes its handler, whose reads and writes then
+ * fail, and sends RST_STREAM unless the stream was already reset.
+ *
+ * @param session the session
+ * @param streamId the stream identifier
+ * @param error the error code
+ */
+static void resetStream(Http2Session *session, uint32_t streamId, uint32_t error) {
+	pthread_mutex_lock(&session->lock);
+	Http2Stream *stream = findStream(session, streamId);
+	bool send = true;
+	if (stream != NULL) {
+		send = !stream->reset;
+		stream->reset = true;
+		pthread_cond_signal(&stream->inReady);
+		pthread_cond_broadcast(&session->sendReady);
+	}
+	pthread_mutex_unlock(&session->lock);
+	if (send) {
+		uint8_t payload[4];
+		putUint32(payload, error);
+		sendFrame(session, FRAME_RST_STREAM, 0, streamId, payload, sizeof(payload));
+	}
+}
+
+/**
+ * Determine whether a stream has been reset.
+ */
+static bool isReset(Http2Stream *stream) {
+	pthread_mutex_lock(&stream->session->lock);
+	bool reset = stream->reset;
+	pthread_mutex_unlock(&stream->session->lock);
+	return reset;
+}
+
+/**
+ * Get the time a wait of a number of milliseconds from now ends.
+ *
+ * @param deadline the end of the wait
+ * @param ms the wait, or 0 for no limit
+ * @return true if the wait has a limit
+ */
+static bool waitDeadline(struct timespec *deadline, unsigned long ms) {
+	if (ms == 0) {
+		return false;
+	}
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += ms / 1000;
+	deadline->tv_nsec += (ms % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+	return true;
+}
+
+/**
+ * Determine whether stream a sends before stream b: lower urgency
+ * first, then non-incremental responses in stream order, then
+ * incremental responses in turn.
+ */
+static bool sendsBefore(const Http2Stream *a, const Http2Stream *b) {
+	if (a->urgency != b->urgency) {
+		return a->urgency < b->urgency;
+	}
+	if (a->incremental != b->incremental) {
+		return !a->incremental;
+	}
+	return a->incremental ? (a->lastSent < b->lastSent) : (a->id < b->id);
+}
+
+/**
+ * Choose the stream that sends the next DATA frame, among those
+ * with data waiting and window to send it. The caller holds the
+ * session lock.
+ *
+ * @return the stream, or NULL if none can send
+ */
+static Http2Stream *nextSender(Http2Session *session) {
+	Http2Stream *best = NULL;
+	for (Http2Stream *stream = session->streams; stream != NULL; stream = stream->next) {
+		if (stream->waiting && !stream->reset && (stream->sendWindow > 0)
+			&& ((best == NULL) || sendsBefore(stream, best))) {
+			best = stream;
+		}
+	}
+	return best;
+}
+
+/**
+ * Send response body bytes on a stream as DATA frames. Each frame
+ * waits for the stream's turn by priority and for window; a stream
+ * that gets no window within the write timeout is reset.
+ *
+ * @param stream the stream
+ * @param buf the bytes
+ * @param len the number of bytes, 0 to only end the stream
+ * @param endStream true to end the stream with the last frame
+ * @return true if successful
+ */
+static bool sendData(Http2Stream *stream, const char *buf, size_t len, bool endStream) {
+	Http2Session *session = stream->session;
+	bool ok = true, timedOut = false;
+	pthread_mutex_lock(&session->lock);
+	stream->waiting = true;
+	do {
+		// the timeout runs while no stream of the session sends
+		struct timespec deadline;
+		bool timed = waitDeadline(&deadline, connTimeoutLimit(TIMEOUT_WRITE));
+		uint64_t seq = session->sendSeq;
+		while (true) {
+			if (stream->reset) {
+				ok = false;
+				break;
+			}
+			if (!session->sending
+				&& ((len == 0) || ((session->sendWindow > 0) && (nextSender(session) == stream)))) {
+				break;
+			}
+			// no more WINDOW_UPDATE frames will come
+			if (session->closed && ((session->sendWindow <= 0) || (stream->sendWindow <= 0))) {
+				ok = false;
+				break;
+			}
+			if (timed) {
+				if (pthread_cond_timedwait(&session->sendReady, &session->lock, &deadline) == ETIMEDOUT) {
+					if (session->sendSeq != seq) {
+						seq = session->sendSeq;
+						waitDeadline(&deadline, connTimeoutLimit(TIMEOUT_WRITE));
+						continue;
+					}
+					ok = false;
+					timedOut = true;
+					break;
+				}
+			} else {
+				pthread_cond_wait(&session->sendReady, &session->lock);
+			}
+		}
+		if (!ok) {
+			break;
+		}
+
+		size_t n = len;
+		if (n > session->peerMaxFrame) {
+			n = session->peerMaxFrame;
+		}
+		if ((int64_t)n > stream->sendWindow) {
+			n = (size_t)stream->sendWindow;
+		}
+		if ((int64_t)n > session->sendWindow) {
+			n = (size_t)session->sendWindow;
+		}
+		bool last = endStream && (n == len);
+		stream->sendWindow -= n;
+		session->sendWindow -= n;
+		stream->lastSent = ++session->sendSeq;
+		session->sending = true;
+		pthread_mutex_unlock(&session->lock);
+
+		ok = sendFrame(session, FRAME_DATA, last ? FLAG_END_STREAM : 0, stream->id, buf, n);
+		stream->counters.bytesOut += FRAME_HEADER_SIZE + n;
+
+		pthread_mutex_lock(&session->lock);
+		session->sending = false;
+		if (last) {
+			stream->endSent = true;
+		}
+		buf += n;
+		len -= n;
+	} while (ok && (len > 0));
+	stream->waiting = false;
+	pthread_cond_broadcast(&session->sendReady);
+	pthread_mutex_unlock(&session->lock);
+
+	if (timedOut) {
+		resetStream(session, stream->id, CANCEL);
+	}
+	return ok;
+}
+
+/**
+ * Read request body bytes of a stream, waiting up to the body
+ * timeout for them to arrive. Half the window read is returned
+ * to the client at a time.
+ */
+static ssize_t streamRead(void *cookie, char *buf, size_t size) {
+	Http2Stream *stream = cookie;
+	Http2Session *session = stream->session;
+	struct timespec deadline;
+	bool timed = waitDeadline(&deadline, connTimeoutLimit(TIMEOUT_BODY));
+	bool timedOut = false;
+	uint32_t update = 0;
+	ssize_t n;
+
+	pthread_mutex_lock(&session->lock);
+	while ((stream->inLen == 0) && !stream->inputEnded && !stream->reset && !session->closed) {
+		if (timed) {
+			if (pthread_cond_timedwait(&stream->inReady, &session->lock, &deadline) == ETIMEDOUT) {
+				timedOut = true;
+				break;
+			}
+		} else {
+			pthread_cond_wait(&stream->inReady, &session->lock);
+		}
+	}
+	if (stream->inLen > 0) {
+		n = (size < stream->inLen) ? (ssize_t)size : (ssize_t)stream->inLen;
+		size_t first = stream->inCap - stream->inStart;
+		if ((size_t)n <= first) {
+			memcpy(buf, stream->in + stream->inStart, n);
+		} else {
+			memcpy(buf, stream->in + stream->inStart, first);
+			memcpy(buf + first, stream->in, n - first);
+		}
+		stream->inStart = (stream->inStart + n) % stream->inCap;
+		stream->inLen -= n;
+		stream->counters.bytesIn += n;
+		stream->consumed += n;
+		if (!stream->inputEnded && (stream->consumed >= stream->inCap / 2)) {
+			update = (uint32_t)stream->consumed;
+			stream->recvWindow += stream->consumed;
+			stream->consumed = 0;
+		}
+	} else {
+		n = (stream->inputEnded && !stream->reset) ? 0 : -1;
+		if (n < 0) {
+			errno = timedOut ? ETIMEDOUT : ECONNRESET;
+		}
+	}
+	pthread_mutex_unlock(&session->lock);
+
+	if (update > 0) {
+		sendWindowUpdate(session, stream->id, update);
+	}
+	if (timedOut) {
+		resetStream(session, stream->id, CANCEL);
+	}
+	return n;
+}
+
+/**
+ * Write response body bytes of a stream. Bytes written to a
+ * response that has no body are discarded. Under a byte rate
+ * limit the bytes go out in paced pieces. As fopencookie(3)
+ * requires, a failed write returns the bytes sent before it,
+ * never -1: stdio takes a negative count as bytes written.
+ */
+static ssize_t streamWrite(void *cookie, const char *buf, size_t size) {
+	Http2Stream *stream = cookie;
+	if ((size == 0) || !stream->headersSent) {
+		return 0;
+	}
+	if (stream->endSent) {
+		return size;
+	}
+	size_t chunk = paceChunkSize();
+	size_t sent = 0;
+	while (sent < size) {
+		size_t len = ((chunk > 0) && (size - sent > chunk)) ? chunk : size - sent;
+		paceResponseBytes(len);
+		if (!sendData(stream, buf + sent, len, false)) {
+			break;
+		}
+		sent += len;
+	}
+	return sent;
+}
+
+/**
+ * Remove a closed stream from its session and free it. The last
+ * stream to close lets a finished session end, or starts the idle
+ * deadline of a running one.
+ *
+ * @param stream the stream
+ */
+static void closeStream(Http2Stream *stream) {
+	Http2Session *session = stream->session;
+	pthread_mutex_lock(&session->lock);
+	for (Http2Stream **p = &session->streams; *p != NULL; p = &(*p)->next) {
+		if (*p == stream) {
+			*p = stream->next;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&session->sendReady);
+	if (--session->openStreams == 0) {
+		syncSessionIdle(session);
+		pthread_cond_broadcast(&session->streamsDone);
+	}
+	pthread_mutex_unlock(&session->lock);
+
+	if (stream->requestHeaders != NULL) {
+		deleteProperties(stream->requestHeaders);
+	}
+	pthread_cond_destroy(&stream->inReady);
+	free(stream->in);
+	free(stream);
+}
+
+/**
+ * End the response of a stream when its handler is done: sends
+ * END_STREAM if the response has not ended, or resets a stream
+ * whose handler sent nothing. A request body left unread is
+ * refused with RST_STREAM (NO_ERROR) once the response is complete.
+ */
+static int streamClose(void *cookie) {
+	Http2Stream *stream = cookie;
+	Http2Session *session = stream->session;
+	bool ok = true;
+	if (!stream->headersSent) {
+		resetStream(session, stream->id, INTERNAL_ERROR);
+		ok = false;
+	} else if (!stream->endSent && !isReset(stream)) {
+		ok = sendData(stream, NULL, 0, true);
+	}
+
+	pthread_mutex_lock(&session->lock);
+	bool unread = !stream->inputEnded && !stream->reset;
+	pthread_mutex_unlock(&session->lock);
+	if (unread) {
+		resetStream(session, stream->id, NO_ERROR);
+	}
+	closeStream(stream);
+	return ok ? 0 : EOF;
+}
+
+/**
+ * Serve the request of a stream on a pool thread.
+ *
+ * @param stream the stream
+ */
+static void runStream(Http2Stream *stream) {
+	cookie_io_functions_t io = {
+		.read = streamRead,
+		.write = streamWrite,
+		.seek = NULL,
+		.close = streamClose
+	};
+	char *buf = borrowBuffer();
+	FILE *file = (buf != NULL) ? fopencookie(stream, "r+", io) : NULL;
+	if (file == NULL) {
+		perror("runStream");
+		returnBuffer(buf);
+		resetStream(stream->session, stream->id, INTERNAL_ERROR);
+		closeStream(stream);
+		return;
+	}
+	setvbuf(file, buf, _IOFBF, POOL_BUFFER_SIZE);
+	stream->file = file;
+
+	// the handler owns the request headers
+	Properties *requestHeaders = stream->requestHeaders;
+	stream->requestHeaders = NULL;
+	currentStream = stream;
+	streamHandler(stream->session->conn, file, &stream->counters, stream->method, stream->target,
+				  requestHeaders);
+	currentStream = NULL;
+
+	// ends the response and frees the stream
+	fclose(file);
+	returnBuffer(buf);
+}
+
+/**
+ * Create a stream for a request and add it to the session.
+ *
+ * @param session the session
+ * @param streamId the stream identifier
+ * @param fields the request fields, whose headers the stream takes
+ * @param endStream true if the request has no body
+ * @return the stream, or NULL if out of memory
+ */
+static Http2Stream *newStream(Http2Session *session, uint32_t streamId, RequestFields *fields, bool endStream) {
+	Http2Stream *stream = calloc(1, sizeof(Http2Stream));
+	if (stream == NULL) {
+		return NULL;
+	}
+	// a body is buffered up to the stream's window
+	if (!endStream) {
+		stream->in = malloc(streamWindow);
+		if (stream->in == NULL) {
+			free(stream);
+			return NULL;
+		}
+		stream->inCap = streamWindow;
+	}
+	stream->session = session;
+	stream->id = streamId;
+	strcpy(stream->method, fields->method);
+	strcpy(stream->target, fields->path);
+	stream->requestHeaders = fields->headers;
+	fields->headers = NULL;
+	stream->head = (strcmp(fields->method, "HEAD") == 0);
+	stream->urgency = fields->urgency;
+	stream->incremental = fields->incremental;
+	stream->recvWindow = streamWindow;
+	stream->inputEnded = endStream;
+	pthread_cond_init(&stream->inReady, NULL);
+
+	pthread_mutex_lock(&session->lock);
+	stream->sendWindow = session->peerWindow;
+	stream->next = session->streams;
+	session->streams = stream;
+	session->openStreams++;
+	pthread_mutex_unlock(&session->lock);
+	return stream;
+}
+
+/**
+ * Queue the request of a stream to the thread pool, in the lane
+ * of its method and target.
+ *
+ * @param stream the stream
+ */
+static void dispatchStream(Http2Stream *stream) {
+	int lane = streamClassifier(stream->method, stream->target, stream->requestHeaders);
+	if (thpool_add_work_lane(streamPool, lane, (void *)runStream, stream) != 0) {
+		resetStream(stream->session, stream->id, REFUSED_STREAM);
+		closeStream(stream);
+	}
+}
+
+/**
+ * Parse an RFC 9218 priority field, such as "u=1, i".
+ *
+ * @param value the field value
+ * @param urgency the urgency, unchanged if not given
+ * @param incremental the incremental flag, unchanged if not given
+ */
+static void parsePriority(const char *value, int *urgency, bool *incremental) {
+	const char *p = value;
+	while (*p != '\0') {
+		while ((*p == ' ') || (*p == ',')) {
+			p++;
+		}
+		if ((p[0] == 'u') && (p[1] == '=') && (p[2] >= '0') && (p[2] <= '7')) {
+			*urgency = p[2] - '0';
+		} else if (p[0] == 'i') {
+			*incremental = (strncmp(p + 1, "=?0", 3) != 0);
+		}
+		while ((*p != '\0') && (*p != ',')) {
+			p++;
+		}
+	}
+}
+
+/**
+ * Determine whether a header applies only to an HTTP/1 connection.
+ *
+ * @param name the name, in lower case
+ */
+static bool isConnectionHeader(const char *name) {
+	return (strcmp(name, "connection") == 0) || (strcmp(name, "keep-alive") == 0)
+		|| (strcmp(name, "proxy-connection") == 0) || (strcmp(name, "transfer-encoding") == 0)
+		|| (strcmp(name, "upgrade") == 0);
+}
+
+/**
+ * Copy a pseudo-header value, marking the request malformed if
+ * it is repeated, empty or too long.
+ */
+static void copyPseudoHeader(RequestFields *fields, char *field, size_t size, const char *value) {
+	if ((field[0] != '\0') || (value[0] == '\0') || (strlen(value) >= size)) {
+		fields->malformed = true;
+	} else {
+		strcpy(field, value);
+	}
+}
+
+/**
+ * Collect a decoded request field.
+ */
+static bool collectField(void *arg, const char *name, const char *value) {
+	RequestFields *fields = arg;
+	if (name[0] == ':') {
+		// pseudo-headers come first
+		if (fields->regular) {
+			fields->malformed = true;
+		} else if (strcmp(name, ":method") == 0) {
+			copyPseudoHeader(fields, fields->method, sizeof(fields->method), value);
+		} else if (strcmp(name, ":path") == 0) {
+			copyPseudoHeader(fields, fields->path, sizeof(fields->path), value);
+		} else if (strcmp(name, ":authority") == 0) {
+			copyPseudoHeader(fields, fields->authority, sizeof(fields->authority), value);
+		} else if (strcmp(name, ":scheme") != 0) {
+			fields->malformed = true;
+		}
+		return true;
+	}
+	fields->regular = true;
+	for (const char *p = name; *p != '\0'; p++) {
+		if (isupper((unsigned char)*p)) {
+			fields->malformed = true;
+		}
+	}
+	if (isConnectionHeader(name) || ((strcmp(name, "te") == 0) && (strcmp(value, "trailers") != 0))) {
+		fields->malformed = true;
+	} else if (strcmp(name, "priority") == 0) {
+		parsePriority(value, &fields->urgency, &fields->incremental);
+	} else if (strcmp(name, "host") == 0) {
+		fields->host = true;
+	}
+	putProperty(fields->headers, name, value);
+	return true;
+}
+
+/**
+ * Ignore a decoded field, such as a trailer.
+ */
+static bool ignoreField(void *arg, const char *name, const char *value) {
+	(void)arg;
+	(void)name;
+	(void)value;
+	return true;
+}
+
+/**
+ * Record a connection error.
+ *
+ * @return false
+ */
+static bool connectionError(Http2Session *session, uint32_t error) {
+	session->error = error;
+	return false;
+}
+
+/**
+ * Handle a complete header block: opens a stream for a request,
+ * or ends the request body of an open stream with trailers.
+ *
+ * @return true if successful, false if a connection error
+ */
+static bool endHeaderBlock(Http2Session *session) {
+	uint32_t streamId = session->blockStream;
+	bool endStream = session->blockEndStream;
+
+	if (streamId <= session->lastStreamId) {
+		// the decoder table changes whether or not the fields are used
+		if (!hpackDecode(&session->decoder, session->block, session->blockLen, ignoreField, NULL)) {
+			return connectionError(session, COMPRESSION_ERROR);
+		}
+		pthread_mutex_lock(&session->lock);
+		Http2Stream *stream = findStream(session, streamId);
+		bool trailers = (stream != NULL) && !stream->inputEnded && endStream;
+		if (trailers) {
+			stream->inputEnded = true;
+			pthread_cond_signal(&stream->inReady);
+		}
+		pthread_mutex_unlock(&session->lock);
+		if (!trailers) {
+			resetStream(session, streamId, (stream != NULL) ? PROTOCOL_ERROR : STREAM_CLOSED);
+		}
+		return true;
+	}
+	if ((streamId & 1) == 0) {
+		return connectionError(session, PROTOCOL_ERROR);
+	}
+	session->lastStreamId = streamId;
+
+	RequestFields fields = { .urgency = DEFAULT_URGENCY };
+	fields.headers = newProperties();
+	bool decoded = hpackDecode(&session->decoder, session->block, session->blockLen, collectField, &fields);
+	if (!decoded) {
+		deleteProperties(fields.headers);
+		return connectionError(session, COMPRESSION_ERROR);
+	}
+	if (fields.malformed || (fields.method[0] == '\0') || (fields.path[0] == '\0')
+		|| (strcmp(fields.method, "CONNECT") == 0)) {
+		deleteProperties(fields.headers);
+		resetStream(session, streamId, PROTOCOL_ERROR);
+		return true;
+	}
+	if ((fields.authority[0] != '\0') && !fields.host) {
+		putProperty(fields.headers, "host", fields.authority);
+	}
+
+	pthread_mutex_lock(&session->lock);
+	bool refused = (session->openStreams >= maxStreams);
+	pthread_mutex_unlock(&session->lock);
+	Http2Stream *stream = refused ? NULL : newStream(session, streamId, &fields, endStream);
+	if (stream == NULL) {
+		deleteProperties(fields.headers);
+		resetStream(session, streamId, REFUSED_STREAM);
+		return true;
+	}
+	stream->counters.bytesIn = FRAME_HEADER_SIZE + session->blockLen;
+	dispatchStream(stream);
+	return true;
+}
+
+/**
+ * Add a header block fragment.
+ *
+ * @return true if successful, false if a connection error
+ */
+static bool addHeaderFragment(Http2Session *session, const uint8_t *fragment, size_t len) {
+	if (session->blockLen + len > MAX_HEADER_BLOCK) {
+		return connectionError(session, ENHANCE_YOUR_CALM);
+	}
+	if (session->blockLen + len > session->blockCap) {
+		size_t cap = (session->blockCap == 0) ? MAX_FRAME_SIZE : session->blockCap;
+		while (cap < session->blockLen + len) {
+			cap *= 2;
+		}
+		uint8_t *block = realloc(session->block, cap);
+		if (block == NULL) {
+			return connectionError(session, INTERNAL_ERROR);
+		}
+		session->block = block;
+		session->blockCap = cap;
+	}
+	memcpy(session->block + session->blockLen, fragment, len);
+	session->blockLen += len;
+	return true;
+}
+
+/**
+ * Handle a HEADERS frame.
+ */
+static bool handleHeaders(Http2Session *session, const FrameHeader *fh, const uint8_t *payload) {
+	if (fh->streamId == 0) {
+		return connectionError(session, PROTOCOL_ERROR);
+	}
+	size_t pos = 0, pad = 0;
+	if (fh->flags & FLAG_PADDED) {
+		if (fh->length < 1) {
+			return connectionError(session, FRAME_SIZE_ERROR);
+		}
+		pad = payload[pos++];
+	}
+	// stream dependencies are superseded by RFC 9218 priorities
+	if (fh->flags & FLAG_PRIORITY) {
+		pos += 5;
+	}
+	if (pos + pad > fh->length) {
+		return connectionError(session, PROTOCOL_ERROR);
+	}
+	session->blockStream = fh->streamId;
+	session->blockEndStream = (fh->flags & FLAG_END_STREAM) != 0;
+	session->blockLen = 0;
+	if (!addHeaderFragment(session, payload + pos, fh->length - pos - pad)) {
+		return false;
+	}
+	if ((fh->flags & FLAG_END_HEADERS) == 0) {
+		session->continuing = true;
+		return true;
+	}
+	return endHeaderBlock(session);
+}
+
+/**
+ * Handle a CONTINUATION frame.
+ */
+static bool handleContinuation(Http2Session *session, const FrameHeader *fh, const uint8_t *payload) {
+	if (!session->continuing || (fh->streamId != session->blockStream)) {
+		return connectionError(session, PROTOCOL_ERROR);
+	}
+	if (!addHeaderFragment(session, payload, fh->length)) {
+		return false;
+	}
+	if ((fh->flags & FLAG_END_HEADERS) == 0) {
+		return true;
+	}
+	session->continuing = false;
+	return endHeaderBlock(session);
+}
+
+/**
+ * Handle a DATA frame: buffers request body bytes for the stream's
+ * handler. The connection window is returned once half is used.
+ */
+static bool handleData(Http2Session *session, const FrameHeader *fh, const uint8_t *payload) {
+	if ((fh->streamId == 0) || (fh->streamId > session->lastStreamId)) {
+		return connectionError(session, PROTOCOL_ERROR);
+	}
+	const uint8_t *data = payload;
+	size_t len = fh->length;
+	if (fh->flags & FLAG_PADDED) {
+		if ((len < 1) || (payload[0] >= len)) {
+			return connectionError(session, PROTOCOL_ERROR);
+		}
+		len -= 1 + payload[0];
+		data++;
+	}
+
+	// the whole frame counts against the windows
+	session->recvUnacked += fh->length;
+	if (session->recvUnacked >= session->connWindow / 2) {
+		sendWindowUpdate(session, 0, session->recvUnacked);
+		session->recvUnacked = 0;
+	}
+
+	pthread_mutex_lock(&session->lock);
+	Http2Stream *stream = findStream(session, fh->streamId);
+	uint32_t error = NO_ERROR;
+	if ((stream == NULL) || stream->inputEnded) {
+		error = STREAM_CLOSED;
+	} else if ((int64_t)fh->length > stream->recvWindow) {
+		error = FLOW_CONTROL_ERROR;
+	} else if (!stream->reset) {
+		stream->recvWindow -= fh->length;
+		size_t end = (stream->inStart + stream->inLen) % stream->inCap;
+		size_t first = stream->inCap - end;
+		if (len <= first) {
+			memcpy(stream->in + end, data, len);
+		} else {
+			memcpy(stream->in + end, data, first);
+			memcpy(stream->in, data + first, len - first);
+		}
+		stream->inLen += len;
+		// padding is consumed at once
+		stream->consumed += fh->length - len;
+		if (fh->flags & FLAG_END_STREAM) {
+			stream->inputEnded = true;
+		}
+		pthread_cond_signal(&stream->inReady);
+	}
+	pthread_mutex_unlock(&session->lock);
+
+	// frames of a stream that has just closed are expected
+	if ((error != NO_ERROR) && (stream != NULL)) {
+		resetStream(session, fh->streamId, error);
+	}
+	return true;
+}
+
+/**
+ * Apply the peer's settings.
+ *
+ * @return true if successful, false if a connection error
+ */
+static bool applySettings(Http2Session *session, const uint8_t *payload, size_t len) {
+	if ((len % 6) != 0) {
+		return connectionError(session, FRAME_SIZE_ERROR);
+	}
+	for (size_t i = 0; i < len; i += 6) {
+		unsigned id = ((unsigned)payload[i] << 8) | payload[i + 1];
+		uint32_t value = getUint32(payload + i + 2);
+		switch (id) {
+		case SETTINGS_HEADER_TABLE_SIZE:
+			pthread_mutex_lock(&session->writeLock);
+			hpackSetEncoderSize(&session->encoder, value);
+			pthread_mutex_unlock(&session->writeLock);
+			break;
+		case SETTINGS_ENABLE_PUSH:
+			if (value > 1) {
+				return connectionError(session, PROTOCOL_ERROR);
+			}
+			break;
+		case SETTINGS_INITIAL_WINDOW_SIZE: {
+			if (value > MAX_WINDOW) {
+				return connectionError(session, FLOW_CONTROL_ERROR);
+			}
+			// the change applies to the windows of open streams
+			bool overflow = false;
+			pthread_mutex_lock(&session->lock);
+			int64_t delta = (int64_t)value - session->peerWindow;
+			for (Http2Stream *stream = session->streams; stream != NULL; stream = stream->next) {
+				stream->sendWindow += delta;
+				overflow |= (stream->sendWindow > MAX_WINDOW);
+			}
+			session->peerWindow = value;
+			pthread_cond_broadcast(&session->sendReady);
+			pthread_mutex_unlock(&session->lock);
+			if (overflow) {
+				return connectionError(session, FLOW_CONTROL_ERROR);
+			}
+			break;
+		}
+		case SETTINGS_MAX_FRAME_SIZE:
+			if ((value < MAX_FRAME_SIZE) || (value > MAX_FRAME_SIZE_LIMIT)) {
+				return connectionError(session, PROTOCOL_ERROR);
+			}
+			pthread_mutex_lock(&session->lock);
+			session->peerMaxFrame = value;
+			pthread_mutex_unlock(&session->lock);
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+/**
+ * Handle a WINDOW_UPDATE frame.
+ */
+static bool handleWindowUpdate(Http2Session *session, const FrameHeader *fh, const uint8_t *payload) {
+	if (fh->length != 4) {
+		return connectionError(session, FRAME_SIZE_ERROR);
+	}
+	uint32_t increment = getUint32(payload) & MAX_WINDOW;
+	if (fh->streamId == 0) {
+		if (increment == 0) {
+			return connectionError(session, PROTOCOL_ERROR);
+		}
+		pthread_mutex_lock(&session->lock);
+		session->sendWindow += increment;
+		bool overflow = (session->sendWindow > MAX_WINDOW);
+		pthread_cond_broadcast(&session->sendReady);
+		pthread_mutex_unlock(&session->lock);
+		return overflow ? connectionError(session, FLOW_CONTROL_ERROR) : true;
+	}
+
+	uint32_t error = NO_ERROR;
+	pthread_mutex_lock(&session->lock);
+	Http2Stream *stream = findStream(session, fh->streamId);
+	if (stream != NULL) {
+		stream->sendWindow += increment;
+		if (increment == 0) {
+			error = PROTOCOL_ERROR;
+		} else if (stream->sendWindow > MAX_WINDOW) {
+			error = FLOW_CONTROL_ERROR;
+		}
+		pthread_cond_broadcast(&session->sendReady);
+	}
+	pthread_mutex_unlock(&session->lock);
+	if (error != NO_ERROR) {
+		resetStream(session, fh->streamId, error);
+	}
+	return true;
+}
+
+/**
+ * Handle a PRIORITY_UPDATE frame (RFC 9218) for an open stream.
+ */
+static bool handlePriorityUpdate(Http2Session *session, const FrameHeader *fh, const uint8_t *payload) {
+	if (fh->streamId != 0) {
+		return connectionError(session, PROTOCOL_ERROR);
+	}
+	if (fh->length < 4) {
+		return connectionError(session, FRAME_SIZE_ERROR);
+	}
+	char value[MAX_PROP_VAL];
+	size_t len = fh->length - 4;
+	if (len >= sizeof(value)) {
+		len = sizeof(value) - 1;
+	}
+	memcpy(value, payload + 4, len);
+	value[len] = '\0';
+
+	pthread_mutex_lock(&session->lock);
+	Http2Stream *stream = findStream(session, getUint32(payload) & MAX_WINDOW);
+	if (stream != NULL) {
+		parsePriority(value, &stream->urgency, &stream->incremental);
+		pthread_cond_broadcast(&session->sendReady);
+	}
+	pthread_mutex_unlock(&session->lock);
+	return true;
+}
+
+/**
+ * Handle a frame.
+ *
+ * @param session the session
+ * @param fh the frame header
+ * @param payload the frame payload
+ * @return true if successful, false if a connection error
+ */
+static bool handleFrame(Http2Session *session, const FrameHeader *fh, const uint8_t *payload) {
+	// a header block must not be interrupted
+	if (session->continuing && (fh->type != FRAME_CONTINUATION)) {
+		return connectionError(session, PROTOCOL_ERROR);
+	}
+
+	switch (fh->type) {
+	case FRAME_DATA:
+		return handleData(session, fh, payload);
+	case FRAME_HEADERS:
+		return handleHeaders(session, fh, payload);
+	case FRAME_CONTINUATION:
+		return handleContinuation(session, fh, payload);
+	case FRAME_PRIORITY:
+		if (fh->streamId == 0) {
+			return connectionError(session, PROTOCOL_ERROR);
+		}
+		return (fh->length == 5) ? true : connectionError(session, FRAME_SIZE_ERROR);
+	case FRAME_RST_STREAM: {
+		if ((fh->streamId == 0) || (fh->streamId > session->lastStreamId)) {
+			return connectionError(session, PROTOCOL_ERROR);
+		}
+		if (fh->length != 4) {
+			return connectionError(session, FRAME_SIZE_ERROR);
+		}
+		pthread_mutex_lock(&session->lock);
+		Http2Stream *stream = findStream(session, fh->streamId);
+		if (stream != NULL) {
+			stream->reset = true;
+			pthread_cond_signal(&stream->inReady);
+			pthread_cond_broadcast(&session->sendReady);
+		}
+		pthread_mutex_unlock(&session->lock);
+		return true;
+	}
+	case FRAME_SETTINGS:
+		if (fh->streamId != 0) {
+			return connectionError(session, PROTOCOL_ERROR);
+		}
+		if (fh->flags & FLAG_ACK) {
+			return (fh->length == 0) ? true : connectionError(session, FRAME_SIZE_ERROR);
+		}
+		if (!applySettings(session, payload, fh->length)) {
+			return false;
+		}
+		sendFrame(session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+		return true;
+	case FRAME_PING:
+		if (fh->streamId != 0) {
+			return connectionError(session, PROTOCOL_ERROR);
+		}
+		if (fh->length != 8) {
+			return connectionError(session, FRAME_SIZE_ERROR);
+		}
+		if ((fh->flags & FLAG_ACK) == 0) {
+			sendFrame(session, FRAME_PING, FLAG_ACK, 0, payload, 8);
+		}
+		return true;
+	case FRAME_GOAWAY:
+		// streams already started finish; the client opens no more
+		return (fh->streamId == 0) ? true : connectionError(session, PROTOCOL_ERROR);
+	case FRAME_WINDOW_UPDATE:
+		return handleWindowUpdate(session, fh, payload);
+	case FRAME_PRIORITY_UPDATE:
+		return handlePriorityUpdate(session, fh, payload);
+	case FRAME_PUSH_PROMISE:
+		return connectionError(session, PROTOCOL_ERROR);
+	default:
+		// unknown frame types are ignored
+		return true;
+	}
+}
+
+/**
+ * Determine whether the session has no open streams.
+ */
+static bool sessionIdle(Http2Session *session) {
+	pthread_mutex_lock(&session->lock);
+	bool idle = (session->openStreams == 0);
+	pthread_mutex_unlock(&session->lock);
+	return idle;
+}
+
+/**
+ * Read bytes from the connection through the input buffer. Between
+ * frames with no streams open the idle deadline runs: when it
+ * passes, the connection is shut down and the read fails.
+ *
+ * @param session the session
+ * @param buf the destination
+ * @param len the number of bytes
+ * @param frameStart true if between frames
+ * @return true if read, false if the connection closed, failed
+ *   or was idle too long
+ */
+static bool readBytes(Http2Session *session, void *buf, size_t len, bool frameStart) {
+	uint8_t *p = buf;
+	if (frameStart) {
+		pthread_mutex_lock(&session->lock);
+		syncSessionIdle(session);
+		pthread_mutex_unlock(&session->lock);
+	}
+	while (len > 0) {
+		if (session->inPos == session->inLen) {
+			ssize_t n = recv(session->sock_fd, session->in, sizeof(session->in), 0);
+			if (n > 0) {
+				session->inPos = 0;
+				session->inLen = n;
+				continue;
+			}
+			if ((n < 0) && (errno == EINTR)) {
+				continue;
+			}
+			return false;
+		}
+		size_t n = session->inLen - session->inPos;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(p, session->in + session->inPos, n);
+		session->inPos += n;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Read the next frame.
+ *
+ * @param session the session
+ * @param fh the frame header
+ * @return true if read, false if the connection closed or
+ *   a connection error
+ */
+static bool readFrame(Http2Session *session, FrameHeader *fh) {
+	uint8_t header[FRAME_HEADER_SIZE];
+	if (!readBytes(session, header, FRAME_HEADER_SIZE, true)) {
+		return false;
+	}
+	fh->length = ((uint32_t)header[0] << 16) | ((uint32_t)header[1] << 8) | header[2];
+	fh->type = header[3];
+	fh->flags = header[4];
+	fh->streamId = getUint32(header + 5) & MAX_WINDOW;
+	if (fh->length > MAX_FRAME_SIZE) {
+		connectionError(session, FRAME_SIZE_ERROR);
+		return false;
+	}
+	return readBytes(session, session->frame, fh->length, false);
+}
+
+/**
+ * Send the server's connection preface: its settings, and a
+ * connection window large enough for every stream's window.
+ */
+static bool sendPreface(Http2Session *session) {
+	uint8_t settings[12];
+	settings[0] = 0;
+	settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+	putUint32(settings + 2, maxStreams);
+	settings[6] = 0;
+	settings[7] = SETTINGS_INITIAL_WINDOW_SIZE;
+	putUint32(settings + 8, streamWindow);
+	if (!sendFrame(session, FRAME_SETTINGS, 0, 0, settings, sizeof(settings))) {
+		return false;
+	}
+	return (session->connWindow == HTTP2_DEFAULT_WINDOW)
+		|| sendWindowUpdate(session, 0, session->connWindow - HTTP2_DEFAULT_WINDOW);
+}
+
+/**
+ * Read frames until the connection closes, fails or is idle,
+ * then wait for open streams to finish and close the connection.
+ * The idle and write-stall deadlines of the session are those of
+ * the connection: a session with no open streams ends after the
+ * idle timeout, and a peer that stops reading after the write
+ * timeout.
+ */
+static void *runSession(void *arg) {
+	Http2Session *session = arg;
+
+#if defined(TCP_NOTSENT_LOWAT)
+	// keep little unsent data in the kernel, so the next frame is
+	// chosen by priority when it can go rather than queued early
+	int lowat = MAX_FRAME_SIZE;
+	setsockopt(session->sock_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+#endif
+
+	if (sendPreface(session)) {
+		// an upgraded request is stream 1
+		if (session->streams != NULL) {
+			dispatchStream(session->streams);
+		}
+
+		// the client preface, then its settings
+		char clientPreface[PREFACE_LEN];
+		// prior knowledge: its first line has been read
+		size_t prefaceLen = session->upgraded ? PREFACE_LEN : PREFACE_LEN - PREFACE_LINE_LEN;
+		FrameHeader fh;
+		if (readBytes(session, clientPreface, prefaceLen, false)
+			&& (memcmp(clientPreface, preface + PREFACE_LEN - prefaceLen, prefaceLen) == 0)) {
+			bool first = true;
+			while (readFrame(session, &fh)) {
+				if (first && (fh.type != FRAME_SETTINGS)) {
+					connectionError(session, PROTOCOL_ERROR);
+					break;
+				}
+				first = false;
+				if (!handleFrame(session, &fh, session->frame)) {
+					break;
+				}
+				// a draining server tells the client to go elsewhere
+				// once the requests it has started are answered
+				if (connectionsDraining() && sessionIdle(session)) {
+					sendGoaway(session, NO_ERROR);
+					break;
+				}
+			}
+		} else {
+			connectionError(session, PROTOCOL_ERROR);
+		}
+		if (session->error != NO_ERROR) {
+			sendGoaway(session, session->error);
+			shutdown(session->sock_fd, SHUT_RDWR);
+		}
+	}
+
+	// wake handlers waiting for input or window, and let them finish
+	pthread_mutex_lock(&session->lock);
+	session->closed = true;
+	for (Http2Stream *stream = session->streams; stream != NULL; stream = stream->next) {
+		pthread_cond_signal(&stream->inReady);
+	}
+	pthread_cond_broadcast(&session->sendReady);
+	while (session->openStreams > 0) {
+		pthread_cond_wait(&session->streamsDone, &session->lock);
+	}
+	pthread_mutex_unlock(&session->lock);
+
+	closeConnection(session->conn);
+	freeHpackTable(&session->encoder);
+	freeHpackTable(&session->decoder);
+	pthread_cond_destroy(&session->streamsDone);
+	pthread_cond_destroy(&session->sendReady);
+	pthread_mutex_destroy(&session->timeoutLock);
+	pthread_mutex_destroy(&session->writeLock);
+	pthread_mutex_destroy(&session->lock);
+	free(session->block);
+	free(session);
+	releaseHttp2Session();
+	return NULL;
+}
+
+/**
+ * Decode base64url, as used by HTTP2-Settings; standard base64
+ * and padding are accepted too.
+ *
+ * @param in the encoded string
+ * @param out the output buffer
+ * @param size the size of the output buffer
+ * @return the decoded length, or -1 if invalid or too long
+ */
+static long decodeBase64Url(const char *in, uint8_t *out, size_t size) {
+	uint32_t bits = 0;
+	int nbits = 0;
+	size_t n = 0;
+	for (; (*in != '\0') && (*in != '='); in++) {
+		int v;
+		if ((*in >= 'A') && (*in <= 'Z')) {
+			v = *in - 'A';
+		} else if ((*in >= 'a') && (*in <= 'z')) {
+			v = *in - 'a' + 26;
+		} else if ((*in >= '0') && (*in <= '9')) {
+			v = *in - '0' + 52;
+		} else if ((*in == '-') || (*in == '+')) {
+			v = 62;
+		} else if ((*in == '_') || (*in == '/')) {
+			v = 63;
+		} else {
+			return -1;
+		}
+		bits = (bits << 6) | v;
+		nbits += 6;
+		if (nbits >= 8) {
+			if (n == size) {
+				return -1;
+			}
+			nbits -= 8;
+			out[n++] = (uint8_t)(bits >> nbits);
+		}
+	}
+	return (long)n;
+}
+
+/**
+ * Determine whether an HTTP/1.1 request asks to upgrade to h2c:
+ * it has "Upgrade: h2c", "Connection: Upgrade" and HTTP2-Settings,
+ * and no body.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the connection can be upgraded
+ */
+bool wantsHttp2Upgrade(Properties *requestHeaders) {
+	char buf[MAX_PROP_VAL];
+	uint8_t settings[MAX_PROP_VAL];
+	if (!enabled
+		|| (findProperty(requestHeaders, 0, "Upgrade", buf) == SIZE_MAX) || (strcasestr(buf, "h2c") == NULL)
+		|| (findProperty(requestHeaders, 0, "Connection", buf) == SIZE_MAX) || (strcasestr(buf, "upgrade") == NULL)
+		|| (findProperty(requestHeaders, 0, "Transfer-Encoding", buf) != SIZE_MAX)) {
+		return false;
+	}
+	if ((findProperty(requestHeaders, 0, "Content-Length", buf) != SIZE_MAX) && (atol(buf) != 0)) {
+		return false;
+	}
+	if (findProperty(requestHeaders, 0, "HTTP2-Settings", buf) == SIZE_MAX) {
+		return false;
+	}
+	long len = decodeBase64Url(buf, settings, sizeof(settings));
+	return (len >= 0) && ((len % 6) == 0);
+}
+
+/**
+ * Continue a connection as HTTP/2. For prior knowledge the preface
+ * line and the blank line after it have been read; for an upgrade
+ * the 101 response has been sent, and the request becomes stream 1.
+ * The session takes over the reservation from reserveHttp2Session(),
+ * and the connection is owned by the session from now on.
+ *
+ * @param conn the connection
+ * @param method the method of the upgraded request, or NULL for prior knowledge
+ * @param target the target of the upgraded request
+ * @param requestHeaders the headers of the upgraded request, owned by the session
+ * @return true if started, false if the connection should be closed
+ */
+bool startHttp2(Connection *conn, const char *method, const char *target, Properties *requestHeaders) {
+	Http2Session *session = calloc(1, sizeof(Http2Session));
+	if ((session == NULL) || !initHpackTable(&session->encoder, HPACK_DEFAULT_TABLE_SIZE)
+		|| !initHpackTable(&session->decoder, HPACK_DEFAULT_TABLE_SIZE)) {
+		if (session != NULL) {
+			freeHpackTable(&session->encoder);
+			free(session);
+		}
+		if (requestHeaders != NULL) {
+			deleteProperties(requestHeaders);
+		}
+		releaseHttp2Session();
+		return false;
+	}
+	session->conn = conn;
+	session->sock_fd = conn->sock_fd;
+	pthread_mutex_init(&session->lock, NULL);
+	pthread_mutex_init(&session->writeLock, NULL);
+	pthread_mutex_init(&session->timeoutLock, NULL);
+	pthread_cond_init(&session->sendReady, NULL);
+	pthread_cond_init(&session->streamsDone, NULL);
+	session->sendWindow = HTTP2_DEFAULT_WINDOW;
+	session->peerWindow = HTTP2_DEFAULT_WINDOW;
+	session->peerMaxFrame = MAX_FRAME_SIZE;
+	uint64_t connWindow = (uint64_t)streamWindow * maxStreams;
+	session->connWindow = (connWindow < MAX_WINDOW) ? (uint32_t)connWindow : MAX_WINDOW;
+
+	bool ok = true;
+	if (method != NULL) {
+		// the upgraded request's settings apply before any frame
+		char buf[MAX_PROP_VAL];
+		uint8_t settings[MAX_PROP_VAL];
+		findProperty(requestHeaders, 0, "HTTP2-Settings", buf);
+		long len = decodeBase64Url(buf, settings, sizeof(settings));
+		ok = (len >= 0) && applySettings(session, settings, len);
+
+		RequestFields fields = { .headers = requestHeaders, .urgency = DEFAULT_URGENCY };
+		if (findProperty(requestHeaders, 0, "Priority", buf) != SIZE_MAX) {
+			parsePriority(buf, &fields.urgency, &fields.incremental);
+		}
+		snprintf(fields.method, sizeof(fields.method), "%s", method);
+		snprintf(fields.path, sizeof(fields.path), "%s", target);
+		session->upgraded = true;
+		session->lastStreamId = 1;
+		ok = ok && (newStream(session, 1, &fields, true) != NULL);
+		if (fields.headers != NULL) {
+			deleteProperties(fields.headers);
+		}
+	}
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	unpin_thread_attr(&attr);  // not on the CPU of the worker starting it
+	ok = ok && (pthread_create(&thread, &attr, runSession, session) == 0);
+	pthread_attr_destroy(&attr);
+	if (!ok) {
+		session->closed = true;
+		if (session->streams != NULL) {
+			closeStream(session->streams);
+		}
+		freeHpackTable(&session->encoder);
+		freeHpackTable(&session->decoder);
+		pthread_cond_destroy(&session->streamsDone);
+		pthread_cond_destroy(&session->sendReady);
+		pthread_mutex_destroy(&session->timeoutLock);
+		pthread_mutex_destroy(&session->writeLock);
+		pthread_mutex_destroy(&session->lock);
+		free(session);
+		releaseHttp2Session();
+	}
+	return ok;
+}
+
+/**
+ * Record the response status for a stream. The status is sent with
+ * the headers.
+ *
+ * @param ostream the output stream
+ * @param status the response status
+ * @return true if ostream is an HTTP/2 stream, false to send it as HTTP/1
+ */
+bool http2SendStatus(FILE *ostream, int status) {
+	Http2Stream *stream = currentStream;
+	if ((stream == NULL) || (stream->file != ostream)) {
+		return false;
+	}
+	stream->status = status;
+	return true;
+}
+
+/**
+ * Send the status and headers of a response on a stream as one
+ * HEADERS frame. Names are sent in lower case, and headers that only
+ * apply to HTTP/1 connections are dropped. A response that can have
+ * no body (HEAD, 204, 304, or Content-Length: 0) ends the stream.
+ *
+ * @param ostream the output stream
+ * @param responseHeaders the response headers
+ * @return true if ostream is an HTTP/2 stream, false to send them as HTTP/1
+ */
+bool http2SendHeaders(FILE *ostream, Properties *responseHeaders) {
+	Http2Stream *stream = currentStream;
+	if ((stream == NULL) || (stream->file != ostream)) {
+		return false;
+	}
+	if (stream->headersSent) {
+		return true;
+	}
+	Http2Session *session = stream->session;
+	int status = (stream->status != 0) ? stream->status : 200;
+	bool endStream = stream->head || (status == 204) || (status == 304);
+
+	uint8_t block[RESPONSE_BLOCK_SIZE];
+	char name[MAX_PROP_NAME], value[MAX_PROP_VAL];
+	pthread_mutex_lock(&session->writeLock);
+	size_t n = hpackBeginBlock(&session->encoder, block, sizeof(block));
+	snprintf(value, sizeof(value), "%d", status);
+	size_t m = (n == SIZE_MAX) ? SIZE_MAX : hpackEncode(&session->encoder, block + n, sizeof(block) - n, ":status", value);
+	for (int i = 0; (m != SIZE_MAX) && getProperty(responseHeaders, i, name, value); i++) {
+		n += m;
+		m = 0;
+		for (char *p = name; *p != '\0'; p++) {
+			*p = tolower((unsigned char)*p);
+		}
+		if (isConnectionHeader(name)) {
+			continue;
+		}
+		if ((strcmp(name, "content-length") == 0) && (strcmp(value, "0") == 0)) {
+			endStream = true;
+		}
+		m = hpackEncode(&session->encoder, block + n, sizeof(block) - n, name, value);
+	}
+	if (m == SIZE_MAX) {
+		// the encoder table no longer matches the peer's
+		fprintf(stderr, "http2SendHeaders: response headers too large\n");
+		shutdown(session->sock_fd, SHUT_RDWR);
+	} else {
+		// sent even to a reset stream, to keep the tables in step;
+		// a failed write shuts down the connection
+		n += m;
+		writeFrame(session, FRAME_HEADERS, FLAG_END_HEADERS | (endStream ? FLAG_END_STREAM : 0),
+						stream->id, block, n);
+		stream->counters.bytesOut += FRAME_HEADER_SIZE + n;
+	}
+	pthread_mutex_unlock(&session->writeLock);
+
+	stream->headersSent = true;
+	stream->endSent = endStream;
+	return true;
+}
+
+/**
+ * Abort the response on a stream whose body cannot be completed,
+ * such as when a proxied response breaks off: the stream is reset
+ * rather than ended, so the client does not take the body as whole.
+ *
+ * @param ostream the output stream
+ * @return true if ostream is an HTTP/2 stream, false if it is HTTP/1
+ */
+bool http2AbortStream(FILE *ostream) {
+	Http2Stream *stream = currentStream;
+	if ((stream == NULL) || (stream->file != ostream)) {
+		return false;
+	}
+	resetStream(stream->session, stream->id, INTERNAL_ERROR);
+	return true;
+}
@@ -0,0 +1,168 @@
+/*
+ * http2.h
+ *
+ * HTTP/2 over cleartext TCP ("h2c", RFC 9113).
+ *
+ * A connection becomes HTTP/2 when it opens with the connection
+ * preface (prior knowledge), or when an HTTP/1.1 request without a
+ * body asks for it with "Upgrade: h2c". From then on a reader thread
+ * owns the connection: it reads frames, decodes header blocks and
+ * runs each stream's request as a job on the thread pool, in the lane
+ * a classifier picks for it as for HTTP/1.1 requests, so many
+ * requests share one connection. At most a configured number of
+ * connections run as HTTP/2 at once; past it an upgrade request is
+ * answered as HTTP/1.1. A handler reads and writes the
+ * stream opened for its request as it would a socket stream; the
+ * response status and headers go out as a HEADERS frame and the
+ * body as DATA frames.
+ *
+ * Frames are written one at a time. When several streams have data
+ * waiting, the next DATA frame goes to the most urgent stream by its
+ * RFC 9218 priority (urgency 0-7, default 3): non-incremental
+ * responses of one urgency are sent in stream order, incremental ones
+ * take turns frame by frame. A stream sends only as much as the
+ * flow-control windows of the stream and connection allow, and a
+ * request body is buffered only up to the window advertised for it.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef HTTP2_H_
+#define HTTP2_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "connection.h"
+#include "properties.h"
+#include "socket_stream.h"
+#include "thpool.h"
+
+/** first line of the connection preface, as read by fgets without CRLF */
+#define HTTP2_PREFACE_LINE "PRI * HTTP/2.0"
+
+/** request version of HTTP/2 requests */
+#define HTTP2_VERSION "HTTP/2.0"
+
+/** default stream flow-control window (RFC 9113 6.9.2) */
+#define HTTP2_DEFAULT_WINDOW 65535
+
+/**
+ * Serves a request received on a stream. The handler owns the
+ * request headers, and must not close the stream: it is closed
+ * once the handler returns, which ends the response.
+ *
+ * @param conn the connection
+ * @param stream the stream to read the body from and write the response to
+ * @param counters bytes received and sent on the stream, current after fflush()
+ * @param method the request method
+ * @param target the request target (path and query)
+ * @param requestHeaders the request headers; :authority is saved as Host
+ */
+typedef void (*Http2StreamHandler)(Connection *conn, FILE *stream, SocketCounters *counters,
+								   const char *method, const char *target, Properties *requestHeaders);
+
+/**
+ * Chooses the pool lane of a request received on a stream.
+ *
+ * @param method the request method
+ * @param target the request target (path and query)
+ * @param requestHeaders the request headers
+ * @return the pool lane
+ */
+typedef int (*Http2StreamClassifier)(const char *method, const char *target, Properties *requestHeaders);
+
+/**
+ * Enable HTTP/2.
+ *
+ * @param pool the thread pool running stream requests
+ * @param classify the function that chooses the lane of a stream request
+ * @param handler the function that serves a stream request
+ * @param maxStreams the most concurrent streams per connection
+ * @param maxSessions the most concurrent HTTP/2 connections
+ * @param window the flow-control window of each stream's request body
+ *   (at least HTTP2_DEFAULT_WINDOW)
+ * @return true if successful
+ */
+bool initHttp2(threadpool pool, Http2StreamClassifier classify, Http2StreamHandler handler,
+			   unsigned maxStreams, unsigned maxSessions, unsigned long window);
+
+/**
+ * Determine whether HTTP/2 is enabled.
+ *
+ * @return true if enabled
+ */
+bool http2Enabled(void);
+
+/**
+ * Reserve one of the concurrent sessions for a connection about to
+ * become HTTP/2. startHttp2() takes over the reservation.
+ *
+ * @return true if reserved, false if the most sessions are running
+ */
+bool reserveHttp2Session(void);
+
+/**
+ * Release a session reserved with reserveHttp2Session() that was
+ * not started.
+ */
+void releaseHttp2Session(void);
+
+/**
+ * Determine whether an HTTP/1.1 request asks to upgrade to h2c:
+ * it has "Upgrade: h2c", "Connection: Upgrade" and HTTP2-Settings,
+ * and no body.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the connection can be upgraded
+ */
+bool wantsHttp2Upgrade(Properties *requestHeaders);
+
+/**
+ * Continue a connection as HTTP/2. For prior knowledge the preface
+ * line and the blank line after it have been read; for an upgrade
+ * the 101 response has been sent, and the request becomes stream 1.
+ * The session takes over the reservation from reserveHttp2Session(),
+ * and the connection is owned by the session from now on.
+ *
+ * @param conn the connection
+ * @param method the method of the upgraded request, or NULL for prior knowledge
+ * @param target the target of the upgraded request
+ * @param requestHeaders the headers of the upgraded request, owned by the session
+ * @return true if started, false if the connection should be closed
+ */
+bool startHttp2(Connection *conn, const char *method, const char *target, Properties *requestHeaders);
+
+/**
+ * Record the response status for a stream. The status is sent with
+ * the headers.
+ *
+ * @param ostream the output stream
+ * @param status the response status
+ * @return true if ostream is an HTTP/2 stream, false to send it as HTTP/1
+ */
+bool http2SendStatus(FILE *ostream, int status);
+
+/**
+ * Send the status and headers of a response on a stream as one
+ * HEADERS frame. Names are sent in lower case, and headers that only
+ * apply to HTTP/1 connections are dropped. A response that can have
+ * no body (HEAD, 204, 304, or Content-Length: 0) ends the stream.
+ *
+ * @param ostream the output stream
+ * @param responseHeaders the response headers
+ * @return true if ostream is an HTTP/2 stream, false to send them as HTTP/1
+ */
+bool http2SendHeaders(FILE *ostream, Properties *responseHeaders);
+
+/**
+ * Abort the response on a stream whose body cannot be completed,
+ * such as when a proxied response breaks off: the stream is reset
+ * rather than ended, so the client does not take the body as whole.
+ *
+ * @param ostream the output stream
+ * @return true if ostream is an HTTP/2 stream, false if it is HTTP/1
+ */
+bool http2AbortStream(FILE *ostream);
+
+#endif /* HTTP2_H_ */
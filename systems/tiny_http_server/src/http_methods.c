@@ -7,16 +7,22 @@
  *  @since 2019-04-10
  *  @author: Philip Gust
  */
+#define _GNU_SOURCE
 
 #include "http_methods.h"
 
+#include <ctype.h>
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <curl/curl.h>
+#include <sys/socket.h>
 
 #include "http_server.h"
 #include "http_util.h"
@@ -24,116 +30,64 @@
 #include "mime_util.h"
 #include "properties.h"
 #include "file_util.h"
+#include "dir_listing.h"
+#include "stat_cache.h"
+#include "file_cache.h"
+#include "content_bundle.h"
+#include "content_hash.h"
+#include "http2.h"
+#include "network_util.h"
 
 
+/**
+ * Get the requested page of a listing from the query string.
+ *
+ * @param requestHeaders the request headers
+ * @return the page, or 0 if not specified
+ */
+static size_t get_listing_page(Properties *requestHeaders) {
+    char query[MAXBUF];
+    if (findProperty(requestHeaders, 0, "?", query) == SIZE_MAX) {
+        return 0;
+    }
+    char *save;
+    for (char *p = strtok_r(query, "&", &save); p != NULL; p = strtok_r(NULL, "&", &save)) {
+        if (strncmp(p, "page=", 5) == 0) {
+            return (size_t)strtoul(p+5, NULL, 10);
+        }
+    }
+    return 0;
+}
+
 /**
  * Handle the dir get request
  */
 
-static void do_get_dir(FILE *stream, const char *uri, const char *dirPath, Properties *responseHeaders, bool sendContent) {
-    
-    FILE *temp = tmpfile();
-    if (temp == NULL) {
-        return;
-    }
-    
-    fprintf(temp,
-            "<html>"
-            "<head><title>index of %s</title></head>"
-            "<body>"
-            "<h1>Index of %s</h1>\n"
-            "<table>\n"
-            "<tr>\n"
-            "<th valign=\"top\"></th>"
-            "<th>Name</th>"
-            "<th>Last modified</th>"
-            "<th>Size</th>"
-            "<th>Description</th>"
-            "\n</tr>\n<tr>"
-            "<td colspan=\"5\"><hr></td></tr>\n"
-            , uri, uri);
+static void do_get_dir(FILE *stream, const char *uri, const char *dirPath, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
     
-    DIR *dir = opendir(dirPath);
-    struct dirent entry;
-    struct dirent *result;
-    while ((readdir_r(dir, &entry, &result) == 0) && (result != NULL)) {
-        
-        if ( (strcmp(entry.d_name, ".") == 0)
-            || ((strcmp(uri, "/") == 0) && (strcmp(entry.d_name, "..") == 0))) {
-            continue;
-        }
-        
-        const char *name = "";
-        if (strcmp(entry.d_name,"..") == 0) {
-            name =  "Parent Directory";
+    DirListing *listing = openDirListing(uri, dirPath, get_listing_page(requestHeaders));
+    if (listing == NULL) {
+        if (errno == ENOENT) {
+            sendErrorResponse(stream, 404, "Not Found", responseHeaders);
         } else {
-            name = entry.d_name;
-        }
-        
-        char file_name[PATH_MAX];
-        makeFilePath(dirPath, entry.d_name, file_name);
-        
-        struct stat sb;
-        stat(file_name, &sb);
-        
-        char timebuf[MAXBUF];
-        milliTimeToShortHM_Date_Time(sb.st_mtim.tv_sec, timebuf);
-        
-        char url[MAXBUF];
-        sprintf(url, S_ISDIR(sb.st_mode) ? "%s/" : "%s", entry.d_name);
-        
-        
-        const char *icon = "";
-        if (strcmp(entry.d_name,"..") == 0) {
-            icon = "&#x23ce";
-        }
-        else if (S_ISDIR(sb.st_mode)) {
-            icon = "&#x1F4c1;";
+            sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
         }
-        
-        
-        fprintf(temp, "<tr>\n"
-                "<td>%s</td>\n"
-                "<td><a href=\"%s\">%s</a></td>\n"
-                "<td align=\"right\">%s</td>\n"
-                "<td align=\"right\">%lu</td>\n"
-                "<td>%s</td>\n"
-                "</tr>\n",
-                icon, url, name, timebuf,(unsigned long) sb.st_size, ""
-                );
-    }
-    closedir(dir);
-    
-    fprintf(temp, "<tr>"
-            " <td colspan=\"5\"><hr></td>\n"
-            "</tr>\n"
-            "</body>\n"
-            "</html>\n"
-            );
-    
-    fflush(temp);
-    rewind(temp);
-    
-    
-    if (temp == NULL) {
-        sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
         return;
     }
     
-    struct stat sb;
-    fileStat(temp, &sb);
-    
-    // record the file length
+    // record the listing length if it is already rendered
     char buf[MAXBUF];
-    size_t contentLen = (size_t)sb.st_size;
-    sprintf(buf,"%lu", contentLen);
-    putProperty(responseHeaders,"Content-Length", buf);
+    size_t contentLen;
+    bool knownLen = dirListingLength(listing, &contentLen);
+    if (knownLen) {
+        sprintf(buf,"%lu", (unsigned long)contentLen);
+        putProperty(responseHeaders,"Content-Length", buf);
+    }
     
     
-    // record the last-modified date/time
-    time_t timer = sb.st_mtim.tv_sec;
+    // record the last-modified date/time of the directory
     putProperty(responseHeaders,"Last-Modified",
-                milliTimeToRFC_1123_Date_Time(timer, buf));
+                milliTimeToRFC_1123_Date_Time(dirListingModified(listing), buf));
     
     
     // get mime type of file
@@ -144,22 +98,175 @@ static void do_get_dir(FILE *stream, const char *uri, const char *dirPath, Prope
     }
     putProperty(responseHeaders, "Content-type", buf);
     
-    // send response
-    sendResponseStatus(stream, 200, "OK");
-    
-    // Send response headers
-    sendResponseHeaders(stream, responseHeaders);
-    
-    //
-    if (sendContent) {
-        copyFileStreamBytes(temp, stream, contentLen);
+    if (knownLen) {
+        // send response
+        sendResponseStatus(stream, 200, "OK");
+        
+        // Send response headers
+        sendResponseHeaders(stream, responseHeaders);
+        
+        if (sendContent) {
+            writeDirListing(listing, stream);
+        }
+    } else {
+        // render the listing as it is sent
+        FILE *body = sendStreamedResponse(stream, 200, "OK", requestHeaders, responseHeaders, sendContent);
+        if (body != NULL) {
+            writeDirListing(listing, body);
+            fclose(body);
+        }
     }
     
-    if (temp != NULL) {
-        fclose(temp);
-    }
+    closeDirListing(listing);
+}
+
+/**
+ * Determine whether the client accepts a content coding by the
+ * Accept-Encoding request header, with a quality above 0.
+ *
+ * @param requestHeaders the request headers
+ * @param coding the content coding
+ * @return true if accepted
+ */
+static bool accepts_encoding(Properties *requestHeaders, const char *coding) {
+	char accept[MAXBUF];
+	if (findProperty(requestHeaders, 0, "Accept-Encoding", accept) == SIZE_MAX) {
+		return false;
+	}
+	size_t codingLen = strlen(coding);
+	char *save;
+	for (char *p = strtok_r(accept, ",", &save); p != NULL; p = strtok_r(NULL, ",", &save)) {
+		p += strspn(p, " \t");
+		size_t len = strcspn(p, " \t;");
+		if ((len == codingLen) && (strncasecmp(p, coding, len) == 0)) {
+			char *q = strstr(p + len, "q=");
+			return (q == NULL) || (strtod(q + 2, NULL) > 0);
+		}
+	}
+	return false;
 }
 
+/**
+ * Determine whether an entity tag matches the If-None-Match request
+ * header, by weak comparison.
+ *
+ * @param requestHeaders the request headers
+ * @param etag the entity tag of the response
+ * @return true if matched
+ */
+static bool etag_matches(Properties *requestHeaders, const char *etag) {
+	char match[MAXBUF];
+	if (findProperty(requestHeaders, 0, "If-None-Match", match) == SIZE_MAX) {
+		return false;
+	}
+	if (strncmp(etag, "W/", 2) == 0) {
+		etag += 2;
+	}
+	size_t etagLen = strlen(etag);
+	char *save;
+	for (char *p = strtok_r(match, ",", &save); p != NULL; p = strtok_r(NULL, ",", &save)) {
+		p += strspn(p, " \t");
+		size_t len = strcspn(p, " \t");
+		if ((len == 1) && (*p == '*')) {
+			return true;
+		}
+		if (strncmp(p, "W/", 2) == 0) {
+			p += 2;
+			len -= 2;
+		}
+		if ((len == etagLen) && (strncmp(p, etag, len) == 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Format the entity tag of a file: a hash of its contents once
+ * known, which a copy of the file with new times keeps, and a weak
+ * tag of its size and modification time until then.
+ *
+ * @param filePath the file path
+ * @param sb the file metadata
+ * @param etag output buffer for the entity tag
+ * @return the entity tag
+ */
+static char *file_etag(const char *filePath, const struct stat *sb, char *etag) {
+	uint64_t hash;
+	if (lookupContentHash(filePath, sb, &hash)) {
+		sprintf(etag, "\"%016llx\"", (unsigned long long)hash);
+	} else {
+		sprintf(etag, "W/\"%llx-%llx.%lx\"", (unsigned long long)sb->st_size,
+				(unsigned long long)sb->st_mtim.tv_sec, (unsigned long)sb->st_mtim.tv_nsec);
+	}
+	return etag;
+}
+
+/**
+ * Handle GET or HEAD request from the content bundle, with no file
+ * system calls. A directory URI is answered with its index.html,
+ * and a precompressed body is sent if the client accepts it.
+ *
+ * @param the socket stream
+ * @param bundle the content bundle
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void do_get_bundle(FILE *stream, ContentBundle *bundle, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+	char path[MAXBUF];
+	size_t len = strlen(uri);
+	const BundleRecord *record = NULL;
+	if ((*uri == '/') && (len + sizeof("index.html") <= sizeof(path))) {
+		strcpy(path, uri);
+		if (path[len-1] == '/') {
+			strcat(path, "index.html");
+		}
+		record = findBundleFile(bundle, path);
+	}
+	if (record == NULL) {
+		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+		return;
+	}
+
+	// the smallest body the client accepts
+	int encoding = BUNDLE_IDENTITY;
+	if ((record->body[BUNDLE_BR].offset != 0) && accepts_encoding(requestHeaders, "br")) {
+		encoding = BUNDLE_BR;
+	} else if ((record->body[BUNDLE_GZIP].offset != 0) && accepts_encoding(requestHeaders, "gzip")) {
+		encoding = BUNDLE_GZIP;
+	}
+	size_t contentLen;
+	const char *body = bundleBody(bundle, record, encoding, &contentLen);
+
+	char buf[MAXBUF];
+	sprintf(buf, "%lu", (unsigned long)contentLen);
+	putProperty(responseHeaders, "Content-Length", buf);
+	putProperty(responseHeaders, "Last-Modified", bundleString(bundle, record->lastModified));
+	putProperty(responseHeaders, "Content-type", bundleString(bundle, record->contentType));
+	const char *etag = bundleString(bundle, record->etag[encoding]);
+	putProperty(responseHeaders, "ETag", etag);
+	if ((record->body[BUNDLE_GZIP].offset != 0) || (record->body[BUNDLE_BR].offset != 0)) {
+		putProperty(responseHeaders, "Vary", "Accept-Encoding");
+	}
+	if (encoding != BUNDLE_IDENTITY) {
+		putProperty(responseHeaders, "Content-Encoding", (encoding == BUNDLE_BR) ? "br" : "gzip");
+	}
+
+	// the client has the body already
+	if (etag_matches(requestHeaders, etag)) {
+		sendResponseStatus(stream, 304, "Not Modified");
+		sendResponseHeaders(stream, responseHeaders);
+		return;
+	}
+
+	sendResponseStatus(stream, 200, "OK");
+	sendResponseHeaders(stream, responseHeaders);
+	if (sendContent) {
+		fwrite(body, 1, contentLen, stream);
+	}
+}
 
 /**
  * Handle GET or HEAD request.
@@ -171,23 +278,31 @@ static void do_get_dir(FILE *stream, const char *uri, const char *dirPath, Prope
  * @param sendContent send content (GET)
  */
 static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+	// the whole site from the content bundle, if serving one
+	ContentBundle *bundle = acquireContentBundle();
+	if (bundle != NULL) {
+		do_get_bundle(stream, bundle, uri, requestHeaders, responseHeaders, sendContent);
+		releaseContentBundle(bundle);
+		return;
+	}
+
 	// get path to URI in file system
 	char filePath[MAXBUF];
-	resolveUri(uri, filePath);
+	if (resolveUri(uri, filePath) == NULL) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		return;
+	}
 
-    char cwd[PATH_MAX];
-    getcwd(cwd, sizeof(cwd));
-    
 	// ensure file exists
 	struct stat sb;
-	if (stat(filePath, &sb) != 0) {
+	if (cachedStat(filePath, &sb) != 0) {
 		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
 		return;
 	}
     
     // if directory
     if(S_ISDIR(sb.st_mode) && (filePath[strlen(filePath)-1] == '/')) {
-        do_get_dir(stream, uri, filePath, responseHeaders, sendContent);
+        do_get_dir(stream, uri, filePath, requestHeaders, responseHeaders, sendContent);
         return;
     }
     
@@ -197,21 +312,68 @@ static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHea
 		return;
 	}
 
-	// record the file length
+	// the client has the contents already
+	char etag[64];
+	if (etag_matches(requestHeaders, file_etag(filePath, &sb, etag))) {
+		char buf[32];
+		sprintf(buf, "%lu", (unsigned long)sb.st_size);
+		putProperty(responseHeaders, "Content-Length", buf);
+		putProperty(responseHeaders, "ETag", etag);
+		sendResponseStatus(stream, 304, "Not Modified");
+		sendResponseHeaders(stream, responseHeaders);
+		return;
+	}
+
+	// the headers, and the contents of a small file, from the file cache
+	FileEntry *file = acquireFile(filePath, &sb, sendContent);
+	const char *body = NULL;
+	if (file != NULL) {
+		countFileHit(file);
+		body = __atomic_load_n(&file->body, __ATOMIC_ACQUIRE);
+	}
+
+	// open the file before committing to a status; with many
+	// connections held open, descriptors can run out here, and
+	// the file may be gone since its metadata was cached
+	FILE *contentStream = NULL;
+	if (sendContent && (body == NULL)) {
+		contentStream = fopen(filePath, "r");
+		if (contentStream == NULL) {
+			int error = errno;
+			if (file != NULL) {
+				releaseFile(file);
+			}
+			if ((error == ENOENT) || (error == ENOTDIR)) {
+				sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+			} else {
+				sendErrorResponse(stream, 503, "Service Unavailable", responseHeaders);
+			}
+			return;
+		}
+	}
+
 	char buf[MAXBUF];
 	size_t contentLen = (size_t)sb.st_size;
-	sprintf(buf,"%lu", contentLen);
-	putProperty(responseHeaders,"Content-Length", buf);
+	if (file != NULL) {
+		putProperty(responseHeaders, "Content-Length", file->contentLength);
+		putProperty(responseHeaders, "Last-Modified", file->lastModified);
+		putProperty(responseHeaders, "Content-type", file->contentType);
+	} else {
+		// record the file length
+		sprintf(buf,"%lu", contentLen);
+		putProperty(responseHeaders,"Content-Length", buf);
 
-	// record the last-modified date/time
-	time_t timer = sb.st_mtim.tv_sec;
-	putProperty(responseHeaders,"Last-Modified",
-				milliTimeToRFC_1123_Date_Time(timer, buf));
+		// record the last-modified date/time
+		time_t timer = sb.st_mtim.tv_sec;
+		putProperty(responseHeaders,"Last-Modified",
+					milliTimeToRFC_1123_Date_Time(timer, buf));
 
-	// get mime type of file
-	getMimeType(filePath, buf);
-    //strcpy(buf, "application/html");
-	putProperty(responseHeaders, "Content-type", buf);
+		// get mime type of file
+		getMimeType(filePath, buf);
+		//strcpy(buf, "application/html");
+		putProperty(responseHeaders, "Content-type", buf);
+	}
+	putProperty(responseHeaders, "ETag", etag);
 
 	// send response
 	sendResponseStatus(stream, 200, "OK");
@@ -219,11 +381,15 @@ static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHea
 	// Send response headers
 	sendResponseHeaders(stream, responseHeaders);
 
-	if (sendContent) {  // for GET
-		FILE *contentStream = fopen(filePath, "r");
+	if (body != NULL) {  // for GET, from memory
+		fwrite(body, 1, contentLen, stream);
+	} else if (sendContent) {  // for GET
 		copyFileStreamBytes(contentStream, stream, contentLen);
 		fclose(contentStream);
 	}
+	if (file != NULL) {
+		releaseFile(file);
+	}
 }
 
 /**
@@ -261,15 +427,24 @@ void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properti
  */
 void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
     //resolve uri to a file path
-    char filePath[PATH_MAX];
-    resolveUri(uri, filePath);
+    char filePath[MAXBUF];
+    if (resolveUri(uri, filePath) == NULL) {
+        sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+        return;
+    }
     
     //create intermediate directories
     char tempPath[PATH_MAX];
     if(getPath(filePath, tempPath) != NULL) {
-        mkdir(tempPath, 0755);
+        if (mkdir(tempPath, 0755) == 0) {
+            invalidateStatCache(tempPath);
+        }
     }
     
+    //check whether it will be created
+    struct stat sb;
+    bool isCreated = (cachedStat(filePath, &sb) != 0); //return 0 if successful
+
     FILE *targetStream = fopen(filePath, "w");
     if(targetStream == NULL) { //cannot open
         sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
@@ -282,11 +457,10 @@ void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Propertie
     copyFileStreamBytes(stream, targetStream, atoi(lenbuf));
     //close file
     fclose(targetStream);
+    invalidateStatCache(filePath);
     
-    //check if it has been created
-    struct stat sb;
-    bool isCreated = (stat(filePath, &sb) != 0); //return 0 if successful
     //send response
+    putProperty(responseHeaders, "Content-Length", "0");
     if(isCreated) {
         sendResponseStatus(stream, 201, "Created");
     }
@@ -323,11 +497,14 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
     
     // get path to URI in file system
     char filePath[MAXBUF];
-    resolveUri(uri, filePath);
+    if (resolveUri(uri, filePath) == NULL) {
+        sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+        return;
+    }
     
     // ensure file exists
     struct stat sb;
-    if (stat(filePath, &sb) != 0) {
+    if (cachedStat(filePath, &sb) != 0) {
         sendErrorResponse(stream, 404, "Not Found", responseHeaders);
         return;
     }
@@ -350,7 +527,10 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
         }
         // else delete
         else{
+            invalidateStatCache(filePath);
+
             // send response
+            putProperty(responseHeaders, "Content-Length", "0");
             sendResponseStatus(stream, 200, "OK");
             
             // Send response headers
@@ -365,6 +545,7 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
     // else, if it is a regular file & not a directory
     else if ((S_ISREG(sb.st_mode)) && (!S_ISDIR(sb.st_mode))){
         // send response
+        putProperty(responseHeaders, "Content-Length", "0");
         sendResponseStatus(stream, 200, "OK");
         
         // Send response headers
@@ -372,9 +553,639 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
 
         // delete file after making all checks
         remove(filePath);
+        invalidateStatCache(filePath);
         
         
         
     }
 	
 }
+
+/** headers that apply to one connection, and are not forwarded */
+static const char *hop_headers[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+    "Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+    "HTTP2-Settings", "Expect"
+};
+
+/**
+ * Determine whether a header applies to one connection only.
+ *
+ * @param name the header name
+ * @return true if the header is not forwarded
+ */
+static bool is_hop_header(const char *name) {
+    for (size_t i = 0; i < sizeof(hop_headers)/sizeof(hop_headers[0]); i++) {
+        if (strcasecmp(name, hop_headers[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Format the request line and headers of a proxied request. The
+ * client address is added to X-Forwarded-For.
+ *
+ * @param head storage for the request head
+ * @param size the size of the storage
+ * @param sock_fd the client socket descriptor
+ * @param method the request method
+ * @param target the request target as sent
+ * @param requestHeaders the request headers
+ * @param host the upstream server, for a request without a Host header
+ * @return the length of the head, or 0 if it does not fit
+ */
+static size_t format_proxy_request(char *head, size_t size, int sock_fd, const char *method, const char *target,
+                                   Properties *requestHeaders, const char *host) {
+    char name[MAX_PROP_NAME], value[MAX_PROP_VAL], forwardedFor[MAXBUF] = "";
+    size_t len = snprintf(head, size, "%s %s HTTP/1.1%s", method, target, CRLF);
+    bool hasHost = false;
+    for (size_t i = 0; (len < size) && getProperty(requestHeaders, i, name, value); i++) {
+        if ((name[0] == '?') || is_hop_header(name) || (strcasecmp(name, "X-Forwarded-Proto") == 0)) {
+            continue;
+        }
+        if (strcasecmp(name, "X-Forwarded-For") == 0) {
+            snprintf(forwardedFor, sizeof(forwardedFor), "%s, ", value);
+            continue;
+        }
+        hasHost |= (strcasecmp(name, "Host") == 0);
+        len += snprintf(head + len, size - len, "%s: %s%s", name, value, CRLF);
+    }
+    if (!hasHost && (len < size)) {
+        len += snprintf(head + len, size - len, "Host: %s%s", host, CRLF);
+    }
+    char client[HOST_ADDR_LEN];
+    int port;
+    if ((get_peer_host_and_port(sock_fd, client, &port) == 0) && (len < size)) {
+        len += snprintf(head + len, size - len, "X-Forwarded-For: %s%s%s", forwardedFor, client, CRLF);
+    }
+    if (len < size) {
+        len += snprintf(head + len, size - len, "X-Forwarded-Proto: http%s%s", CRLF, CRLF);
+    }
+    return (len < size) ? len : 0;
+}
+
+/**
+ * Send a proxied request and its body to the upstream server.
+ *
+ * @param exchange the upstream exchange
+ * @param stream the client stream the body is read from
+ * @param head the request head
+ * @param len the length of the head
+ * @param contentLen the length of the request body
+ * @return 0 if sent, 400 if the client body broke off, 502 if the server failed
+ */
+static int send_proxy_request(UpstreamExchange *exchange, FILE *stream, const char *head, size_t len,
+                              unsigned long long contentLen) {
+    if (!sendUpstream(exchange, head, len)) {
+        return 502;
+    }
+    char buf[UPSTREAM_BUFFER_SIZE];
+    while (contentLen > 0) {
+        size_t n = fread(buf, 1, (contentLen < sizeof(buf)) ? contentLen : sizeof(buf), stream);
+        if (n == 0) {
+            return 400;
+        }
+        if (!sendUpstream(exchange, buf, n)) {
+            return 502;
+        }
+        contentLen -= n;
+    }
+    return 0;
+}
+
+/**
+ * Copy a response body of known length from the upstream server.
+ *
+ * @param exchange the upstream exchange
+ * @param out the client stream
+ * @param length the body length
+ * @return true if the whole body was copied
+ */
+static bool relay_length(UpstreamExchange *exchange, FILE *out, unsigned long long length) {
+    char buf[UPSTREAM_BUFFER_SIZE];
+    while (length > 0) {
+        ssize_t n = readUpstream(exchange, buf, (length < sizeof(buf)) ? length : sizeof(buf));
+        if ((n <= 0) || (fwrite(buf, 1, n, out) < (size_t)n)) {
+            return false;
+        }
+        length -= n;
+    }
+    return true;
+}
+
+/**
+ * Copy a chunked response body from the upstream server, decoding
+ * the chunks. Trailers are read and dropped.
+ *
+ * @param exchange the upstream exchange
+ * @param out the client body stream
+ * @return true if the whole body was copied
+ */
+static bool relay_chunked(UpstreamExchange *exchange, FILE *out) {
+    char line[MAXBUF];
+    while (true) {
+        char *end;
+        if (!readUpstreamLine(exchange, line, sizeof(line))) {
+            return false;
+        }
+        unsigned long long size = strtoull(line, &end, 16);
+        if ((end == line) || ((*end != '\0') && (*end != ';') && (*end != ' ') && (*end != '\t'))) {
+            return false;
+        }
+        if (size == 0) {
+            break;
+        }
+        if (!relay_length(exchange, out, size)
+            || !readUpstreamLine(exchange, line, sizeof(line)) || (line[0] != '\0')) {
+            return false;
+        }
+    }
+    do {
+        if (!readUpstreamLine(exchange, line, sizeof(line))) {
+            return false;
+        }
+    } while (line[0] != '\0');
+    return true;
+}
+
+/**
+ * Copy a response body that ends when the upstream server closes
+ * the connection.
+ *
+ * @param exchange the upstream exchange
+ * @param out the client body stream
+ * @return true if the whole body was copied
+ */
+static bool relay_until_close(UpstreamExchange *exchange, FILE *out) {
+    char buf[UPSTREAM_BUFFER_SIZE];
+    ssize_t n;
+    while ((n = readUpstream(exchange, buf, sizeof(buf))) > 0) {
+        if (fwrite(buf, 1, n, out) < (size_t)n) {
+            return false;
+        }
+    }
+    return n == 0;
+}
+
+/**
+ * Abort a response whose body broke off. The bytes relayed so far
+ * are sent, then an HTTP/1 connection is shut down and an HTTP/2
+ * stream reset: without the last chunk or the whole length, the
+ * client must not take the body as complete.
+ *
+ * @param stream the client stream
+ * @param body the client body stream, or NULL
+ * @param sock_fd the client socket descriptor
+ */
+static void abort_proxy_response(FILE *stream, FILE *body, int sock_fd) {
+    if (!http2AbortStream(stream)) {
+        if (body != NULL) {
+            fflush(body);
+        }
+        fflush(stream);
+        shutdown(sock_fd, SHUT_RDWR);
+    }
+}
+
+/**
+ * Relay the response of the upstream server, whose status line has
+ * been read, to the client.
+ *
+ * @param exchange the upstream exchange
+ * @param stream the client stream
+ * @param sock_fd the client socket descriptor
+ * @param statusLine the response status line (MAXBUF bytes)
+ * @param head true if the request was HEAD
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return true if the upstream connection can serve another request
+ */
+static bool relay_proxy_response(UpstreamExchange *exchange, FILE *stream, int sock_fd, char *statusLine,
+                                 bool head, Properties *requestHeaders, Properties *responseHeaders) {
+    char line[MAXBUF];
+    int minor, status, reasonAt;
+
+    // skip interim responses such as 100 Continue
+    while (true) {
+        reasonAt = 0;
+        if ((sscanf(statusLine, "HTTP/1.%d %3d %n", &minor, &status, &reasonAt) < 2) || (status < 100)) {
+            sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+            return false;
+        }
+        if (status >= 200) {
+            break;
+        }
+        do {
+            if (!readUpstreamLine(exchange, line, sizeof(line))) {
+                sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+                return false;
+            }
+        } while (line[0] != '\0');
+        if (!readUpstreamLine(exchange, statusLine, MAXBUF)) {
+            sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+            return false;
+        }
+    }
+    const char *reason = (reasonAt > 0) ? statusLine + reasonAt : "";
+
+    // read the headers, and note how the body ends
+    Properties *upstreamHeaders = newProperties();
+    bool keepAlive = (minor >= 1), chunked = false, hasLength = false;
+    unsigned long long contentLen = 0;
+    while (true) {
+        if (!readUpstreamLine(exchange, line, sizeof(line))) {
+            deleteProperties(upstreamHeaders);
+            sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+            return false;
+        }
+        if (line[0] == '\0') {
+            break;
+        }
+        char *value = strchr(line, ':');
+        if (value == NULL) {
+            continue;
+        }
+        for (*value++ = '\0'; (*value == ' ') || (*value == '\t'); value++) {}
+        if (strcasecmp(line, "Connection") == 0) {
+            if (strcasestr(value, "close") != NULL) {
+                keepAlive = false;
+            } else if (strcasestr(value, "keep-alive") != NULL) {
+                keepAlive = true;
+            }
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+            chunked = (strcasestr(value, "chunked") != NULL);
+        } else if (strcasecmp(line, "Content-Length") == 0) {
+            hasLength = true;
+            contentLen = strtoull(value, NULL, 10);
+        }
+        putProperty(upstreamHeaders, line, value);
+    }
+    hasLength = hasLength && !chunked;
+
+    // forward the end-to-end headers; this server's Date and Server stand
+    char name[MAX_PROP_NAME], value[MAX_PROP_VAL];
+    for (size_t i = 0; getProperty(upstreamHeaders, i, name, value); i++) {
+        if (!is_hop_header(name) && (strcasecmp(name, "Date") != 0) && (strcasecmp(name, "Server") != 0)
+            && (hasLength || (strcasecmp(name, "Content-Length") != 0))) {
+            putProperty(responseHeaders, name, value);
+        }
+    }
+    deleteProperties(upstreamHeaders);
+
+    bool noBody = head || (status == 204) || (status == 304);
+    bool complete;
+    if (noBody || hasLength) {
+        sendResponseStatus(stream, status, reason);
+        sendResponseHeaders(stream, responseHeaders);
+        complete = noBody || relay_length(exchange, stream, contentLen);
+    } else {
+        // a body of unknown length is sent on as it arrives
+        FILE *body = sendStreamedResponse(stream, status, reason, requestHeaders, responseHeaders, true);
+        complete = (body != NULL) && (chunked ? relay_chunked(exchange, body) : relay_until_close(exchange, body));
+        if (!complete) {
+            abort_proxy_response(stream, body, sock_fd);
+        }
+        if (body != NULL) {
+            fclose(body);
+        }
+        return complete && keepAlive && chunked;
+    }
+    if (!complete) {
+        abort_proxy_response(stream, NULL, sock_fd);
+    }
+    return complete && keepAlive;
+}
+
+/**
+ * Handle a request for a proxied route: forward it to an upstream
+ * server of the route and stream the response back as it arrives.
+ * A GET or HEAD without a body may be pipelined behind other requests
+ * on an upstream connection, and is retried once on a new connection
+ * if a reused connection fails before its response begins.
+ *
+ * @param stream the socket stream
+ * @param sock_fd the socket descriptor
+ * @param route the route
+ * @param method the request method
+ * @param target the request target as sent
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_proxy(FILE *stream, int sock_fd, ProxyRoute *route, const char *method, const char *target,
+              Properties *requestHeaders, Properties *responseHeaders) {
+    char buf[MAXBUF];
+    unsigned long long contentLen = 0;
+    if (findProperty(requestHeaders, 0, "Content-Length", buf) != SIZE_MAX) {
+        contentLen = strtoull(buf, NULL, 10);
+    }
+    bool head = (strcasecmp(method, "HEAD") == 0);
+    bool pipelined = (contentLen == 0) && (head || (strcasecmp(method, "GET") == 0));
+
+    UpstreamExchange exchange;
+    char statusLine[MAXBUF];
+    for (int attempt = 0; ; attempt++) {
+        errno = 0;
+        if (!beginUpstreamExchange(route, &exchange, pipelined, attempt > 0)) {
+            sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+            return;
+        }
+        char request[UPSTREAM_BUFFER_SIZE];
+        size_t len = format_proxy_request(request, sizeof(request), sock_fd, method, target,
+                                          requestHeaders, upstreamName(&exchange));
+        if (len == 0) {
+            endUpstreamExchange(&exchange, false);
+            sendErrorResponse(stream, 431, "Request Header Fields Too Large", responseHeaders);
+            return;
+        }
+        int error = send_proxy_request(&exchange, stream, request, len, contentLen);
+        if ((error == 0) && awaitUpstreamResponse(&exchange)
+            && readUpstreamLine(&exchange, statusLine, sizeof(statusLine))) {
+            break;
+        }
+        bool timedOut = (errno == EAGAIN) || (errno == EWOULDBLOCK);
+        bool retry = (error == 0) && !timedOut && pipelined && exchange.reused && (attempt == 0);
+        endUpstreamExchange(&exchange, false);
+        if (error == 400) {
+            sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+            return;
+        }
+        if (!retry) {
+            if (timedOut) {
+                sendErrorResponse(stream, 504, "Gateway Timeout", responseHeaders);
+            } else {
+                sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+            }
+            return;
+        }
+    }
+
+    bool reusable = relay_proxy_response(&exchange, stream, sock_fd, statusLine, head,
+                                         requestHeaders, responseHeaders);
+    endUpstreamExchange(&exchange, reusable);
+}
+
+/**
+ * Add the CGI meta-variables of a request as parameters for its
+ * FastCGI worker, with each request header as HTTP_<NAME>.
+ *
+ * @param req the FastCGI request
+ * @param handler the handler
+ * @param sock_fd the client socket descriptor
+ * @param method the request method
+ * @param target the request target as sent
+ * @param uri the decoded request URI
+ * @param version the request protocol version
+ * @param requestHeaders the request headers
+ * @return true if the parameters were added
+ */
+static bool add_cgi_params(FcgiRequest *req, FcgiHandler *handler, int sock_fd, const char *method,
+                           const char *target, const char *uri, const char *version,
+                           Properties *requestHeaders) {
+    char buf[MAXBUF], filePath[MAXBUF];
+    const char *query = strchr(target, '?');
+    bool ok = addFcgiParam(req, "GATEWAY_INTERFACE", "CGI/1.1")
+        && addFcgiParam(req, "SERVER_SOFTWARE", "Tiny C Http Server")
+        && addFcgiParam(req, "SERVER_PROTOCOL", version)
+        && addFcgiParam(req, "REQUEST_METHOD", method)
+        && addFcgiParam(req, "REQUEST_URI", target)
+        && addFcgiParam(req, "QUERY_STRING", (query != NULL) ? query+1 : "")
+        && addFcgiParam(req, "DOCUMENT_ROOT", CONTENT_BASE);
+
+    // the script is named by the handler's prefix or the whole URI
+    size_t scriptLen = fcgiScriptLength(handler, uri);
+    snprintf(buf, sizeof(buf), "%.*s", (int)scriptLen, uri);
+    ok = ok && addFcgiParam(req, "SCRIPT_NAME", buf);
+    if (resolveUri(buf, filePath) != NULL) {
+        ok = ok && addFcgiParam(req, "SCRIPT_FILENAME", filePath);
+    }
+    if (uri[scriptLen] != '\0') {
+        ok = ok && addFcgiParam(req, "PATH_INFO", uri + scriptLen);
+    }
+
+    char host[HOST_ADDR_LEN];
+    int port;
+    if (get_peer_host_and_port(sock_fd, host, &port) == 0) {
+        sprintf(buf, "%d", port);
+        ok = ok && addFcgiParam(req, "REMOTE_ADDR", host) && addFcgiParam(req, "REMOTE_PORT", buf);
+    }
+    if (get_local_host_and_port(sock_fd, host, &port) == 0) {
+        sprintf(buf, "%d", port);
+        ok = ok && addFcgiParam(req, "SERVER_ADDR", host) && addFcgiParam(req, "SERVER_PORT", buf);
+    } else {
+        strcpy(host, "localhost");
+    }
+
+    char name[MAX_PROP_NAME + 5], value[MAX_PROP_VAL];
+    if (findProperty(requestHeaders, 0, "Host", value) != SIZE_MAX) {
+        // drop the port, keeping an IPv6 address whole
+        char *colon = strrchr(value, ':');
+        if ((colon != NULL) && (strchr(colon, ']') == NULL)) {
+            *colon = '\0';
+        }
+        ok = ok && addFcgiParam(req, "SERVER_NAME", value);
+    } else {
+        ok = ok && addFcgiParam(req, "SERVER_NAME", host);
+    }
+
+    for (size_t i = 0; ok && getProperty(requestHeaders, i, name, value); i++) {
+        // a Proxy header must not become HTTP_PROXY in the worker environment
+        if ((name[0] == '?') || (strcasecmp(name, "Proxy") == 0)) {
+            continue;
+        }
+        if (strcasecmp(name, "Content-Type") == 0) {
+            ok = addFcgiParam(req, "CONTENT_TYPE", value);
+        } else if (strcasecmp(name, "Content-Length") == 0) {
+            ok = addFcgiParam(req, "CONTENT_LENGTH", value);
+        } else {
+            char *p = stpcpy(buf, "HTTP_");
+            for (const char *q = name; *q != '\0'; q++) {
+                *p++ = (*q == '-') ? '_' : toupper((unsigned char)*q);
+            }
+            *p = '\0';
+            ok = addFcgiParam(req, buf, value);
+        }
+    }
+    return ok;
+}
+
+/**
+ * Send a request body to a FastCGI worker, and end its input.
+ *
+ * @param req the FastCGI request
+ * @param stream the client stream the body is read from
+ * @param contentLen the length of the request body
+ * @return 0 if sent, 400 if the client body broke off, 502 if the worker failed
+ */
+static int send_fcgi_body(FcgiRequest *req, FILE *stream, unsigned long long contentLen) {
+    char buf[MAXBUF];
+    while (contentLen > 0) {
+        size_t n = fread(buf, 1, (contentLen < sizeof(buf)) ? contentLen : sizeof(buf), stream);
+        if (n == 0) {
+            return 400;
+        }
+        if (!sendFcgiStdin(req, buf, n)) {
+            return 502;
+        }
+        contentLen -= n;
+    }
+    return sendFcgiStdin(req, NULL, 0) ? 0 : 502;
+}
+
+/**
+ * Copy the response body output by a FastCGI worker.
+ *
+ * @param req the FastCGI request
+ * @param out the client body stream
+ * @param hasLength true if the body length is known
+ * @param length the body length
+ * @return true if the whole body was copied
+ */
+static bool copy_fcgi_body(FcgiRequest *req, FILE *out, bool hasLength, unsigned long long length) {
+    char buf[MAXBUF];
+    while (!hasLength || (length > 0)) {
+        ssize_t n = readFcgi(req, buf, (hasLength && (length < sizeof(buf))) ? length : sizeof(buf));
+        if (n == 0) {
+            return !hasLength;
+        }
+        if ((n < 0) || (fwrite(buf, 1, n, out) < (size_t)n)) {
+            return false;
+        }
+        if (hasLength) {
+            length -= n;
+        }
+    }
+    return true;
+}
+
+/**
+ * Send the error response for a FastCGI request that failed
+ * before its response began.
+ *
+ * @param stream the client stream
+ * @param err the errno of the failure
+ * @param responseHeaders the response headers
+ */
+static void send_fcgi_error(FILE *stream, int err, Properties *responseHeaders) {
+    if (err == EAGAIN) {
+        sendErrorResponse(stream, 504, "Gateway Timeout", responseHeaders);
+    } else if (err == EBUSY) {
+        sendErrorResponse(stream, 503, "Service Unavailable", responseHeaders);
+    } else {
+        sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+    }
+}
+
+/**
+ * Handle a request for a dynamic handler: pass it to a FastCGI
+ * worker of the handler and stream the response back as the worker
+ * writes it. The worker's CGI headers become response headers; a
+ * Status header sets the status, and a Location without one
+ * redirects with 302.
+ *
+ * @param stream the socket stream
+ * @param sock_fd the socket descriptor
+ * @param handler the handler
+ * @param method the request method
+ * @param target the request target as sent
+ * @param uri the decoded request URI
+ * @param version the request protocol version
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_fastcgi(FILE *stream, int sock_fd, FcgiHandler *handler, const char *method, const char *target,
+                const char *uri, const char *version, Properties *requestHeaders, Properties *responseHeaders) {
+    char line[MAXBUF];
+    unsigned long long contentLen = 0;
+    if (findProperty(requestHeaders, 0, "Content-Length", line) != SIZE_MAX) {
+        contentLen = strtoull(line, NULL, 10);
+    }
+
+    FcgiRequest *req = beginFcgiRequest(handler);
+    if (req == NULL) {
+        send_fcgi_error(stream, errno, responseHeaders);
+        return;
+    }
+    if (!add_cgi_params(req, handler, sock_fd, method, target, uri, version, requestHeaders)) {
+        endFcgiRequest(req);
+        sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+        return;
+    }
+    int error = send_fcgi_body(req, stream, contentLen);
+    if (error != 0) {
+        endFcgiRequest(req);
+        if (error == 400) {
+            sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+        } else {
+            sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+        }
+        return;
+    }
+
+    // read the CGI headers
+    int status = 200;
+    char reason[MAXBUF] = "OK";
+    bool hasStatus = false, hasLocation = false, hasLength = false;
+    unsigned long long length = 0;
+    while (true) {
+        errno = 0;
+        if (!readFcgiLine(req, line, sizeof(line))) {
+            int err = errno;
+            endFcgiRequest(req);
+            send_fcgi_error(stream, err, responseHeaders);
+            return;
+        }
+        if (line[0] == '\0') {
+            break;
+        }
+        char *value = strchr(line, ':');
+        if (value == NULL) {
+            continue;
+        }
+        for (*value++ = '\0'; (*value == ' ') || (*value == '\t'); value++) {}
+        if (strcasecmp(line, "Status") == 0) {
+            int reasonAt = 0;
+            if ((sscanf(value, "%3d %n", &status, &reasonAt) < 1) || (status < 200) || (status > 599)) {
+                endFcgiRequest(req);
+                sendErrorResponse(stream, 502, "Bad Gateway", responseHeaders);
+                return;
+            }
+            strcpy(reason, (reasonAt > 0) ? value + reasonAt : "");
+            hasStatus = true;
+            continue;
+        }
+        if (strcasecmp(line, "Location") == 0) {
+            hasLocation = true;
+        } else if (strcasecmp(line, "Content-Length") == 0) {
+            hasLength = true;
+            length = strtoull(value, NULL, 10);
+        } else if (is_hop_header(line)) {
+            continue;
+        }
+        putProperty(responseHeaders, line, value);
+    }
+    if (hasLocation && !hasStatus) {
+        status = 302;
+        strcpy(reason, "Found");
+    }
+
+    bool noBody = (strcasecmp(method, "HEAD") == 0) || (status == 204) || (status == 304);
+    if (noBody || hasLength) {
+        sendResponseStatus(stream, status, reason);
+        sendResponseHeaders(stream, responseHeaders);
+        if (!noBody && !copy_fcgi_body(req, stream, true, length)) {
+            abort_proxy_response(stream, NULL, sock_fd);
+        }
+    } else {
+        // a body of unknown length is sent on as the worker writes it
+        FILE *body = sendStreamedResponse(stream, status, reason, requestHeaders, responseHeaders, true);
+        if ((body == NULL) || !copy_fcgi_body(req, body, false, 0)) {
+            abort_proxy_response(stream, body, sock_fd);
+        }
+        if (body != NULL) {
+            fclose(body);
+        }
+    }
+    endFcgiRequest(req);
+}
@@ -13,6 +13,8 @@
 
 #include <stdio.h>
 #include "properties.h"
+#include "upstream.h"
+#include "fastcgi.h"
 
 /**
  * Handle HEAD request.
@@ -64,4 +66,42 @@ void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properti
  */
 void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
+/**
+ * Handle a request for a proxied route: forward it to an upstream
+ * server of the route and stream the response back as it arrives.
+ * A GET or HEAD without a body may be pipelined behind other requests
+ * on an upstream connection, and is retried once on a new connection
+ * if a reused connection fails before its response begins.
+ *
+ * @param stream the socket stream
+ * @param sock_fd the socket descriptor
+ * @param route the route
+ * @param method the request method
+ * @param target the request target as sent
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_proxy(FILE *stream, int sock_fd, ProxyRoute *route, const char *method, const char *target,
+              Properties *requestHeaders, Properties *responseHeaders);
+
+/**
+ * Handle a request for a dynamic handler: pass it to a FastCGI
+ * worker of the handler and stream the response back as the worker
+ * writes it. The worker's CGI headers become response headers; a
+ * Status header sets the status, and a Location without one
+ * redirects with 302.
+ *
+ * @param stream the socket stream
+ * @param sock_fd the socket descriptor
+ * @param handler the handler
+ * @param method the request method
+ * @param target the request target as sent
+ * @param uri the decoded request URI
+ * @param version the request protocol version
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void do_fastcgi(FILE *stream, int sock_fd, FcgiHandler *handler, const char *method, const char *target,
+                const char *uri, const char *version, Properties *requestHeaders, Properties *responseHeaders);
+
 #endif /* HTTP_METHODS_H_ */
@@ -6,46 +6,341 @@
  *  @since 2019-04-10
  *  @author: Philip Gust
  */
+#define _GNU_SOURCE
+
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "http_methods.h"
+#include "http_request.h"
 #include "http_util.h"
+#include "http2.h"
 #include "time_util.h"
 #include "http_server.h"
+#include "server_stats.h"
+#include "access_log.h"
+#include "buffer_pool.h"
+#include "slab.h"
+#include "stat_cache.h"
+#include "traffic_capture.h"
+#include "rate_limit.h"
+#include "content_bundle.h"
+
+/** thread pool for bulk requests (NULL if lanes not enabled) */
+static threadpool lanePool;
+
+/** smallest transfer that goes to the bulk lane */
+static long laneBulkThreshold;
+
+/** serve statistics at STATS_URI */
+static bool statsEndpoint;
 
+/** requests allocated together */
+#define REQUESTS_PER_CHUNK 64
+
+/** slab of requests in flight */
+static Slab *requestSlab;
+
+/** keep connections open between requests */
+static bool keepAliveEnabled;
+
+/** most requests per connection, or 0 for no limit */
+static unsigned long keepAliveMax;
 
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ * Enable dispatch of large requests to the bulk lane.
+ *
+ * @param pool the thread pool running requests
+ * @param bulkThreshold the smallest bulk transfer in bytes
  */
-void process_request(int sock_fd) {
+void initRequestLanes(threadpool pool, long bulkThreshold) {
+	laneBulkThreshold = bulkThreshold;
+	lanePool = pool;
+}
+
+/**
+ * Enable or disable the statistics endpoint at STATS_URI.
+ *
+ * @param enable true to serve statistics
+ */
+void enableStatsEndpoint(bool enable) {
+	statsEndpoint = enable;
+}
+
+/**
+ * Log a finished request and free its headers.
+ *
+ * @param req the request
+ */
+static void end_request(HttpRequest *req) {
+	// a body that stopped arriving is logged as 408 whatever the handler sent
+	if (connTimeoutExpired(&req->conn->timeout) == TIMEOUT_BODY) {
+		recordResponseStatus(408);
+	}
+
+	// count and log every request that got as far as a response
+	if (req->responseHeaders != NULL) {
+		fflush(req->stream);
+		unsigned long long durationNs = monotonicTimeNs() - req->startNs;
+		logAccess(req->sock_fd, req->method, req->target, req->version, getResponseStatus(),
+				  req->counters.bytesIn, req->counters.bytesOut, durationNs);
+		recordRequest(req->method, req->counters.bytesIn, req->counters.bytesOut, durationNs);
+		captureRequest(req->startNs, durationNs, req->request, req->requestHeaders,
+					   getResponseStatus(), req->counters.bytesOut);
+	}
+
+	endRequestPacing();
+
+	if (req->requestHeaders != NULL) {
+		deleteProperties(req->requestHeaders);
+		req->requestHeaders = NULL;
+	}
+	if (req->responseHeaders != NULL) {
+		deleteProperties(req->responseHeaders);
+		req->responseHeaders = NULL;
+	}
+}
+
+/**
+ * Close the socket stream of a request and return the request
+ * and its buffer; the connection stays open.
+ *
+ * @param req the request
+ */
+static void release_request(HttpRequest *req) {
+	fflush(req->stream);
+	fclose(req->stream);
+	returnBuffer(req->streamBuf);
+	slabFree(requestSlab, req);
+}
+
+/**
+ * Close the connection of a request and free the request.
+ *
+ * @param req the request
+ */
+static void close_request(HttpRequest *req) {
+	end_request(req);
+	Connection *conn = req->conn;
+	release_request(req);
+	closeConnection(conn);
+}
+
+/**
+ * Decide whether the connection can serve another request
+ * once this one is answered.
+ *
+ * @param req the request
+ * @return true if the client asked to keep the connection open
+ */
+static bool wants_keep_alive(HttpRequest *req) {
+	if (!keepAliveEnabled || connectionsDraining()
+		|| ((keepAliveMax > 0) && (req->conn->requests >= keepAliveMax))) {
+		return false;
+	}
 	char buf[MAXBUF];
-	char request[MAXBUF];
-	char method[MAXBUF];
-	char uri[MAXBUF], encUri[MAXBUF];
-	char version[MAXBUF];
+	if (findProperty(req->requestHeaders, 0, "Connection", buf) != SIZE_MAX) {
+		if (strcasestr(buf, "close") != NULL) {
+			return false;
+		}
+		if (strcasestr(buf, "keep-alive") != NULL) {
+			return true;
+		}
+	}
+	// HTTP/1.1 connections persist unless closed
+	return acceptsChunked(req->requestHeaders);
+}
 
-	// open socket as a stream
-	FILE *stream = fdopen(sock_fd, "r+");
-	if (stream == NULL) {
-		perror("fdopen");
-		return;
+/**
+ * Decide whether the connection is still usable for another
+ * request: the response must have a length or be chunked, so its
+ * end is known without closing, and any request body must have
+ * been read.
+ *
+ * @param req the request
+ * @return true if the connection can be kept
+ */
+static bool can_keep_alive(HttpRequest *req) {
+	char buf[MAXBUF];
+	if (!req->keepAlive || (req->responseHeaders == NULL) || ferror(req->stream)
+		|| (connTimeoutExpired(&req->conn->timeout) != TIMEOUT_NONE)) {
+		return false;
+	}
+	if ((findProperty(req->responseHeaders, 0, "Content-Length", buf) == SIZE_MAX)
+		&& (findProperty(req->responseHeaders, 0, "Transfer-Encoding", buf) == SIZE_MAX)) {
+		return false;
 	}
+	// handlers that fail before reading a body leave it unread
+	if ((findProperty(req->requestHeaders, 0, "Content-Length", buf) != SIZE_MAX)
+		&& (atol(buf) > 0) && (getResponseStatus() >= 300)) {
+		return false;
+	}
+	return fflush(req->stream) == 0;
+}
 
-	// get header line
-	if (fgets(request, MAXBUF, stream) == NULL) {
+/**
+ * Finish a request. A kept-alive connection whose next request is
+ * already buffered continues on this thread; otherwise it is parked
+ * until the next request arrives, and the request is released.
+ *
+ * @param req the request
+ * @return true if the next request should be read now
+ */
+static bool finish_request(HttpRequest *req) {
+	if (!can_keep_alive(req)) {
+		close_request(req);
+		return false;
+	}
+	end_request(req);
+
+	// a pipelined request is waiting: keep the stream and buffer
+	if (socketHasInput(req->sock_fd)) {
+		memset(&req->counters, 0, sizeof(HttpRequest) - offsetof(HttpRequest, counters));
+		return true;
+	}
+
+	Connection *conn = req->conn;
+	release_request(req);
+	if (!parkConnection(conn)) {
+		closeConnection(conn);
+	}
+	return false;
+}
+
+/**
+ * If the client did not send the request line and headers before
+ * the header deadline, answer 408 Request Timeout and close the
+ * connection.
+ *
+ * @param req the request
+ * @return true if the request timed out and was closed
+ */
+static bool request_timed_out(HttpRequest *req) {
+	if (connTimeoutExpired(&req->conn->timeout) != TIMEOUT_HEADER) {
+		return false;
+	}
+	if (req->method[0] == '\0') {
+		strcpy(req->method, "-");
+		strcpy(req->target, "-");
+	}
+	sendErrorResponse(req->stream, 408, "Request Timeout", req->responseHeaders);
+	close_request(req);
+	return true;
+}
+
+/**
+ * Classify a request by method, Content-Length and target size.
+ *
+ * @param method the request method
+ * @param uri the decoded request path
+ * @param requestHeaders the request headers
+ * @return REQUEST_LANE_BULK for large transfers, otherwise REQUEST_LANE_FAST
+ */
+static int classify_request(const char *method, const char *uri, Properties *requestHeaders) {
+	char buf[MAXBUF];
+	if ((strcasecmp(method, "PUT") == 0) || (strcasecmp(method, "POST") == 0)) {
+		if (findProperty(requestHeaders, 0, "Content-Length", buf) != SIZE_MAX
+			&& atol(buf) >= laneBulkThreshold) {
+			return REQUEST_LANE_BULK;
+		}
+	} else if ((strcasecmp(method, "GET") == 0) && (findProxyRoute(uri) == NULL)
+			   && (findFcgiHandler(uri) == NULL)) {
+		// by the index of the content bundle, if serving one
+		ContentBundle *bundle = acquireContentBundle();
+		if (bundle != NULL) {
+			const BundleRecord *record = findBundleFile(bundle, uri);
+			bool bulk = (record != NULL) && (record->body[BUNDLE_IDENTITY].length >= (uint64_t)laneBulkThreshold);
+			releaseContentBundle(bundle);
+			return bulk ? REQUEST_LANE_BULK : REQUEST_LANE_FAST;
+		}
+		char filePath[MAXBUF];
+		struct stat sb;
+		if ((resolveUri(uri, filePath) != NULL) && (cachedStat(filePath, &sb) == 0) && S_ISREG(sb.st_mode) && (sb.st_size >= laneBulkThreshold)) {
+			return REQUEST_LANE_BULK;
+		}
+	}
+	return REQUEST_LANE_FAST;
+}
+
+/**
+ * Dispatch a parsed request to its method handler.
+ *
+ * @param req the request
+ */
+static void handle_request(HttpRequest *req) {
+	FILE *stream = req->stream;
+	const char *uri = req->uri;
+	Properties *requestHeaders = req->requestHeaders;
+	Properties *responseHeaders = req->responseHeaders;
+
+	// refuse a client or server over its request rate; the
+	// response of an admitted request is paced by its byte rate
+	long retryAfter;
+	int limited = admitRequest(req->sock_fd, uri, &retryAfter);
+	if (limited != 0) {
+		char buf[32];
+		sprintf(buf, "%ld", retryAfter);
+		putProperty(responseHeaders, "Retry-After", buf);
+		if (limited == 429) {
+			sendErrorResponse(stream, 429, "Too Many Requests", responseHeaders);
+		} else {
+			sendErrorResponse(stream, 503, "Service Unavailable", responseHeaders);
+		}
 		return;
 	}
-	// eliminate newline
-	char *p = strstr(request, CRLF);
-	if (p != NULL) {
-		*p = '\0';
+
+	// dispatch based on method
+	ProxyRoute *route;
+	FcgiHandler *handler;
+	if (statsEndpoint && (strcmp(uri, STATS_URI) == 0)
+		&& ((strcasecmp(req->method, "GET") == 0) || (strcasecmp(req->method, "HEAD") == 0))) {
+		sendStatsResponse(stream, requestHeaders, responseHeaders);
+	} else if ((route = findProxyRoute(uri)) != NULL) {
+		do_proxy(stream, req->sock_fd, route, req->method, req->target, requestHeaders, responseHeaders);
+	} else if ((handler = findFcgiHandler(uri)) != NULL) {
+		do_fastcgi(stream, req->sock_fd, handler, req->method, req->target, uri, req->version,
+				   requestHeaders, responseHeaders);
+	} else if (strcasecmp(req->method, "GET") == 0) {
+		do_get(stream, uri, requestHeaders, responseHeaders);
+	} else 	if (strcasecmp(req->method, "HEAD") == 0) {
+		do_head(stream, uri, requestHeaders, responseHeaders);
+	} else 	if (strcasecmp(req->method, "PUT") == 0) {
+		do_put(stream, uri, requestHeaders, responseHeaders);
+	} else 	if (strcasecmp(req->method, "POST") == 0) {
+		do_post(stream, uri, requestHeaders, responseHeaders);
+	} else 	if (strcasecmp(req->method, "DELETE") == 0) {
+		do_delete(stream, uri, requestHeaders, responseHeaders);
+	} else {
+		sendErrorResponse(stream, 501, "Not Implemented", responseHeaders);
 	}
+}
 
-	// initialize request headers
+/**
+ * Arm the body deadline of a request about to be handled: a request
+ * body must keep arriving. The response is covered by the write-stall
+ * deadline as it is sent.
+ *
+ * @param req the request
+ */
+static void arm_body_timeout(HttpRequest *req) {
+	char buf[MAXBUF];
+	if ((findProperty(req->requestHeaders, 0, "Content-Length", buf) != SIZE_MAX) && (atol(buf) > 0)) {
+		armConnTimeout(&req->conn->timeout, TIMEOUT_BODY);
+	}
+}
+
+/**
+ * Create the response headers of a request, naming the server
+ * and the date and time of the response.
+ *
+ * @return the response headers
+ */
+static Properties *new_response_headers(void) {
+	char buf[MAXBUF];
 	Properties *responseHeaders = newProperties();
 	// name of server
 	putProperty(responseHeaders, "Server", "Tiny C Http Server");
@@ -55,64 +350,374 @@ void process_request(int sock_fd) {
 	time(&timer); // need to get local file time?
 	putProperty(responseHeaders,"Date",
 				milliTimeToRFC_1123_Date_Time(timer, buf));
+	return responseHeaders;
+}
 
+/**
+ * Save the query of a request target as "?" and decode its path.
+ *
+ * @param req the request
+ * @param encUri the request target; the query is cut off
+ * @return true if the path is valid and stays in the content tree
+ */
+static bool decode_target(HttpRequest *req, char *encUri) {
+	// save query parameters as key "?"
+	char *p = strpbrk(encUri,"?&");
+	if (p != NULL) {
+		putProperty(req->requestHeaders, "?", p+1);
+		*p = '\0';
+		if (debug) {
+			fprintf(stderr, "Query: %s\n", p+1);
+		}
+	}
+
+	// unescape URI
+	if (unescapeUri(encUri, req->uri) == NULL) {
+		if (debug) {
+			fprintf(stderr, "request header invalid URI encoding %s\n", req->request);
+		}
+		return false;
+	}
+
+	// reject paths that would leave the content tree before touching it
+	char filePath[MAXBUF];
+	if (resolveUri(req->uri, filePath) == NULL) {
+		if (debug) {
+			fprintf(stderr, "request header invalid URI path %s\n", req->request);
+		}
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Switch the connection of a request to HTTP/2 at the client's
+ * request: answers 101 Switching Protocols, and the request is
+ * answered as stream 1 of the new session.
+ *
+ * @param req the request
+ * @param encUri the request target
+ */
+static void upgrade_request(HttpRequest *req, const char *encUri) {
+	fprintf(req->stream, "HTTP/1.1 101 Switching Protocols%sConnection: Upgrade%sUpgrade: h2c%s%s",
+			CRLF, CRLF, CRLF, CRLF);
+	bool switched = (fflush(req->stream) == 0);
+
+	char method[MAXBUF], target[MAXBUF];
+	strcpy(method, req->method);
+	strcpy(target, encUri);
+	Connection *conn = req->conn;
+	Properties *requestHeaders = req->requestHeaders;
+	req->requestHeaders = NULL;
+	deleteProperties(req->responseHeaders);
+	req->responseHeaders = NULL;
+	release_request(req);
+	if (!switched) {
+		releaseHttp2Session();
+		deleteProperties(requestHeaders);
+		closeConnection(conn);
+	} else if (!startHttp2(conn, method, target, requestHeaders)) {
+		closeConnection(conn);
+	}
+}
+
+static void dispatch_request(HttpRequest *req);
+
+/**
+ * Read and parse the next request of a connection.
+ *
+ * @param req the request
+ * @return true if the request is ready to dispatch on this thread,
+ *   false if it was answered and closed, or moved to the bulk lane
+ */
+static bool read_request(HttpRequest *req) {
+	char buf[MAXBUF];
+	char encUri[MAXBUF];
+	FILE *stream = req->stream;
+	char *request = req->request;
+	req->startNs = monotonicTimeNs();
+	req->conn->requests++;
+	frameRequestHeaders(&req->framing);
+	clearerr(stream);
+
+	// the whole request line and headers must arrive in time,
+	// however slowly their bytes trickle in
+	armConnTimeout(&req->conn->timeout, TIMEOUT_HEADER);
+
+	// get header line
+	if (fgets(request, MAXBUF, stream) == NULL) {
+		close_request(req);
+		return false;
+	}
+	// eliminate newline
+	char *p = strstr(request, CRLF);
+	if (p != NULL) {
+		*p = '\0';
+	}
+
+	// an HTTP/2 client with prior knowledge opens with the preface,
+	// whose first line is followed by a blank line; it is refused
+	// when the most HTTP/2 sessions are running
+	if (http2Enabled() && (strcmp(request, HTTP2_PREFACE_LINE) == 0)) {
+		bool preface = (fgets(buf, MAXBUF, stream) != NULL) && (strcmp(buf, CRLF) == 0);
+		cancelConnTimeout(&req->conn->timeout);
+		Connection *conn = req->conn;
+		release_request(req);
+		if (!preface || !reserveHttp2Session() || !startHttp2(conn, NULL, NULL, NULL)) {
+			closeConnection(conn);
+		}
+		return false;
+	}
+
+	// initialize request headers
+	Properties *responseHeaders = new_response_headers();
+	req->responseHeaders = responseHeaders;
+	if (request_timed_out(req)) {
+		return false;
+	}
 
 	// decode header
-	if (sscanf(request, "%s %s %s", method, encUri, version) != 3) {
+	if (sscanf(request, "%s %s %s", req->method, encUri, req->version) != 3) {
+		strcpy(req->target, "-");
 		if (debug) {
 			fprintf(stderr, "request header incomplete: %s\n", request);
 		}
 		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
-		return;
+		close_request(req);
+		return false;
 	}
 	// initialize request headers
 	Properties *requestHeaders = newProperties();
+	req->requestHeaders = requestHeaders;
 	readRequestHeaders(stream, requestHeaders);
+	if (request_timed_out(req)) {
+		return false;
+	}
+	cancelConnTimeout(&req->conn->timeout);
+	if (findProperty(requestHeaders, 0, "Content-Length", buf) != SIZE_MAX) {
+		frameRequestBody(&req->framing, strtoull(buf, NULL, 10));
+	}
 	if (debug) {
 		debugRequest(request, requestHeaders);
 	}
 
-	// save query parameters as key "?"
-	p = strpbrk(encUri,"?&");
-	if (p != NULL) {
-		putProperty(requestHeaders, "?", p+1);
-		*p = '\0';
-		if (debug) {
-			fprintf(stderr, "Query: %s\n", p+1);
+	strcpy(req->target, encUri);
+
+	// an HTTP/1.1 request without a body may switch to HTTP/2,
+	// or stays HTTP/1.1 when the most HTTP/2 sessions are running
+	if ((strcmp(req->version, "HTTP/1.1") == 0) && wantsHttp2Upgrade(requestHeaders)
+		&& reserveHttp2Session()) {
+		upgrade_request(req, encUri);
+		return false;
+	}
+
+	// save the request version as key "?version"
+	putProperty(requestHeaders, "?version", req->version);
+
+	// tell the client whether the connection stays open
+	req->keepAlive = wants_keep_alive(req);
+	if (!req->keepAlive) {
+		putProperty(responseHeaders, "Connection", "close");
+	} else if (!acceptsChunked(requestHeaders)) {
+		putProperty(responseHeaders, "Connection", "keep-alive");
+	}
+
+	// save the query and decode the path
+	if (!decode_target(req, encUri)) {
+		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		close_request(req);
+		return false;
+	}
+
+	// hand large transfers to the bulk lane so they do not
+	// hold up small requests queued behind them
+	if ((lanePool != NULL) && (classify_request(req->method, req->uri, requestHeaders) == REQUEST_LANE_BULK)) {
+		if (thpool_add_work_lane(lanePool, REQUEST_LANE_BULK, (void*)dispatch_request, req) == 0) {
+			return false;
 		}
 	}
+	return true;
+}
 
-	// unescape URI
-	if (unescapeUri(encUri, uri) == NULL) {
-		if (debug) {
-			fprintf(stderr, "request header invalid URI encoding %s\n", request);
+/**
+ * Serve requests on a connection until it is closed, parked
+ * or moved to the bulk lane.
+ *
+ * @param req the request
+ */
+static void serve_requests(HttpRequest *req) {
+	do {
+		if (!read_request(req)) {
+			return;
 		}
-		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
+		arm_body_timeout(req);
+		handle_request(req);
+	} while (finish_request(req));
+}
+
+/**
+ * Dispatch a request moved to the bulk lane, then serve
+ * the rest of its connection.
+ *
+ * @param req the request
+ */
+static void dispatch_request(HttpRequest *req) {
+	arm_body_timeout(req);
+	handle_request(req);
+	if (finish_request(req)) {
+		serve_requests(req);
+	}
+}
+
+/**
+ * Serve a connection that has a request to read, borrowing
+ * a request and a stream buffer while it is served.
+ *
+ * @param conn the connection
+ */
+static void resume_connection(Connection *conn) {
+	HttpRequest *req = slabAlloc(requestSlab);
+	char *streamBuf = borrowBuffer();
+	FILE *stream = NULL;
+	if ((req != NULL) && (streamBuf != NULL)) {
+		req->conn = conn;
+		req->sock_fd = conn->sock_fd;
+		req->streamBuf = streamBuf;
+		stream = openSocketStream(conn->sock_fd, &req->counters, &conn->timeout, &req->framing);
+	}
+	if (stream == NULL) {
+		perror("resume_connection");
+		returnBuffer(streamBuf);
+		slabFree(requestSlab, req);
+		closeConnection(conn);
 		return;
 	}
+	setvbuf(stream, streamBuf, _IOFBF, POOL_BUFFER_SIZE);
+	req->stream = stream;
+	serve_requests(req);
+}
 
-	// dispatch based on method
-	if (strcasecmp(method, "GET") == 0) {
-		do_get(stream, uri, requestHeaders, responseHeaders);
-	} else 	if (strcasecmp(method, "HEAD") == 0) {
-		do_head(stream, uri, requestHeaders, responseHeaders);
-	} else 	if (strcasecmp(method, "PUT") == 0) {
-		do_put(stream, uri, requestHeaders, responseHeaders);
-	} else 	if (strcasecmp(method, "POST") == 0) {
-		do_post(stream, uri, requestHeaders, responseHeaders);
-	} else 	if (strcasecmp(method, "DELETE") == 0) {
-		do_delete(stream, uri, requestHeaders, responseHeaders);
-	} else {
-		sendErrorResponse(stream, 501, "Not Implemented", responseHeaders);
+/**
+ * Serve a request received on an HTTP/2 stream. The stream
+ * ends when it is closed after the request is logged.
+ *
+ * @param conn the connection
+ * @param stream the stream
+ * @param counters bytes received and sent on the stream
+ * @param method the request method
+ * @param target the request target
+ * @param requestHeaders the request headers
+ */
+static void serve_http2_stream(Connection *conn, FILE *stream, SocketCounters *counters,
+							   const char *method, const char *target, Properties *requestHeaders) {
+	HttpRequest *req = slabAlloc(requestSlab);
+	if (req == NULL) {
+		perror("serve_http2_stream");
+		deleteProperties(requestHeaders);
+		return;
+	}
+	memset(req, 0, sizeof(HttpRequest));
+	req->conn = conn;
+	req->sock_fd = conn->sock_fd;
+	req->stream = stream;
+	req->startNs = monotonicTimeNs();
+	snprintf(req->request, MAXBUF, "%s %s %s", method, target, HTTP2_VERSION);
+	strcpy(req->method, method);
+	strcpy(req->target, target);
+	strcpy(req->version, HTTP2_VERSION);
+	req->requestHeaders = requestHeaders;
+	req->responseHeaders = new_response_headers();
+	if (debug) {
+		debugRequest(req->request, requestHeaders);
 	}
 
-	// delete headers
-	deleteProperties(requestHeaders);
-	deleteProperties(responseHeaders);
+	// save the request version as key "?version"
+	putProperty(requestHeaders, "?version", req->version);
+
+	char encUri[MAXBUF];
+	strcpy(encUri, target);
+	if (decode_target(req, encUri)) {
+		handle_request(req);
+	} else {
+		sendErrorResponse(stream, 400, "Bad Request", req->responseHeaders);
+	}
 
-	// close socket stream
 	fflush(stream);
-	fclose(stream);
-	close(sock_fd);
+	req->counters = *counters;
+	end_request(req);
+	slabFree(requestSlab, req);
+}
+
+/**
+ * Choose the lane of a request received on an HTTP/2 stream, as
+ * read_request() does for HTTP/1.1: large transfers go to the bulk
+ * lane when lanes are enabled.
+ *
+ * @param method the request method
+ * @param target the request target
+ * @param requestHeaders the request headers
+ * @return the pool lane
+ */
+static int classify_http2_stream(const char *method, const char *target, Properties *requestHeaders) {
+	if (lanePool == NULL) {
+		return REQUEST_LANE_FAST;
+	}
+	// the path without its query; a bad target is refused on any lane
+	char path[MAXBUF], uri[MAXBUF];
+	snprintf(path, sizeof(path), "%s", target);
+	char *p = strpbrk(path, "?&");
+	if (p != NULL) {
+		*p = '\0';
+	}
+	if (unescapeUri(path, uri) == NULL) {
+		return REQUEST_LANE_FAST;
+	}
+	return classify_request(method, uri, requestHeaders);
 }
 
+/**
+ * Enable HTTP/2, by prior knowledge or by upgrade from HTTP/1.1.
+ * Stream requests run on the lane classify_request() picks.
+ *
+ * @param pool the thread pool running requests
+ * @param maxStreams the most concurrent streams per connection
+ * @param maxSessions the most concurrent HTTP/2 connections
+ * @param window the flow-control window of each request body
+ * @return true if successful
+ */
+bool enableHttp2(threadpool pool, unsigned maxStreams, unsigned maxSessions, unsigned long window) {
+	return initHttp2(pool, classify_http2_stream, serve_http2_stream, maxStreams, maxSessions, window);
+}
+
+/**
+ *  Process the http requests of a new connection.
+ *  @param sock_fd the socket descriptor
+ */
+void process_request(int sock_fd) {
+	Connection *conn = newConnection(sock_fd);
+	if (conn == NULL) {
+		perror("process_request");
+		close(sock_fd);
+		recordConnectionClosed();
+		return;
+	}
+	resume_connection(conn);
+}
+
+/**
+ * Initialize request processing.
+ *
+ * @param pool the thread pool running requests
+ * @param keepAlive true to keep connections open between requests
+ * @param maxRequests the most requests served per connection, or 0 for no limit
+ * @return true if successful
+ */
+bool initRequests(threadpool pool, bool keepAlive, unsigned long maxRequests) {
+	requestSlab = newSlab(sizeof(HttpRequest), REQUESTS_PER_CHUNK);
+	if (requestSlab == NULL) {
+		return false;
+	}
+	keepAliveEnabled = keepAlive;
+	keepAliveMax = maxRequests;
+	return initConnections(pool, REQUEST_LANE_FAST, resume_connection);
+}
@@ -10,8 +10,85 @@
 #ifndef HTTP_REQUEST_H_
 #define HTTP_REQUEST_H_
 
+#include <stdio.h>
+
+#include "connection.h"
+#include "http_server.h"
+#include "properties.h"
+#include "socket_stream.h"
+#include "thpool.h"
+
+/** Thread pool lanes used for requests */
+enum {
+	REQUEST_LANE_FAST = 0,	/** small files, errors and new connections */
+	REQUEST_LANE_BULK = 1	/** large transfers and uploads */
+};
+
+/**
+ * A request in flight, borrowed for the connection while requests
+ * are read and answered. Fields from counters on are per request.
+ */
+typedef struct HttpRequest {
+	Connection *conn;				/** the connection */
+	int sock_fd;					/** the socket descriptor */
+	FILE *stream;					/** the socket stream */
+	char *streamBuf;				/** stream buffer from the buffer pool */
+	SocketFraming framing;			/** read limits of the stream */
+	SocketCounters counters;		/** bytes received and sent */
+	unsigned long long startNs;		/** time processing started */
+	bool keepAlive;					/** the connection may serve another request */
+	char request[MAXBUF];			/** the request line */
+	char method[MAXBUF];			/** the request method */
+	char target[MAXBUF];			/** the request URI as sent */
+	char uri[MAXBUF];				/** the decoded request URI */
+	char version[MAXBUF];			/** the request protocol version */
+	Properties *requestHeaders;		/** the request headers */
+	Properties *responseHeaders;	/** the response headers */
+} HttpRequest;
+
+/**
+ * Initialize request processing.
+ *
+ * @param pool the thread pool running requests
+ * @param keepAlive true to keep connections open between requests
+ * @param maxRequests the most requests served per connection, or 0 for no limit
+ * @return true if successful
+ */
+bool initRequests(threadpool pool, bool keepAlive, unsigned long maxRequests);
+
+/**
+ * Enable dispatch of large requests to the bulk lane.
+ * Requests are classified once their headers are read:
+ * GETs of files and PUT/POST bodies larger than the
+ * threshold continue on REQUEST_LANE_BULK.
+ *
+ * @param pool the thread pool running requests
+ * @param bulkThreshold the smallest bulk transfer in bytes
+ */
+void initRequestLanes(threadpool pool, long bulkThreshold);
+
+/**
+ * Enable or disable the statistics endpoint at STATS_URI.
+ *
+ * @param enable true to serve statistics
+ */
+void enableStatsEndpoint(bool enable);
+
+/**
+ * Enable HTTP/2, by prior knowledge or by upgrade from HTTP/1.1.
+ * Stream requests run on the lane of their method and target, as
+ * HTTP/1.1 requests do.
+ *
+ * @param pool the thread pool running requests
+ * @param maxStreams the most concurrent streams per connection
+ * @param maxSessions the most concurrent HTTP/2 connections
+ * @param window the flow-control window of each request body
+ * @return true if successful
+ */
+bool enableHttp2(threadpool pool, unsigned maxStreams, unsigned maxSessions, unsigned long window);
+
 /**
- *  Process an http request.
+ *  Process the http requests of a new connection.
  *  @param sock_fd the socket descriptor
  */
 void process_request(int sock_fd);
@@ -12,8 +12,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <signal.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/resource.h>
 
 #include "http_methods.h"
 #include "time_util.h"
@@ -24,68 +27,492 @@
 #include "thpool.h"
 #include "mime_util.h"
 #include "thpool.h"
+#include "properties.h"
+#include "server_config.h"
+#include "cpu_affinity.h"
+#include "server_stats.h"
+#include "access_log.h"
+#include "traffic_capture.h"
+#include "conn_timeout.h"
+#include "stat_cache.h"
+#include "dir_listing.h"
+#include "buffer_pool.h"
+#include "upstream.h"
+#include "fastcgi.h"
+#include "rate_limit.h"
+#include "listener_handoff.h"
+#include "cache_arena.h"
+#include "file_cache.h"
+#include "warm_up.h"
+#include "content_bundle.h"
+#include "content_hash.h"
 
 #define DEFAULT_HTTP_PORT 1500
 #define MIN_PORT 1000
 #define THREADS 32
 
 /** debug flag */
-const bool debug = true;
+bool debug = true;
 
 /** subdirectory of application home directory for web content */
 const char *CONTENT_BASE = "/Users/mayuribedekar/5600/Assignment-5/content";
 
+/** content base set from the server configuration */
+static char contentBaseBuf[MAX_PROP_VAL];
+
+/** set when the server is asked to stop */
+static volatile sig_atomic_t stopping = 0;
+
+/** set when the server is asked to reload its content bundle */
+static volatile sig_atomic_t reloading = 0;
+
+/**
+ * Signal handler that asks the server to stop on SIGTERM,
+ * or to reload its content bundle on SIGHUP.
+ *
+ * @param sig the signal
+ */
+static void on_signal(int sig) {
+    if (sig == SIGTERM) {
+        stopping = 1;
+    } else if (sig == SIGHUP) {
+        reloading = 1;
+    }
+}
+
+/**
+ * Wait until the connections in flight are answered and closed,
+ * and the thread pool has no work left, or the deadline passes.
+ *
+ * @param pool the thread pool serving connections
+ * @param timeoutMs the most time to wait in milliseconds
+ * @return true if all connections closed
+ */
+static bool drain_connections(threadpool pool, long timeoutMs) {
+    static thpool_stats_t stats;
+    unsigned long long deadline = monotonicTimeNs() + (unsigned long long)timeoutMs * 1000000ULL;
+    while (true) {
+        size_t open, idle, bytes;
+        connectionUsage(&open, &idle, &bytes);
+        thpool_stats(pool, &stats, NULL, 0);
+        if ((open == 0) && (stats.queue_len == 0) && (stats.num_threads_working == 0)) {
+            return true;
+        }
+        if (monotonicTimeNs() >= deadline) {
+            fprintf(stderr, "HttpServer closing %zu connections at drain timeout\n", open);
+            return false;
+        }
+        poll(NULL, 0, 50);
+    }
+}
+
 /**
  * Main program starts the server and processes requests
  * @param argv[1]: optional port number (default: 1500)
+ * @param argv[2]: optional server properties file
  */
 int main(int argc, char* argv[argc]) {
 	int port = DEFAULT_HTTP_PORT;
+
+    // SIGTERM stops the server gracefully, and SIGHUP reloads the
+    // content bundle. They are blocked in every thread, and taken
+    // only by the accept loop
+    sigset_t serverSignals;
+    sigemptyset(&serverSignals);
+    sigaddset(&serverSignals, SIGTERM);
+    sigaddset(&serverSignals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &serverSignals, NULL);
+    struct sigaction signalAction = { .sa_handler = on_signal };
+    sigaction(SIGTERM, &signalAction, NULL);
+    sigaction(SIGHUP, &signalAction, NULL);
+
+    // read the optional server configuration
+    if (argc == 3) {
+        loadServerConfig(argv[2]);
+    }
+    CONTENT_BASE = getConfigString("content_base", CONTENT_BASE, contentBaseBuf);
     
     // populate the properties list by reading the mime.types file
-    char* pathToMimeTypeFile = "/Users/mayuribedekar/5600/assignment-5-mayurib/mime.types";
+    char mimeBuf[MAX_PROP_VAL];
+    const char* pathToMimeTypeFile =
+        getConfigString("mime_types", "/Users/mayuribedekar/5600/assignment-5-mayurib/mime.types", mimeBuf);
     readMimeTypes(pathToMimeTypeFile);
+
+    // per-request debug output is synchronous; use the access log instead
+    debug = getConfigBool("debug", true);
+
+    // structured access log written by a background thread
+    char logBuf[MAX_PROP_VAL], logFormatBuf[MAX_PROP_VAL];
+    const char *accessLog = getConfigString("access_log", NULL, logBuf);
+    if (accessLog != NULL) {
+        const char *format = getConfigString("access_log_format", "common", logFormatBuf);
+        AccessLogFormat logFormat = (strcmp(format, "json") == 0) ? ACCESS_LOG_JSON : ACCESS_LOG_COMMON;
+        if (!openAccessLog(accessLog, logFormat, (int)getConfigInt("access_log_ring", 4096))) {
+            perror(accessLog);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // binary trace of requests for bench/replay
+    char captureBuf[MAX_PROP_VAL];
+    const char *capture = getConfigString("capture", NULL, captureBuf);
+    if ((capture != NULL) && !openTrafficCapture(capture)) {
+        perror(capture);
+        return EXIT_FAILURE;
+    }
     
 
-    if (argc == 2) {
+    // each kept-alive connection holds a descriptor
+    struct rlimit nofile;
+    if ((getrlimit(RLIMIT_NOFILE, &nofile) == 0) && (nofile.rlim_cur < nofile.rlim_max)) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
+    if (argc >= 2) {
 		if ((sscanf(argv[1], "%d", &port) != 1) || (port < MIN_PORT)) {
 			fprintf(stderr, "Invalid port %s\n", argv[1]);
 			return EXIT_FAILURE;
 		}
 	}
 
-    int listen_sock_fd = get_listener_socket(port);
-	if (listen_sock_fd == 0) {
-		perror("listen_sock_fd");
-		return EXIT_FAILURE;
-	}
+    // place workers according to the affinity policy: compact,
+    // scatter, or an explicit CPU list (default: no placement)
+    char affinityBuf[MAX_PROP_VAL];
+    const char *affinity = getConfigString("affinity", "none", affinityBuf);
+    int cpus[MAX_AFFINITY_CPUS];
+    int ncpus = get_affinity_cpus(affinity, cpus, MAX_AFFINITY_CPUS);
+    if (ncpus < 0) {
+        fprintf(stderr, "Invalid affinity %s\n", affinity);
+        return EXIT_FAILURE;
+    }
+
+    // create the threadpool; each worker keeps a few I/O buffers
+    // of its own, allocated on its NUMA node after it is pinned
+    int nthreads = (int)getConfigInt("threads", THREADS);
+    threadpool thpool = thpool_init_affinity(nthreads, cpus, ncpus, sizeof(WorkerBuffers));
+
+    // record queue-wait and run time of each job
+    if (getConfigBool("thpool_stats", false)) {
+        thpool_enable_stats(thpool, 1);
+    }
+
+    // keep connections open between requests; idle connections
+    // hold only a small slab object until their next request
+    if (!initBufferPool((size_t)getConfigInt("buffer_pool_idle", 256))
+        || !initRequests(thpool, getConfigBool("keep_alive", true),
+                         (unsigned long)getConfigInt("keep_alive_requests", 0))) {
+        perror("initRequests");
+        return EXIT_FAILURE;
+    }
+
+    // report statistics at /__stats
+    initServerStats(thpool);
+    enableStatsEndpoint(getConfigBool("stats_endpoint", true));
+
+    // deadlines for each phase of a connection, in milliseconds,
+    // so stalled or trickling clients cannot hold workers forever
+    if (!initConnTimeouts((unsigned)getConfigInt("timeout_tick", 100),
+                          getConfigInt("header_timeout", 10000),
+                          getConfigInt("body_timeout", 30000),
+                          getConfigInt("idle_timeout", 5000),
+                          getConfigInt("write_timeout", 30000))) {
+        perror("initConnTimeouts");
+        return EXIT_FAILURE;
+    }
+
+    // HTTP/2 over cleartext, by prior knowledge or Upgrade: h2c,
+    // so many requests share one connection
+    if (getConfigBool("http2", true)
+        && !enableHttp2(thpool, (unsigned)getConfigInt("http2_max_streams", 100),
+                        (unsigned)getConfigInt("http2_max_sessions", 64),
+                        (unsigned long)getConfigInt("http2_window", 65535))) {
+        perror("enableHttp2");
+        return EXIT_FAILURE;
+    }
+
+    // forward URI prefixes to upstream servers (proxy_1, proxy_2, ...)
+    // over pooled persistent connections
+    char routeName[32], routeBuf[MAX_PROP_VAL], healthBuf[MAX_PROP_VAL];
+    for (int i = 1; i <= MAX_PROXY_ROUTES; i++) {
+        sprintf(routeName, "proxy_%d", i);
+        const char *route = getConfigString(routeName, NULL, routeBuf);
+        if (route == NULL) {
+            break;
+        }
+        if (!addProxyRoute(route)) {
+            perror(route);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!initProxy((unsigned)getConfigInt("proxy_pipeline", 4),
+                   (unsigned)getConfigInt("proxy_idle", 32),
+                   getConfigInt("proxy_timeout", 30000),
+                   getConfigInt("proxy_health_interval", 5000),
+                   getConfigString("proxy_health_path", "/", healthBuf))) {
+        perror("initProxy");
+        return EXIT_FAILURE;
+    }
 
-	fprintf(stderr, "HttpServer running on port %d\n", port);
+    // serve dynamic URIs (fastcgi_1, fastcgi_2, ...) from pools of
+    // long-lived FastCGI workers instead of a process per request
+    char handlerName[32], handlerBuf[MAX_PROP_VAL], socketDirBuf[MAX_PROP_VAL];
+    for (int i = 1; i <= MAX_FCGI_HANDLERS; i++) {
+        sprintf(handlerName, "fastcgi_%d", i);
+        const char *handler = getConfigString(handlerName, NULL, handlerBuf);
+        if (handler == NULL) {
+            break;
+        }
+        if (!addFcgiHandler(handler)) {
+            perror(handler);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!initFastCgi((unsigned)getConfigInt("fastcgi_workers", 2),
+                     (unsigned long)getConfigInt("fastcgi_max_requests", 0),
+                     getConfigInt("fastcgi_timeout", 30000),
+                     getConfigString("fastcgi_socket_dir", "/tmp", socketDirBuf))) {
+        perror("initFastCgi");
+        return EXIT_FAILURE;
+    }
+
+    // limit requests and pace response bytes per client, under
+    // URI prefixes (rate_limit_1, rate_limit_2, ...) and server-wide
+    char ruleName[32], ruleBuf[MAX_PROP_VAL];
+    for (int i = 1; i <= MAX_RATE_RULES; i++) {
+        sprintf(ruleName, "rate_limit_%d", i);
+        const char *rule = getConfigString(ruleName, NULL, ruleBuf);
+        if (rule == NULL) {
+            break;
+        }
+        if (!addRateRule(rule)) {
+            perror(rule);
+            return EXIT_FAILURE;
+        }
+    }
+    RateLimits clientLimits = {
+        .requests = getConfigInt("rate_limit_requests", 0),
+        .requestBurst = getConfigInt("rate_limit_request_burst", 0),
+        .bytes = getConfigInt("rate_limit_bytes", 0),
+        .byteBurst = getConfigInt("rate_limit_byte_burst", 0)
+    };
+    RateLimits globalLimits = {
+        .requests = getConfigInt("rate_limit_global_requests", 0),
+        .requestBurst = getConfigInt("rate_limit_global_request_burst", 0),
+        .bytes = getConfigInt("rate_limit_global_bytes", 0),
+        .byteBurst = getConfigInt("rate_limit_global_byte_burst", 0)
+    };
+    if (!initRateLimits((size_t)getConfigInt("rate_limit_clients", 65536), &clientLimits, &globalLimits)) {
+        perror("initRateLimits");
+        return EXIT_FAILURE;
+    }
+
+    // cache file metadata, including misses, so repeated
+    // lookups of the same paths cost no system calls
+    if (!initStatCache((size_t)getConfigInt("stat_cache", 4096),
+                       getConfigInt("stat_cache_ttl", 5000),
+                       getConfigInt("stat_cache_negative_ttl", 500),
+                       CONTENT_BASE)) {
+        perror("initStatCache");
+        return EXIT_FAILURE;
+    }
+
+    // keep cached contents in huge pages; the arena reserves twice
+    // the contents budget, for slots rounded up to their size class
+    // and runs partly used, but only the pages in use take memory
+    if (getConfigBool("file_cache_arena", false)
+        && !initCacheArena(2 * (size_t)getConfigInt("file_cache_size", 64*1024*1024),
+                           getConfigBool("file_cache_hugetlb", false))) {
+        perror("initCacheArena");
+        return EXIT_FAILURE;
+    }
+
+    // cache the headers of files, and the contents of small ones
+    if (!initFileCache((size_t)getConfigInt("file_cache", 4096),
+                       (size_t)getConfigInt("file_cache_size", 64*1024*1024),
+                       (size_t)getConfigInt("file_cache_max_file", 1024*1024))) {
+        perror("initFileCache");
+        return EXIT_FAILURE;
+    }
+
+    // entity tags from content hashes, computed on the bulk lane
+    // and kept across restarts in a sidecar file
+    char hashesBuf[MAX_PROP_VAL];
+    if (!initContentHashes((size_t)getConfigInt("content_hashes", 65536), thpool, REQUEST_LANE_BULK,
+                           (size_t)getConfigInt("content_hash_pending", 256),
+                           getConfigString("content_hash_cache", NULL, hashesBuf))) {
+        perror("initContentHashes");
+        return EXIT_FAILURE;
+    }
+
+    // cache rendered directory listings, optionally split into pages
+    if (!initDirListings((size_t)getConfigInt("dir_listing_cache", 64),
+                         (size_t)getConfigInt("dir_page_size", 0),
+                         getConfigInt("dir_listing_ttl", 5000))) {
+        perror("initDirListings");
+        return EXIT_FAILURE;
+    }
+
+    // large transfers run on their own lane with a worker budget,
+    // so small requests always find a free worker
+    long bulkThreshold = getConfigInt("bulk_threshold", 1024*1024);
+    if (bulkThreshold > 0) {
+        int bulkWorkers = (int)getConfigInt("bulk_workers", (nthreads+3)/4);
+        thpool_set_lane(thpool, REQUEST_LANE_FAST, 0, (int)getConfigInt("fast_weight", 4));
+        thpool_set_lane(thpool, REQUEST_LANE_BULK, bulkWorkers, (int)getConfigInt("bulk_weight", 1));
+        initRequestLanes(thpool, bulkThreshold);
+    }
+
+    // serve the whole site from a packed bundle instead of the
+    // content tree; SIGHUP swaps in the bundle file anew
+    char bundleBuf[MAX_PROP_VAL];
+    const char *bundleFile = getConfigString("bundle", NULL, bundleBuf);
+    if ((bundleFile != NULL) && !openContentBundle(bundleFile)) {
+        perror(bundleFile);
+        return EXIT_FAILURE;
+    }
+
+    // warm the caches before opening the listeners: scan the content
+    // tree on the pool, and load the hottest files of the last run
+    char hitsBuf[MAX_PROP_VAL];
+    const char *hitsSnapshot = getConfigString("warm_up_hits", NULL, hitsBuf);
+    if (getConfigBool("warm_up", false)) {
+        unsigned long long warmStartNs = monotonicTimeNs();
+        if (startWarmUp(thpool, REQUEST_LANE_FAST, CONTENT_BASE, hitsSnapshot,
+                        (size_t)getConfigInt("warm_up_files", 1000))) {
+            bool warm = awaitWarmUp((int)getConfigInt("warm_up_threshold", 100),
+                                    getConfigInt("warm_up_timeout", 30000));
+            size_t files, loaded, total;
+            warmUpProgress(&files, &loaded, &total);
+            fprintf(stderr, "HttpServer %s %zu files, %zu of %zu hottest loaded, in %llu ms\n",
+                    warm ? "warmed up" : "still warming up", files, loaded, total,
+                    (monotonicTimeNs() - warmStartNs) / 1000000ULL);
+        } else {
+            perror("startWarmUp");
+        }
+    }
+
+    // listener tuning: the pending connection queue, deferring the
+    // accept until the request arrives, and TCP Fast Open
+    ListenerOptions listenerOptions = {
+        .backlog = (int)getConfigInt("listen_backlog", 1024),
+        .deferAccept = (int)getConfigInt("defer_accept", 1),
+        .fastOpen = (int)getConfigInt("fast_open", 0),
+        .unixMode = (int)getConfigInt("unix_socket_mode", 0)
+    };
+
+    // take over the listeners of a running server through the
+    // handoff socket, so an upgrade refuses no connections
+    char handoffBuf[MAX_PROP_VAL];
+    const char *handoff = getConfigString("handoff_socket", NULL, handoffBuf);
+    int listen_fds[MAX_LISTENERS];
+    int nlisteners = (handoff != NULL) ? takeListeners(handoff, listen_fds, MAX_LISTENERS) : 0;
+    if (nlisteners < 0) {
+        perror(handoff);
+        return EXIT_FAILURE;
+    }
+
+    // otherwise listen on the configured listeners, or on the port dual-stack
+    char listenBuf[MAX_PROP_VAL], defaultListener[32];
+    sprintf(defaultListener, "tcp:%d", port);
+    const char *listeners = getConfigString("listen", defaultListener, listenBuf);
+    if (nlisteners > 0) {
+        fprintf(stderr, "HttpServer took over %d listeners from %s\n", nlisteners, handoff);
+    } else {
+        nlisteners = get_listener_sockets(listeners, &listenerOptions, listen_fds, MAX_LISTENERS);
+        if (nlisteners <= 0) {
+            fprintf(stderr, "No listeners in %s\n", listeners);
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "HttpServer listening on %s\n", listeners);
+    }
     
-    // create the threadpool
-    threadpool thpool = thpool_init(THREADS);
-
-	while (true) {
-        // accept client connection
-		int socket_fd = accept_peer_connection(listen_sock_fd);
-
-		if (debug) {
-			int port;
-			char host[MAXBUF];
-			if (get_peer_host_and_port(socket_fd, host, &port) != 0) {
-			    perror("get_peer_host_and_port");
-			} else {
-				fprintf(stderr, "New connection accepted  %s:%d\n", host, port);
+    // the server taken over from stops accepting once this one
+    // accepts; then offer the listeners to the next one
+    if (handoff != NULL) {
+        if (!completeHandoff(getConfigInt("handoff_timeout", 5000))) {
+            fprintf(stderr, "HttpServer: %s did not confirm the handoff\n", handoff);
+        }
+        if (!offerListeners(handoff, listen_fds, nlisteners)) {
+            perror(handoff);
+        }
+    }
+
+    // co-locate the accept loop with the first worker's NUMA node so
+    // the accept wakeup and the hand-off stay on one socket; pinned
+    // only now, so the helper threads started above do not inherit it
+    if (ncpus > 0) {
+        pin_thread_to_node(get_cpu_node(cpus[0]));
+    }
+
+    int peer_fds[ACCEPT_BATCH];
+    struct sockaddr_storage peer_addrs[ACCEPT_BATCH];
+	while (!stopping) {
+        // accept all pending client connections
+		int naccepted = accept_peer_connections(listen_fds, nlisteners, peer_fds, peer_addrs, ACCEPT_BATCH);
+		for (int i = 0; i < naccepted; i++) {
+			recordConnectionOpened();
+
+			if (debug) {
+				int port;
+				char host[HOST_ADDR_LEN];
+				if (get_host_and_port((struct sockaddr *)&peer_addrs[i], host, &port) == 0) {
+					fprintf(stderr, "New connection accepted  %s:%d\n", host, port);
+				}
 			}
+
+			// handle request
+			int arg = peer_fds[i];
+			thpool_add_work(thpool, (void*)process_request, (void *) arg);
 		}
 
-        // handle request
-        int arg = socket_fd;
-        thpool_add_work(thpool, (void*)process_request, (void *) arg);
+        // under steady load the accept loop never waits, which
+        // is when signals are delivered: take them here instead
+        if (naccepted > 0) {
+            int sig;
+            while ((sig = sigtimedwait(&serverSignals, NULL, &(struct timespec){ 0, 0 })) > 0) {
+                on_signal(sig);
+            }
+        }
+
+        // swap in the bundle file anew; requests in flight finish
+        // with the bundle they started with
+        if (reloading) {
+            reloading = 0;
+            if (!contentBundleEnabled()) {
+                fprintf(stderr, "HttpServer has no bundle to reload\n");
+            } else if (reloadContentBundle()) {
+                fprintf(stderr, "HttpServer reloaded bundle %s\n", bundleFile);
+            } else {
+                perror(bundleFile);
+            }
+        }
     }
 
-    // close listener socket
-    close(listen_sock_fd);
+    // stop accepting: connections still queued are refused, or
+    // accepted by the server that took over the listeners
+    fprintf(stderr, "HttpServer draining\n");
+    if (ncpus > 0) {
+        unpin_thread();
+    }
+    withdrawListeners();
+    for (int i = 0; i < nlisteners; i++) {
+        close(listen_fds[i]);
+    }
+
+    // answer the requests in flight, closing each connection after
+    // its response, up to the drain deadline
+    drainConnections();
+    drain_connections(thpool, getConfigInt("drain_timeout", 30000));
+    flushAccessLog();
+
+    // the files requested most, for the next warm-up
+    if ((hitsSnapshot != NULL) && !saveFileHits(hitsSnapshot)) {
+        perror(hitsSnapshot);
+    }
+    if (!saveContentHashes()) {
+        perror("saveContentHashes");
+    }
     return EXIT_SUCCESS;
 
 }
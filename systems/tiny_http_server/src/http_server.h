@@ -19,7 +19,7 @@
 static const char *CRLF = "\r\n";
 
 /** debug flag */
-extern const bool debug;
+extern bool debug;
 
 /** subdirectory of application home directory for web content */
 extern const char *CONTENT_BASE;
@@ -7,11 +7,17 @@
  *  @author: Philip Gust
  */
 
+#define _GNU_SOURCE
+
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "http_util.h"
+#include "http2.h"
 #include "properties.h"
 #include "file_util.h"
 #include "http_server.h"
+#include "server_stats.h"
 
 
 /** The default response protocol */
@@ -57,9 +63,14 @@ void readRequestHeaders(FILE *istream, Properties *requestHeaders) {
  * @param statusMsg the response message
  */
 void sendResponseStatus(FILE *ostream, int status, const char *statusMsg) {
-	fprintf(ostream, "%s %d %s %s", responseProtocol, status, statusMsg, CRLF);
+	// an HTTP/2 stream sends the status with the headers
+	bool http2 = http2SendStatus(ostream, status);
+	if (!http2) {
+		fprintf(ostream, "%s %d %s %s", responseProtocol, status, statusMsg, CRLF);
+	}
+	recordResponseStatus(status);
 	if (debug) {
-		fprintf(stderr, "%s %d %s\n", responseProtocol, status, statusMsg);
+		fprintf(stderr, "%s %d %s\n", http2 ? HTTP2_VERSION : responseProtocol, status, statusMsg);
 	}
 }
 
@@ -70,17 +81,24 @@ void sendResponseStatus(FILE *ostream, int status, const char *statusMsg) {
  * @param responseCharset the response charset
  */
 void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
+	// an HTTP/2 stream sends them as a HEADERS frame
+	bool http2 = http2SendHeaders(ostream, responseHeaders);
+
 	// output headers
 	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
 	for (int i = 0; getProperty(responseHeaders, i, name, val); i++) {
-		fprintf(ostream, "%s: %s%s", name, val, CRLF);
+		if (!http2) {
+			fprintf(ostream, "%s: %s%s", name, val, CRLF);
+		}
     	if (debug) {
     		fprintf(stderr, "%s: %s\n", name, val);
     	}
 	}
 
 	// Send a blank line to indicate the end of the header lines.
-	fprintf(ostream, "%s", CRLF);
+	if (!http2) {
+		fprintf(ostream, "%s", CRLF);
+	}
 	if (debug) {
 		fprintf(stderr, "\n");
 	}
@@ -105,7 +123,6 @@ void sendErrorResponse(FILE* ostream, int responseCode, const char *responseStr,
 	    "<br>usage:http://yourHostName:port/"
 	    "fileName.html</body></html>";
 	sprintf(errorBody, errorPage, responseCode, responseStr, responseCode, responseStr);
-	FILE *tmpStream = tmpStringFile(errorBody);
 
 	char buf[MAXBUF];
 	size_t contentLen = strlen(errorBody);
@@ -117,9 +134,119 @@ void sendErrorResponse(FILE* ostream, int responseCode, const char *responseStr,
 	// Send the headers
 	sendResponseHeaders(ostream, responseHeaders);
 
-	// Send the error page body.
-	copyFileStreamBytes(tmpStream, ostream, contentLen);
-	fclose(tmpStream);
+	// Send the error page body directly; it must not need a
+	// descriptor, since running out of them is one of the errors
+	fwrite(errorBody, 1, contentLen, ostream);
+}
+
+/**
+ * Determine whether the client can receive a chunked response,
+ * from the request version saved under "?version". HTTP/2 has
+ * no chunked encoding: its DATA frames delimit the body.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the request is HTTP/1.1
+ */
+bool acceptsChunked(Properties *requestHeaders) {
+	char version[MAX_PROP_VAL];
+	int major, minor;
+	if ((findProperty(requestHeaders, 0, "?version", version) == SIZE_MAX)
+		|| (sscanf(version, "HTTP/%d.%d", &major, &minor) != 2)) {
+		return false;
+	}
+	return (major == 1) && (minor >= 1);
+}
+
+/**
+ * Write a buffer of a body stream as one chunk. A failed write
+ * returns 0, as fopencookie(3) requires, not -1.
+ */
+static ssize_t chunkedWrite(void *cookie, const char *buf, size_t size) {
+	FILE *ostream = cookie;
+	if (size == 0) {
+		return 0;
+	}
+	if ((fprintf(ostream, "%zx%s", size, CRLF) < 0)
+		|| (fwrite(buf, 1, size, ostream) != size)
+		|| (fputs(CRLF, ostream) == EOF)) {
+		return 0;
+	}
+	return size;
+}
+
+/**
+ * Send the last chunk of a body stream.
+ */
+static int chunkedClose(void *cookie) {
+	FILE *ostream = cookie;
+	fprintf(ostream, "0%s%s", CRLF, CRLF);
+	return (fflush(ostream) == 0) ? 0 : EOF;
+}
+
+/**
+ * Pass a buffer of a body stream through, returning the bytes
+ * passed.
+ */
+static ssize_t identityWrite(void *cookie, const char *buf, size_t size) {
+	FILE *ostream = cookie;
+	return fwrite(buf, 1, size, ostream);
+}
+
+/**
+ * Flush a body stream that passes bytes through.
+ */
+static int identityClose(void *cookie) {
+	FILE *ostream = cookie;
+	return (fflush(ostream) == 0) ? 0 : EOF;
+}
+
+/**
+ * Open a stream for a response body whose length is not known in
+ * advance. If chunked, each buffer of up to CHUNK_SIZE bytes written
+ * is sent as a chunk and closing the stream sends the last chunk;
+ * otherwise bytes pass through and the body ends when the connection
+ * closes. Closing the body stream does not close ostream.
+ *
+ * @param ostream the output socket stream
+ * @param chunked true to use Transfer-Encoding: chunked
+ * @return the body stream, or NULL if error
+ */
+FILE *openBodyStream(FILE *ostream, bool chunked) {
+	cookie_io_functions_t io = {
+		.read = NULL,
+		.write = chunked ? chunkedWrite : identityWrite,
+		.seek = NULL,
+		.close = chunked ? chunkedClose : identityClose
+	};
+	FILE *body = fopencookie(ostream, "w", io);
+	if (body != NULL) {
+		setvbuf(body, NULL, _IOFBF, CHUNK_SIZE);
+	}
+	return body;
+}
+
+/**
+ * Send the status and headers of a response whose body is generated
+ * as it is sent, and open a stream for the body. The body is chunked
+ * if the client accepts it.
+ *
+ * @param ostream the output socket stream
+ * @param status the response status
+ * @param statusMsg the response message
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent true to send a body (GET), false if none (HEAD)
+ * @return the body stream to write and close, or NULL if no body
+ */
+FILE *sendStreamedResponse(FILE *ostream, int status, const char *statusMsg,
+						   Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+	bool chunked = acceptsChunked(requestHeaders);
+	if (chunked) {
+		putProperty(responseHeaders, "Transfer-Encoding", "chunked");
+	}
+	sendResponseStatus(ostream, status, statusMsg);
+	sendResponseHeaders(ostream, responseHeaders);
+	return sendContent ? openBodyStream(ostream, chunked) : NULL;
 }
 
 /**
@@ -149,13 +276,59 @@ char *unescapeUri(const char *escUri, char *uri) {
 
 /**
  * Resolves server URI to file system path.
- * @param uri the request URI
- * @param fspath the file system path
- * @return the file system path
+ * Empty and "." segments are dropped; a ".." segment is
+ * rejected rather than resolved, so the path cannot leave
+ * CONTENT_BASE. No system calls are made.
+ * @param uri the decoded request URI
+ * @param fspath the file system path (MAXBUF bytes)
+ * @return the file system path, or NULL if the URI is not
+ *   absolute, has a ".." segment, or is too long
  */
 char *resolveUri(const char *uri, char *fspath) {
-	strcpy(fspath, CONTENT_BASE);
-	strcat(fspath, uri);
+	if (uri[0] != '/') {
+		return NULL;
+	}
+	size_t len = strlen(CONTENT_BASE);
+	while ((len > 0) && (CONTENT_BASE[len-1] == '/')) {
+		len--;
+	}
+	if (len >= MAXBUF) {
+		return NULL;
+	}
+	memcpy(fspath, CONTENT_BASE, len);
+
+	// copy segments, dropping empty and "." segments and rejecting ".."
+	const char *p = uri;
+	while (*p != '\0') {
+		while (*p == '/') {
+			p++;
+		}
+		const char *seg = p;
+		while ((*p != '\0') && (*p != '/')) {
+			p++;
+		}
+		size_t segLen = p - seg;
+		if ((segLen == 0) || ((segLen == 1) && (seg[0] == '.'))) {
+			continue;
+		}
+		if ((segLen == 2) && (seg[0] == '.') && (seg[1] == '.')) {
+			return NULL;
+		}
+		if (len + 1 + segLen >= MAXBUF) {
+			return NULL;
+		}
+		fspath[len++] = '/';
+		memcpy(fspath + len, seg, segLen);
+		len += segLen;
+	}
+	// keep a trailing separator: it marks a directory request
+	if (p[-1] == '/') {
+		if (len + 1 >= MAXBUF) {
+			return NULL;
+		}
+		fspath[len++] = '/';
+	}
+	fspath[len] = '\0';
 	return fspath;
 }
 
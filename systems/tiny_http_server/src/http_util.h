@@ -10,10 +10,15 @@
 #ifndef HTTP_UTIL_H_
 #define HTTP_UTIL_H_
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <time.h>
 
 #include "properties.h"
 
+/** largest chunk sent by a chunked body stream */
+#define CHUNK_SIZE 8192
+
 /**
  * Reads request headers from request stream until empty line.
  *
@@ -52,6 +57,45 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders);
  */
 void sendErrorResponse(FILE* ostream, int responseCode, const char *responseStr, Properties *responseHeaders);
 
+/**
+ * Determine whether the client can receive a chunked response,
+ * from the request version saved under "?version". HTTP/2 has
+ * no chunked encoding: its DATA frames delimit the body.
+ *
+ * @param requestHeaders the request headers
+ * @return true if the request is HTTP/1.1
+ */
+bool acceptsChunked(Properties *requestHeaders);
+
+/**
+ * Open a stream for a response body whose length is not known in
+ * advance. If chunked, each buffer of up to CHUNK_SIZE bytes written
+ * is sent as a chunk and closing the stream sends the last chunk;
+ * otherwise bytes pass through and the body ends when the connection
+ * closes. Closing the body stream does not close ostream.
+ *
+ * @param ostream the output socket stream
+ * @param chunked true to use Transfer-Encoding: chunked
+ * @return the body stream, or NULL if error
+ */
+FILE *openBodyStream(FILE *ostream, bool chunked);
+
+/**
+ * Send the status and headers of a response whose body is generated
+ * as it is sent, and open a stream for the body. The body is chunked
+ * if the client accepts it.
+ *
+ * @param ostream the output socket stream
+ * @param status the response status
+ * @param statusMsg the response message
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent true to send a body (GET), false if none (HEAD)
+ * @return the body stream to write and close, or NULL if no body
+ */
+FILE *sendStreamedResponse(FILE *ostream, int status, const char *statusMsg,
+						   Properties *requestHeaders, Properties *responseHeaders, bool sendContent);
+
 /**
  * Unescape a URI string by replacing %xx with
  * the corresponding character code.
@@ -63,9 +107,13 @@ char *unescapeUri(const char *escUri, char *uri);
 
 /**
  * Resolves server URI to file system path.
- * @param uri the request URI
- * @param fspath the file system path
- * @return the file system path
+ * Empty and "." segments are dropped; a ".." segment is
+ * rejected rather than resolved, so the path cannot leave
+ * CONTENT_BASE. No system calls are made.
+ * @param uri the decoded request URI
+ * @param fspath the file system path (MAXBUF bytes)
+ * @return the file system path, or NULL if the URI is not
+ *   absolute, has a ".." segment, or is too long
  */
 char *resolveUri(const char *uri, char *fspath);
 
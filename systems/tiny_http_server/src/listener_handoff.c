@@ -0,0 +1,320 @@
+/*
+ * listener_handoff.c
+ *
+ * Hand the listener sockets of a running server to its successor.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "listener_handoff.h"
+#include "network_util.h"
+
+/** message of a successor that is accepting */
+#define HANDOFF_READY 'R'
+
+/** message of a server that gave up the handoff socket */
+#define HANDOFF_DONE 'D'
+
+/** the handoff socket path */
+static char handoffPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/** the handoff socket served, or -1 if none */
+static int handoffFd = -1;
+
+/** inode of the handoff socket file, to remove only our own */
+static ino_t handoffIno;
+
+/** the listener sockets offered */
+static int offeredFds[MAX_LISTENERS];
+static int nOffered;
+
+/** the listeners were given to a successor */
+static bool handedOff;
+
+/** connection to the server whose listeners were taken, or -1 if none */
+static int predecessorFd = -1;
+
+/**
+ * Set the receive timeout of a socket.
+ *
+ * @param fd the socket
+ * @param timeoutMs the timeout, or 0 for none
+ */
+static void setReceiveTimeout(int fd, long timeoutMs) {
+	struct timeval tv = { .tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Fill in the address of a handoff socket.
+ *
+ * @param path the socket path
+ * @param addr the address
+ * @return true if the path fits the address
+ */
+static bool handoffAddress(const char *path, struct sockaddr_un *addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if ((*path == '\0') || (strlen(path) >= sizeof(addr->sun_path))) {
+		errno = EINVAL;
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+/**
+ * Take the listener sockets of the server serving a handoff socket.
+ * The listeners are in the order the server opened them.
+ *
+ * @param path the handoff socket path
+ * @param listen_fds array for the listener sockets
+ * @param max the size of the array
+ * @return the number of listeners, 0 if no server serves the
+ *  socket, or -1 with errno set if the handoff failed
+ */
+int takeListeners(const char *path, int listen_fds[], int max) {
+	struct sockaddr_un addr;
+	if (!handoffAddress(path, &addr)) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		int err = errno;
+		close(fd);
+		// no socket, or one left by a server that is gone
+		if ((err == ENOENT) || (err == ECONNREFUSED)) {
+			return 0;
+		}
+		errno = err;
+		return -1;
+	}
+
+	// the number of listeners, carrying their descriptors
+	int count = 0;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+	} control;
+	struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf)
+	};
+	setReceiveTimeout(fd, 5000);
+	ssize_t n;
+	while (((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0) && (errno == EINTR)) {
+		continue;
+	}
+
+	int nfds = 0;
+	if (n > 0) {
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+				nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+				memcpy(control.buf, CMSG_DATA(cmsg), nfds * sizeof(int));
+				break;
+			}
+		}
+	}
+	int *fds = (int *)control.buf;
+	if ((n != sizeof(count)) || (count != nfds) || (nfds == 0) || (nfds > max)
+		|| ((msg.msg_flags & MSG_CTRUNC) != 0)) {
+		for (int i = 0; i < nfds; i++) {
+			close(fds[i]);
+		}
+		close(fd);
+		errno = (n < 0) ? errno : EPROTO;
+		return -1;
+	}
+	memcpy(listen_fds, fds, nfds * sizeof(int));
+	predecessorFd = fd;
+	return nfds;
+}
+
+/**
+ * Tell the server whose listeners were taken that this server is
+ * accepting, so it stops accepting and drains, and wait until it
+ * has given up the handoff socket.
+ *
+ * @param timeoutMs the most time to wait for the server
+ * @return true if the server gave up the handoff socket
+ */
+bool completeHandoff(long timeoutMs) {
+	if (predecessorFd < 0) {
+		return true;
+	}
+	char reply = 0;
+	bool done = (send(predecessorFd, &(char){ HANDOFF_READY }, 1, MSG_NOSIGNAL) == 1);
+	if (done) {
+		setReceiveTimeout(predecessorFd, timeoutMs);
+		ssize_t n;
+		while (((n = recv(predecessorFd, &reply, 1, 0)) < 0) && (errno == EINTR)) {
+			continue;
+		}
+		done = (n == 1) && (reply == HANDOFF_DONE);
+	}
+	close(predecessorFd);
+	predecessorFd = -1;
+	return done;
+}
+
+/**
+ * Give the listeners to a successor, and wait until it is
+ * accepting. Then give up the handoff socket and drain.
+ *
+ * @param fd the connection from the successor
+ * @return true if the successor took over
+ */
+static bool handOff(int fd) {
+	int count = nOffered;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct iovec iov = { .iov_base = &count, .iov_len = sizeof(count) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = CMSG_SPACE(sizeof(int) * nOffered)
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nOffered);
+	memcpy(CMSG_DATA(cmsg), offeredFds, sizeof(int) * nOffered);
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(count)) {
+		perror("handoff");
+		return false;
+	}
+
+	// both servers accept until the successor is started; one
+	// that fails before then closes the connection instead
+	char ready = 0;
+	ssize_t n;
+	while (((n = recv(fd, &ready, 1, 0)) < 0) && (errno == EINTR)) {
+		continue;
+	}
+	if ((n != 1) || (ready != HANDOFF_READY)) {
+		fprintf(stderr, "handoff: successor did not start\n");
+		return false;
+	}
+
+	// the successor serves the handoff socket from now on
+	handedOff = true;
+	close(handoffFd);
+	handoffFd = -1;
+	unlink(handoffPath);
+	send(fd, &(char){ HANDOFF_DONE }, 1, MSG_NOSIGNAL);
+	fprintf(stderr, "handoff: listeners taken over, draining\n");
+	kill(getpid(), SIGTERM);
+	return true;
+}
+
+/**
+ * Handoff thread: serves successors one at a time until
+ * one takes over.
+ */
+static void *serveHandoff(void *arg) {
+	int listen_fd = (int)(long)arg;
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED)) {
+				continue;
+			}
+			// withdrawn
+			return NULL;
+		}
+		bool done = handOff(fd);
+		close(fd);
+		if (done) {
+			return NULL;
+		}
+	}
+}
+
+/**
+ * Offer the listener sockets to a successor: serve the handoff
+ * socket on a thread of its own. When a successor that took the
+ * listeners is ready, SIGTERM is raised to drain this server.
+ *
+ * @param path the handoff socket path
+ * @param listen_fds the listener sockets
+ * @param nlisteners the number of listener sockets
+ * @return true if successful
+ */
+bool offerListeners(const char *path, const int listen_fds[], int nlisteners) {
+	struct sockaddr_un addr;
+	if (!handoffAddress(path, &addr)) {
+		return false;
+	}
+	if ((nlisteners <= 0) || (nlisteners > MAX_LISTENERS)) {
+		errno = EINVAL;
+		return false;
+	}
+	memcpy(offeredFds, listen_fds, nlisteners * sizeof(int));
+	nOffered = nlisteners;
+	strcpy(handoffPath, path);
+
+	// a socket left here was given up by the server this one
+	// took over from, or by a server that is gone
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return false;
+	}
+	unlink(path);
+	struct stat sb;
+	if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		|| (chmod(path, 0600) != 0) || (lstat(path, &sb) != 0)
+		|| (listen(fd, 1) != 0)) {
+		close(fd);
+		return false;
+	}
+	handoffIno = sb.st_ino;
+	handoffFd = fd;
+
+	pthread_t handoff;
+	if (pthread_create(&handoff, NULL, serveHandoff, (void *)(long)fd) != 0) {
+		withdrawListeners();
+		return false;
+	}
+	pthread_detach(handoff);
+	return true;
+}
+
+/**
+ * Stop offering the listener sockets, removing the handoff socket
+ * unless it was given to a successor.
+ */
+void withdrawListeners(void) {
+	if (handedOff || (handoffFd < 0)) {
+		return;
+	}
+	// wakes the handoff thread from its accept
+	shutdown(handoffFd, SHUT_RDWR);
+	struct stat sb;
+	if ((lstat(handoffPath, &sb) == 0) && (sb.st_ino == handoffIno)) {
+		unlink(handoffPath);
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * listener_handoff.h
+ *
+ * Hand the listener sockets of a running server to its successor,
+ * so the server can be upgraded without refusing a connection.
+ *
+ * A server offering its listeners serves a Unix domain handoff
+ * socket. A new server started with the same handoff socket
+ * connects to it and receives the listener descriptors (SCM_RIGHTS)
+ * instead of binding its own, then starts up while the old server
+ * keeps accepting on the same sockets. Once ready, it tells the old
+ * server, which stops accepting and drains, and takes over the
+ * handoff socket for the next upgrade. Connections waiting in the
+ * listen queue are accepted by the new server, since the queue
+ * belongs to the shared socket. If the new server fails before it
+ * is ready, the old server keeps serving.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef LISTENER_HANDOFF_H_
+#define LISTENER_HANDOFF_H_
+
+#include <stdbool.h>
+
+/**
+ * Take the listener sockets of the server serving a handoff socket.
+ * The listeners are in the order the server opened them.
+ *
+ * @param path the handoff socket path
+ * @param listen_fds array for the listener sockets
+ * @param max the size of the array
+ * @return the number of listeners, 0 if no server serves the
+ *  socket, or -1 with errno set if the handoff failed
+ */
+int takeListeners(const char *path, int listen_fds[], int max);
+
+/**
+ * Tell the server whose listeners were taken that this server is
+ * accepting, so it stops accepting and drains, and wait until it
+ * has given up the handoff socket.
+ *
+ * @param timeoutMs the most time to wait for the server
+ * @return true if the server gave up the handoff socket
+ */
+bool completeHandoff(long timeoutMs);
+
+/**
+ * Offer the listener sockets to a successor: serve the handoff
+ * socket on a thread of its own. When a successor that took the
+ * listeners is ready, SIGTERM is raised to drain this server.
+ *
+ * @param path the handoff socket path
+ * @param listen_fds the listener sockets
+ * @param nlisteners the number of listener sockets
+ * @return true if successful
+ */
+bool offerListeners(const char *path, const int listen_fds[], int nlisteners);
+
+/**
+ * Stop offering the listener sockets, removing the handoff socket
+ * unless it was given to a successor.
+ */
+void withdrawListeners(void);
+
+#endif /* LISTENER_HANDOFF_H_ */
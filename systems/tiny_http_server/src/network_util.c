@@ -7,93 +7,437 @@
  *  @author: Philip Gust
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "network_util.h"
 
 /**
- * Get listener socket
+ * Set the TCP options of a listener socket.
  *
- * @param port the port number
- * @return listener socket or 0 if unavailable
+ * @param listen_sock_fd the listen socket
+ * @param options the listener options
  */
-int get_listener_socket(int port) {
-    // Creating internet socket stream file descriptor
-    int listen_sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_sock_fd == 0) {
-        return 0;
+static void set_tcp_listener_options(int listen_sock_fd, const ListenerOptions *options) {
+#if defined(TCP_DEFER_ACCEPT)
+    // complete the accept only once the request has begun to arrive,
+    // so a worker is not woken for a connection with nothing to read
+    if (options->deferAccept > 0) {
+        int optval = options->deferAccept;
+        if (setsockopt(listen_sock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &optval, sizeof(int)) < 0) {
+            perror("TCP_DEFER_ACCEPT");
+        }
     }
+#endif
 
-    // SO_REUSEADDR prevents the "address already in use" errors
-    // that commonly come up when testing servers.
-    int optval = 1;
-    if (setsockopt(listen_sock_fd, SOL_SOCKET, SO_REUSEADDR, &optval , sizeof(int)) < 0) {
+#if defined(TCP_FASTOPEN)
+    // let returning clients send the request with the SYN
+    if (options->fastOpen > 0) {
+        int optval = options->fastOpen;
+        if (setsockopt(listen_sock_fd, IPPROTO_TCP, TCP_FASTOPEN, &optval, sizeof(int)) < 0) {
+            perror("TCP_FASTOPEN");
+        }
+    }
+#endif
+}
+
+/**
+ * Start listening on a bound socket.
+ *
+ * @param listen_sock_fd the listen socket
+ * @param options the listener options
+ * @return the listen socket, or 0 if error
+ */
+static int start_listening(int listen_sock_fd, const ListenerOptions *options) {
+    // set up queue for pending client connections; the kernel
+    // caps the length at net.core.somaxconn
+    int backlog = (options->backlog > 0) ? options->backlog : SOMAXCONN;
+    if (listen(listen_sock_fd, backlog) < 0) {
     	close(listen_sock_fd);
     	return 0;
     }
+	return listen_sock_fd;
+}
 
-    // host address and port
-    struct sockaddr_in address;
-    socklen_t addrlen = sizeof(address);
-    memset(&address, 0, addrlen);
-    address.sin_family = AF_INET;  // address from internet
-    address.sin_port = htons(port);   // port in network byte order
-    address.sin_addr.s_addr = INADDR_ANY;  // bind to any address
+/**
+ * Open a TCP listener. The address is a port, or a host and port
+ * separated by ':' with an IPv6 host in brackets. Without a host,
+ * a listener of unspecified family is dual-stack: it binds the IPv6
+ * wildcard address and accepts IPv4 clients as IPv4-mapped addresses,
+ * or binds the IPv4 wildcard if IPv6 is not available.
+ *
+ * @param address the host and port
+ * @param family AF_INET, AF_INET6, or AF_UNSPEC for either
+ * @param options the listener options
+ * @return listener socket or 0 if unavailable
+ */
+static int open_tcp_listener(const char *address, int family, const ListenerOptions *options) {
+	char host[HOST_ADDR_LEN];
+	const char *port = strrchr(address, ':');
+	bool anyHost = (port == NULL);
+	if (anyHost) {
+		port = address;
+	} else {
+		size_t len = port - address;
+		if ((len >= 2) && (address[0] == '[') && (address[len-1] == ']')) {
+			address++;	// [IPv6 address]
+			len -= 2;
+		}
+		if (len >= sizeof(host)) {
+			errno = EINVAL;
+			return 0;
+		}
+		memcpy(host, address, len);
+		host[len] = '\0';
+		port++;
+	}
 
-    // bind host address to port
-    if (bind(listen_sock_fd, (struct sockaddr *)&address, addrlen) < 0) {
-    	close(listen_sock_fd);
+	// prefer the IPv6 wildcard for a dual-stack listener
+	struct addrinfo hints = {
+		.ai_family = (anyHost && (family == AF_UNSPEC)) ? AF_INET6 : family,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE | AI_NUMERICSERV
+	};
+	struct addrinfo *addrs;
+	int status = getaddrinfo(anyHost ? NULL : host, port, &hints, &addrs);
+	if ((status != 0) && (hints.ai_family != family)) {
+		hints.ai_family = AF_INET;
+		status = getaddrinfo(NULL, port, &hints, &addrs);
+	}
+	if (status != 0) {
+		errno = (status == EAI_SYSTEM) ? errno : EINVAL;
 		return 0;
-    }
+	}
 
-    // set up queue for clients connections up to default
-    // maximum pending socket connections (usually 128)
-    if (listen(listen_sock_fd, SOMAXCONN) < 0) {
-    	close(listen_sock_fd);
-    	return 0;
-    }
+	int listen_sock_fd = 0;
+	for (struct addrinfo *ai = addrs; ai != NULL; ai = ai->ai_next) {
+	    // Creating internet socket stream file descriptor
+		int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if ((fd < 0) && (errno == EAFNOSUPPORT) && anyHost && (family == AF_UNSPEC)) {
+			// no IPv6 on this host
+			freeaddrinfo(addrs);
+			return open_tcp_listener(port, AF_INET, options);
+		}
+		if (fd < 0) {
+			continue;
+		}
 
-	return listen_sock_fd;
+	    // SO_REUSEADDR prevents the "address already in use" errors
+	    // that commonly come up when testing servers.
+	    int optval = 1;
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval , sizeof(int));
+
+	    // a dual-stack listener also accepts IPv4 clients
+	    if (ai->ai_family == AF_INET6) {
+	    	optval = (family == AF_INET6);
+	    	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(int));
+	    }
+
+	    // bind host address to port
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			listen_sock_fd = fd;
+			break;
+		}
+		close(fd);
+	}
+	freeaddrinfo(addrs);
+	if (listen_sock_fd == 0) {
+		return 0;
+	}
+
+	set_tcp_listener_options(listen_sock_fd, options);
+	return start_listening(listen_sock_fd, options);
 }
 
 /**
- * Accept new peer connection on a listen socket.
+ * Open a Unix domain listener. A socket file left by a server
+ * that is no longer running is replaced.
+ *
+ * @param address the socket path
+ * @param family AF_UNIX
+ * @param options the listener options
+ * @return listener socket or 0 if unavailable
+ */
+static int open_unix_listener(const char *address, int family, const ListenerOptions *options) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if ((*address == '\0') || (strlen(address) >= sizeof(addr.sun_path))) {
+		errno = EINVAL;
+		return 0;
+	}
+	strcpy(addr.sun_path, address);
+
+	int listen_sock_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_sock_fd < 0) {
+		return 0;
+	}
+
+	// remove a stale socket file, but not one a server still accepts on
+	struct stat sb;
+	if ((lstat(address, &sb) == 0) && S_ISSOCK(sb.st_mode)) {
+		int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		bool live = (probe_fd >= 0) && (connect(probe_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+		if (probe_fd >= 0) {
+			close(probe_fd);
+		}
+		if (live) {
+			close(listen_sock_fd);
+			errno = EADDRINUSE;
+			return 0;
+		}
+		unlink(address);
+	}
+
+	if (bind(listen_sock_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(listen_sock_fd);
+		return 0;
+	}
+	if ((options->unixMode != 0) && (chmod(address, options->unixMode) < 0)) {
+		perror(address);
+	}
+	return start_listening(listen_sock_fd, options);
+}
+
+/** A type of listener */
+typedef struct ListenerType {
+	const char *prefix;		/** prefix of the listener address */
+	int family;				/** address family */
+	int (*open)(const char *address, int family, const ListenerOptions *options);
+} ListenerType;
+
+/** listener types by address prefix */
+static const ListenerType listener_types[] = {
+	{ "tcp:", AF_UNSPEC, open_tcp_listener },
+	{ "tcp4:", AF_INET, open_tcp_listener },
+	{ "tcp6:", AF_INET6, open_tcp_listener },
+	{ "unix:", AF_UNIX, open_unix_listener },
+};
+
+/**
+ * Get listener socket. The socket is non-blocking, so pending
+ * connections can be drained in batches.
+ *
+ * The listener address is a type prefix followed by the address:
+ * "tcp:[host:]port" (dual-stack without a host), "tcp4:[host:]port",
+ * "tcp6:[host:]port" or "unix:path". A bare port is "tcp:port".
+ *
+ * @param listener the listener address
+ * @param options the listener options
+ * @return listener socket or 0 if unavailable
+ */
+int get_listener_socket(const char *listener, const ListenerOptions *options) {
+	for (size_t i = 0; i < sizeof(listener_types)/sizeof(listener_types[0]); i++) {
+		const ListenerType *type = &listener_types[i];
+		size_t len = strlen(type->prefix);
+		if (strncmp(listener, type->prefix, len) == 0) {
+			return type->open(listener + len, type->family, options);
+		}
+	}
+	return open_tcp_listener(listener, AF_UNSPEC, options);
+}
+
+/**
+ * Get listener sockets for a list of listener addresses
+ * separated by commas or spaces.
+ *
+ * @param listeners the listener addresses
+ * @param options the listener options
+ * @param listen_fds array for the listener sockets
+ * @param max the size of the array
+ * @return the number of listeners, or -1 if one is unavailable
+ */
+int get_listener_sockets(const char *listeners, const ListenerOptions *options, int listen_fds[], int max) {
+	char buf[1024];
+	if (strlen(listeners) >= sizeof(buf)) {
+		errno = EINVAL;
+		return -1;
+	}
+	strcpy(buf, listeners);
+
+	int n = 0;
+	char *save;
+	for (char *listener = strtok_r(buf, ", \t", &save); listener != NULL; listener = strtok_r(NULL, ", \t", &save)) {
+		int fd = (n < max) ? get_listener_socket(listener, options) : 0;
+		if (fd == 0) {
+			if (n >= max) {
+				errno = EMFILE;
+			}
+			perror(listener);
+			while (n > 0) {
+				close(listen_fds[--n]);
+			}
+			return -1;
+		}
+		listen_fds[n++] = fd;
+	}
+	return n;
+}
+
+/** descriptor held in reserve to shed connections when out of descriptors */
+static int spare_fd = -1;
+
+/**
+ * Accept a pending connection and close it at once, using the
+ * spare descriptor. Otherwise a connection that cannot be accepted
+ * stays pending, and the listener reports it as ready forever.
  *
  * @param listen_sock_fd the listen socket
- * @return the peer socket fd
+ * @return true if a connection was shed
+ */
+static bool shed_peer_connection(int listen_sock_fd) {
+	if (spare_fd < 0) {
+		return false;
+	}
+	close(spare_fd);
+	int peer_sock_fd = accept(listen_sock_fd, NULL, NULL);
+	if (peer_sock_fd >= 0) {
+		close(peer_sock_fd);
+	}
+	spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	return (peer_sock_fd >= 0);
+}
+
+/**
+ * Accept pending peer connections on listen sockets. Waits until
+ * at least one connection is pending, then takes up to max without
+ * waiting again. Accepted sockets are blocking, for socket streams.
+ * Signals the caller blocks are delivered while it waits, so one
+ * can end the wait.
+ *
+ * @param listen_fds the listen sockets
+ * @param nlisteners the number of listen sockets
+ * @param peer_fds array for the peer socket fds
+ * @param peer_addrs array for the peer addresses
+ * @param max the size of the arrays
+ * @return the number of connections accepted, 0 if a signal ended the wait
  */
-int accept_peer_connection(int listen_sock_fd) {
+int accept_peer_connections(const int listen_fds[], int nlisteners, int peer_fds[], struct sockaddr_storage peer_addrs[], int max) {
+	if (spare_fd < 0) {
+		spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	}
+	static bool reported = false;
+	int n = 0;
 	while (true) {
-		struct sockaddr_in peer_addr;
-		socklen_t peer_size = sizeof(peer_addr);
-		int peer_sock_fd = accept(listen_sock_fd, (struct sockaddr *)&peer_addr, &peer_size);
-		if (peer_sock_fd > 0) {
-			return peer_sock_fd;
+		for (int l = 0; l < nlisteners; l++) {
+			int listen_sock_fd = listen_fds[l];
+			while (n < max) {
+				socklen_t peer_size = sizeof(peer_addrs[n]);
+				int peer_sock_fd = accept4(listen_sock_fd, (struct sockaddr *)&peer_addrs[n], &peer_size, SOCK_CLOEXEC);
+				if (peer_sock_fd >= 0) {
+					// an unnamed Unix domain peer has only a family
+					struct sockaddr_un *un = (struct sockaddr_un *)&peer_addrs[n];
+					if ((un->sun_family == AF_UNIX) && (peer_size <= offsetof(struct sockaddr_un, sun_path))) {
+						un->sun_path[0] = '\0';
+					}
+					peer_fds[n++] = peer_sock_fd;
+					reported = false;
+					continue;
+				}
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+					break;
+				}
+				if ((errno == EINTR) || (errno == ECONNABORTED)) {
+					continue;
+				}
+				// report running out of descriptors once, not per connection
+				if (!reported) {
+					perror("accept");
+					reported = true;
+				}
+				if ((errno == EMFILE) || (errno == ENFILE)) {
+					if (!shed_peer_connection(listen_sock_fd)) {
+						poll(NULL, 0, 10);
+					}
+				}
+				break;
+			}
+		}
+		if (n > 0) {
+			return n;
 		}
-		perror("accept");
+
+		// nothing pending: wait for the next connection
+		struct pollfd pfds[MAX_LISTENERS];
+		int npfds = (nlisteners < MAX_LISTENERS) ? nlisteners : MAX_LISTENERS;
+		for (int l = 0; l < npfds; l++) {
+			pfds[l].fd = listen_fds[l];
+			pfds[l].events = POLLIN;
+		}
+		sigset_t none;
+		sigemptyset(&none);
+		if (ppoll(pfds, npfds, NULL, &none) < 0) {
+			if (errno == EINTR) {
+				return 0;
+			}
+			perror("accept");
+		}
+	}
+}
+
+/**
+ * Get the host and port of a socket address. An IPv4-mapped IPv6
+ * address is reported as the IPv4 address; a Unix domain address
+ * is reported as its path, or "unix" if unnamed, with port 0.
+ *
+ * @param addr the socket address
+ * @param addr_str buffer for address string of HOST_ADDR_LEN chars
+ * @param port pointer for port value
+ * @return 0 if successful
+ */
+int get_host_and_port(const struct sockaddr *addr, char *addr_str, int *port) {
+	if (addr->sa_family == AF_INET) {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+		*port = ntohs(in->sin_port);
+		return (inet_ntop(AF_INET, &in->sin_addr, addr_str, HOST_ADDR_LEN) != NULL) ? 0 : -1;
+	}
+	if (addr->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+		*port = ntohs(in6->sin6_port);
+		if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+			return (inet_ntop(AF_INET, &in6->sin6_addr.s6_addr[12], addr_str, HOST_ADDR_LEN) != NULL) ? 0 : -1;
+		}
+		return (inet_ntop(AF_INET6, &in6->sin6_addr, addr_str, HOST_ADDR_LEN) != NULL) ? 0 : -1;
+	}
+	if (addr->sa_family == AF_UNIX) {
+		const struct sockaddr_un *un = (const struct sockaddr_un *)addr;
+		*port = 0;
+		snprintf(addr_str, HOST_ADDR_LEN, "%s", (un->sun_path[0] != '\0') ? un->sun_path : "unix");
+		return 0;
 	}
+	errno = EAFNOSUPPORT;
+	return -1;
 }
 
 /**
  * Get the local host and port for a socket.
  *
  * @param sock_fd the socket
- * @param addr_str buffer for IP address string
+ * @param addr_str buffer for address string of HOST_ADDR_LEN chars
  * @param port pointer for port value
  * @return 0 if successful
 */
 int get_local_host_and_port(int sock_fd, char *addr_str, int *port) {
-	struct sockaddr_in addr;
+	struct sockaddr_storage addr = { 0 };
 	socklen_t size = sizeof(addr);
 
 	int status = getsockname(sock_fd, (struct sockaddr *)&addr, &size);
     if (status == 0) {
-    	*port = ntohs(addr.sin_port);
-    	strcpy(addr_str, inet_ntoa(addr.sin_addr));
+    	status = get_host_and_port((struct sockaddr *)&addr, addr_str, port);
     }
     return status;
 }
@@ -102,20 +446,79 @@ int get_local_host_and_port(int sock_fd, char *addr_str, int *port) {
  * Get the peer host and port for a socket.
  *
  * @param sock_fd the socket
- * @param addr_str buffer for IP address string
+ * @param addr_str buffer for address string of HOST_ADDR_LEN chars
  * @param port pointer for port value
  * @return 0 if successful
  */
 int get_peer_host_and_port(int sock_fd, char *addr_str, int *port) {
-	struct sockaddr_in addr;
+	struct sockaddr_storage addr = { 0 };
 	socklen_t size = sizeof(addr);
 
 	int status = getpeername(sock_fd, (struct sockaddr *)&addr, &size);
     if (status == 0) {
-    	*port = ntohs(addr.sin_port);
-    	strcpy(addr_str, inet_ntoa(addr.sin_addr));
+    	status = get_host_and_port((struct sockaddr *)&addr, addr_str, port);
     }
     return status;
 }
 
+/**
+ * Resolve the address of a server to connect to. The address has
+ * the form of a listener address with a host: "tcp:host:port",
+ * "tcp4:host:port", "tcp6:host:port" or "unix:path", with an IPv6
+ * host in brackets; "host:port" is "tcp:host:port".
+ *
+ * @param peer the server address
+ * @param addr storage for the socket address
+ * @param addr_len storage for the length of the socket address
+ * @return 0 if successful, -1 with errno set if error
+ */
+int get_peer_address(const char *peer, struct sockaddr_storage *addr, socklen_t *addr_len) {
+	memset(addr, 0, sizeof(*addr));
+	if (strncmp(peer, "unix:", 5) == 0) {
+		struct sockaddr_un *un = (struct sockaddr_un *)addr;
+		if ((peer[5] == '\0') || (strlen(peer+5) >= sizeof(un->sun_path))) {
+			errno = EINVAL;
+			return -1;
+		}
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, peer+5);
+		*addr_len = sizeof(struct sockaddr_un);
+		return 0;
+	}
+
+	int family = AF_UNSPEC;
+	for (size_t i = 0; i < sizeof(listener_types)/sizeof(listener_types[0]); i++) {
+		size_t len = strlen(listener_types[i].prefix);
+		if (strncmp(peer, listener_types[i].prefix, len) == 0) {
+			family = listener_types[i].family;
+			peer += len;
+			break;
+		}
+	}
 
+	char host[HOST_ADDR_LEN];
+	const char *port = strrchr(peer, ':');
+	size_t len = (port != NULL) ? (size_t)(port - peer) : 0;
+	if ((len >= 2) && (peer[0] == '[') && (peer[len-1] == ']')) {
+		peer++;	// [IPv6 address]
+		len -= 2;
+	}
+	if ((len == 0) || (len >= sizeof(host))) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(host, peer, len);
+	host[len] = '\0';
+
+	struct addrinfo hints = { .ai_family = family, .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV };
+	struct addrinfo *addrs;
+	int status = getaddrinfo(host, port+1, &hints, &addrs);
+	if (status != 0) {
+		errno = (status == EAI_SYSTEM) ? errno : EINVAL;
+		return -1;
+	}
+	memcpy(addr, addrs->ai_addr, addrs->ai_addrlen);
+	*addr_len = addrs->ai_addrlen;
+	freeaddrinfo(addrs);
+	return 0;
+}
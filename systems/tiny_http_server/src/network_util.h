@@ -10,27 +10,84 @@
 #ifndef NETWORK_UTIL_H_
 #define NETWORK_UTIL_H_
 
+#include <sys/socket.h>
+
+/** most connections taken per accept batch */
+#define ACCEPT_BATCH 64
+
+/** most listeners a server accepts on */
+#define MAX_LISTENERS 16
+
+/** size of a host address string, including a Unix socket path */
+#define HOST_ADDR_LEN 128
+
+/** Options for a listener socket */
+typedef struct ListenerOptions {
+	int backlog;		/** pending connection queue length, 0 for SOMAXCONN */
+	int deferAccept;	/** seconds to wait for request data before accept, 0 to disable */
+	int fastOpen;		/** TCP Fast Open queue length, 0 to disable */
+	int unixMode;		/** permissions of a Unix socket file, 0 for the umask default */
+} ListenerOptions;
+
 /**
- * Get listener socket
+ * Get listener socket. The socket is non-blocking, so pending
+ * connections can be drained in batches.
  *
- * @param port the port number
+ * The listener address is a type prefix followed by the address:
+ * "tcp:[host:]port" (dual-stack without a host), "tcp4:[host:]port",
+ * "tcp6:[host:]port" or "unix:path". A bare port is "tcp:port".
+ *
+ * @param listener the listener address
+ * @param options the listener options
  * @return listener socket or 0 if unavailable
  */
-int get_listener_socket(int port) ;
+int get_listener_socket(const char *listener, const ListenerOptions *options);
+
+/**
+ * Get listener sockets for a list of listener addresses
+ * separated by commas or spaces.
+ *
+ * @param listeners the listener addresses
+ * @param options the listener options
+ * @param listen_fds array for the listener sockets
+ * @param max the size of the array
+ * @return the number of listeners, or -1 if one is unavailable
+ */
+int get_listener_sockets(const char *listeners, const ListenerOptions *options, int listen_fds[], int max);
 
 /**
- * Accept new peer connection on a listen socket.
+ * Accept pending peer connections on listen sockets. Waits until
+ * at least one connection is pending, then takes up to max without
+ * waiting again. Accepted sockets are blocking, for socket streams.
+ * Signals the caller blocks are delivered while it waits, so one
+ * can end the wait.
  *
- * @param listen_sock_fd the listen socket
- * @return the peer socket fd
+ * @param listen_fds the listen sockets
+ * @param nlisteners the number of listen sockets
+ * @param peer_fds array for the peer socket fds
+ * @param peer_addrs array for the peer addresses
+ * @param max the size of the arrays
+ * @return the number of connections accepted, 0 if a signal ended the wait
  */
-int accept_peer_connection(int listen_sock_fd);
+int accept_peer_connections(const int listen_fds[], int nlisteners, int peer_fds[], struct sockaddr_storage peer_addrs[], int max);
+
+/**
+ * Get the host and port of a socket address. An IPv4-mapped IPv6
+ * address is reported as the IPv4 address; a Unix domain address
+ * is reported as its path, or "unix" if unnamed, with port 0.
+ *
+ * @param addr the socket address
+ * @param addr_str buffer for address string of HOST_ADDR_LEN chars
+ * @param port pointer for port value
+ * @return 0 if successful
+ */
+int get_host_and_port(const struct sockaddr *addr, char *addr_str, int *port);
 
 /**
  * Get the local host and port for a socket.
  *
  * @param sock_fd the socket
- * @param addr_str buffer for IP address string
+ * @param addr_str buffer for address string of HOST_ADDR_LEN chars
  * @param port pointer for port value
  * @return 0 if successful
 */
@@ -40,10 +97,23 @@ int get_local_host_and_port(int sock_fd, char *addr_str, int *port);
  * Get the peer host and port for a socket.
  *
  * @param sock_fd the socket
- * @param addr_str buffer for IP address string
+ * @param addr_str buffer for address string of HOST_ADDR_LEN chars
  * @param port pointer for port value
  * @return 0 if successful
  */
 int get_peer_host_and_port(int sock_fd, char *addr_str, int *port);
 
+/**
+ * Resolve the address of a server to connect to. The address has
+ * the form of a listener address with a host: "tcp:host:port",
+ * "tcp4:host:port", "tcp6:host:port" or "unix:path", with an IPv6
+ * host in brackets; "host:port" is "tcp:host:port".
+ *
+ * @param peer the server address
+ * @param addr storage for the socket address
+ * @param addr_len storage for the length of the socket address
+ * @return 0 if successful, -1 with errno set if error
+ */
+int get_peer_address(const char *peer, struct sockaddr_storage *addr, socklen_t *addr_len);
+
 #endif /* NETWORK_UTIL_H_ */
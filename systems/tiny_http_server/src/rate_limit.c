@@ -0,0 +1,389 @@
+/*
+ * rate_limit.c
+ *
+ * Per-client request rate limits and response bandwidth shaping.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "rate_limit.h"
+#include "properties.h"
+#include "time_util.h"
+
+/** slots probed for a client within its shard */
+#define RATE_PROBES 8
+
+/** time between paced sends, so no single wait is long */
+#define PACE_STEP_NS 100000000ULL
+
+/** smallest and largest paced send */
+#define MIN_PACE_CHUNK 1024
+#define MAX_PACE_CHUNK (64*1024)
+
+/**
+ * Limits of a bucket pair as arrival intervals: a bucket admits
+ * tokens while its theoretical arrival time is within the burst
+ * tolerance of now, and each token moves it on by its interval.
+ */
+typedef struct RateIntervals {
+	uint64_t requestNs;			/** interval of a request, or 0 for no limit */
+	uint64_t requestTolNs;		/** burst tolerance of requests */
+	double byteNs;				/** interval of a byte, or 0 for no limit */
+	uint64_t byteTolNs;			/** burst tolerance of bytes */
+	size_t paceChunk;			/** bytes sent per pacing step */
+} RateIntervals;
+
+/** The buckets of a client, one cache line each */
+typedef struct RateSlot {
+	uint64_t key;				/** the client and rule, or 0 if free */
+	uint64_t lastNs;			/** time of last use */
+	uint64_t requestTat;		/** theoretical arrival time of the next request */
+	uint64_t byteTat;			/** theoretical arrival time of the next byte */
+} __attribute__((aligned(64))) RateSlot;
+
+/** Limits of a URI prefix */
+typedef struct RateRule {
+	char prefix[MAX_PROP_VAL];	/** the URI prefix */
+	size_t prefixLen;			/** length of the prefix */
+	RateLimits limits;			/** limits of each client under it */
+	RateIntervals intervals;	/** the limits as intervals */
+} RateRule;
+
+/** the prefix rules */
+static RateRule rules[MAX_RATE_RULES];
+static unsigned nrules;
+
+/** limits of each client outside the prefix rules */
+static RateIntervals clientIntervals;
+
+/** limits and buckets of the server as a whole */
+static RateIntervals globalIntervals;
+static RateSlot globalSlot;
+
+/** the client table, RATE_LIMIT_SHARDS shards of shardSize slots */
+static RateSlot *slots;
+static size_t shardSize;
+
+/** limits are enforced */
+static bool rateLimitsOn;
+
+/** buckets whose byte rates pace the thread's sends */
+static __thread RateSlot *paceSlot;
+static __thread const RateIntervals *paceIntervals;
+
+/**
+ * Convert limits to bucket intervals.
+ */
+static void toIntervals(const RateLimits *limits, RateIntervals *intervals) {
+	memset(intervals, 0, sizeof(RateIntervals));
+	if (limits->requests > 0) {
+		long burst = (limits->requestBurst > 0) ? limits->requestBurst : limits->requests;
+		intervals->requestNs = 1000000000ULL / limits->requests;
+		intervals->requestTolNs = intervals->requestNs * (burst - 1);
+	}
+	if (limits->bytes > 0) {
+		long burst = (limits->byteBurst > 0) ? limits->byteBurst : limits->bytes;
+		intervals->byteNs = 1e9 / limits->bytes;
+		intervals->byteTolNs = (uint64_t)(intervals->byteNs * burst);
+		size_t chunk = (size_t)(limits->bytes * (PACE_STEP_NS / 1e9));
+		intervals->paceChunk = (chunk < MIN_PACE_CHUNK) ? MIN_PACE_CHUNK
+							 : (chunk > MAX_PACE_CHUNK) ? MAX_PACE_CHUNK : chunk;
+	}
+}
+
+/**
+ * Take tokens from a bucket, without locking: the bucket is its
+ * theoretical arrival time, moved on by compare-and-swap.
+ *
+ * @param tat the theoretical arrival time of the bucket
+ * @param now the current time
+ * @param cost the interval of the tokens
+ * @param tolerance the burst tolerance of the bucket
+ * @param wait true to take the tokens even if they do not conform yet
+ * @return nanoseconds until the tokens conform, or 0 if they do now
+ */
+static uint64_t takeTokens(uint64_t *tat, uint64_t now, uint64_t cost, uint64_t tolerance, bool wait) {
+	uint64_t old = __atomic_load_n(tat, __ATOMIC_RELAXED);
+	while (true) {
+		uint64_t base = (old > now) ? old : now;
+		uint64_t delay = (base - now > tolerance) ? base - now - tolerance : 0;
+		if ((delay > 0) && !wait) {
+			return delay;
+		}
+		if (__atomic_compare_exchange_n(tat, &old, base + cost, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			return delay;
+		}
+	}
+}
+
+/**
+ * Give back tokens taken from a bucket for a request that was
+ * refused after all. Moving the arrival time back by the cost
+ * commutes with concurrent takes, and a time left at or before
+ * now only means a full burst, as it would have been.
+ *
+ * @param tat the theoretical arrival time of the bucket
+ * @param cost the interval of the tokens
+ */
+static void refundTokens(uint64_t *tat, uint64_t cost) {
+	__atomic_sub_fetch(tat, cost, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the key of the client of a socket under a rule. An IPv6
+ * client is keyed by its /64, which one host may hold whole; all
+ * Unix domain clients share a key.
+ *
+ * @param sock_fd the client socket descriptor
+ * @param rule the rule index, or -1 for the client limits
+ * @return the key, never 0
+ */
+static uint64_t clientKey(int sock_fd, int rule) {
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	uint64_t h = 0;
+	if (getpeername(sock_fd, (struct sockaddr *)&addr, &len) == 0) {
+		if (addr.ss_family == AF_INET) {
+			h = ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+		} else if (addr.ss_family == AF_INET6) {
+			const struct in6_addr *a6 = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+			if (IN6_IS_ADDR_V4MAPPED(a6)) {
+				memcpy(&h, &a6->s6_addr[12], 4);
+			} else {
+				memcpy(&h, a6->s6_addr, 8);
+				h ^= (uint64_t)AF_INET6 << 56;
+			}
+		}
+	}
+	// mix, so keys of neighboring addresses spread over shards
+	h ^= (uint64_t)(rule + 2) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return (h != 0) ? h : 1;
+}
+
+/**
+ * Find the buckets of a client, adding them if new. Slots are
+ * claimed by compare-and-swap; when the slots probed are all taken,
+ * the least recently used client among them gives up its slot.
+ *
+ * @param key the client key
+ * @param now the current time
+ * @return the slot
+ */
+static RateSlot *findSlot(uint64_t key, uint64_t now) {
+	RateSlot *shard = slots + (key % RATE_LIMIT_SHARDS) * shardSize;
+	size_t start = (key / RATE_LIMIT_SHARDS) % shardSize;
+	RateSlot *victim = NULL;
+	uint64_t victimNs = UINT64_MAX;
+	for (size_t i = 0; i < RATE_PROBES; i++) {
+		RateSlot *slot = &shard[(start + i) % shardSize];
+		uint64_t k = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+		if ((k == 0) && __atomic_compare_exchange_n(&slot->key, &k, key, false,
+													 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&slot->lastNs, now, __ATOMIC_RELAXED);
+			return slot;
+		}
+		if (k == key) {
+			__atomic_store_n(&slot->lastNs, now, __ATOMIC_RELAXED);
+			return slot;
+		}
+		uint64_t lastNs = __atomic_load_n(&slot->lastNs, __ATOMIC_RELAXED);
+		if (lastNs < victimNs) {
+			victim = slot;
+			victimNs = lastNs;
+		}
+	}
+
+	// a replaced client starts with full buckets if it returns
+	uint64_t k = __atomic_load_n(&victim->key, __ATOMIC_ACQUIRE);
+	if (__atomic_compare_exchange_n(&victim->key, &k, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&victim->requestTat, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&victim->byteTat, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&victim->lastNs, now, __ATOMIC_RELAXED);
+	return victim;
+}
+
+/**
+ * Add limits for a URI prefix: the prefix followed by requests per
+ * second and response bytes per second, with 0 for no limit, such
+ * as "/downloads/ 10 1048576". Bursts are those of the client limits.
+ *
+ * @param rule the rule
+ * @return true if successful, false with errno set if invalid
+ */
+bool addRateRule(const char *rule) {
+	RateRule *r = &rules[nrules];
+	char prefix[MAX_PROP_VAL];
+	long requests, bytes;
+	if ((nrules == MAX_RATE_RULES) || (strlen(rule) >= sizeof(prefix))
+		|| (sscanf(rule, "%s %ld %ld", prefix, &requests, &bytes) != 3)
+		|| (prefix[0] != '/') || (requests < 0) || (bytes < 0)) {
+		errno = EINVAL;
+		return false;
+	}
+	memset(r, 0, sizeof(RateRule));
+	strcpy(r->prefix, prefix);
+	r->prefixLen = strlen(prefix);
+	r->limits.requests = requests;
+	r->limits.bytes = bytes;
+	nrules++;
+	return true;
+}
+
+/**
+ * Initialize rate limiting. Limits apply if any rate is set.
+ *
+ * @param clients the number of client buckets kept
+ * @param client the limits of each client
+ * @param global the limits of the server as a whole
+ * @return true if successful
+ */
+bool initRateLimits(size_t clients, const RateLimits *client, const RateLimits *global) {
+	toIntervals(client, &clientIntervals);
+	toIntervals(global, &globalIntervals);
+	bool limited = (client->requests > 0) || (client->bytes > 0) || (global->requests > 0) || (global->bytes > 0);
+	for (unsigned i = 0; i < nrules; i++) {
+		rules[i].limits.requestBurst = client->requestBurst;
+		rules[i].limits.byteBurst = client->byteBurst;
+		toIntervals(&rules[i].limits, &rules[i].intervals);
+		limited |= (rules[i].limits.requests > 0) || (rules[i].limits.bytes > 0);
+	}
+	if (!limited) {
+		return true;
+	}
+
+	shardSize = (clients + RATE_LIMIT_SHARDS - 1) / RATE_LIMIT_SHARDS;
+	if (shardSize < RATE_PROBES) {
+		shardSize = RATE_PROBES;
+	}
+	if (posix_memalign((void **)&slots, sizeof(RateSlot), RATE_LIMIT_SHARDS * shardSize * sizeof(RateSlot)) != 0) {
+		return false;
+	}
+	memset(slots, 0, RATE_LIMIT_SHARDS * shardSize * sizeof(RateSlot));
+	rateLimitsOn = true;
+	return true;
+}
+
+/**
+ * Admit a request by its client's and the server's request rates,
+ * and pace the response bytes the thread sends until
+ * endRequestPacing() by the client's and server's byte rates.
+ *
+ * @param sock_fd the client socket descriptor
+ * @param uri the decoded request URI
+ * @param retryAfter seconds until a refused request may be retried
+ * @return 0 if admitted, 429 if the client is over its rate,
+ *  503 if the server is over its rate
+ */
+int admitRequest(int sock_fd, const char *uri, long *retryAfter) {
+	paceSlot = NULL;
+	paceIntervals = NULL;
+	if (!rateLimitsOn) {
+		return 0;
+	}
+
+	// the longest matching prefix rule, or the client limits
+	int rule = -1;
+	for (unsigned i = 0; i < nrules; i++) {
+		if ((strncmp(uri, rules[i].prefix, rules[i].prefixLen) == 0)
+			&& ((rule < 0) || (rules[i].prefixLen > rules[rule].prefixLen))) {
+			rule = i;
+		}
+	}
+	const RateIntervals *intervals = (rule < 0) ? &clientIntervals : &rules[rule].intervals;
+
+	uint64_t now = monotonicTimeNs();
+	uint64_t delay;
+	RateSlot *slot = NULL;
+	if ((intervals->requestNs > 0) || (intervals->byteNs > 0)) {
+		slot = findSlot(clientKey(sock_fd, rule), now);
+	}
+	if ((intervals->requestNs > 0)
+		&& ((delay = takeTokens(&slot->requestTat, now, intervals->requestNs, intervals->requestTolNs, false)) > 0)) {
+		*retryAfter = (long)((delay + 999999999ULL) / 1000000000ULL);
+		return 429;
+	}
+	if ((globalIntervals.requestNs > 0)
+		&& ((delay = takeTokens(&globalSlot.requestTat, now, globalIntervals.requestNs,
+								globalIntervals.requestTolNs, false)) > 0)) {
+		// the client is not charged for a request the server refused
+		if (intervals->requestNs > 0) {
+			refundTokens(&slot->requestTat, intervals->requestNs);
+		}
+		*retryAfter = (long)((delay + 999999999ULL) / 1000000000ULL);
+		return 503;
+	}
+	if (intervals->byteNs > 0) {
+		paceSlot = slot;
+		paceIntervals = intervals;
+	}
+	return 0;
+}
+
+/**
+ * Stop pacing the bytes the thread sends.
+ */
+void endRequestPacing(void) {
+	paceSlot = NULL;
+	paceIntervals = NULL;
+}
+
+/**
+ * Wait until response bytes about to be sent by the thread
+ * conform to the rates of its request.
+ *
+ * @param len the number of bytes
+ */
+void paceResponseBytes(size_t len) {
+	if (!rateLimitsOn || (len == 0)) {
+		return;
+	}
+	uint64_t now = monotonicTimeNs();
+	uint64_t delay = 0;
+	if (paceSlot != NULL) {
+		delay = takeTokens(&paceSlot->byteTat, now, (uint64_t)(len * paceIntervals->byteNs),
+						   paceIntervals->byteTolNs, true);
+	}
+	if (globalIntervals.byteNs > 0) {
+		uint64_t globalDelay = takeTokens(&globalSlot.byteTat, now, (uint64_t)(len * globalIntervals.byteNs),
+										  globalIntervals.byteTolNs, true);
+		if (globalDelay > delay) {
+			delay = globalDelay;
+		}
+	}
+	if (delay > 0) {
+		struct timespec ts = { .tv_sec = delay / 1000000000ULL, .tv_nsec = delay % 1000000000ULL };
+		while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR)) {}
+	}
+}
+
+/**
+ * Get the most bytes to send at once while pacing, so the wait
+ * before each send stays short.
+ *
+ * @return the number of bytes, or 0 if sends are not paced
+ */
+size_t paceChunkSize(void) {
+	if (!rateLimitsOn) {
+		return 0;
+	}
+	size_t chunk = (paceSlot != NULL) ? paceIntervals->paceChunk : 0;
+	if ((globalIntervals.paceChunk > 0) && ((chunk == 0) || (globalIntervals.paceChunk < chunk))) {
+		chunk = globalIntervals.paceChunk;
+	}
+	return chunk;
+}
@@ -0,0 +1,96 @@
+/*
+ * rate_limit.h
+ *
+ * Per-client request rate limits and response bandwidth shaping.
+ *
+ * Each client address (an IPv6 client by its /64) has a token bucket
+ * for requests and one for response bytes, kept in a hash table of
+ * RATE_LIMIT_SHARDS shards. A bucket is a single theoretical arrival
+ * time updated by compare-and-swap, so taking tokens never locks.
+ * A request over its client's rate is refused with 429 and over the
+ * server's rate with 503, both with Retry-After. Response bytes over
+ * a rate are not refused but paced: the thread sending them sleeps
+ * until the bucket allows them, so a heavy downloader slows down
+ * smoothly while other clients keep their latency.
+ *
+ * URI prefixes may have limits of their own, with buckets of their
+ * own per client.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef RATE_LIMIT_H_
+#define RATE_LIMIT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** number of shards of the client table */
+#define RATE_LIMIT_SHARDS 64
+
+/** most URI prefixes with limits of their own */
+#define MAX_RATE_RULES 16
+
+/** Limits of a bucket pair (0 for no limit) */
+typedef struct RateLimits {
+	long requests;			/** requests per second */
+	long requestBurst;		/** requests allowed at once */
+	long bytes;				/** response bytes per second */
+	long byteBurst;			/** response bytes sent at once */
+} RateLimits;
+
+/**
+ * Add limits for a URI prefix: the prefix followed by requests per
+ * second and response bytes per second, with 0 for no limit, such
+ * as "/downloads/ 10 1048576". Bursts are those of the client limits.
+ *
+ * @param rule the rule
+ * @return true if successful, false with errno set if invalid
+ */
+bool addRateRule(const char *rule);
+
+/**
+ * Initialize rate limiting. Limits apply if any rate is set.
+ *
+ * @param clients the number of client buckets kept
+ * @param client the limits of each client
+ * @param global the limits of the server as a whole
+ * @return true if successful
+ */
+bool initRateLimits(size_t clients, const RateLimits *client, const RateLimits *global);
+
+/**
+ * Admit a request by its client's and the server's request rates,
+ * and pace the response bytes the thread sends until
+ * endRequestPacing() by the client's and server's byte rates.
+ *
+ * @param sock_fd the client socket descriptor
+ * @param uri the decoded request URI
+ * @param retryAfter seconds until a refused request may be retried
+ * @return 0 if admitted, 429 if the client is over its rate,
+ *  503 if the server is over its rate
+ */
+int admitRequest(int sock_fd, const char *uri, long *retryAfter);
+
+/**
+ * Stop pacing the bytes the thread sends.
+ */
+void endRequestPacing(void);
+
+/**
+ * Wait until response bytes about to be sent by the thread
+ * conform to the rates of its request.
+ *
+ * @param len the number of bytes
+ */
+void paceResponseBytes(size_t len);
+
+/**
+ * Get the most bytes to send at once while pacing, so the wait
+ * before each send stays short.
+ *
+ * @return the number of bytes, or 0 if sends are not paced
+ */
+size_t paceChunkSize(void);
+
+#endif /* RATE_LIMIT_H_ */
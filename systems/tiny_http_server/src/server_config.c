@@ -0,0 +1,97 @@
+/*
+ * server_config.c
+ *
+ * Functions for reading server configuration properties.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include "properties.h"
+#include "server_config.h"
+
+/** the configuration properties */
+static Properties *config;
+
+/**
+ * Load server configuration from a properties file.
+ * A missing file leaves all settings at their defaults.
+ *
+ * @param configFile the properties file
+ * @return number of properties read
+ */
+int loadServerConfig(const char *configFile) {
+	if (config == NULL) {
+		config = newProperties();
+	}
+	return loadProperties(configFile, config);
+}
+
+/**
+ * Get a string configuration value.
+ *
+ * @param name the property name
+ * @param defaultVal value returned if the property is not set
+ * @param val storage for the value (at least MAX_PROP_VAL bytes)
+ * @return val, or defaultVal if the property is not set
+ */
+const char *getConfigString(const char *name, const char *defaultVal, char *val) {
+	if ((config == NULL) || (findProperty(config, 0, name, val) == SIZE_MAX)) {
+		return defaultVal;
+	}
+
+	// loadProperties() keeps the line terminator: trim trailing whitespace
+	size_t len = strlen(val);
+	while ((len > 0) && isspace((unsigned char)val[len-1])) {
+		val[--len] = '\0';
+	}
+	return val;
+}
+
+/**
+ * Get an integer configuration value.
+ *
+ * @param name the property name
+ * @param defaultVal value returned if the property is not set or invalid
+ * @return the value
+ */
+long getConfigInt(const char *name, long defaultVal) {
+	char buf[MAX_PROP_VAL];
+	const char *val = getConfigString(name, NULL, buf);
+	if (val == NULL) {
+		return defaultVal;
+	}
+	char *end;
+	long n = strtol(val, &end, 0);
+	return ((end == val) || (*end != '\0')) ? defaultVal : n;
+}
+
+/**
+ * Get a boolean configuration value. Accepts true/false,
+ * yes/no, on/off and 1/0.
+ *
+ * @param name the property name
+ * @param defaultVal value returned if the property is not set or invalid
+ * @return the value
+ */
+bool getConfigBool(const char *name, bool defaultVal) {
+	char buf[MAX_PROP_VAL];
+	const char *val = getConfigString(name, NULL, buf);
+	if (val == NULL) {
+		return defaultVal;
+	}
+	if ((strcasecmp(val, "true") == 0) || (strcasecmp(val, "yes") == 0)
+		|| (strcasecmp(val, "on") == 0) || (strcmp(val, "1") == 0)) {
+		return true;
+	}
+	if ((strcasecmp(val, "false") == 0) || (strcasecmp(val, "no") == 0)
+		|| (strcasecmp(val, "off") == 0) || (strcmp(val, "0") == 0)) {
+		return false;
+	}
+	return defaultVal;
+}
@@ -0,0 +1,56 @@
+/*
+ * server_config.h
+ *
+ * Functions for reading server configuration properties.
+ *
+ * The configuration is a properties file of name=value lines
+ * loaded once at startup; it is read-only after that, so the
+ * accessors may be called from any thread.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SERVER_CONFIG_H_
+#define SERVER_CONFIG_H_
+
+#include <stdbool.h>
+
+/**
+ * Load server configuration from a properties file.
+ * A missing file leaves all settings at their defaults.
+ *
+ * @param configFile the properties file
+ * @return number of properties read
+ */
+int loadServerConfig(const char *configFile);
+
+/**
+ * Get a string configuration value.
+ *
+ * @param name the property name
+ * @param defaultVal value returned if the property is not set
+ * @param val storage for the value (at least MAX_PROP_VAL bytes)
+ * @return val, or defaultVal if the property is not set
+ */
+const char *getConfigString(const char *name, const char *defaultVal, char *val);
+
+/**
+ * Get an integer configuration value.
+ *
+ * @param name the property name
+ * @param defaultVal value returned if the property is not set or invalid
+ * @return the value
+ */
+long getConfigInt(const char *name, long defaultVal);
+
+/**
+ * Get a boolean configuration value. Accepts true/false,
+ * yes/no, on/off and 1/0.
+ *
+ * @param name the property name
+ * @param defaultVal value returned if the property is not set or invalid
+ * @return the value
+ */
+bool getConfigBool(const char *name, bool defaultVal);
+
+#endif /* SERVER_CONFIG_H_ */
@@ -0,0 +1,525 @@
+/*
+ * server_stats.c
+ *
+ * Functions for collecting and reporting server statistics.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "http_server.h"
+#include "http_util.h"
+#include "histogram.h"
+#include "server_stats.h"
+#include "access_log.h"
+#include "buffer_pool.h"
+#include "cache_arena.h"
+#include "connection.h"
+
+/** maximum number of threads with statistics slots */
+#define MAX_STATS_THREADS 1024
+
+/** request methods counted separately */
+static const char *statsMethods[] = { "GET", "HEAD", "PUT", "POST", "DELETE", "OTHER" };
+#define STATS_METHODS (sizeof(statsMethods) / sizeof(statsMethods[0]))
+
+/** lowest and number of response status codes counted */
+#define STATS_MIN_STATUS 100
+#define STATS_STATUSES 500
+
+/** Statistics slot of one thread; only that thread writes it */
+typedef struct ThreadStats {
+	uint64_t requests[STATS_METHODS][STATS_STATUSES];	/** requests by method and status */
+	uint64_t bytesIn;						/** bytes received */
+	uint64_t bytesOut;						/** bytes sent */
+	uint64_t connectionsOpened;				/** connections accepted */
+	uint64_t connectionsClosed;				/** connections closed */
+	uint64_t timeouts[TIMEOUT_KINDS];		/** connections timed out by phase */
+	uint64_t cacheHits[MAX_STATS_CACHES];	/** cache hits by cache */
+	uint64_t cacheMisses[MAX_STATS_CACHES];	/** cache misses by cache */
+	uint64_t cacheCoalesced[MAX_STATS_CACHES];	/** misses that waited for another load */
+	histogram latency;						/** request time in ns */
+} ThreadStats;
+
+/** slots of all threads that recorded statistics */
+static ThreadStats *statsSlots[MAX_STATS_THREADS];
+static int nStatsSlots;
+static pthread_mutex_t statsSlotsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** slot of the calling thread */
+static __thread ThreadStats *myStats;
+
+/** status of the request running on the calling thread */
+static __thread int myStatus;
+
+/** registered cache names */
+static const char *statsCaches[MAX_STATS_CACHES];
+static int nStatsCaches;
+
+/** the request thread pool */
+static threadpool statsPool;
+
+/**
+ * Get the slot of the calling thread, creating it on first use.
+ * Only this step takes a lock, once per thread.
+ *
+ * @return the slot, or NULL if none available
+ */
+static ThreadStats *getThreadStats(void) {
+	if (myStats == NULL) {
+		ThreadStats *ts = calloc(1, sizeof(ThreadStats));
+		if (ts == NULL) {
+			return NULL;
+		}
+		pthread_mutex_lock(&statsSlotsLock);
+		if (nStatsSlots < MAX_STATS_THREADS) {
+			__atomic_store_n(&statsSlots[nStatsSlots], ts, __ATOMIC_RELEASE);
+			__atomic_store_n(&nStatsSlots, nStatsSlots+1, __ATOMIC_RELEASE);
+			myStats = ts;
+		} else {
+			free(ts);
+		}
+		pthread_mutex_unlock(&statsSlotsLock);
+	}
+	return myStats;
+}
+
+/**
+ * Add to a counter that only the calling thread writes.
+ */
+static inline void statsAdd(uint64_t *counter, uint64_t n) {
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Read a counter written by another thread.
+ */
+static inline uint64_t statsGet(const uint64_t *counter) {
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Initialize statistics reporting.
+ *
+ * @param pool the request thread pool, whose statistics are also reported
+ */
+void initServerStats(threadpool pool) {
+	statsPool = pool;
+}
+
+/**
+ * Register a cache whose hit rate is reported.
+ *
+ * @param name the cache name
+ * @return the cache id, or -1 if too many caches
+ */
+int registerStatsCache(const char *name) {
+	if (nStatsCaches >= MAX_STATS_CACHES) {
+		return -1;
+	}
+	statsCaches[nStatsCaches] = name;
+	return nStatsCaches++;
+}
+
+/**
+ * Record a cache lookup.
+ *
+ * @param cache the cache id
+ * @param hit true if the lookup was a hit
+ */
+void recordCacheLookup(int cache, bool hit) {
+	ThreadStats *ts = getThreadStats();
+	if ((ts != NULL) && (cache >= 0) && (cache < MAX_STATS_CACHES)) {
+		statsAdd(hit ? &ts->cacheHits[cache] : &ts->cacheMisses[cache], 1);
+	}
+}
+
+/**
+ * Record a cache miss that waited for the load of another
+ * request instead of loading itself.
+ *
+ * @param cache the cache id
+ */
+void recordCacheCoalesced(int cache) {
+	ThreadStats *ts = getThreadStats();
+	if ((ts != NULL) && (cache >= 0) && (cache < MAX_STATS_CACHES)) {
+		statsAdd(&ts->cacheCoalesced[cache], 1);
+	}
+}
+
+/**
+ * Record that a connection was accepted.
+ */
+void recordConnectionOpened(void) {
+	ThreadStats *ts = getThreadStats();
+	if (ts != NULL) {
+		statsAdd(&ts->connectionsOpened, 1);
+	}
+}
+
+/**
+ * Record that a connection was closed.
+ */
+void recordConnectionClosed(void) {
+	ThreadStats *ts = getThreadStats();
+	if (ts != NULL) {
+		statsAdd(&ts->connectionsClosed, 1);
+	}
+}
+
+/**
+ * Record that a connection was closed because a deadline passed.
+ *
+ * @param kind the phase that timed out
+ */
+void recordTimeout(TimeoutKind kind) {
+	ThreadStats *ts = getThreadStats();
+	if ((ts != NULL) && (kind > TIMEOUT_NONE) && (kind < TIMEOUT_KINDS)) {
+		statsAdd(&ts->timeouts[kind], 1);
+	}
+}
+
+/**
+ * Record the response status of the request running on this thread.
+ *
+ * @param status the response status
+ */
+void recordResponseStatus(int status) {
+	myStatus = status;
+}
+
+/**
+ * Get the response status last recorded on this thread.
+ *
+ * @return the response status, or 0 if none
+ */
+int getResponseStatus(void) {
+	return myStatus;
+}
+
+/**
+ * Record a completed request with the status last recorded on
+ * this thread by recordResponseStatus().
+ *
+ * @param method the request method
+ * @param bytesIn bytes received for the request
+ * @param bytesOut bytes sent for the request
+ * @param durationNs time to process the request in nanoseconds
+ */
+void recordRequest(const char *method, unsigned long long bytesIn,
+				   unsigned long long bytesOut, unsigned long long durationNs) {
+	ThreadStats *ts = getThreadStats();
+	if (ts == NULL) {
+		return;
+	}
+	size_t m = STATS_METHODS - 1;
+	for (size_t i = 0; i < STATS_METHODS - 1; i++) {
+		if (strcasecmp(method, statsMethods[i]) == 0) {
+			m = i;
+			break;
+		}
+	}
+	int status = myStatus - STATS_MIN_STATUS;
+	if ((status >= 0) && (status < STATS_STATUSES)) {
+		statsAdd(&ts->requests[m][status], 1);
+	}
+	statsAdd(&ts->bytesIn, bytesIn);
+	statsAdd(&ts->bytesOut, bytesOut);
+	hist_record(&ts->latency, durationNs);
+	myStatus = 0;
+}
+
+/**
+ * Merge the slots of all threads.
+ *
+ * @param total the merged statistics (zeroed by caller)
+ */
+static void mergeThreadStats(ThreadStats *total) {
+	int n = __atomic_load_n(&nStatsSlots, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < n; i++) {
+		ThreadStats *ts = __atomic_load_n(&statsSlots[i], __ATOMIC_ACQUIRE);
+		for (size_t m = 0; m < STATS_METHODS; m++) {
+			for (int s = 0; s < STATS_STATUSES; s++) {
+				total->requests[m][s] += statsGet(&ts->requests[m][s]);
+			}
+		}
+		total->bytesIn += statsGet(&ts->bytesIn);
+		total->bytesOut += statsGet(&ts->bytesOut);
+		total->connectionsOpened += statsGet(&ts->connectionsOpened);
+		total->connectionsClosed += statsGet(&ts->connectionsClosed);
+		for (int k = 0; k < TIMEOUT_KINDS; k++) {
+			total->timeouts[k] += statsGet(&ts->timeouts[k]);
+		}
+		for (int c = 0; c < MAX_STATS_CACHES; c++) {
+			total->cacheHits[c] += statsGet(&ts->cacheHits[c]);
+			total->cacheMisses[c] += statsGet(&ts->cacheMisses[c]);
+			total->cacheCoalesced[c] += statsGet(&ts->cacheCoalesced[c]);
+		}
+		hist_merge(&total->latency, &ts->latency);
+	}
+}
+
+/** percentiles reported for histograms */
+static const double statsQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+#define STATS_QUANTILES (sizeof(statsQuantiles) / sizeof(statsQuantiles[0]))
+
+/**
+ * Write a histogram of nanoseconds as a Prometheus summary in seconds.
+ */
+static void writePrometheusSummary(FILE *out, const char *name, const char *help, const histogram *hist) {
+	fprintf(out, "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+	for (size_t q = 0; q < STATS_QUANTILES; q++) {
+		fprintf(out, "%s{quantile=\"%g\"} %.9f\n", name, statsQuantiles[q],
+				hist_percentile(hist, statsQuantiles[q] * 100.0) / 1e9);
+	}
+	fprintf(out, "%s_sum %.9f\n%s_count %llu\n", name, hist->sum / 1e9,
+			name, (unsigned long long)hist->total);
+}
+
+/**
+ * Write the statistics in Prometheus text format.
+ */
+static void writePrometheus(FILE *out, const ThreadStats *total, const thpool_stats_t *pool) {
+	fprintf(out, "# HELP http_requests_total Requests by method and status.\n"
+				 "# TYPE http_requests_total counter\n");
+	for (size_t m = 0; m < STATS_METHODS; m++) {
+		for (int s = 0; s < STATS_STATUSES; s++) {
+			if (total->requests[m][s] != 0) {
+				fprintf(out, "http_requests_total{method=\"%s\",status=\"%d\"} %llu\n",
+						statsMethods[m], s + STATS_MIN_STATUS,
+						(unsigned long long)total->requests[m][s]);
+			}
+		}
+	}
+	fprintf(out, "# HELP http_received_bytes_total Bytes received.\n"
+				 "# TYPE http_received_bytes_total counter\n"
+				 "http_received_bytes_total %llu\n",
+				 (unsigned long long)total->bytesIn);
+	fprintf(out, "# HELP http_sent_bytes_total Bytes sent.\n"
+				 "# TYPE http_sent_bytes_total counter\n"
+				 "http_sent_bytes_total %llu\n",
+				 (unsigned long long)total->bytesOut);
+	fprintf(out, "# HELP http_connections_total Connections accepted.\n"
+				 "# TYPE http_connections_total counter\n"
+				 "http_connections_total %llu\n",
+				 (unsigned long long)total->connectionsOpened);
+	fprintf(out, "# HELP http_active_connections Connections open now.\n"
+				 "# TYPE http_active_connections gauge\n"
+				 "http_active_connections %lld\n",
+				 (long long)(total->connectionsOpened - total->connectionsClosed));
+	size_t open, idle, connBytes, borrowed, spare;
+	connectionUsage(&open, &idle, &connBytes);
+	bufferPoolUsage(&borrowed, &spare);
+	fprintf(out, "# HELP http_idle_connections Kept-alive connections waiting for a request.\n"
+				 "# TYPE http_idle_connections gauge\n"
+				 "http_idle_connections %zu\n", idle);
+	fprintf(out, "# HELP http_connection_memory_bytes Memory reserved for connections and their buffers.\n"
+				 "# TYPE http_connection_memory_bytes gauge\n"
+				 "http_connection_memory_bytes{kind=\"connections\"} %zu\n"
+				 "http_connection_memory_bytes{kind=\"buffers\"} %zu\n",
+				 connBytes, (borrowed + spare) * POOL_BUFFER_SIZE);
+	fprintf(out, "# HELP http_timeouts_total Connections closed by a deadline, by phase.\n"
+				 "# TYPE http_timeouts_total counter\n");
+	for (int k = TIMEOUT_NONE + 1; k < TIMEOUT_KINDS; k++) {
+		fprintf(out, "http_timeouts_total{phase=\"%s\"} %llu\n",
+				timeoutKindName(k), (unsigned long long)total->timeouts[k]);
+	}
+	if (nStatsCaches > 0) {
+		fprintf(out, "# HELP http_cache_lookups_total Cache lookups by cache and result.\n"
+					 "# TYPE http_cache_lookups_total counter\n");
+		for (int c = 0; c < nStatsCaches; c++) {
+			fprintf(out, "http_cache_lookups_total{cache=\"%s\",result=\"hit\"} %llu\n"
+						 "http_cache_lookups_total{cache=\"%s\",result=\"miss\"} %llu\n",
+						 statsCaches[c], (unsigned long long)total->cacheHits[c],
+						 statsCaches[c], (unsigned long long)total->cacheMisses[c]);
+		}
+		fprintf(out, "# HELP http_cache_coalesced_total Cache misses that waited for the load of another request.\n"
+					 "# TYPE http_cache_coalesced_total counter\n");
+		for (int c = 0; c < nStatsCaches; c++) {
+			fprintf(out, "http_cache_coalesced_total{cache=\"%s\"} %llu\n",
+					statsCaches[c], (unsigned long long)total->cacheCoalesced[c]);
+		}
+	}
+	if (cacheArenaEnabled()) {
+		ArenaUsage arena;
+		cacheArenaUsage(&arena);
+		fprintf(out, "# HELP http_cache_arena_bytes Cache arena memory by kind; huge is resident in huge pages.\n"
+					 "# TYPE http_cache_arena_bytes gauge\n"
+					 "http_cache_arena_bytes{kind=\"reserved\"} %zu\n"
+					 "http_cache_arena_bytes{kind=\"pages\"} %zu\n"
+					 "http_cache_arena_bytes{kind=\"allocated\"} %zu\n"
+					 "http_cache_arena_bytes{kind=\"requested\"} %zu\n"
+					 "http_cache_arena_bytes{kind=\"resident\"} %zu\n"
+					 "http_cache_arena_bytes{kind=\"huge\"} %zu\n",
+					 arena.reserved, arena.pages, arena.allocated, arena.requested,
+					 arena.resident, arena.huge);
+		fprintf(out, "# HELP http_cache_arena_fallbacks_total Cache allocations the arena could not hold.\n"
+					 "# TYPE http_cache_arena_fallbacks_total counter\n"
+					 "http_cache_arena_fallbacks_total %lu\n", arena.fallbacks);
+	}
+	writePrometheusSummary(out, "http_request_duration_seconds",
+						   "Time to process a request.", &total->latency);
+	if (accessLogEnabled()) {
+		fprintf(out, "# HELP http_access_log_dropped_total Access log records dropped.\n"
+					 "# TYPE http_access_log_dropped_total counter\n"
+					 "http_access_log_dropped_total %llu\n", accessLogDropped());
+	}
+
+	if (pool != NULL) {
+		fprintf(out, "# HELP thpool_threads Worker threads.\n# TYPE thpool_threads gauge\n"
+					 "thpool_threads %d\n", pool->num_threads);
+		fprintf(out, "# HELP thpool_threads_working Workers running a job.\n# TYPE thpool_threads_working gauge\n"
+					 "thpool_threads_working %d\n", pool->num_threads_working);
+		fprintf(out, "# HELP thpool_queue_length Jobs queued.\n# TYPE thpool_queue_length gauge\n"
+					 "thpool_queue_length %d\n", pool->queue_len);
+		fprintf(out, "# HELP thpool_queue_length_max Most jobs ever queued.\n# TYPE thpool_queue_length_max gauge\n"
+					 "thpool_queue_length_max %d\n", pool->max_queue_len);
+		fprintf(out, "# HELP thpool_busy_seconds_total Worker time running jobs.\n# TYPE thpool_busy_seconds_total counter\n"
+					 "thpool_busy_seconds_total %.9f\n", pool->total.busy_ns / 1e9);
+		fprintf(out, "# HELP thpool_idle_seconds_total Worker time waiting for jobs.\n# TYPE thpool_idle_seconds_total counter\n"
+					 "thpool_idle_seconds_total %.9f\n", pool->total.idle_ns / 1e9);
+		writePrometheusSummary(out, "thpool_job_wait_seconds", "Time a job waited in the queue.", &pool->wait);
+		writePrometheusSummary(out, "thpool_job_run_seconds", "Time a job ran.", &pool->run);
+	}
+}
+
+/**
+ * Write a histogram of nanoseconds as a JSON object in seconds.
+ */
+static void writeJsonSummary(FILE *out, const histogram *hist) {
+	fprintf(out, "{\"count\": %llu, \"mean\": %.9f", (unsigned long long)hist->total, hist_mean(hist) / 1e9);
+	for (size_t q = 0; q < STATS_QUANTILES; q++) {
+		fprintf(out, ", \"p%g\": %.9f", statsQuantiles[q] * 100.0,
+				hist_percentile(hist, statsQuantiles[q] * 100.0) / 1e9);
+	}
+	fprintf(out, ", \"max\": %.9f}", hist->max / 1e9);
+}
+
+/**
+ * Write the statistics as JSON.
+ */
+static void writeJson(FILE *out, const ThreadStats *total, const thpool_stats_t *pool) {
+	fprintf(out, "{\n  \"requests\": [");
+	const char *sep = "";
+	for (size_t m = 0; m < STATS_METHODS; m++) {
+		for (int s = 0; s < STATS_STATUSES; s++) {
+			if (total->requests[m][s] != 0) {
+				fprintf(out, "%s\n    {\"method\": \"%s\", \"status\": %d, \"count\": %llu}",
+						sep, statsMethods[m], s + STATS_MIN_STATUS,
+						(unsigned long long)total->requests[m][s]);
+				sep = ",";
+			}
+		}
+	}
+	fprintf(out, "\n  ],\n");
+	fprintf(out, "  \"bytes_in\": %llu,\n  \"bytes_out\": %llu,\n",
+			(unsigned long long)total->bytesIn, (unsigned long long)total->bytesOut);
+	fprintf(out, "  \"connections\": %llu,\n  \"active_connections\": %lld,\n",
+			(unsigned long long)total->connectionsOpened,
+			(long long)(total->connectionsOpened - total->connectionsClosed));
+	size_t open, idle, connBytes, borrowed, spare;
+	connectionUsage(&open, &idle, &connBytes);
+	bufferPoolUsage(&borrowed, &spare);
+	fprintf(out, "  \"idle_connections\": %zu,\n"
+			"  \"connection_memory_bytes\": {\"connections\": %zu, \"buffers\": %zu},\n",
+			idle, connBytes, (borrowed + spare) * POOL_BUFFER_SIZE);
+	fprintf(out, "  \"timeouts\": {");
+	for (int k = TIMEOUT_NONE + 1; k < TIMEOUT_KINDS; k++) {
+		fprintf(out, "%s\"%s\": %llu", (k > TIMEOUT_NONE + 1) ? ", " : "",
+				timeoutKindName(k), (unsigned long long)total->timeouts[k]);
+	}
+	fprintf(out, "},\n");
+	fprintf(out, "  \"caches\": {");
+	for (int c = 0; c < nStatsCaches; c++) {
+		uint64_t lookups = total->cacheHits[c] + total->cacheMisses[c];
+		fprintf(out, "%s\n    \"%s\": {\"hits\": %llu, \"misses\": %llu, \"coalesced\": %llu, \"hit_rate\": %.4f}",
+				(c > 0) ? "," : "", statsCaches[c],
+				(unsigned long long)total->cacheHits[c], (unsigned long long)total->cacheMisses[c],
+				(unsigned long long)total->cacheCoalesced[c],
+				(lookups == 0) ? 0.0 : (double)total->cacheHits[c] / lookups);
+	}
+	fprintf(out, "%s},\n", (nStatsCaches > 0) ? "\n  " : "");
+	if (cacheArenaEnabled()) {
+		// fragmentation is the share of the pages in runs not holding
+		// requested bytes; coverage the share of resident bytes in
+		// huge pages
+		ArenaUsage arena;
+		cacheArenaUsage(&arena);
+		fprintf(out, "  \"cache_arena\": {\"hugetlb\": %s, \"reserved\": %zu, \"pages\": %zu, "
+					 "\"allocated\": %zu, \"requested\": %zu, \"resident\": %zu, \"huge\": %zu, "
+					 "\"fallbacks\": %lu,\n    \"fragmentation\": %.4f, \"huge_page_coverage\": %.4f},\n",
+				arena.hugetlb ? "true" : "false", arena.reserved, arena.pages,
+				arena.allocated, arena.requested, arena.resident, arena.huge, arena.fallbacks,
+				(arena.pages == 0) ? 0.0 : 1.0 - (double)arena.requested / arena.pages,
+				(arena.resident == 0) ? 0.0 : (double)arena.huge / arena.resident);
+	}
+	fprintf(out, "  \"latency_seconds\": ");
+	writeJsonSummary(out, &total->latency);
+	if (accessLogEnabled()) {
+		fprintf(out, ",\n  \"access_log_dropped\": %llu", accessLogDropped());
+	}
+	if (pool != NULL) {
+		fprintf(out, ",\n  \"thpool\": {\"threads\": %d, \"working\": %d, \"queue_length\": %d, "
+					 "\"queue_length_max\": %d, \"jobs\": %llu, \"busy_seconds\": %.9f, "
+					 "\"idle_seconds\": %.9f,\n    \"wait_seconds\": ",
+				pool->num_threads, pool->num_threads_working, pool->queue_len,
+				pool->max_queue_len, pool->total.jobs,
+				pool->total.busy_ns / 1e9, pool->total.idle_ns / 1e9);
+		writeJsonSummary(out, &pool->wait);
+		fprintf(out, ",\n    \"run_seconds\": ");
+		writeJsonSummary(out, &pool->run);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n}\n");
+}
+
+/**
+ * Send the statistics in Prometheus text format, or as JSON if
+ * the query is "format=json" or the client accepts application/json.
+ *
+ * @param stream the socket stream
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void sendStatsResponse(FILE *stream, Properties *requestHeaders, Properties *responseHeaders) {
+	char buf[MAX_PROP_VAL];
+	bool json = false;
+	if (findProperty(requestHeaders, 0, "?", buf) != SIZE_MAX) {
+		json = (strstr(buf, "format=json") != NULL);
+	} else if (findProperty(requestHeaders, 0, "Accept", buf) != SIZE_MAX) {
+		json = (strstr(buf, "application/json") != NULL);
+	}
+
+	ThreadStats *total = calloc(1, sizeof(ThreadStats));
+	thpool_stats_t *pool = (statsPool != NULL) ? calloc(1, sizeof(thpool_stats_t)) : NULL;
+	if ((total == NULL) || ((statsPool != NULL) && (pool == NULL))) {
+		free(total);
+		free(pool);
+		sendErrorResponse(stream, 500, "Internal Server Error", responseHeaders);
+		return;
+	}
+	mergeThreadStats(total);
+	if (pool != NULL) {
+		thpool_stats(statsPool, pool, NULL, 0);
+	}
+
+	putProperty(responseHeaders, "Content-type",
+				json ? "application/json" : "text/plain; version=0.0.4");
+	putProperty(responseHeaders, "Cache-Control", "no-store");
+	FILE *out = sendStreamedResponse(stream, 200, "OK", requestHeaders, responseHeaders, true);
+	if (out != NULL) {
+		if (json) {
+			writeJson(out, total, pool);
+		} else {
+			writePrometheus(out, total, pool);
+		}
+		fclose(out);
+	}
+	free(total);
+	free(pool);
+}
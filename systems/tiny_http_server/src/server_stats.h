@@ -0,0 +1,114 @@
+/*
+ * server_stats.h
+ *
+ * Functions for collecting and reporting server statistics.
+ *
+ * Each thread counts into its own slot, so recording never takes a
+ * shared lock. The slots are merged only when the statistics are
+ * read through the /__stats endpoint.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SERVER_STATS_H_
+#define SERVER_STATS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "conn_timeout.h"
+#include "properties.h"
+#include "thpool.h"
+
+/** URI of the statistics endpoint */
+#define STATS_URI "/__stats"
+
+/** maximum number of caches that report lookups */
+#define MAX_STATS_CACHES 8
+
+/**
+ * Initialize statistics reporting.
+ *
+ * @param pool the request thread pool, whose statistics are also reported
+ */
+void initServerStats(threadpool pool);
+
+/**
+ * Register a cache whose hit rate is reported.
+ * Call once per cache at startup.
+ *
+ * @param name the cache name
+ * @return the cache id, or -1 if too many caches
+ */
+int registerStatsCache(const char *name);
+
+/**
+ * Record a cache lookup.
+ *
+ * @param cache the cache id
+ * @param hit true if the lookup was a hit
+ */
+void recordCacheLookup(int cache, bool hit);
+
+/**
+ * Record a cache miss that waited for the load of another
+ * request instead of loading itself.
+ *
+ * @param cache the cache id
+ */
+void recordCacheCoalesced(int cache);
+
+/**
+ * Record that a connection was accepted.
+ */
+void recordConnectionOpened(void);
+
+/**
+ * Record that a connection was closed.
+ */
+void recordConnectionClosed(void);
+
+/**
+ * Record that a connection was closed because a deadline passed.
+ *
+ * @param kind the phase that timed out
+ */
+void recordTimeout(TimeoutKind kind);
+
+/**
+ * Record the response status of the request running on this thread.
+ *
+ * @param status the response status
+ */
+void recordResponseStatus(int status);
+
+/**
+ * Get the response status last recorded on this thread.
+ *
+ * @return the response status, or 0 if none
+ */
+int getResponseStatus(void);
+
+/**
+ * Record a completed request with the status last recorded on
+ * this thread by recordResponseStatus().
+ *
+ * @param method the request method
+ * @param bytesIn bytes received for the request
+ * @param bytesOut bytes sent for the request
+ * @param durationNs time to process the request in nanoseconds
+ */
+void recordRequest(const char *method, unsigned long long bytesIn,
+				   unsigned long long bytesOut, unsigned long long durationNs);
+
+/**
+ * Send the statistics in Prometheus text format, or as JSON if
+ * the query is "format=json" or the client accepts application/json.
+ *
+ * @param stream the socket stream
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ */
+void sendStatsResponse(FILE *stream, Properties *requestHeaders, Properties *responseHeaders);
+
+#endif /* SERVER_STATS_H_ */
@@ -0,0 +1,129 @@
+/*
+ * single_flight.c
+ *
+ * Coalescing of concurrent cache misses on the same key.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <string.h>
+
+#include "single_flight.h"
+
+/**
+ * Hash a key with 64-bit FNV-1a.
+ */
+static uint64_t hashKey(const char *key, size_t len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)key[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/**
+ * Find the flight of a key. The caller holds the lock.
+ *
+ * @return the flight, or NULL if none
+ */
+static Flight *findFlight(FlightGroup *group, const char *key, size_t len, uint64_t hash) {
+	for (Flight *f = group->flights; f != NULL; f = f->next) {
+		if ((f->hash == hash) && (f->len == len) && (memcmp(f->key, key, len) == 0)) {
+			return f;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Determine whether a flight is still in the air. The caller
+ * holds the lock.
+ */
+static bool inFlight(FlightGroup *group, uint64_t id) {
+	for (Flight *f = group->flights; f != NULL; f = f->next) {
+		if (f->id == id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Initialize a group.
+ *
+ * @param group the group
+ * @return true if successful
+ */
+bool initFlightGroup(FlightGroup *group) {
+	group->flights = NULL;
+	group->nextId = 0;
+	group->waiting = 0;
+	if (pthread_mutex_init(&group->lock, NULL) != 0) {
+		return false;
+	}
+	if (pthread_cond_init(&group->landed, NULL) != 0) {
+		pthread_mutex_destroy(&group->lock);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Board the flight of a key after a cache miss. If no load of the
+ * key is in flight, the caller leads a new one: it loads the value
+ * and then lands the flight with landFlight(). Otherwise the caller
+ * waits until the flight in progress lands.
+ *
+ * @param group the group
+ * @param key the key
+ * @param len the length of the key
+ * @param flight the flight the caller leads, kept until it lands
+ * @return true if the caller leads, or false after waiting
+ *  for the flight of another caller
+ */
+bool boardFlight(FlightGroup *group, const char *key, size_t len, Flight *flight) {
+	uint64_t hash = hashKey(key, len);
+	pthread_mutex_lock(&group->lock);
+	Flight *leading = findFlight(group, key, len, hash);
+	if (leading == NULL) {
+		flight->id = group->nextId++;
+		flight->hash = hash;
+		flight->key = key;
+		flight->len = len;
+		flight->next = group->flights;
+		group->flights = flight;
+		pthread_mutex_unlock(&group->lock);
+		return true;
+	}
+
+	// by id: the flight of the leader is gone once it lands
+	uint64_t id = leading->id;
+	group->waiting++;
+	while (inFlight(group, id)) {
+		pthread_cond_wait(&group->landed, &group->lock);
+	}
+	group->waiting--;
+	pthread_mutex_unlock(&group->lock);
+	return false;
+}
+
+/**
+ * Land a flight led by the caller, once its value is in the
+ * cache or failed to load, waking the callers waiting for it.
+ *
+ * @param group the group
+ * @param flight the flight
+ */
+void landFlight(FlightGroup *group, Flight *flight) {
+	pthread_mutex_lock(&group->lock);
+	for (Flight **link = &group->flights; *link != NULL; link = &(*link)->next) {
+		if (*link == flight) {
+			*link = flight->next;
+			break;
+		}
+	}
+	if (group->waiting > 0) {
+		pthread_cond_broadcast(&group->landed);
+	}
+	pthread_mutex_unlock(&group->lock);
+}
@@ -0,0 +1,82 @@
+/*
+ * single_flight.h
+ *
+ * Coalescing of concurrent cache misses on the same key.
+ *
+ * The first request to miss a key boards a flight for it and loads
+ * the value; requests missing the same key meanwhile board the same
+ * flight and wait until it lands, then find the value in the cache
+ * instead of loading it again. A hot key that expires or changes is
+ * then loaded once rather than once per waiting request.
+ *
+ * A flight holds no value: the leader stores what it loaded in its
+ * cache as usual, and the waiters look it up there. A waiter that
+ * still misses, because the leader failed or did not cache the
+ * value, loads the value itself without boarding again, so waiting
+ * is bounded by one load.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SINGLE_FLIGHT_H_
+#define SINGLE_FLIGHT_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** A load in flight, held by its leader */
+typedef struct Flight {
+	struct Flight *next;		/** next flight of the group */
+	uint64_t id;				/** unique within the group */
+	uint64_t hash;				/** hash of the key */
+	const char *key;			/** the key */
+	size_t len;					/** length of the key */
+} Flight;
+
+/** The loads in flight of a cache, or of a shard of one */
+typedef struct FlightGroup {
+	pthread_mutex_t lock;		/** guards the group */
+	pthread_cond_t landed;		/** signaled as flights land */
+	Flight *flights;			/** the flights */
+	uint64_t nextId;			/** id of the next flight */
+	size_t waiting;				/** callers waiting for flights */
+} FlightGroup;
+
+/** static initializer of a group */
+#define FLIGHT_GROUP_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0 }
+
+/**
+ * Initialize a group.
+ *
+ * @param group the group
+ * @return true if successful
+ */
+bool initFlightGroup(FlightGroup *group);
+
+/**
+ * Board the flight of a key after a cache miss. If no load of the
+ * key is in flight, the caller leads a new one: it loads the value
+ * and then lands the flight with landFlight(). Otherwise the caller
+ * waits until the flight in progress lands.
+ *
+ * @param group the group
+ * @param key the key
+ * @param len the length of the key
+ * @param flight the flight the caller leads, kept until it lands
+ * @return true if the caller leads, or false after waiting
+ *  for the flight of another caller
+ */
+bool boardFlight(FlightGroup *group, const char *key, size_t len, Flight *flight);
+
+/**
+ * Land a flight led by the caller, once its value is in the
+ * cache or failed to load, waking the callers waiting for it.
+ *
+ * @param group the group
+ * @param flight the flight
+ */
+void landFlight(FlightGroup *group, Flight *flight);
+
+#endif /* SINGLE_FLIGHT_H_ */
@@ -0,0 +1,154 @@
+/*
+ * slab.c
+ *
+ * Allocator for many objects of one size.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+/** A free object, linked through its first bytes */
+typedef struct FreeObject {
+	struct FreeObject *next;
+} FreeObject;
+
+/** A chunk of objects */
+typedef struct SlabChunk {
+	struct SlabChunk *next;		/** next chunk */
+	max_align_t objects[];		/** the objects */
+} SlabChunk;
+
+/** A slab of objects */
+struct Slab {
+	pthread_mutex_t lock;		/** guards the slab */
+	size_t objectSize;			/** size of an object, rounded for alignment */
+	size_t objectsPerChunk;		/** objects per chunk */
+	SlabChunk *chunks;			/** the chunks */
+	size_t nchunks;				/** number of chunks */
+	FreeObject *free;			/** free objects */
+	size_t inUse;				/** objects allocated */
+};
+
+/**
+ * Create a slab.
+ *
+ * @param objectSize the size of an object
+ * @param objectsPerChunk the number of objects allocated together
+ * @return the slab, or NULL if error
+ */
+Slab *newSlab(size_t objectSize, size_t objectsPerChunk) {
+	if ((objectSize == 0) || (objectsPerChunk == 0)) {
+		return NULL;
+	}
+	Slab *slab = calloc(1, sizeof(Slab));
+	if (slab == NULL) {
+		return NULL;
+	}
+	size_t align = sizeof(max_align_t);
+	if (objectSize < sizeof(FreeObject)) {
+		objectSize = sizeof(FreeObject);
+	}
+	slab->objectSize = (objectSize + align - 1) / align * align;
+	slab->objectsPerChunk = objectsPerChunk;
+	pthread_mutex_init(&slab->lock, NULL);
+	return slab;
+}
+
+/**
+ * Delete a slab and every object in it.
+ *
+ * @param slab the slab
+ */
+void deleteSlab(Slab *slab) {
+	while (slab->chunks != NULL) {
+		SlabChunk *chunk = slab->chunks;
+		slab->chunks = chunk->next;
+		free(chunk);
+	}
+	pthread_mutex_destroy(&slab->lock);
+	free(slab);
+}
+
+/**
+ * Add a chunk of free objects. Called with the lock held.
+ *
+ * @return true if successful
+ */
+static bool addChunk(Slab *slab) {
+	SlabChunk *chunk = malloc(sizeof(SlabChunk) + slab->objectSize * slab->objectsPerChunk);
+	if (chunk == NULL) {
+		return false;
+	}
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+	slab->nchunks++;
+
+	// link objects so the first in the chunk is handed out first
+	char *objects = (char *)chunk->objects;
+	for (size_t i = slab->objectsPerChunk; i-- > 0; ) {
+		FreeObject *obj = (FreeObject *)(objects + i * slab->objectSize);
+		obj->next = slab->free;
+		slab->free = obj;
+	}
+	return true;
+}
+
+/**
+ * Allocate a zeroed object.
+ *
+ * @param slab the slab
+ * @return the object, or NULL if out of memory
+ */
+void *slabAlloc(Slab *slab) {
+	pthread_mutex_lock(&slab->lock);
+	if ((slab->free == NULL) && !addChunk(slab)) {
+		pthread_mutex_unlock(&slab->lock);
+		return NULL;
+	}
+	FreeObject *obj = slab->free;
+	slab->free = obj->next;
+	slab->inUse++;
+	pthread_mutex_unlock(&slab->lock);
+
+	memset(obj, 0, slab->objectSize);
+	return obj;
+}
+
+/**
+ * Release an object to its slab.
+ *
+ * @param slab the slab
+ * @param object the object from slabAlloc()
+ */
+void slabFree(Slab *slab, void *object) {
+	if (object == NULL) {
+		return;
+	}
+	FreeObject *obj = object;
+	pthread_mutex_lock(&slab->lock);
+	obj->next = slab->free;
+	slab->free = obj;
+	slab->inUse--;
+	pthread_mutex_unlock(&slab->lock);
+}
+
+/**
+ * Get the usage of a slab.
+ *
+ * @param slab the slab
+ * @param inUse the number of objects allocated
+ * @param bytes the bytes of memory reserved by the slab
+ */
+void slabUsage(Slab *slab, size_t *inUse, size_t *bytes) {
+	pthread_mutex_lock(&slab->lock);
+	*inUse = slab->inUse;
+	*bytes = slab->nchunks * (sizeof(SlabChunk) + slab->objectSize * slab->objectsPerChunk);
+	pthread_mutex_unlock(&slab->lock);
+}
@@ -0,0 +1,63 @@
+/*
+ * slab.h
+ *
+ * Allocator for many objects of one size.
+ *
+ * Objects are carved from large chunks and recycled through a free
+ * list, so each costs its own size plus no allocator header, and
+ * allocation and release are a few instructions under a lock. Chunks
+ * are kept for reuse and released only when the slab is deleted.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stddef.h>
+
+/** A slab of objects */
+typedef struct Slab Slab;
+
+/**
+ * Create a slab.
+ *
+ * @param objectSize the size of an object
+ * @param objectsPerChunk the number of objects allocated together
+ * @return the slab, or NULL if error
+ */
+Slab *newSlab(size_t objectSize, size_t objectsPerChunk);
+
+/**
+ * Delete a slab and every object in it.
+ *
+ * @param slab the slab
+ */
+void deleteSlab(Slab *slab);
+
+/**
+ * Allocate a zeroed object.
+ *
+ * @param slab the slab
+ * @return the object, or NULL if out of memory
+ */
+void *slabAlloc(Slab *slab);
+
+/**
+ * Release an object to its slab.
+ *
+ * @param slab the slab
+ * @param object the object from slabAlloc()
+ */
+void slabFree(Slab *slab, void *object);
+
+/**
+ * Get the usage of a slab.
+ *
+ * @param slab the slab
+ * @param inUse the number of objects allocated
+ * @param bytes the bytes of memory reserved by the slab
+ */
+void slabUsage(Slab *slab, size_t *inUse, size_t *bytes);
+
+#endif /* SLAB_H_ */
@@ -0,0 +1,271 @@
+/*
+ * socket_stream.c
+ *
+ * Functions for opening C FILE streams on sockets.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "socket_stream.h"
+#include "rate_limit.h"
+
+// MacOS has no MSG_NOSIGNAL: SIGPIPE is disabled per socket instead
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+/** State of a socket stream */
+typedef struct SocketCookie {
+	int sock_fd;				/** the socket */
+	SocketCounters *counters;	/** byte counts */
+	ConnTimeout *timeout;		/** deadline of the connection, or NULL */
+	SocketFraming *framing;		/** read limits, or NULL */
+} SocketCookie;
+
+/**
+ * Start reading a request: reads stop at the blank line that
+ * ends the request headers.
+ *
+ * @param framing the read limits of the stream
+ */
+void frameRequestHeaders(SocketFraming *framing) {
+	framing->headers = true;
+	framing->eolState = 0;
+	framing->remaining = 0;
+}
+
+/**
+ * Continue with the request body: reads stop after its length,
+ * and then return end of file.
+ *
+ * @param framing the read limits of the stream
+ * @param length the body length
+ */
+void frameRequestBody(SocketFraming *framing, unsigned long long length) {
+	framing->headers = false;
+	framing->remaining = length;
+}
+
+/**
+ * Find the end of the headers in bytes peeked from the socket.
+ * A line end is LF or CRLF, and the headers end at an empty line.
+ *
+ * @return the length through the end of the headers, or 0 if not found
+ */
+static size_t findHeadersEnd(SocketFraming *framing, const char *buf, size_t len) {
+	int state = framing->eolState;  // 0: in a line, 1: after LF, 2: after LF CR
+	for (size_t i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			if (state != 0) {
+				framing->eolState = 0;
+				return i + 1;
+			}
+			state = 1;
+		} else if ((buf[i] == '\r') && (state == 1)) {
+			state = 2;
+		} else {
+			state = 0;
+		}
+	}
+	framing->eolState = state;
+	return 0;
+}
+
+/**
+ * Read from the socket.
+ */
+static ssize_t socketRead(void *cookie, char *buf, size_t size) {
+	SocketCookie *sc = cookie;
+	SocketFraming *framing = sc->framing;
+	ssize_t n;
+	if ((framing != NULL) && framing->headers) {
+		// peek, then take only through the end of the headers
+		do {
+			n = recv(sc->sock_fd, buf, size, MSG_PEEK);
+		} while ((n < 0) && (errno == EINTR));
+		if (n > 0) {
+			int eolState = framing->eolState;
+			size_t end = findHeadersEnd(framing, buf, n);
+			if (end > 0) {
+				framing->headers = false;
+				n = end;
+			}
+			do {
+				n = recv(sc->sock_fd, buf, n, 0);
+			} while ((n < 0) && (errno == EINTR));
+			if ((n > 0) && (end > 0) && ((size_t)n < end)) {
+				// fewer bytes than peeked: rescan what was taken
+				framing->headers = true;
+				framing->eolState = eolState;
+				findHeadersEnd(framing, buf, n);
+			}
+		}
+	} else {
+		if (framing != NULL) {
+			if (framing->remaining == 0) {
+				return 0;
+			}
+			if (size > framing->remaining) {
+				size = framing->remaining;
+			}
+		}
+		do {
+			n = recv(sc->sock_fd, buf, size, 0);
+		} while ((n < 0) && (errno == EINTR));
+		if ((n > 0) && (framing != NULL)) {
+			framing->remaining -= n;
+		}
+	}
+	if (n > 0) {
+		sc->counters->bytesIn += n;
+		if (sc->timeout != NULL) {
+			connReadProgress(sc->timeout);
+		}
+	}
+	return n;
+}
+
+/**
+ * Write all bytes to the socket. A peer that has gone away
+ * makes the write fail rather than raising SIGPIPE; a failed
+ * write returns the bytes sent before it, never -1, which
+ * stdio would take as a count. The write-stall deadline
+ * restarts whenever bytes go out. Under a byte rate limit the
+ * bytes go out in paced pieces.
+ */
+static ssize_t socketWrite(void *cookie, const char *buf, size_t size) {
+	SocketCookie *sc = cookie;
+	size_t chunk = paceChunkSize();
+	size_t sent = 0;
+	while (sent < size) {
+		size_t len = size - sent;
+		if (chunk > 0) {
+			if (len > chunk) {
+				len = chunk;
+			}
+			paceResponseBytes(len);
+		}
+		if (sc->timeout != NULL) {
+			connWriteProgress(sc->timeout);
+		}
+		ssize_t n = send(sc->sock_fd, buf + sent, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		sent += n;
+	}
+	sc->counters->bytesOut += sent;
+	return sent;
+}
+
+/**
+ * Release the stream state; the socket stays open.
+ */
+static int socketClose(void *cookie) {
+	free(cookie);
+	return 0;
+}
+
+#if defined(__linux__)
+
+/**
+ * Open a read/write stream on a socket.
+ *
+ * @param sock_fd the socket descriptor
+ * @param counters storage for byte counts (must outlive the stream)
+ * @param timeout deadline re-armed as bytes move, or NULL
+ * @param framing read limits (must outlive the stream), or NULL for none
+ * @return the stream, or NULL with errno set if error
+ */
+FILE *openSocketStream(int sock_fd, SocketCounters *counters, ConnTimeout *timeout,
+					   SocketFraming *framing) {
+	SocketCookie *sc = malloc(sizeof(SocketCookie));
+	if (sc == NULL) {
+		return NULL;
+	}
+	sc->sock_fd = sock_fd;
+	sc->counters = counters;
+	sc->timeout = timeout;
+	sc->framing = framing;
+
+	cookie_io_functions_t io = {
+		.read = socketRead,
+		.write = socketWrite,
+		.seek = NULL,
+		.close = socketClose
+	};
+	FILE *stream = fopencookie(sc, "r+", io);
+	if (stream == NULL) {
+		free(sc);
+	}
+	return stream;
+}
+
+#else
+
+static int socketReadBsd(void *cookie, char *buf, int size) {
+	return (int)socketRead(cookie, buf, (size_t)size);
+}
+
+static int socketWriteBsd(void *cookie, const char *buf, int size) {
+	return (int)socketWrite(cookie, buf, (size_t)size);
+}
+
+/**
+ * Open a read/write stream on a socket.
+ *
+ * @param sock_fd the socket descriptor
+ * @param counters storage for byte counts (must outlive the stream)
+ * @param timeout deadline re-armed as bytes move, or NULL
+ * @param framing read limits (must outlive the stream), or NULL for none
+ * @return the stream, or NULL with errno set if error
+ */
+FILE *openSocketStream(int sock_fd, SocketCounters *counters, ConnTimeout *timeout,
+					   SocketFraming *framing) {
+	SocketCookie *sc = malloc(sizeof(SocketCookie));
+	if (sc == NULL) {
+		return NULL;
+	}
+	sc->sock_fd = sock_fd;
+	sc->counters = counters;
+	sc->timeout = timeout;
+	sc->framing = framing;
+
+#if defined(SO_NOSIGPIPE)
+	int optval = 1;
+	setsockopt(sock_fd, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof(optval));
+#endif
+
+	FILE *stream = funopen(sc, socketReadBsd, socketWriteBsd, NULL, socketClose);
+	if (stream == NULL) {
+		free(sc);
+	}
+	return stream;
+}
+
+#endif
+
+/**
+ * Determine without blocking whether a socket has input waiting,
+ * such as a pipelined request.
+ *
+ * @param sock_fd the socket descriptor
+ * @return true if input is waiting
+ */
+bool socketHasInput(int sock_fd) {
+	char c;
+	return recv(sock_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
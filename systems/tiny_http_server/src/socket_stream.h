@@ -0,0 +1,80 @@
+/*
+ * socket_stream.h
+ *
+ * Functions for opening C FILE streams on sockets.
+ *
+ * A socket stream reads and writes its socket directly and counts
+ * the bytes transferred, and keeps the connection's deadline moving
+ * while a body or response transfer makes progress. Closing the
+ * stream does not close the socket, so the owner of the socket
+ * decides when it is closed.
+ *
+ * A stream with framing never reads past the request it is on: the
+ * headers end at the blank line and the body after its length, so a
+ * pipelined request stays in the socket. This matters because stdio
+ * cannot switch a read/write stream from reading to writing while
+ * unread input is buffered.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef SOCKET_STREAM_H_
+#define SOCKET_STREAM_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "conn_timeout.h"
+
+/** Byte counts of a socket stream */
+typedef struct SocketCounters {
+	unsigned long long bytesIn;		/** bytes received */
+	unsigned long long bytesOut;	/** bytes sent */
+} SocketCounters;
+
+/** What a framed socket stream may read next */
+typedef struct SocketFraming {
+	bool headers;					/** reading up to the end of the headers */
+	int eolState;					/** progress through the blank line */
+	unsigned long long remaining;	/** body bytes left to read */
+} SocketFraming;
+
+/**
+ * Open a read/write stream on a socket.
+ *
+ * @param sock_fd the socket descriptor
+ * @param counters storage for byte counts (must outlive the stream)
+ * @param timeout deadline re-armed as bytes move, or NULL
+ * @param framing read limits (must outlive the stream), or NULL for none
+ * @return the stream, or NULL with errno set if error
+ */
+FILE *openSocketStream(int sock_fd, SocketCounters *counters, ConnTimeout *timeout,
+					   SocketFraming *framing);
+
+/**
+ * Start reading a request: reads stop at the blank line that
+ * ends the request headers.
+ *
+ * @param framing the read limits of the stream
+ */
+void frameRequestHeaders(SocketFraming *framing);
+
+/**
+ * Continue with the request body: reads stop after its length,
+ * and then return end of file.
+ *
+ * @param framing the read limits of the stream
+ * @param length the body length
+ */
+void frameRequestBody(SocketFraming *framing, unsigned long long length);
+
+/**
+ * Determine without blocking whether a socket has input waiting,
+ * such as a pipelined request.
+ *
+ * @param sock_fd the socket descriptor
+ * @return true if input is waiting
+ */
+bool socketHasInput(int sock_fd);
+
+#endif /* SOCKET_STREAM_H_ */
@@ -0,0 +1,516 @@
+/*
+ * stat_cache.c
+ *
+ * Cache of file metadata by path.
+ *
+ *  @since 2026-10-19
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "stat_cache.h"
+#include "server_stats.h"
+#include "single_flight.h"
+#include "time_util.h"
+
+/** A cached stat result */
+typedef struct StatEntry {
+	struct StatEntry *chain;			/** next entry in the hash bucket */
+	struct StatEntry *newer, *older;	/** LRU list links */
+	uint64_t hash;						/** hash of the path */
+	unsigned long long expiresNs;		/** monotonic time the entry expires */
+	int error;							/** errno of a missing path, or 0 */
+	struct stat sb;						/** the metadata if found */
+	char path[];						/** the path */
+} StatEntry;
+
+/** One independently locked part of the cache */
+typedef struct StatShard {
+	pthread_mutex_t lock;		/** guards the shard */
+	StatEntry **buckets;		/** hash buckets */
+	size_t mask;				/** number of buckets - 1 */
+	size_t count;				/** number of entries */
+	size_t capacity;			/** maximum number of entries */
+	StatEntry lru;				/** list head: lru.older is newest, lru.newer oldest */
+	uint64_t generation;		/** bumped by every invalidation */
+	FlightGroup flights;		/** stats of missed paths in progress */
+	char pad[64];				/** keep shard locks on separate cache lines */
+} StatShard;
+
+/** the shards, or NULL if the cache is disabled */
+static StatShard *statShards;
+
+/** lifetimes of entries in nanoseconds */
+static unsigned long long statTtlNs, statNegativeTtlNs;
+
+/** cache id for statistics */
+static int statCacheId = -1;
+
+/**
+ * Hash a path with FNV-1a.
+ */
+static uint64_t hashPath(const char *path, size_t len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)path[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/**
+ * Length of a path without trailing separators.
+ */
+static size_t keyLength(const char *path) {
+	size_t len = strlen(path);
+	while ((len > 1) && (path[len-1] == '/')) {
+		len--;
+	}
+	return len;
+}
+
+/**
+ * Unlink an entry from the LRU list.
+ */
+static void lruUnlink(StatEntry *e) {
+	e->newer->older = e->older;
+	e->older->newer = e->newer;
+}
+
+/**
+ * Link an entry at the newest end of the LRU list.
+ */
+static void lruPushNewest(StatShard *shard, StatEntry *e) {
+	e->older = shard->lru.older;
+	e->newer = &shard->lru;
+	shard->lru.older->newer = e;
+	shard->lru.older = e;
+}
+
+/**
+ * Find the bucket link that points to an entry for a path.
+ *
+ * @return the link; *link is NULL if not found
+ */
+static StatEntry **findEntry(StatShard *shard, const char *path, size_t len, uint64_t hash) {
+	StatEntry **link = &shard->buckets[(hash >> 4) & shard->mask];
+	while (*link != NULL) {
+		StatEntry *e = *link;
+		if ((e->hash == hash) && (strncmp(e->path, path, len) == 0) && (e->path[len] == '\0')) {
+			break;
+		}
+		link = &e->chain;
+	}
+	return link;
+}
+
+/**
+ * Remove and free the entry a bucket link points to.
+ */
+static void removeEntry(StatShard *shard, StatEntry **link) {
+	StatEntry *e = *link;
+	*link = e->chain;
+	lruUnlink(e);
+	shard->count--;
+	free(e);
+}
+
+/**
+ * Drop the entry of one path, if cached.
+ */
+static void invalidatePath(const char *path, size_t len) {
+	uint64_t hash = hashPath(path, len);
+	StatShard *shard = &statShards[hash & (STAT_CACHE_SHARDS - 1)];
+	pthread_mutex_lock(&shard->lock);
+	shard->generation++;
+	StatEntry **link = findEntry(shard, path, len, hash);
+	if (*link != NULL) {
+		removeEntry(shard, link);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Drop the entries of a path with and without a trailing
+ * separator. Paths are cached exactly as asked for, and stat()
+ * of "file/" fails where stat() of "file" does not.
+ *
+ * @param path the path
+ * @param len the length of the path without trailing separators
+ */
+static void invalidatePathForms(const char *path, size_t len) {
+	invalidatePath(path, len);
+	char dirPath[PATH_MAX];
+	if (len + 1 < sizeof(dirPath)) {
+		memcpy(dirPath, path, len);
+		dirPath[len] = '/';
+		invalidatePath(dirPath, len + 1);
+	}
+}
+
+/**
+ * Drop every entry.
+ */
+static void invalidateAll(void) {
+	for (int s = 0; s < STAT_CACHE_SHARDS; s++) {
+		StatShard *shard = &statShards[s];
+		pthread_mutex_lock(&shard->lock);
+		shard->generation++;
+		for (size_t b = 0; b <= shard->mask; b++) {
+			while (shard->buckets[b] != NULL) {
+				removeEntry(shard, &shard->buckets[b]);
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/**
+ * Look up the cached metadata of a path, dropping an expired entry.
+ *
+ * @param shard the shard of the path
+ * @param path the path
+ * @param len the length of the path key
+ * @param hash the hash of the path key
+ * @param sb the metadata if found
+ * @param rc the result of stat(), with errno set, if cached
+ * @return true if cached
+ */
+static bool lookupStat(StatShard *shard, const char *path, size_t len, uint64_t hash, struct stat *sb, int *rc) {
+	unsigned long long now = monotonicTimeNs();
+	pthread_mutex_lock(&shard->lock);
+	StatEntry **link = findEntry(shard, path, len, hash);
+	if (*link != NULL) {
+		StatEntry *e = *link;
+		if (now < e->expiresNs) {
+			int error = e->error;
+			if (error == 0) {
+				*sb = e->sb;
+			}
+			lruUnlink(e);
+			lruPushNewest(shard, e);
+			pthread_mutex_unlock(&shard->lock);
+			if (error != 0) {
+				errno = error;
+				*rc = -1;
+			} else {
+				*rc = 0;
+			}
+			return true;
+		}
+		removeEntry(shard, link);
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return false;
+}
+
+/**
+ * Get the metadata of a path from the file system, and cache it.
+ *
+ * @param shard the shard of the path
+ * @param path the path
+ * @param len the length of the path key
+ * @param hash the hash of the path key
+ * @param sb the metadata if found
+ * @return the result of stat(), with errno set
+ */
+static int statAndCache(StatShard *shard, const char *path, size_t len, uint64_t hash, struct stat *sb) {
+	pthread_mutex_lock(&shard->lock);
+	uint64_t generation = shard->generation;
+	pthread_mutex_unlock(&shard->lock);
+	unsigned long long now = monotonicTimeNs();
+
+	int rc = stat(path, sb);
+	int error = (rc == 0) ? 0 : errno;
+	if ((error != 0) && (error != ENOENT) && (error != ENOTDIR)) {
+		return rc;  // only cache definite answers
+	}
+
+	StatEntry *e = malloc(sizeof(StatEntry) + len + 1);
+	if (e == NULL) {
+		errno = error;
+		return rc;
+	}
+	memcpy(e->path, path, len);
+	e->path[len] = '\0';
+	e->hash = hash;
+	e->error = error;
+	e->expiresNs = now + ((error == 0) ? statTtlNs : statNegativeTtlNs);
+	if (error == 0) {
+		e->sb = *sb;
+	}
+
+	StatEntry **link;
+	pthread_mutex_lock(&shard->lock);
+	// a change since the stat may have made the result stale
+	if ((shard->generation != generation) || (*(link = findEntry(shard, path, len, hash)) != NULL)) {
+		free(e);
+	} else {
+		if (shard->count >= shard->capacity) {
+			StatEntry *oldest = shard->lru.newer;
+			removeEntry(shard, findEntry(shard, oldest->path, strlen(oldest->path), oldest->hash));
+			link = findEntry(shard, path, len, hash);
+		}
+		e->chain = NULL;
+		*link = e;
+		lruPushNewest(shard, e);
+		shard->count++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	errno = error;
+	return rc;
+}
+
+/**
+ * Get file metadata like stat(2), from the cache if possible.
+ *
+ * @param path the file path
+ * @param sb the metadata
+ * @return 0 if successful, -1 with errno set if error
+ */
+int cachedStat(const char *path, struct stat *sb) {
+	if (statShards == NULL) {
+		return stat(path, sb);
+	}
+	size_t len = strlen(path);
+	uint64_t hash = hashPath(path, len);
+	StatShard *shard = &statShards[hash & (STAT_CACHE_SHARDS - 1)];
+
+	int rc;
+	if (lookupStat(shard, path, len, hash, sb, &rc)) {
+		recordCacheLookup(statCacheId, true);
+		return rc;
+	}
+	recordCacheLookup(statCacheId, false);
+
+	// concurrent misses of a path wait for one stat
+	Flight flight;
+	bool leader = boardFlight(&shard->flights, path, len, &flight);
+	if (!leader) {
+		recordCacheCoalesced(statCacheId);
+		if (lookupStat(shard, path, len, hash, sb, &rc)) {
+			return rc;
+		}
+	}
+	rc = statAndCache(shard, path, len, hash, sb);
+	if (leader) {
+		int error = errno;
+		landFlight(&shard->flights, &flight);
+		errno = error;
+	}
+	return rc;
+}
+
+/**
+ * Drop the cache entries of a path and its parent directory.
+ * Call after creating, changing or deleting a file.
+ *
+ * @param path the file path
+ */
+void invalidateStatCache(const char *path) {
+	if (statShards == NULL) {
+		return;
+	}
+	size_t len = keyLength(path);
+	invalidatePathForms(path, len);
+	while ((len > 0) && (path[len-1] != '/')) {
+		len--;
+	}
+	if (len > 1) {
+		invalidatePathForms(path, len - 1);
+	}
+}
+
+#if defined(__linux__)
+
+/** inotify descriptor */
+static int inotifyFd = -1;
+
+/** watched directory paths by watch descriptor */
+static char **watchPaths;
+static int nWatchPaths;
+
+/** events that change metadata in a watched directory */
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM \
+					  | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/**
+ * Watch a directory and every directory below it.
+ */
+static void watchTree(const char *dir) {
+	int wd = inotify_add_watch(inotifyFd, dir, WATCH_EVENTS);
+	if (wd < 0) {
+		return;
+	}
+	if (wd >= nWatchPaths) {
+		int n = (wd + 1) * 2;
+		char **paths = realloc(watchPaths, n * sizeof(char *));
+		if (paths == NULL) {
+			return;
+		}
+		memset(paths + nWatchPaths, 0, (n - nWatchPaths) * sizeof(char *));
+		watchPaths = paths;
+		nWatchPaths = n;
+	}
+	free(watchPaths[wd]);
+	watchPaths[wd] = strdup(dir);
+
+	DIR *d = opendir(dir);
+	if (d == NULL) {
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL) {
+		if ((entry->d_type == DT_DIR) && (strcmp(entry->d_name, ".") != 0)
+			&& (strcmp(entry->d_name, "..") != 0)) {
+			char path[PATH_MAX];
+			if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) < (int)sizeof(path)) {
+				watchTree(path);
+			}
+		}
+	}
+	closedir(d);
+}
+
+/**
+ * Watcher thread: drops the entries of paths as they change.
+ */
+static void *statCacheWatcher(void *arg) {
+	(void)arg;
+	char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (true) {
+		ssize_t n = read(inotifyFd, buf, sizeof(buf));
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("statCacheWatcher");
+			return NULL;
+		}
+		for (char *p = buf; p < buf + n; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			p += sizeof(struct inotify_event) + ev->len;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				// events were lost: start over
+				invalidateAll();
+				continue;
+			}
+			if ((ev->wd < 0) || (ev->wd >= nWatchPaths) || (watchPaths[ev->wd] == NULL)) {
+				continue;
+			}
+			const char *dir = watchPaths[ev->wd];
+			if (ev->mask & IN_IGNORED) {
+				free(watchPaths[ev->wd]);
+				watchPaths[ev->wd] = NULL;
+				continue;
+			}
+			if (ev->len == 0) {
+				invalidateStatCache(dir);
+				continue;
+			}
+			char path[PATH_MAX];
+			if (snprintf(path, sizeof(path), "%s/%s", dir, ev->name) >= (int)sizeof(path)) {
+				continue;
+			}
+			invalidateStatCache(path);
+			if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+				watchTree(path);
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Start watching a directory tree for changes.
+ */
+static bool startWatcher(const char *root) {
+	inotifyFd = inotify_init1(IN_CLOEXEC);
+	if (inotifyFd < 0) {
+		return false;
+	}
+	watchTree(root);
+	pthread_t watcher;
+	if (pthread_create(&watcher, NULL, statCacheWatcher, NULL) != 0) {
+		close(inotifyFd);
+		inotifyFd = -1;
+		return false;
+	}
+	pthread_detach(watcher);
+	return true;
+}
+
+#else
+
+/**
+ * No change notification: entries live until their TTL.
+ */
+static bool startWatcher(const char *root) {
+	(void)root;
+	return true;
+}
+
+#endif
+
+/**
+ * Initialize the cache and start watching a directory tree.
+ *
+ * @param capacity maximum number of entries; 0 disables the cache
+ * @param ttlMs lifetime of an entry for an existing path
+ * @param negativeTtlMs lifetime of an entry for a missing path
+ * @param root the directory tree to watch for changes
+ * @return true if successful
+ */
+bool initStatCache(size_t capacity, long ttlMs, long negativeTtlMs, const char *root) {
+	if (capacity == 0) {
+		return true;
+	}
+	StatShard *shards = calloc(STAT_CACHE_SHARDS, sizeof(StatShard));
+	if (shards == NULL) {
+		return false;
+	}
+	size_t perShard = (capacity + STAT_CACHE_SHARDS - 1) / STAT_CACHE_SHARDS;
+	size_t nbuckets = 16;
+	while (nbuckets < perShard) {
+		nbuckets <<= 1;
+	}
+	for (int s = 0; s < STAT_CACHE_SHARDS; s++) {
+		StatShard *shard = &shards[s];
+		pthread_mutex_init(&shard->lock, NULL);
+		initFlightGroup(&shard->flights);
+		shard->buckets = calloc(nbuckets, sizeof(StatEntry *));
+		if (shard->buckets == NULL) {
+			return false;
+		}
+		shard->mask = nbuckets - 1;
+		shard->capacity = perShard;
+		shard->lru.newer = shard->lru.older = &shard->lru;
+	}
+	statTtlNs = (unsigned long long)ttlMs * 1000000ULL;
+	statNegativeTtlNs = (unsigned long long)negativeTtlMs * 1000000ULL;
+	statCacheId = registerStatsCache("stat");
+	statShards = shards;
+
+	// watch the tree by the same spelling of its path as lookups use
+	char rootBuf[PATH_MAX];
+	snprintf(rootBuf, sizeof(rootBuf), "%.*s", (int)keyLength(root), root);
+	if (!startWatcher(rootBuf)) {
+		perror("initStatCache: inotify");
+	}
+	return true;
+}
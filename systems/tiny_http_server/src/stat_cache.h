@@ -0,0 +1,55 @@
+/*
+ * stat_cache.h
+ *
+ * Cache of file metadata by path.
+ *
+ * Lookups hash to one of STAT_CACHE_SHARDS independently locked
+ * shards, each an LRU-ordered hash table. Missing paths are cached
+ * too, with a shorter TTL, so repeated 404s cost no system calls.
+ * Concurrent misses of a path wait for one stat() of it.
+ * On Linux an inotify thread watches the content tree and drops
+ * entries as files change; elsewhere entries live until their TTL.
+ * Handlers that change files also invalidate their entries directly.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef STAT_CACHE_H_
+#define STAT_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/** number of independently locked shards */
+#define STAT_CACHE_SHARDS 16
+
+/**
+ * Initialize the cache and start watching a directory tree.
+ *
+ * @param capacity maximum number of entries; 0 disables the cache
+ * @param ttlMs lifetime of an entry for an existing path
+ * @param negativeTtlMs lifetime of an entry for a missing path
+ * @param root the directory tree to watch for changes
+ * @return true if successful
+ */
+bool initStatCache(size_t capacity, long ttlMs, long negativeTtlMs, const char *root);
+
+/**
+ * Get file metadata like stat(2), from the cache if possible.
+ *
+ * @param path the file path
+ * @param sb the metadata
+ * @return 0 if successful, -1 with errno set if error
+ */
+int cachedStat(const char *path, struct stat *sb);
+
+/**
+ * Drop the cache entries of a path and its parent directory.
+ * Call after creating, changing or deleting a file.
+ *
+ * @param path the file path
+ */
+void invalidateStatCache(const char *path);
+
+#endif /* STAT_CACHE_H_ */
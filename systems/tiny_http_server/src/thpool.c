@@ -15,12 +15,15 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <errno.h>
+#include <string.h>
 #include <time.h>
 #if defined(__linux__)
 #include <sys/prctl.h>
 #endif
 
 #include "thpool.h"
+#include "cpu_affinity.h"
+#include "histogram.h"
 
 #ifdef THPOOL_DEBUG
 #define THPOOL_DEBUG 1
@@ -37,17 +40,12 @@
 static volatile int threads_keepalive;
 static volatile int threads_on_hold;
 
+/* Worker running on the calling thread (NULL outside the pool) */
+static __thread struct thread* thread_self;
 
 
-/* ========================== STRUCTURES ============================ */
-
 
-/* Binary semaphore */
-typedef struct bsem {
-	pthread_mutex_t mutex;
-	pthread_cond_t   cond;
-	int v;
-} bsem;
+/* ========================== STRUCTURES ============================ */
 
 
 /* Job */
@@ -55,6 +53,7 @@ typedef struct job{
 	struct job*  prev;                   /* pointer to previous job   */
 	void   (*function)(void* arg);       /* function pointer          */
 	void*  arg;                          /* function's argument       */
+	unsigned long long queued_ns;        /* time added, if stats on   */
 } job;
 
 
@@ -63,14 +62,37 @@ typedef struct jobqueue{
 	pthread_mutex_t rwmutex;             /* used for queue r/w access */
 	job  *front;                         /* pointer to front of queue */
 	job  *rear;                          /* pointer to rear  of queue */
-	bsem *has_jobs;                      /* flag as binary semaphore  */
 	int   len;                           /* number of jobs in queue   */
 } jobqueue;
 
 
+/* Lane: a job queue with its own worker budget and weight */
+typedef struct lane{
+	jobqueue  jobqueue;                  /* job queue of the lane     */
+	int       max_working;               /* worker budget, 0 = all    */
+	int       weight;                    /* scheduling weight         */
+	int       num_working;               /* workers running its jobs  */
+	int       credit;                    /* weighted round-robin state*/
+} lane;
+
+
+/* Worker statistics, written only by the worker */
+typedef struct thread_stats{
+	histogram wait;                      /* queue-wait time in ns     */
+	histogram run;                       /* run time in ns            */
+	unsigned long long jobs;             /* jobs run                  */
+	unsigned long long busy_ns;          /* time running jobs         */
+	unsigned long long idle_ns;          /* time waiting for jobs     */
+	unsigned long long last_ns;          /* end of the last job       */
+} thread_stats;
+
+
 /* Thread */
 typedef struct thread{
 	int       id;                        /* friendly id               */
+	int       cpu;                       /* pinned CPU or -1          */
+	void*     local;                     /* per-worker state          */
+	thread_stats* stats;                 /* statistics, if enabled    */
 	pthread_t pthread;                   /* pointer to actual thread  */
 	struct thpool_* thpool_p;            /* access to thpool          */
 } thread;
@@ -83,7 +105,14 @@ typedef struct thpool_{
 	volatile int num_threads_working;    /* threads currently working */
 	pthread_mutex_t  thcount_lock;       /* used for thread count etc */
 	pthread_cond_t  threads_all_idle;    /* signal to thpool_wait     */
-	jobqueue  jobqueue;                  /* job queue                 */
+	lane      lanes[THPOOL_MAX_LANES];   /* job queues by priority    */
+	pthread_mutex_t  lane_lock;          /* guards lanes and queues   */
+	pthread_cond_t  has_jobs;            /* signal to idle workers    */
+	volatile int stats_enabled;          /* record job statistics     */
+	int       max_queue_len;             /* queue length watermark    */
+	int*      cpus;                      /* CPU of each worker        */
+	int       num_cpus;                  /* number of CPUs in cpus    */
+	size_t    local_size;                /* size of per-worker state  */
 } thpool_;
 
 
@@ -104,11 +133,12 @@ static void  jobqueue_push(jobqueue* jobqueue_p, struct job* newjob_p);
 static struct job* jobqueue_pull(jobqueue* jobqueue_p);
 static void  jobqueue_destroy(jobqueue* jobqueue_p);
 
-static void  bsem_init(struct bsem *bsem_p, int value);
-static void  bsem_reset(struct bsem *bsem_p);
-static void  bsem_post(struct bsem *bsem_p);
-static void  bsem_post_all(struct bsem *bsem_p);
-static void  bsem_wait(struct bsem *bsem_p);
+static int   lane_next(thpool_* thpool_p);
+static int   lanes_len(thpool_* thpool_p);
+
+static unsigned long long clock_ns(void);
+static void  stats_add(unsigned long long* counter, unsigned long long n);
+static unsigned long long stats_get(const unsigned long long* counter);
 
 
 
@@ -119,6 +149,12 @@ static void  bsem_wait(struct bsem *bsem_p);
 
 /* Initialise thread pool */
 struct thpool_* thpool_init(int num_threads){
+	return thpool_init_affinity(num_threads, NULL, 0, 0);
+}
+
+
+/* Initialise thread pool with pinned workers */
+struct thpool_* thpool_init_affinity(int num_threads, const int* cpus, int num_cpus, size_t local_size){
 
 	threads_on_hold   = 0;
 	threads_keepalive = 1;
@@ -136,19 +172,39 @@ struct thpool_* thpool_init(int num_threads){
 	}
 	thpool_p->num_threads_alive   = 0;
 	thpool_p->num_threads_working = 0;
+	thpool_p->local_size          = local_size;
+	thpool_p->stats_enabled       = 0;
+	thpool_p->max_queue_len       = 0;
+	thpool_p->cpus                = NULL;
+	thpool_p->num_cpus            = 0;
+	if (cpus != NULL && num_cpus > 0){
+		thpool_p->cpus = (int*)malloc(num_cpus * sizeof(int));
+		if (thpool_p->cpus == NULL){
+			err("thpool_init(): Could not allocate memory for CPU list\n");
+			free(thpool_p);
+			return NULL;
+		}
+		memcpy(thpool_p->cpus, cpus, num_cpus * sizeof(int));
+		thpool_p->num_cpus = num_cpus;
+	}
 
-	/* Initialise the job queue */
-	if (jobqueue_init(&thpool_p->jobqueue) == -1){
-		err("thpool_init(): Could not allocate memory for job queue\n");
-		free(thpool_p);
-		return NULL;
+	/* Initialise the lanes: all unlimited with equal weight */
+	int l;
+	for (l=0; l<THPOOL_MAX_LANES; l++){
+		jobqueue_init(&thpool_p->lanes[l].jobqueue);
+		thpool_p->lanes[l].max_working = 0;
+		thpool_p->lanes[l].weight      = 1;
+		thpool_p->lanes[l].num_working = 0;
+		thpool_p->lanes[l].credit      = 0;
 	}
+	pthread_mutex_init(&(thpool_p->lane_lock), NULL);
+	pthread_cond_init(&thpool_p->has_jobs, NULL);
 
 	/* Make threads in pool */
 	thpool_p->threads = (struct thread**)malloc(num_threads * sizeof(struct thread *));
 	if (thpool_p->threads == NULL){
 		err("thpool_init(): Could not allocate memory for threads\n");
-		jobqueue_destroy(&thpool_p->jobqueue);
+		free(thpool_p->cpus);
 		free(thpool_p);
 		return NULL;
 	}
@@ -174,8 +230,19 @@ struct thpool_* thpool_init(int num_threads){
 
 /* Add work to the thread pool */
 int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
+	return thpool_add_work_lane(thpool_p, 0, function_p, arg_p);
+}
+
+
+/* Add work to a lane of the thread pool */
+int thpool_add_work_lane(thpool_* thpool_p, int lane_id, void (*function_p)(void*), void* arg_p){
 	job* newjob;
 
+	if (lane_id < 0 || lane_id >= THPOOL_MAX_LANES){
+		err("thpool_add_work_lane(): Invalid lane\n");
+		return -1;
+	}
+
 	newjob=(struct job*)malloc(sizeof(struct job));
 	if (newjob==NULL){
 		err("thpool_add_work(): Could not allocate memory for new job\n");
@@ -185,10 +252,33 @@ int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
 	/* add function and argument */
 	newjob->function=function_p;
 	newjob->arg=arg_p;
+	newjob->queued_ns = thpool_p->stats_enabled ? clock_ns() : 0;
+
+	/* add job to queue and wake an idle worker */
+	pthread_mutex_lock(&thpool_p->lane_lock);
+	jobqueue_push(&thpool_p->lanes[lane_id].jobqueue, newjob);
+	int len = lanes_len(thpool_p);
+	if (len > thpool_p->max_queue_len){
+		thpool_p->max_queue_len = len;
+	}
+	pthread_cond_signal(&thpool_p->has_jobs);
+	pthread_mutex_unlock(&thpool_p->lane_lock);
+
+	return 0;
+}
 
-	/* add job to queue */
-	jobqueue_push(&thpool_p->jobqueue, newjob);
 
+/* Set worker budget and weight of a lane */
+int thpool_set_lane(thpool_* thpool_p, int lane_id, int max_working, int weight){
+	if (lane_id < 0 || lane_id >= THPOOL_MAX_LANES || max_working < 0 || weight < 1){
+		err("thpool_set_lane(): Invalid lane settings\n");
+		return -1;
+	}
+	pthread_mutex_lock(&thpool_p->lane_lock);
+	thpool_p->lanes[lane_id].max_working = max_working;
+	thpool_p->lanes[lane_id].weight      = weight;
+	pthread_cond_broadcast(&thpool_p->has_jobs);
+	pthread_mutex_unlock(&thpool_p->lane_lock);
 	return 0;
 }
 
@@ -196,7 +286,7 @@ int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
 /* Wait until all jobs have finished */
 void thpool_wait(thpool_* thpool_p){
 	pthread_mutex_lock(&thpool_p->thcount_lock);
-	while (thpool_p->jobqueue.len || thpool_p->num_threads_working) {
+	while (lanes_len(thpool_p) || thpool_p->num_threads_working) {
 		pthread_cond_wait(&thpool_p->threads_all_idle, &thpool_p->thcount_lock);
 	}
 	pthread_mutex_unlock(&thpool_p->thcount_lock);
@@ -219,25 +309,33 @@ void thpool_destroy(thpool_* thpool_p){
 	double tpassed = 0.0;
 	time (&start);
 	while (tpassed < TIMEOUT && thpool_p->num_threads_alive){
-		bsem_post_all(thpool_p->jobqueue.has_jobs);
+		pthread_mutex_lock(&thpool_p->lane_lock);
+		pthread_cond_broadcast(&thpool_p->has_jobs);
+		pthread_mutex_unlock(&thpool_p->lane_lock);
 		time (&end);
 		tpassed = difftime(end,start);
 	}
 
 	/* Poll remaining threads */
 	while (thpool_p->num_threads_alive){
-		bsem_post_all(thpool_p->jobqueue.has_jobs);
+		pthread_mutex_lock(&thpool_p->lane_lock);
+		pthread_cond_broadcast(&thpool_p->has_jobs);
+		pthread_mutex_unlock(&thpool_p->lane_lock);
 		sleep(1);
 	}
 
 	/* Job queue cleanup */
-	jobqueue_destroy(&thpool_p->jobqueue);
+	int l;
+	for (l=0; l < THPOOL_MAX_LANES; l++){
+		jobqueue_destroy(&thpool_p->lanes[l].jobqueue);
+	}
 	/* Deallocs */
 	int n;
 	for (n=0; n < threads_total; n++){
 		thread_destroy(thpool_p->threads[n]);
 	}
 	free(thpool_p->threads);
+	free(thpool_p->cpus);
 	free(thpool_p);
 }
 
@@ -267,6 +365,60 @@ int thpool_num_threads_working(thpool_* thpool_p){
 }
 
 
+/* Turn job statistics on or off */
+void thpool_enable_stats(thpool_* thpool_p, int enable){
+	thpool_p->stats_enabled = enable;
+}
+
+
+/* Snapshot of the job statistics */
+int thpool_stats(thpool_* thpool_p, thpool_stats_t* stats, thpool_worker_stats* workers, int max_workers){
+	memset(stats, 0, sizeof(thpool_stats_t));
+
+	pthread_mutex_lock(&thpool_p->lane_lock);
+	stats->queue_len     = lanes_len(thpool_p);
+	stats->max_queue_len = thpool_p->max_queue_len;
+	pthread_mutex_unlock(&thpool_p->lane_lock);
+
+	stats->num_threads         = thpool_p->num_threads_alive;
+	stats->num_threads_working = thpool_p->num_threads_working;
+
+	/* Each worker writes only its own counters: merge without locking */
+	int n;
+	int filled = 0;
+	for (n=0; n < stats->num_threads; n++){
+		thread_stats* ts = __atomic_load_n(&thpool_p->threads[n]->stats, __ATOMIC_ACQUIRE);
+		thpool_worker_stats ws = {0, 0, 0};
+		if (ts != NULL){
+			ws.jobs    = stats_get(&ts->jobs);
+			ws.busy_ns = stats_get(&ts->busy_ns);
+			ws.idle_ns = stats_get(&ts->idle_ns);
+			hist_merge(&stats->wait, &ts->wait);
+			hist_merge(&stats->run, &ts->run);
+		}
+		stats->total.jobs    += ws.jobs;
+		stats->total.busy_ns += ws.busy_ns;
+		stats->total.idle_ns += ws.idle_ns;
+		if (workers != NULL && filled < max_workers){
+			workers[filled++] = ws;
+		}
+	}
+	return filled;
+}
+
+
+/* Per-worker state of the calling thread */
+void* thpool_thread_local(void){
+	return (thread_self != NULL) ? thread_self->local : NULL;
+}
+
+
+/* Id of the calling worker */
+int thpool_thread_id(void){
+	return (thread_self != NULL) ? thread_self->id : -1;
+}
+
+
 
 
 
@@ -289,6 +441,9 @@ static int thread_init (thpool_* thpool_p, struct thread** thread_p, int id){
 
 	(*thread_p)->thpool_p = thpool_p;
 	(*thread_p)->id       = id;
+	(*thread_p)->local    = NULL;
+	(*thread_p)->stats    = NULL;
+	(*thread_p)->cpu      = (thpool_p->num_cpus > 0) ? thpool_p->cpus[id % thpool_p->num_cpus] : -1;
 
 	pthread_create(&(*thread_p)->pthread, NULL, (void *)thread_do, (*thread_p));
 	pthread_detach((*thread_p)->pthread);
@@ -316,6 +471,12 @@ static void thread_hold(int sig_id) {
 */
 static void* thread_do(struct thread* thread_p){
 
+	/* Pin before allocating anything so memory is node-local */
+	if (thread_p->cpu >= 0 && pin_thread_to_cpu(thread_p->cpu) != 0){
+		err("thread_do(): cannot set CPU affinity\n");
+	}
+	thread_self = thread_p;
+
 	/* Set thread name for profiling and debuging */
 	char thread_name[128] = {0};
 	sprintf(thread_name, "thread-pool-%d", thread_p->id);
@@ -332,6 +493,16 @@ static void* thread_do(struct thread* thread_p){
 	/* Assure all threads have been created before starting serving */
 	thpool_* thpool_p = thread_p->thpool_p;
 
+	/* Allocate and touch per-worker state from the pinned thread */
+	if (thpool_p->local_size > 0){
+		thread_p->local = malloc(thpool_p->local_size);
+		if (thread_p->local == NULL){
+			err("thread_do(): Could not allocate memory for worker state\n");
+		} else {
+			memset(thread_p->local, 0, thpool_p->local_size);
+		}
+	}
+
 	/* Register signal handler */
 	struct sigaction act;
 	sigemptyset(&act.sa_mask);
@@ -346,27 +517,74 @@ static void* thread_do(struct thread* thread_p){
 	thpool_p->num_threads_alive += 1;
 	pthread_mutex_unlock(&thpool_p->thcount_lock);
 
+	thread_stats* stats = NULL;
 	while(threads_keepalive){
 
-		bsem_wait(thpool_p->jobqueue.has_jobs);
+		/* Wait for a lane with queued jobs and spare budget */
+		pthread_mutex_lock(&thpool_p->lane_lock);
+		int lane_id = -1;
+		while (threads_keepalive && (lane_id = lane_next(thpool_p)) < 0){
+			pthread_cond_wait(&thpool_p->has_jobs, &thpool_p->lane_lock);
+		}
 
-		if (threads_keepalive){
+		if (threads_keepalive && lane_id >= 0){
 
 			pthread_mutex_lock(&thpool_p->thcount_lock);
 			thpool_p->num_threads_working++;
 			pthread_mutex_unlock(&thpool_p->thcount_lock);
 
-			/* Read job from queue and execute it */
+			/* Read job from queue; wake another worker if more is runnable */
+			lane* lane_p = &thpool_p->lanes[lane_id];
+			lane_p->num_working++;
+			job* job_p = jobqueue_pull(&lane_p->jobqueue);
+			if (lanes_len(thpool_p)){
+				pthread_cond_signal(&thpool_p->has_jobs);
+			}
+			pthread_mutex_unlock(&thpool_p->lane_lock);
+
+			/* Allocate statistics from this thread once they are enabled */
+			if (stats == NULL && thpool_p->stats_enabled){
+				stats = (thread_stats*)malloc(sizeof(thread_stats));
+				if (stats != NULL){
+					memset(stats, 0, sizeof(thread_stats));
+					stats->last_ns = clock_ns();
+					__atomic_store_n(&thread_p->stats, stats, __ATOMIC_RELEASE);
+				}
+			}
+
+			/* Execute the job */
 			void (*func_buff)(void*);
 			void*  arg_buff;
-			job* job_p = jobqueue_pull(&thpool_p->jobqueue);
 			if (job_p) {
+				unsigned long long start_ns = 0;
+				if (stats != NULL){
+					start_ns = clock_ns();
+					if (job_p->queued_ns && start_ns > job_p->queued_ns){
+						hist_record(&stats->wait, start_ns - job_p->queued_ns);
+					}
+					stats_add(&stats->idle_ns, start_ns - stats->last_ns);
+				}
 				func_buff = job_p->function;
 				arg_buff  = job_p->arg;
 				func_buff(arg_buff);
 				free(job_p);
+				if (stats != NULL){
+					unsigned long long end_ns = clock_ns();
+					hist_record(&stats->run, end_ns - start_ns);
+					stats_add(&stats->busy_ns, end_ns - start_ns);
+					stats_add(&stats->jobs, 1);
+					stats->last_ns = end_ns;
+				}
 			}
 
+			/* Give the budget back; a job held back by it may now run */
+			pthread_mutex_lock(&thpool_p->lane_lock);
+			lane_p->num_working--;
+			if (lane_p->jobqueue.len){
+				pthread_cond_signal(&thpool_p->has_jobs);
+			}
+			pthread_mutex_unlock(&thpool_p->lane_lock);
+
 			pthread_mutex_lock(&thpool_p->thcount_lock);
 			thpool_p->num_threads_working--;
 			if (!thpool_p->num_threads_working) {
@@ -374,6 +592,8 @@ static void* thread_do(struct thread* thread_p){
 			}
 			pthread_mutex_unlock(&thpool_p->thcount_lock);
 
+		} else {
+			pthread_mutex_unlock(&thpool_p->lane_lock);
 		}
 	}
 	pthread_mutex_lock(&thpool_p->thcount_lock);
@@ -386,6 +606,8 @@ static void* thread_do(struct thread* thread_p){
 
 /* Frees a thread  */
 static void thread_destroy (thread* thread_p){
+	free(thread_p->stats);
+	free(thread_p->local);
 	free(thread_p);
 }
 
@@ -402,13 +624,7 @@ static int jobqueue_init(jobqueue* jobqueue_p){
 	jobqueue_p->front = NULL;
 	jobqueue_p->rear  = NULL;
 
-	jobqueue_p->has_jobs = (struct bsem*)malloc(sizeof(struct bsem));
-	if (jobqueue_p->has_jobs == NULL){
-		return -1;
-	}
-
 	pthread_mutex_init(&(jobqueue_p->rwmutex), NULL);
-	bsem_init(jobqueue_p->has_jobs, 0);
 
 	return 0;
 }
@@ -423,7 +639,6 @@ static void jobqueue_clear(jobqueue* jobqueue_p){
 
 	jobqueue_p->front = NULL;
 	jobqueue_p->rear  = NULL;
-	bsem_reset(jobqueue_p->has_jobs);
 	jobqueue_p->len = 0;
 
 }
@@ -450,7 +665,6 @@ static void jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
 	}
 	jobqueue_p->len++;
 
-	bsem_post(jobqueue_p->has_jobs);
 	pthread_mutex_unlock(&jobqueue_p->rwmutex);
 }
 
@@ -481,8 +695,6 @@ static struct job* jobqueue_pull(jobqueue* jobqueue_p){
 		default: /* if >1 jobs in queue */
 					jobqueue_p->front = job_p->prev;
 					jobqueue_p->len--;
-					/* more than one job in queue -> post it */
-					bsem_post(jobqueue_p->has_jobs);
 
 	}
 
@@ -494,58 +706,81 @@ static struct job* jobqueue_pull(jobqueue* jobqueue_p){
 /* Free all queue resources back to the system */
 static void jobqueue_destroy(jobqueue* jobqueue_p){
 	jobqueue_clear(jobqueue_p);
-	free(jobqueue_p->has_jobs);
 }
 
 
 
 
 
-/* ======================== SYNCHRONISATION ========================= */
+/* ============================== LANES ============================= */
 
 
-/* Init semaphore to 1 or 0 */
-static void bsem_init(bsem *bsem_p, int value) {
-	if (value < 0 || value > 1) {
-		err("bsem_init(): Binary semaphore can take only values 1 or 0");
-		exit(1);
+/* Pick the lane the next job comes from
+ *
+ * A lane is runnable if it has queued jobs and its running jobs are
+ * below its worker budget. Among runnable lanes, smooth weighted
+ * round-robin picks each lane in proportion to its weight, so a
+ * busy low-weight lane cannot crowd out a high-weight one.
+ *
+ * Notice: Caller MUST hold lane_lock
+ *
+ * @return lane id, or -1 if no lane is runnable
+ */
+static int lane_next(thpool_* thpool_p){
+	int best = -1;
+	int total = 0;
+	int l;
+	for (l=0; l < THPOOL_MAX_LANES; l++){
+		lane* lane_p = &thpool_p->lanes[l];
+		if (lane_p->jobqueue.len == 0
+			|| (lane_p->max_working && lane_p->num_working >= lane_p->max_working)){
+			continue;
+		}
+		lane_p->credit += lane_p->weight;
+		total += lane_p->weight;
+		if (best < 0 || lane_p->credit > thpool_p->lanes[best].credit){
+			best = l;
+		}
+	}
+	if (best >= 0){
+		thpool_p->lanes[best].credit -= total;
 	}
-	pthread_mutex_init(&(bsem_p->mutex), NULL);
-	pthread_cond_init(&(bsem_p->cond), NULL);
-	bsem_p->v = value;
+	return best;
 }
 
 
-/* Reset semaphore to 0 */
-static void bsem_reset(bsem *bsem_p) {
-	bsem_init(bsem_p, 0);
+/* Number of jobs queued in all lanes */
+static int lanes_len(thpool_* thpool_p){
+	int len = 0;
+	int l;
+	for (l=0; l < THPOOL_MAX_LANES; l++){
+		len += thpool_p->lanes[l].jobqueue.len;
+	}
+	return len;
 }
 
 
-/* Post to at least one thread */
-static void bsem_post(bsem *bsem_p) {
-	pthread_mutex_lock(&bsem_p->mutex);
-	bsem_p->v = 1;
-	pthread_cond_signal(&bsem_p->cond);
-	pthread_mutex_unlock(&bsem_p->mutex);
+
+
+
+/* ============================ STATISTICS ========================== */
+
+
+/* Monotonic time in nanoseconds */
+static unsigned long long clock_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
 }
 
 
-/* Post to all threads */
-static void bsem_post_all(bsem *bsem_p) {
-	pthread_mutex_lock(&bsem_p->mutex);
-	bsem_p->v = 1;
-	pthread_cond_broadcast(&bsem_p->cond);
-	pthread_mutex_unlock(&bsem_p->mutex);
+/* Add to a counter written only by the calling worker */
+static void stats_add(unsigned long long* counter, unsigned long long n){
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
 }
 
 
-/* Wait on semaphore until semaphore has value 0 */
-static void bsem_wait(bsem* bsem_p) {
-	pthread_mutex_lock(&bsem_p->mutex);
-	while (bsem_p->v != 1) {
-		pthread_cond_wait(&bsem_p->cond, &bsem_p->mutex);
-	}
-	bsem_p->v = 0;
-	pthread_mutex_unlock(&bsem_p->mutex);
+/* Read a counter written by another thread */
+static unsigned long long stats_get(const unsigned long long* counter){
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
 }
@@ -7,6 +7,10 @@
 #ifndef _THPOOL_
 #define _THPOOL_
 
+#include <stddef.h>
+
+#include "histogram.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -17,6 +21,30 @@ extern "C" {
 typedef struct thpool_* threadpool;
 
 
+/* Number of job lanes in a threadpool */
+#define THPOOL_MAX_LANES 4
+
+
+/* Busy and idle time of a worker (or of all workers) */
+typedef struct thpool_worker_stats{
+	unsigned long long jobs;             /* jobs run                  */
+	unsigned long long busy_ns;          /* time running jobs         */
+	unsigned long long idle_ns;          /* time waiting for jobs     */
+} thpool_worker_stats;
+
+
+/* Snapshot of threadpool statistics */
+typedef struct thpool_stats_t{
+	int num_threads;                     /* threads alive             */
+	int num_threads_working;             /* threads running a job     */
+	int queue_len;                       /* jobs queued now           */
+	int max_queue_len;                   /* most jobs ever queued     */
+	thpool_worker_stats total;           /* sum over all workers      */
+	histogram wait;                      /* queue-wait time in ns     */
+	histogram run;                       /* run time in ns            */
+} thpool_stats_t;
+
+
 /**
  * @brief  Initialize threadpool
  *
@@ -37,6 +65,33 @@ typedef struct thpool_* threadpool;
 threadpool thpool_init(int num_threads);
 
 
+/**
+ * @brief  Initialize threadpool with pinned workers
+ *
+ * Like thpool_init(), but worker n is pinned to cpus[n % num_cpus]
+ * before it allocates anything, so its stack, stdio buffers and
+ * per-worker state come from the memory of its own NUMA node
+ * (first-touch placement). Each worker also gets a zeroed block of
+ * local_size bytes, allocated by the worker itself after pinning,
+ * which it can reach through thpool_thread_local().
+ *
+ * @example
+ *
+ *    ..
+ *    int cpus[] = {0, 1, 2, 3};
+ *    threadpool thpool = thpool_init_affinity(8, cpus, 4, 0);
+ *    ..
+ *
+ * @param  num_threads   number of threads to be created in the threadpool
+ * @param  cpus          CPU for each worker (NULL for default affinity)
+ * @param  num_cpus      number of entries in cpus
+ * @param  local_size    size of the per-worker state (0 for none)
+ * @return threadpool    created threadpool on success,
+ *                       NULL on error
+ */
+threadpool thpool_init_affinity(int num_threads, const int* cpus, int num_cpus, size_t local_size);
+
+
 /**
  * @brief Add work to the job queue
  *
@@ -67,6 +122,45 @@ threadpool thpool_init(int num_threads);
 int thpool_add_work(threadpool, void (*function_p)(void*), void* arg_p);
 
 
+/**
+ * @brief Add work to a lane of the job queue
+ *
+ * Like thpool_add_work(), but queues the job on the given lane.
+ * thpool_add_work() uses lane 0. Each lane is a separate FIFO with
+ * its own worker budget and weight (see thpool_set_lane()), so
+ * long-running jobs on one lane cannot delay short jobs on another.
+ *
+ * @example
+ *
+ *    thpool_set_lane(thpool, 1, 2, 1);     // at most 2 workers on lane 1
+ *    thpool_add_work_lane(thpool, 1, (void*)long_job, (void*)arg);
+ *
+ * @param  threadpool    threadpool to which the work will be added
+ * @param  lane          lane number (0..THPOOL_MAX_LANES-1)
+ * @param  function_p    pointer to function to add as work
+ * @param  arg_p         pointer to an argument
+ * @return 0 on successs, -1 otherwise.
+ */
+int thpool_add_work_lane(threadpool, int lane, void (*function_p)(void*), void* arg_p);
+
+
+/**
+ * @brief Set the worker budget and weight of a lane
+ *
+ * A lane never runs more than max_working jobs at once (0 means no
+ * limit besides the pool size). When several lanes have queued jobs
+ * and spare budget, workers take jobs from them in proportion to
+ * their weights. All lanes start unlimited with weight 1.
+ *
+ * @param  threadpool    the threadpool
+ * @param  lane          lane number (0..THPOOL_MAX_LANES-1)
+ * @param  max_working   worker budget of the lane, 0 for no limit
+ * @param  weight        scheduling weight, at least 1
+ * @return 0 on successs, -1 otherwise.
+ */
+int thpool_set_lane(threadpool, int lane, int max_working, int weight);
+
+
 /**
  * @brief Wait for all queued jobs to finish
  *
@@ -180,6 +274,67 @@ void thpool_destroy(threadpool);
 int thpool_num_threads_working(threadpool);
 
 
+/**
+ * @brief Turn job statistics on or off
+ *
+ * While statistics are on, each worker records the queue-wait time
+ * and run time of its jobs in its own histograms and accumulates
+ * its busy and idle time. Workers only write their own counters, so
+ * recording takes no lock beyond the ones the pool already holds.
+ * The queue length watermark is always kept.
+ *
+ * @param threadpool     the threadpool
+ * @param enable         1 to record statistics, 0 to stop
+ * @return nothing
+ */
+void thpool_enable_stats(threadpool, int enable);
+
+
+/**
+ * @brief Snapshot of the threadpool statistics
+ *
+ * Merges the per-worker histograms and counters into stats.
+ * The snapshot is taken without stopping the workers, so it may
+ * miss jobs finishing while it runs. thpool_stats_t holds two
+ * histograms, so prefer a static or heap-allocated one.
+ *
+ * @example
+ *
+ *    static thpool_stats_t stats;
+ *    thpool_stats(thpool, &stats, NULL, 0);
+ *    printf("p99 wait: %llu ns\n",
+ *           (unsigned long long)hist_percentile(&stats.wait, 99.0));
+ *
+ * @param threadpool     the threadpool of interest
+ * @param stats          storage for the snapshot
+ * @param workers        storage for per-worker statistics, or NULL
+ * @param max_workers    capacity of workers
+ * @return integer       number of entries filled in workers
+ */
+int thpool_stats(threadpool, thpool_stats_t* stats, thpool_worker_stats* workers, int max_workers);
+
+
+/**
+ * @brief Per-worker state of the calling thread
+ *
+ * Returns the local_size block allocated by the calling worker
+ * (see thpool_init_affinity()).
+ *
+ * @return pointer         the worker's state, or NULL if the caller
+ *                         is not a pool worker or local_size was 0
+ */
+void* thpool_thread_local(void);
+
+
+/**
+ * @brief Id of the calling worker
+ *
+ * @return integer       id of the calling worker (0..num_threads-1),
+ *                       or -1 if the caller is not a pool worker
+ */
+int thpool_thread_id(void);
+
+
 #ifdef __cplusplus
 }
 #endif
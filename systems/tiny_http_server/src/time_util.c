@@ -35,3 +35,14 @@ char *milliTimeToShortHM_Date_Time(time_t timer, char *buf) {
 	strftime(buf, 128, "%F %H:%M", tm_info);
 	return buf;
 }
+
+/**
+ * Returns the time of a monotonic clock in nanoseconds,
+ * for measuring intervals.
+ * @return the time in nanoseconds
+ */
+unsigned long long monotonicTimeNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
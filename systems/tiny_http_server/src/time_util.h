@@ -30,4 +30,11 @@ char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf);
  */
 char *milliTimeToShortHM_Date_Time(time_t timer, char *buf);
 
+/**
+ * Returns the time of a monotonic clock in nanoseconds,
+ * for measuring intervals.
+ * @return the time in nanoseconds
+ */
+unsigned long long monotonicTimeNs(void);
+
 #endif /* TIME_UTIL_H_ */
@@ -0,0 +1,191 @@
+/*
+ * timer_wheel.c
+ *
+ * Hierarchical timer wheel.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+#include "time_util.h"
+
+/** A timer wheel */
+struct TimerWheel {
+	pthread_mutex_t lock;		/** guards slots, timers and now */
+	uint64_t now;				/** current tick */
+	uint64_t startNs;			/** monotonic time of tick 0 */
+	unsigned tickMs;			/** tick length */
+	WheelTimer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];	/** list heads */
+};
+
+/**
+ * Unlink a timer from its slot.
+ */
+static void unlinkTimer(WheelTimer *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+}
+
+/**
+ * Link a timer into the slot for its expiry relative to now. The
+ * level is the lowest one at which the expiry is fewer than
+ * TIMER_WHEEL_SLOTS slots ahead, so it never lands in the slot
+ * being processed.
+ */
+static void linkTimer(TimerWheel *wheel, WheelTimer *timer) {
+	int level = 0;
+	while ((level < TIMER_WHEEL_LEVELS - 1)
+		   && ((timer->expires >> (level * TIMER_WHEEL_BITS))
+			   - (wheel->now >> (level * TIMER_WHEEL_BITS)) >= TIMER_WHEEL_SLOTS)) {
+		level++;
+	}
+	int shift = level * TIMER_WHEEL_BITS;
+	if ((timer->expires >> shift) - (wheel->now >> shift) >= TIMER_WHEEL_SLOTS) {
+		// beyond the span of the wheel
+		timer->expires = ((wheel->now >> shift) + TIMER_WHEEL_SLOTS - 1) << shift;
+	}
+	WheelTimer *head = &wheel->slots[level][(timer->expires >> shift) & (TIMER_WHEEL_SLOTS - 1)];
+	timer->next = head->next;
+	timer->prev = head;
+	head->next->prev = timer;
+	head->next = timer;
+}
+
+/**
+ * Advance the wheel by one tick: cascade higher levels whose slot
+ * comes due, then expire the level-0 slot.
+ */
+static void advanceWheel(TimerWheel *wheel) {
+	wheel->now++;
+	for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		int shift = (level - 1) * TIMER_WHEEL_BITS;
+		if (((wheel->now >> shift) & (TIMER_WHEEL_SLOTS - 1)) != 0) {
+			break;
+		}
+		WheelTimer *head = &wheel->slots[level][(wheel->now >> (shift + TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1)];
+		while (head->next != head) {
+			WheelTimer *timer = head->next;
+			unlinkTimer(timer);
+			linkTimer(wheel, timer);
+		}
+	}
+	WheelTimer *head = &wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)];
+	while (head->next != head) {
+		WheelTimer *timer = head->next;
+		unlinkTimer(timer);
+		timer->callback(timer);
+	}
+}
+
+/**
+ * Wheel thread: advances the wheel to the current time once per tick.
+ */
+static void *wheelThread(void *arg) {
+	TimerWheel *wheel = arg;
+	struct timespec tick = { wheel->tickMs / 1000, (wheel->tickMs % 1000) * 1000000L };
+	while (true) {
+		nanosleep(&tick, NULL);
+		uint64_t target = (monotonicTimeNs() - wheel->startNs) / (wheel->tickMs * 1000000ULL);
+		pthread_mutex_lock(&wheel->lock);
+		while (wheel->now < target) {
+			advanceWheel(wheel);
+		}
+		pthread_mutex_unlock(&wheel->lock);
+	}
+	return NULL;
+}
+
+/**
+ * Create a timer wheel and start its thread.
+ *
+ * @param tickMs the tick length in milliseconds
+ * @return the wheel, or NULL if error
+ */
+TimerWheel *newTimerWheel(unsigned tickMs) {
+	TimerWheel *wheel = calloc(1, sizeof(TimerWheel));
+	if (wheel == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&wheel->lock, NULL);
+	wheel->tickMs = (tickMs > 0) ? tickMs : 1;
+	wheel->startNs = monotonicTimeNs();
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+			wheel->slots[level][slot].next = wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+		}
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, wheelThread, wheel) != 0) {
+		free(wheel);
+		return NULL;
+	}
+	pthread_detach(thread);
+	return wheel;
+}
+
+/**
+ * Initialize a timer.
+ *
+ * @param timer the timer
+ * @param callback function called when the timer expires
+ */
+void initWheelTimer(WheelTimer *timer, WheelCallback callback) {
+	timer->next = timer->prev = NULL;
+	timer->expires = 0;
+	timer->callback = callback;
+}
+
+/**
+ * Return the tick at which a timer armed now for a timeout would
+ * expire.
+ *
+ * @param wheel the wheel
+ * @param timeoutMs milliseconds from now
+ * @return the expiry tick
+ */
+uint64_t wheelExpiry(TimerWheel *wheel, unsigned long timeoutMs) {
+	// round up so a timer never fires early
+	uint64_t tickNs = wheel->tickMs * 1000000ULL;
+	uint64_t deadlineNs = monotonicTimeNs() - wheel->startNs + timeoutMs * 1000000ULL;
+	return (deadlineNs + tickNs - 1) / tickNs;
+}
+
+/**
+ * Arm a timer, or move it if already armed.
+ *
+ * @param wheel the wheel
+ * @param timer the timer
+ * @param timeoutMs milliseconds from now
+ */
+void armWheelTimer(TimerWheel *wheel, WheelTimer *timer, unsigned long timeoutMs) {
+	uint64_t expires = wheelExpiry(wheel, timeoutMs);
+	pthread_mutex_lock(&wheel->lock);
+	if (timer->prev != NULL) {
+		unlinkTimer(timer);
+	}
+	// the slot of the current tick has already been expired
+	timer->expires = (expires > wheel->now) ? expires : wheel->now + 1;
+	linkTimer(wheel, timer);
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+/**
+ * Cancel a timer if armed. Once this returns, the callback of the
+ * timer is not running and will not run.
+ *
+ * @param wheel the wheel
+ * @param timer the timer
+ */
+void cancelWheelTimer(TimerWheel *wheel, WheelTimer *timer) {
+	pthread_mutex_lock(&wheel->lock);
+	if (timer->prev != NULL) {
+		unlinkTimer(timer);
+	}
+	pthread_mutex_unlock(&wheel->lock);
+}
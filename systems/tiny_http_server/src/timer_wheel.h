@@ -0,0 +1,94 @@
+/*
+ * timer_wheel.h
+ *
+ * Hierarchical timer wheel.
+ *
+ * Timers hash into TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS
+ * slots; a slot at level L spans SLOTS^L ticks. Arming and
+ * cancelling a timer are O(1). A background thread advances the
+ * wheel once per tick, expiring the current level-0 slot and
+ * cascading a higher-level slot into the levels below whenever
+ * the level below wraps. Deadlines are accurate to one tick and
+ * deadlines beyond the wheel's span are clamped to it.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** levels of the wheel */
+#define TIMER_WHEEL_LEVELS 4
+
+/** bits of slot index per level */
+#define TIMER_WHEEL_BITS 6
+
+/** slots per level */
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+typedef struct WheelTimer WheelTimer;
+
+/**
+ * Function called when a timer expires. It runs on the wheel
+ * thread with the wheel locked, so it must be short and must not
+ * arm or cancel timers; the timer is already disarmed.
+ */
+typedef void (*WheelCallback)(WheelTimer *timer);
+
+/** A timer; embed in the object it times */
+struct WheelTimer {
+	WheelTimer *next, *prev;	/** slot list links; prev is NULL if not armed */
+	uint64_t expires;			/** tick the timer expires */
+	WheelCallback callback;		/** called when the timer expires */
+};
+
+typedef struct TimerWheel TimerWheel;
+
+/**
+ * Create a timer wheel and start its thread.
+ *
+ * @param tickMs the tick length in milliseconds
+ * @return the wheel, or NULL if error
+ */
+TimerWheel *newTimerWheel(unsigned tickMs);
+
+/**
+ * Initialize a timer.
+ *
+ * @param timer the timer
+ * @param callback function called when the timer expires
+ */
+void initWheelTimer(WheelTimer *timer, WheelCallback callback);
+
+/**
+ * Arm a timer, or move it if already armed.
+ *
+ * @param wheel the wheel
+ * @param timer the timer
+ * @param timeoutMs milliseconds from now
+ */
+void armWheelTimer(TimerWheel *wheel, WheelTimer *timer, unsigned long timeoutMs);
+
+/**
+ * Cancel a timer if armed. Once this returns, the callback of the
+ * timer is not running and will not run.
+ *
+ * @param wheel the wheel
+ * @param timer the timer
+ */
+void cancelWheelTimer(TimerWheel *wheel, WheelTimer *timer);
+
+/**
+ * Return the tick at which a timer armed now for a timeout would
+ * expire.
+ *
+ * @param wheel the wheel
+ * @param timeoutMs milliseconds from now
+ * @return the expiry tick
+ */
+uint64_t wheelExpiry(TimerWheel *wheel, unsigned long timeoutMs);
+
+#endif /* TIMER_WHEEL_H_ */
@@ -0,0 +1,190 @@
+/*
+ * traffic_capture.c
+ *
+ * Functions for capturing request traffic to a binary trace.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "traffic_capture.h"
+#include "time_util.h"
+
+/** encoding buffer: request line and fields in one half, headers in the other */
+#define MAX_TRACE_RECORD 16384
+
+/** interval at which the trace is flushed */
+#define TRACE_FLUSH_NS 100000000L
+
+/** the trace file, or NULL if not capturing */
+static FILE *traceFile;
+
+/** serializes writes to the trace */
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** monotonic time the trace started */
+static unsigned long long traceStartNs;
+
+/**
+ * Append an unsigned LEB128 varint.
+ *
+ * @return the new length
+ */
+static size_t putVarint(uint8_t *buf, size_t len, uint64_t value) {
+	while (value >= 0x80) {
+		buf[len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (uint8_t)value;
+	return len;
+}
+
+/**
+ * Append a length-prefixed string if it fits.
+ *
+ * @return the new length, or 0 if the string does not fit
+ */
+static size_t putString(uint8_t *buf, size_t len, size_t size, const char *s) {
+	size_t n = strlen(s);
+	if (len + n + 10 > size) {
+		return 0;
+	}
+	len = putVarint(buf, len, n);
+	memcpy(buf + len, s, n);
+	return len + n;
+}
+
+/**
+ * Background flusher so a trace is complete shortly after
+ * the last request even if the server is killed.
+ */
+static void *traceFlusher(void *arg) {
+	(void)arg;
+	struct timespec interval = { 0, TRACE_FLUSH_NS };
+	while (true) {
+		nanosleep(&interval, NULL);
+		pthread_mutex_lock(&traceLock);
+		fflush(traceFile);
+		pthread_mutex_unlock(&traceLock);
+	}
+	return NULL;
+}
+
+/**
+ * Open a trace file and start capturing requests.
+ *
+ * @param path the trace file
+ * @return true if the trace was opened
+ */
+bool openTrafficCapture(const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		return false;
+	}
+	setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t wallNs = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+	uint8_t header[TRACE_MAGIC_LEN + 8];
+	memcpy(header, TRACE_MAGIC, TRACE_MAGIC_LEN);
+	for (int i = 0; i < 8; i++) {
+		header[TRACE_MAGIC_LEN + i] = (uint8_t)(wallNs >> (8 * i));
+	}
+	if (fwrite(header, sizeof(header), 1, f) != 1) {
+		fclose(f);
+		return false;
+	}
+	traceStartNs = monotonicTimeNs();
+	traceFile = f;
+
+	pthread_t flusher;
+	if (pthread_create(&flusher, NULL, traceFlusher, NULL) != 0) {
+		traceFile = NULL;
+		fclose(f);
+		return false;
+	}
+	pthread_detach(flusher);
+	return true;
+}
+
+/**
+ * Return whether requests are being captured.
+ *
+ * @return true if capturing
+ */
+bool trafficCaptureEnabled(void) {
+	return traceFile != NULL;
+}
+
+/**
+ * Capture a completed request.
+ *
+ * @param startNs monotonic time the request arrived in nanoseconds
+ * @param durationNs time to process the request in nanoseconds
+ * @param requestLine the request line
+ * @param requestHeaders the request headers
+ * @param status the response status
+ * @param bytesOut bytes sent for the request
+ */
+void captureRequest(unsigned long long startNs, unsigned long long durationNs,
+					const char *requestLine, Properties *requestHeaders,
+					int status, unsigned long long bytesOut) {
+	if (traceFile == NULL) {
+		return;
+	}
+
+	// encode the record outside the lock
+	uint8_t *buf = malloc(MAX_TRACE_RECORD);
+	if (buf == NULL) {
+		return;
+	}
+	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
+	unsigned long long bodyBytes = 0;
+	size_t nHeaders = 0;
+	if (requestHeaders != NULL) {
+		if (findProperty(requestHeaders, 0, "Content-Length", val) != SIZE_MAX) {
+			bodyBytes = strtoull(val, NULL, 10);
+		}
+		nHeaders = nProperties(requestHeaders);
+	}
+
+	// headers first, so the count covers only those that fit;
+	// the query and version are saved under "?" keys and are
+	// already in the request line
+	uint8_t *headers = buf + MAX_TRACE_RECORD / 2;
+	size_t hlen = 0, count = 0;
+	for (size_t i = 0; i < nHeaders; i++) {
+		if (!getProperty(requestHeaders, i, name, val) || name[0] == '?') {
+			continue;
+		}
+		size_t n = putString(headers, hlen, MAX_TRACE_RECORD / 2, name);
+		if (n == 0 || (n = putString(headers, n, MAX_TRACE_RECORD / 2, val)) == 0) {
+			break;
+		}
+		hlen = n;
+		count++;
+	}
+
+	size_t len = 0;
+	len = putVarint(buf, len, (startNs > traceStartNs) ? (startNs - traceStartNs) / 1000 : 0);
+	len = putVarint(buf, len, durationNs / 1000);
+	len = putVarint(buf, len, (uint64_t)status);
+	len = putVarint(buf, len, bodyBytes);
+	len = putVarint(buf, len, bytesOut);
+	size_t n = putString(buf, len, MAX_TRACE_RECORD / 2, requestLine);
+	len = (n != 0) ? n : putString(buf, len, MAX_TRACE_RECORD / 2, "-");
+	len = putVarint(buf, len, count);
+
+	pthread_mutex_lock(&traceLock);
+	fwrite(buf, 1, len, traceFile);
+	fwrite(headers, 1, hlen, traceFile);
+	pthread_mutex_unlock(&traceLock);
+	free(buf);
+}
@@ -0,0 +1,63 @@
+/*
+ * traffic_capture.h
+ *
+ * Functions for capturing request traffic to a binary trace that
+ * bench/replay can play back against a copy of the content root.
+ *
+ * A trace starts with TRACE_MAGIC and the wall-clock start time in
+ * nanoseconds as a little-endian 64-bit integer. Each request follows
+ * as unsigned LEB128 varints and length-prefixed strings:
+ *
+ *   arrival offset (us)  duration (us)  status
+ *   request body bytes   response bytes
+ *   request line         header count   { name value } ...
+ *
+ * Records are written when requests complete, so arrival offsets
+ * are not strictly increasing.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef TRAFFIC_CAPTURE_H_
+#define TRAFFIC_CAPTURE_H_
+
+#include <stdbool.h>
+
+#include "properties.h"
+
+/** first bytes of a trace file */
+#define TRACE_MAGIC "THTRACE1"
+
+/** length of TRACE_MAGIC */
+#define TRACE_MAGIC_LEN 8
+
+/**
+ * Open a trace file and start capturing requests.
+ *
+ * @param path the trace file
+ * @return true if the trace was opened
+ */
+bool openTrafficCapture(const char *path);
+
+/**
+ * Return whether requests are being captured.
+ *
+ * @return true if capturing
+ */
+bool trafficCaptureEnabled(void);
+
+/**
+ * Capture a completed request.
+ *
+ * @param startNs monotonic time the request arrived in nanoseconds
+ * @param durationNs time to process the request in nanoseconds
+ * @param requestLine the request line
+ * @param requestHeaders the request headers
+ * @param status the response status
+ * @param bytesOut bytes sent for the request
+ */
+void captureRequest(unsigned long long startNs, unsigned long long durationNs,
+					const char *requestLine, Properties *requestHeaders,
+					int status, unsigned long long bytesOut);
+
+#endif /* TRAFFIC_CAPTURE_H_ */
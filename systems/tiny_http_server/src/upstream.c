@@ -0,0 +1,698 @@
+/*
+ * upstream.c
+ *
+ * Upstream servers of proxied routes, and their pools of
+ * persistent connections.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "upstream.h"
+#include "network_util.h"
+#include "properties.h"
+
+/** An upstream server */
+typedef struct Upstream {
+	char name[MAX_PROP_VAL];			/** the address as configured */
+	char host[MAX_PROP_VAL];			/** the address as a Host header */
+	struct sockaddr_storage addr;		/** the socket address */
+	socklen_t addrLen;					/** length of the socket address */
+	pthread_mutex_t lock;				/** guards the connections and their counts */
+	UpstreamConn *conns;				/** open connections */
+	unsigned idle;						/** connections with no requests in flight */
+	unsigned outstanding;				/** requests in flight */
+	bool healthy;						/** taking requests */
+} Upstream;
+
+/** A connection to an upstream server */
+struct UpstreamConn {
+	UpstreamConn *next;					/** next connection to the server */
+	Upstream *upstream;					/** the server */
+	int fd;								/** the socket */
+	pthread_mutex_t writeLock;			/** held while a request is written */
+	pthread_cond_t turn;				/** signaled when a response has been read */
+	unsigned long sent;					/** requests written */
+	unsigned long served;				/** responses read */
+	unsigned users;						/** exchanges using the connection */
+	bool exclusive;						/** in use by a request that cannot share it */
+	bool persistent;					/** the server kept it open after a response */
+	bool broken;						/** takes no further requests */
+	size_t start;						/** first unread byte of buf */
+	size_t end;							/** end of the bytes in buf */
+	char buf[UPSTREAM_BUFFER_SIZE];		/** response bytes received */
+};
+
+/** A URI prefix served by upstream servers */
+struct ProxyRoute {
+	char prefix[MAX_PROP_VAL];			/** the URI prefix */
+	size_t prefixLen;					/** length of the prefix */
+	Upstream *upstreams[MAX_ROUTE_UPSTREAMS];	/** the servers */
+	unsigned nupstreams;				/** number of servers */
+	unsigned next;						/** first server considered by the next request */
+};
+
+/** the routes */
+static ProxyRoute routes[MAX_PROXY_ROUTES];
+static unsigned nroutes;
+
+/** the servers of all routes */
+static Upstream *upstreams[MAX_PROXY_ROUTES * MAX_ROUTE_UPSTREAMS];
+static unsigned nupstreams;
+
+/** most requests in flight on one connection */
+static unsigned pipelineDepth = 1;
+
+/** most idle connections kept per server */
+static unsigned maxIdleConns;
+
+/** connect, send and receive timeout in milliseconds, or 0 for none */
+static long upstreamTimeoutMs;
+
+/** milliseconds between health checks */
+static long healthIntervalMs;
+
+/** target requested by health checks */
+static char healthTarget[MAX_PROP_VAL];
+
+/**
+ * Take a server in or out of rotation, reporting a change.
+ */
+static void setHealthy(Upstream *up, bool healthy) {
+	if (__atomic_exchange_n(&up->healthy, healthy, __ATOMIC_RELAXED) != healthy) {
+		fprintf(stderr, "Upstream %s is %s\n", up->name, healthy ? "up" : "down");
+	}
+}
+
+/**
+ * Open a socket connected to a server.
+ *
+ * @return the socket, or -1 with errno set if error
+ */
+static int connectUpstream(Upstream *up) {
+	int fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (upstreamTimeoutMs > 0) {
+		// the send timeout also bounds connect()
+		struct timeval tv = { .tv_sec = upstreamTimeoutMs / 1000, .tv_usec = (upstreamTimeoutMs % 1000) * 1000 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+	if (up->addr.ss_family != AF_UNIX) {
+		int optval = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+	}
+	if (connect(fd, (struct sockaddr *)&up->addr, up->addrLen) != 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Open a new connection to a server.
+ *
+ * @return the connection, or NULL with errno set if error
+ */
+static UpstreamConn *newUpstreamConn(Upstream *up) {
+	UpstreamConn *conn = malloc(sizeof(UpstreamConn));
+	if (conn == NULL) {
+		return NULL;
+	}
+	conn->fd = connectUpstream(up);
+	if (conn->fd < 0) {
+		int err = errno;
+		free(conn);
+		errno = err;
+		return NULL;
+	}
+	conn->next = NULL;
+	conn->upstream = up;
+	pthread_mutex_init(&conn->writeLock, NULL);
+	pthread_cond_init(&conn->turn, NULL);
+	conn->sent = conn->served = 0;
+	conn->users = 0;
+	conn->exclusive = conn->persistent = conn->broken = false;
+	conn->start = conn->end = 0;
+	return conn;
+}
+
+/**
+ * Close a connection and free it.
+ */
+static void freeUpstreamConn(UpstreamConn *conn) {
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->writeLock);
+	pthread_cond_destroy(&conn->turn);
+	free(conn);
+}
+
+/**
+ * Determine whether an idle connection was closed by the server:
+ * it has nothing to say between responses, so any input means the
+ * connection cannot be used.
+ */
+static bool isStale(UpstreamConn *conn) {
+	struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+	return (conn->start != conn->end) || (poll(&pfd, 1, 0) != 0);
+}
+
+/**
+ * Close the idle connections of a server that it has closed.
+ * Called with the server locked.
+ */
+static void pruneIdleConns(Upstream *up) {
+	for (UpstreamConn **link = &up->conns; *link != NULL; ) {
+		UpstreamConn *conn = *link;
+		if ((conn->users == 0) && isStale(conn)) {
+			*link = conn->next;
+			up->idle--;
+			freeUpstreamConn(conn);
+		} else {
+			link = &conn->next;
+		}
+	}
+}
+
+/**
+ * Take a connection to a server for a request: an idle connection,
+ * else for a pipelined request the persistent connection with the
+ * fewest requests in flight, else a new connection.
+ *
+ * @param up the server
+ * @param pipelined true if the request may share a connection
+ * @param fresh true to open a new connection
+ * @param reused set true if the connection served earlier requests
+ * @return the connection, or NULL with errno set if error
+ */
+static UpstreamConn *takeUpstreamConn(Upstream *up, bool pipelined, bool fresh, bool *reused) {
+	UpstreamConn *conn = NULL;
+	pthread_mutex_lock(&up->lock);
+	for (UpstreamConn **link = &up->conns; !fresh && (*link != NULL); ) {
+		UpstreamConn *c = *link;
+		if (c->users == 0) {
+			if (!isStale(c)) {
+				conn = c;
+				break;
+			}
+			*link = c->next;
+			up->idle--;
+			freeUpstreamConn(c);
+			continue;
+		}
+		if (pipelined && c->persistent && !c->exclusive && !c->broken
+			&& (c->users < pipelineDepth) && ((conn == NULL) || (c->users < conn->users))) {
+			conn = c;
+		}
+		link = &c->next;
+	}
+	if (conn != NULL) {
+		if (conn->users == 0) {
+			up->idle--;
+		}
+		*reused = true;
+	} else {
+		pthread_mutex_unlock(&up->lock);
+		conn = newUpstreamConn(up);
+		if (conn == NULL) {
+			return NULL;
+		}
+		pthread_mutex_lock(&up->lock);
+		conn->next = up->conns;
+		up->conns = conn;
+		*reused = false;
+	}
+	conn->users++;
+	conn->exclusive = !pipelined;
+	up->outstanding++;
+	pthread_mutex_unlock(&up->lock);
+	return conn;
+}
+
+/**
+ * Choose a server of a route not tried yet: a healthy one before
+ * one that is down, then the one with the fewest requests in
+ * flight. Servers equally loaded take turns.
+ *
+ * @param route the route
+ * @param tried the servers already tried
+ * @return the index of the server, or -1 if all were tried
+ */
+static int pickUpstream(ProxyRoute *route, const bool tried[]) {
+	int best = -1;
+	bool bestHealthy = false;
+	unsigned bestLoad = 0;
+	unsigned first = __atomic_fetch_add(&route->next, 1, __ATOMIC_RELAXED);
+	for (unsigned i = 0; i < route->nupstreams; i++) {
+		unsigned k = (first + i) % route->nupstreams;
+		if (tried[k]) {
+			continue;
+		}
+		Upstream *up = route->upstreams[k];
+		bool healthy = __atomic_load_n(&up->healthy, __ATOMIC_RELAXED);
+		unsigned load = __atomic_load_n(&up->outstanding, __ATOMIC_RELAXED);
+		if ((best < 0) || (healthy && !bestHealthy)
+			|| ((healthy == bestHealthy) && (load < bestLoad))) {
+			best = (int)k;
+			bestHealthy = healthy;
+			bestLoad = load;
+		}
+	}
+	return best;
+}
+
+/**
+ * Begin an exchange with an upstream server of a route. The server
+ * is chosen by health and load, and the connection is an idle one, a
+ * new one, or for pipelined requests one with requests in flight.
+ * The caller writes the request with sendUpstream().
+ *
+ * @param route the route
+ * @param exchange the exchange
+ * @param pipelined true if the request may share a connection
+ * @param fresh true to open a new connection
+ * @return true if successful, false if no server could be reached
+ */
+bool beginUpstreamExchange(ProxyRoute *route, UpstreamExchange *exchange, bool pipelined, bool fresh) {
+	bool tried[MAX_ROUTE_UPSTREAMS] = { false };
+	int k;
+	while ((k = pickUpstream(route, tried)) >= 0) {
+		tried[k] = true;
+		Upstream *up = route->upstreams[k];
+		UpstreamConn *conn = takeUpstreamConn(up, pipelined, fresh, &exchange->reused);
+		if (conn == NULL) {
+			// out of descriptors or memory is not the server's fault
+			if ((errno != EMFILE) && (errno != ENFILE) && (errno != ENOMEM) && (errno != ENOBUFS)) {
+				setHealthy(up, false);
+			}
+			continue;
+		}
+
+		// responses come back in the order requests are written
+		pthread_mutex_lock(&conn->writeLock);
+		pthread_mutex_lock(&up->lock);
+		exchange->ticket = conn->sent++;
+		pthread_mutex_unlock(&up->lock);
+		exchange->conn = conn;
+		exchange->writing = true;
+		exchange->reading = false;
+		return true;
+	}
+	exchange->conn = NULL;
+	return false;
+}
+
+/**
+ * Send request bytes to the upstream server.
+ *
+ * @param exchange the exchange
+ * @param buf the bytes
+ * @param len the number of bytes
+ * @return true if sent
+ */
+bool sendUpstream(UpstreamExchange *exchange, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(exchange->conn->fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+/**
+ * Finish sending the request, and wait until the responses to
+ * requests sent before it on the connection have been read.
+ *
+ * @param exchange the exchange
+ * @return true if the response can be read, false if the connection failed
+ */
+bool awaitUpstreamResponse(UpstreamExchange *exchange) {
+	UpstreamConn *conn = exchange->conn;
+	Upstream *up = conn->upstream;
+	if (exchange->writing) {
+		pthread_mutex_unlock(&conn->writeLock);
+		exchange->writing = false;
+	}
+	pthread_mutex_lock(&up->lock);
+	while ((conn->served != exchange->ticket) && !conn->broken) {
+		pthread_cond_wait(&conn->turn, &up->lock);
+	}
+	exchange->reading = (conn->served == exchange->ticket);
+	pthread_mutex_unlock(&up->lock);
+	return exchange->reading;
+}
+
+/**
+ * Receive bytes from a connection.
+ *
+ * @return the number of bytes, 0 at end of file, or -1 if error
+ */
+static ssize_t recvUpstream(UpstreamConn *conn, char *buf, size_t size) {
+	ssize_t n;
+	do {
+		n = recv(conn->fd, buf, size, 0);
+	} while ((n < 0) && (errno == EINTR));
+	return n;
+}
+
+/**
+ * Read a line of the response, without its line terminator.
+ * A line too long for the buffer is truncated.
+ *
+ * @param exchange the exchange
+ * @param line storage for the line
+ * @param size the size of the storage
+ * @return true if a line was read
+ */
+bool readUpstreamLine(UpstreamExchange *exchange, char *line, size_t size) {
+	UpstreamConn *conn = exchange->conn;
+	size_t len = 0;
+	while (true) {
+		if (conn->start == conn->end) {
+			ssize_t n = recvUpstream(conn, conn->buf, sizeof(conn->buf));
+			if (n <= 0) {
+				return false;
+			}
+			conn->start = 0;
+			conn->end = n;
+		}
+		char *p = conn->buf + conn->start;
+		size_t avail = conn->end - conn->start;
+		char *eol = memchr(p, '\n', avail);
+		size_t take = (eol != NULL) ? (size_t)(eol - p) : avail;
+		size_t copy = (take < size - 1 - len) ? take : size - 1 - len;
+		memcpy(line + len, p, copy);
+		len += copy;
+		conn->start += take;
+		if (eol != NULL) {
+			conn->start++;
+			if ((len > 0) && (line[len-1] == '\r')) {
+				len--;
+			}
+			line[len] = '\0';
+			return true;
+		}
+	}
+}
+
+/**
+ * Read response bytes.
+ *
+ * @param exchange the exchange
+ * @param buf storage for the bytes
+ * @param size the most bytes to read
+ * @return the number of bytes read, 0 at end of file, or -1 if error
+ */
+ssize_t readUpstream(UpstreamExchange *exchange, char *buf, size_t size) {
+	UpstreamConn *conn = exchange->conn;
+	if (conn->start == conn->end) {
+		// large reads bypass the buffer
+		if (size >= sizeof(conn->buf)) {
+			return recvUpstream(conn, buf, size);
+		}
+		ssize_t n = recvUpstream(conn, conn->buf, sizeof(conn->buf));
+		if (n <= 0) {
+			return n;
+		}
+		conn->start = 0;
+		conn->end = n;
+	}
+	size_t n = conn->end - conn->start;
+	if (n > size) {
+		n = size;
+	}
+	memcpy(buf, conn->buf + conn->start, n);
+	conn->start += n;
+	return n;
+}
+
+/**
+ * End an exchange. A connection whose response was read completely
+ * and that the server keeps open serves later requests; otherwise
+ * it is closed once the requests pipelined on it give up.
+ *
+ * @param exchange the exchange
+ * @param reusable true if the connection can serve another request
+ */
+void endUpstreamExchange(UpstreamExchange *exchange, bool reusable) {
+	UpstreamConn *conn = exchange->conn;
+	if (conn == NULL) {
+		return;
+	}
+	Upstream *up = conn->upstream;
+	if (exchange->writing) {
+		pthread_mutex_unlock(&conn->writeLock);
+		exchange->writing = false;
+	}
+
+	pthread_mutex_lock(&up->lock);
+	if (exchange->reading && reusable) {
+		conn->served++;
+		conn->persistent = true;
+	} else {
+		// requests written after this one cannot be answered
+		conn->broken = true;
+	}
+	pthread_cond_broadcast(&conn->turn);
+	up->outstanding--;
+	bool closing = false;
+	if (--conn->users == 0) {
+		conn->exclusive = false;
+		if (conn->broken || (up->idle >= maxIdleConns)) {
+			for (UpstreamConn **link = &up->conns; *link != NULL; link = &(*link)->next) {
+				if (*link == conn) {
+					*link = conn->next;
+					break;
+				}
+			}
+			closing = true;
+		} else {
+			up->idle++;
+		}
+	}
+	pthread_mutex_unlock(&up->lock);
+
+	if (closing) {
+		freeUpstreamConn(conn);
+	}
+	exchange->conn = NULL;
+}
+
+/**
+ * Get the address of the upstream server of an exchange, as
+ * configured, for a Host header or logging.
+ *
+ * @param exchange the exchange
+ * @return the address
+ */
+const char *upstreamName(UpstreamExchange *exchange) {
+	return exchange->conn->upstream->host;
+}
+
+/**
+ * Check a server by requesting the health check target on a new
+ * connection: it is healthy if it answers with a status below 500.
+ *
+ * @return true if healthy
+ */
+static bool checkUpstream(Upstream *up) {
+	int fd = connectUpstream(up);
+	if (fd < 0) {
+		return false;
+	}
+	char buf[3*MAX_PROP_VAL];
+	int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+					   healthTarget, up->host);
+	bool healthy = false;
+	if (send(fd, buf, len, MSG_NOSIGNAL) == len) {
+		size_t have = 0;
+		ssize_t n;
+		while ((have < sizeof(buf) - 1)
+			   && ((n = recv(fd, buf + have, sizeof(buf) - 1 - have, 0)) > 0)) {
+			have += n;
+			buf[have] = '\0';
+			if (strchr(buf, '\n') != NULL) {
+				int status;
+				healthy = (sscanf(buf, "HTTP/%*d.%*d %d", &status) == 1) && (status < 500);
+				break;
+			}
+		}
+	}
+	close(fd);
+	return healthy;
+}
+
+/**
+ * Check every server periodically, and close idle connections
+ * that servers have closed.
+ */
+static void *upstreamHealthChecker(void *arg) {
+	(void)arg;
+	struct timespec interval = {
+		.tv_sec = healthIntervalMs / 1000,
+		.tv_nsec = (healthIntervalMs % 1000) * 1000000
+	};
+	while (true) {
+		nanosleep(&interval, NULL);
+		for (unsigned i = 0; i < nupstreams; i++) {
+			Upstream *up = upstreams[i];
+			setHealthy(up, checkUpstream(up));
+			pthread_mutex_lock(&up->lock);
+			pruneIdleConns(up);
+			pthread_mutex_unlock(&up->lock);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Find a server by its address, or add it.
+ *
+ * @param name the address
+ * @return the server, or NULL with errno set if error
+ */
+static Upstream *getUpstream(const char *name) {
+	for (unsigned i = 0; i < nupstreams; i++) {
+		if (strcmp(upstreams[i]->name, name) == 0) {
+			return upstreams[i];
+		}
+	}
+	if ((nupstreams == sizeof(upstreams)/sizeof(upstreams[0])) || (strlen(name) >= MAX_PROP_VAL)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	Upstream *up = calloc(1, sizeof(Upstream));
+	if (up == NULL) {
+		return NULL;
+	}
+	if (get_peer_address(name, &up->addr, &up->addrLen) != 0) {
+		free(up);
+		return NULL;
+	}
+	strcpy(up->name, name);
+	if (up->addr.ss_family == AF_UNIX) {
+		strcpy(up->host, "localhost");
+	} else {
+		// drop the address type
+		const char *colon = strchr(name, ':');
+		bool typed = (colon != NULL) && (strchr(colon+1, ':') != NULL) && (name[0] != '[');
+		strcpy(up->host, typed ? colon+1 : name);
+	}
+	pthread_mutex_init(&up->lock, NULL);
+	up->healthy = true;
+	upstreams[nupstreams++] = up;
+	return up;
+}
+
+/**
+ * Add a proxied route: a URI prefix followed by one or more upstream
+ * server addresses (see get_peer_address()), separated by commas or
+ * spaces, such as "/api/ 127.0.0.1:9000,127.0.0.1:9001".
+ *
+ * @param route the route
+ * @return true if successful, false with errno set if invalid
+ */
+bool addProxyRoute(const char *route) {
+	char buf[MAX_PROP_VAL];
+	if ((nroutes == MAX_PROXY_ROUTES) || (strlen(route) >= sizeof(buf))) {
+		errno = EINVAL;
+		return false;
+	}
+	strcpy(buf, route);
+
+	char *save;
+	char *prefix = strtok_r(buf, ", \t", &save);
+	if ((prefix == NULL) || (*prefix != '/')) {
+		errno = EINVAL;
+		return false;
+	}
+	ProxyRoute *r = &routes[nroutes];
+	memset(r, 0, sizeof(ProxyRoute));
+	strcpy(r->prefix, prefix);
+	r->prefixLen = strlen(prefix);
+	for (char *name = strtok_r(NULL, ", \t", &save); name != NULL; name = strtok_r(NULL, ", \t", &save)) {
+		if (r->nupstreams == MAX_ROUTE_UPSTREAMS) {
+			errno = EINVAL;
+			return false;
+		}
+		Upstream *up = getUpstream(name);
+		if (up == NULL) {
+			return false;
+		}
+		r->upstreams[r->nupstreams++] = up;
+	}
+	if (r->nupstreams == 0) {
+		errno = EINVAL;
+		return false;
+	}
+	nroutes++;
+	return true;
+}
+
+/**
+ * Find the route of a request by the longest matching prefix.
+ *
+ * @param uri the decoded request URI
+ * @return the route, or NULL if the request is not proxied
+ */
+ProxyRoute *findProxyRoute(const char *uri) {
+	ProxyRoute *found = NULL;
+	for (unsigned i = 0; i < nroutes; i++) {
+		if ((strncmp(uri, routes[i].prefix, routes[i].prefixLen) == 0)
+			&& ((found == NULL) || (routes[i].prefixLen > found->prefixLen))) {
+			found = &routes[i];
+		}
+	}
+	return found;
+}
+
+/**
+ * Initialize proxying of the routes added, and start health checks.
+ *
+ * @param pipeline the most requests in flight on one connection (1 for no pipelining)
+ * @param maxIdle the most idle connections kept per upstream server
+ * @param timeoutMs the connect, send and receive timeout for upstream servers (0 for none)
+ * @param healthInterval milliseconds between health checks (0 for none)
+ * @param healthPath the target requested by health checks
+ * @return true if successful
+ */
+bool initProxy(unsigned pipeline, unsigned maxIdle, long timeoutMs,
+			   long healthInterval, const char *healthPath) {
+	pipelineDepth = (pipeline > 0) ? pipeline : 1;
+	maxIdleConns = maxIdle;
+	upstreamTimeoutMs = timeoutMs;
+	healthIntervalMs = healthInterval;
+	snprintf(healthTarget, sizeof(healthTarget), "%s", healthPath);
+	if ((nupstreams == 0) || (healthIntervalMs <= 0)) {
+		return true;
+	}
+	pthread_t checker;
+	if (pthread_create(&checker, NULL, upstreamHealthChecker, NULL) != 0) {
+		return false;
+	}
+	pthread_detach(checker);
+	return true;
+}
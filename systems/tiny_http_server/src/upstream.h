@@ -0,0 +1,150 @@
+/*
+ * upstream.h
+ *
+ * Upstream servers of proxied routes, and their pools of
+ * persistent connections.
+ *
+ * A route maps a URI prefix to one or more upstream servers. Each
+ * request goes to the healthy server with the fewest requests in
+ * flight. Connections to a server are kept open between requests,
+ * and a GET or HEAD without a body may be pipelined: it is written
+ * on a connection whose earlier requests are still being answered,
+ * and reads its response when theirs have been read. A background
+ * thread checks each server periodically; a server that refuses a
+ * connection is taken out of rotation until a check succeeds.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef UPSTREAM_H_
+#define UPSTREAM_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** most proxied routes */
+#define MAX_PROXY_ROUTES 16
+
+/** most upstream servers of a route */
+#define MAX_ROUTE_UPSTREAMS 8
+
+/** size of the response buffer of an upstream connection */
+#define UPSTREAM_BUFFER_SIZE 8192
+
+typedef struct ProxyRoute ProxyRoute;
+typedef struct UpstreamConn UpstreamConn;
+
+/** One request and response on an upstream connection */
+typedef struct UpstreamExchange {
+	UpstreamConn *conn;			/** the connection */
+	unsigned long ticket;		/** position of the request on the connection */
+	bool writing;				/** the connection's write lock is held */
+	bool reading;				/** the response is being read */
+	bool reused;				/** the connection was opened for an earlier request */
+} UpstreamExchange;
+
+/**
+ * Initialize proxying of the routes added, and start health checks.
+ *
+ * @param pipeline the most requests in flight on one connection (1 for no pipelining)
+ * @param maxIdle the most idle connections kept per upstream server
+ * @param timeoutMs the connect, send and receive timeout for upstream servers (0 for none)
+ * @param healthInterval milliseconds between health checks (0 for none)
+ * @param healthPath the target requested by health checks
+ * @return true if successful
+ */
+bool initProxy(unsigned pipeline, unsigned maxIdle, long timeoutMs,
+			   long healthInterval, const char *healthPath);
+
+/**
+ * Add a proxied route: a URI prefix followed by one or more upstream
+ * server addresses (see get_peer_address()), separated by commas or
+ * spaces, such as "/api/ 127.0.0.1:9000,127.0.0.1:9001".
+ *
+ * @param route the route
+ * @return true if successful, false with errno set if invalid
+ */
+bool addProxyRoute(const char *route);
+
+/**
+ * Find the route of a request by the longest matching prefix.
+ *
+ * @param uri the decoded request URI
+ * @return the route, or NULL if the request is not proxied
+ */
+ProxyRoute *findProxyRoute(const char *uri);
+
+/**
+ * Begin an exchange with an upstream server of a route. The server
+ * is chosen by health and load, and the connection is an idle one, a
+ * new one, or for pipelined requests one with requests in flight.
+ * The caller writes the request with sendUpstream().
+ *
+ * @param route the route
+ * @param exchange the exchange
+ * @param pipelined true if the request may share a connection
+ * @param fresh true to open a new connection
+ * @return true if successful, false if no server could be reached
+ */
+bool beginUpstreamExchange(ProxyRoute *route, UpstreamExchange *exchange, bool pipelined, bool fresh);
+
+/**
+ * Send request bytes to the upstream server.
+ *
+ * @param exchange the exchange
+ * @param buf the bytes
+ * @param len the number of bytes
+ * @return true if sent
+ */
+bool sendUpstream(UpstreamExchange *exchange, const char *buf, size_t len);
+
+/**
+ * Finish sending the request, and wait until the responses to
+ * requests sent before it on the connection have been read.
+ *
+ * @param exchange the exchange
+ * @return true if the response can be read, false if the connection failed
+ */
+bool awaitUpstreamResponse(UpstreamExchange *exchange);
+
+/**
+ * Read a line of the response, without its line terminator.
+ * A line too long for the buffer is truncated.
+ *
+ * @param exchange the exchange
+ * @param line storage for the line
+ * @param size the size of the storage
+ * @return true if a line was read
+ */
+bool readUpstreamLine(UpstreamExchange *exchange, char *line, size_t size);
+
+/**
+ * Read response bytes.
+ *
+ * @param exchange the exchange
+ * @param buf storage for the bytes
+ * @param size the most bytes to read
+ * @return the number of bytes read, 0 at end of file, or -1 if error
+ */
+ssize_t readUpstream(UpstreamExchange *exchange, char *buf, size_t size);
+
+/**
+ * End an exchange. A connection whose response was read completely
+ * and that the server keeps open serves later requests; otherwise
+ * it is closed once the requests pipelined on it give up.
+ *
+ * @param exchange the exchange
+ * @param reusable true if the connection can serve another request
+ */
+void endUpstreamExchange(UpstreamExchange *exchange, bool reusable);
+
+/**
+ * Get the address of the upstream server of an exchange, as
+ * configured, for a Host header or logging.
+ *
+ * @param exchange the exchange
+ * @return the address
+ */
+const char *upstreamName(UpstreamExchange *exchange);
+
+#endif /* UPSTREAM_H_ */
@@ -0,0 +1,323 @@
+/*
+ * warm_up.c
+ *
+ * Cache warm-up before the server accepts connections.
+ *
+ *  @since 2026-10-19
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "warm_up.h"
+#include "file_cache.h"
+#include "stat_cache.h"
+
+/** A hot file of the hit snapshot */
+typedef struct HotFile {
+	unsigned long hits;		/** hits in the last run */
+	char path[];			/** the file path */
+} HotFile;
+
+/** pool and lane running warm-up jobs */
+static threadpool warmPool;
+static int warmLane;
+
+/** guards the progress */
+static pthread_mutex_t warmLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** signaled as warm-up progresses */
+static pthread_cond_t warmProgress = PTHREAD_COND_INITIALIZER;
+
+/** directories queued or being scanned */
+static size_t pendingDirs;
+
+/** files scanned */
+static size_t filesScanned;
+
+/** hottest files loaded, and to load */
+static size_t hotLoaded, hotTotal;
+
+static void scanDirectory(char *dir);
+
+/**
+ * Queue the scan of a directory.
+ *
+ * @param dir the directory path
+ */
+static void queueDirectory(const char *dir) {
+	char *copy = strdup(dir);
+	if (copy == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&warmLock);
+	pendingDirs++;
+	pthread_mutex_unlock(&warmLock);
+	if (thpool_add_work_lane(warmPool, warmLane, (void *)scanDirectory, copy) != 0) {
+		scanDirectory(copy);
+	}
+}
+
+/**
+ * Scan a directory: prime the stat cache with its entries, build
+ * the headers of its files, and queue its subdirectories.
+ *
+ * @param dir the directory path, freed when done
+ */
+static void scanDirectory(char *dir) {
+	size_t files = 0;
+	DIR *d = opendir(dir);
+	if (d != NULL) {
+		struct dirent *entry;
+		while ((entry = readdir(d)) != NULL) {
+			if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+				continue;
+			}
+			char path[PATH_MAX];
+			if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path)) {
+				continue;
+			}
+			struct stat sb;
+			if (cachedStat(path, &sb) != 0) {
+				continue;
+			}
+			if (S_ISDIR(sb.st_mode)) {
+				// not through links, which may loop
+				if (entry->d_type != DT_LNK) {
+					queueDirectory(path);
+				}
+			} else if (S_ISREG(sb.st_mode)) {
+				FileEntry *file = acquireFile(path, &sb, false);
+				if (file != NULL) {
+					releaseFile(file);
+				}
+				files++;
+			}
+		}
+		closedir(d);
+	}
+	free(dir);
+
+	pthread_mutex_lock(&warmLock);
+	filesScanned += files;
+	pendingDirs--;
+	pthread_cond_broadcast(&warmProgress);
+	pthread_mutex_unlock(&warmLock);
+}
+
+/**
+ * Have the kernel read a file into the page cache.
+ *
+ * @param path the file path
+ * @param size the file size
+ */
+static void readAhead(const char *path, size_t size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+#if defined(__linux__)
+	readahead(fd, 0, size);
+#else
+	posix_fadvise(fd, 0, (off_t)size, POSIX_FADV_WILLNEED);
+#endif
+	close(fd);
+}
+
+/**
+ * Load a hot file into the file cache, or into the page cache
+ * if too large to cache. It keeps half its hits, so files that
+ * are no longer requested cool down over restarts.
+ *
+ * @param hot the hot file, freed when done
+ */
+static void loadHotFile(HotFile *hot) {
+	struct stat sb;
+	if ((cachedStat(hot->path, &sb) == 0) && S_ISREG(sb.st_mode)) {
+		FileEntry *file = acquireFile(hot->path, &sb, true);
+		if (file != NULL) {
+			setFileHits(file, (hot->hits + 1) / 2);
+		}
+		if ((file == NULL) || (file->body == NULL)) {
+			readAhead(hot->path, (size_t)sb.st_size);
+		}
+		if (file != NULL) {
+			releaseFile(file);
+		}
+	}
+	free(hot);
+
+	pthread_mutex_lock(&warmLock);
+	hotLoaded++;
+	pthread_cond_broadcast(&warmProgress);
+	pthread_mutex_unlock(&warmLock);
+}
+
+/**
+ * Order hot files by hits, most first.
+ */
+static int compareHits(const void *a, const void *b) {
+	const HotFile *ha = *(HotFile * const *)a;
+	const HotFile *hb = *(HotFile * const *)b;
+	return (ha->hits < hb->hits) ? 1 : (ha->hits > hb->hits) ? -1 : 0;
+}
+
+/**
+ * Queue loading the hottest files of a hit snapshot, hottest first.
+ *
+ * @param hitsPath the snapshot file
+ * @param hottest the most files to load
+ */
+static void queueHotFiles(const char *hitsPath, size_t hottest) {
+	FILE *in = fopen(hitsPath, "r");
+	if (in == NULL) {
+		if (errno != ENOENT) {
+			perror(hitsPath);
+		}
+		return;
+	}
+	HotFile **hot = NULL;
+	size_t n = 0, size = 0;
+	char line[PATH_MAX + 32];
+	while (fgets(line, sizeof(line), in) != NULL) {
+		char *end;
+		unsigned long hits = strtoul(line, &end, 10);
+		if ((end == line) || (*end != ' ')) {
+			continue;
+		}
+		char *path = end + 1;
+		path[strcspn(path, "\n")] = '\0';
+		if (n == size) {
+			size = (size == 0) ? 256 : size * 2;
+			HotFile **grown = realloc(hot, size * sizeof(HotFile *));
+			if (grown == NULL) {
+				break;
+			}
+			hot = grown;
+		}
+		HotFile *file = malloc(sizeof(HotFile) + strlen(path) + 1);
+		if (file == NULL) {
+			break;
+		}
+		file->hits = hits;
+		strcpy(file->path, path);
+		hot[n++] = file;
+	}
+	fclose(in);
+
+	qsort(hot, n, sizeof(HotFile *), compareHits);
+	size_t queued = (n < hottest) ? n : hottest;
+	pthread_mutex_lock(&warmLock);
+	hotTotal = queued;
+	pthread_mutex_unlock(&warmLock);
+	for (size_t i = 0; i < n; i++) {
+		if ((i >= queued) || (thpool_add_work_lane(warmPool, warmLane, (void *)loadHotFile, hot[i]) != 0)) {
+			if (i < queued) {
+				loadHotFile(hot[i]);
+			} else {
+				free(hot[i]);
+			}
+		}
+	}
+	free(hot);
+}
+
+/**
+ * Start warming up on the thread pool.
+ *
+ * @param pool the thread pool
+ * @param lane the pool lane for warm-up jobs
+ * @param root the content tree
+ * @param hitsPath the hit snapshot of the last run, or NULL if none
+ * @param hottest the most files of the snapshot to load
+ * @return true if started
+ */
+bool startWarmUp(threadpool pool, int lane, const char *root, const char *hitsPath, size_t hottest) {
+	warmPool = pool;
+	warmLane = lane;
+
+	// the hottest files first, then the tree
+	if ((hitsPath != NULL) && (hottest > 0)) {
+		queueHotFiles(hitsPath, hottest);
+	}
+
+	// scan by the same spelling of paths as requests resolve to
+	char rootBuf[PATH_MAX];
+	size_t len = strlen(root);
+	while ((len > 1) && (root[len-1] == '/')) {
+		len--;
+	}
+	if (len >= sizeof(rootBuf)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	memcpy(rootBuf, root, len);
+	rootBuf[len] = '\0';
+	queueDirectory(rootBuf);
+	return true;
+}
+
+/**
+ * Determine whether warm-up reached a percentage of the hottest
+ * files. The caller holds the lock.
+ */
+static bool warmUpReached(int percent) {
+	return (pendingDirs == 0) && (hotLoaded * 100 >= (size_t)percent * hotTotal);
+}
+
+/**
+ * Wait until the tree is scanned and a percentage of the hottest
+ * files are loaded, or a timeout passes.
+ *
+ * @param percent the percentage of the hottest files
+ * @param timeoutMs the most time to wait, or 0 for no limit
+ * @return true if warm-up reached the percentage
+ */
+bool awaitWarmUp(int percent, long timeoutMs) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&warmLock);
+	while (!warmUpReached(percent)) {
+		if (timeoutMs <= 0) {
+			pthread_cond_wait(&warmProgress, &warmLock);
+		} else if (pthread_cond_timedwait(&warmProgress, &warmLock, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	bool reached = warmUpReached(percent);
+	pthread_mutex_unlock(&warmLock);
+	return reached;
+}
+
+/**
+ * Get the progress of warm-up.
+ *
+ * @param files the number of files scanned
+ * @param loaded the number of hottest files loaded
+ * @param total the number of hottest files to load
+ */
+void warmUpProgress(size_t *files, size_t *loaded, size_t *total) {
+	pthread_mutex_lock(&warmLock);
+	*files = filesScanned;
+	*loaded = hotLoaded;
+	*total = hotTotal;
+	pthread_mutex_unlock(&warmLock);
+}
@@ -0,0 +1,56 @@
+/*
+ * warm_up.h
+ *
+ * Cache warm-up before the server accepts connections.
+ *
+ * Warm-up scans the content tree in parallel on the thread pool, one
+ * job per directory, priming the stat cache and building the headers
+ * of every file in the file cache. Meanwhile it loads the contents of
+ * the hottest files of the last run, by a saved hit snapshot, into
+ * the file cache, hottest first, and has the kernel read ahead those
+ * too large to cache. The first requests after a restart then find
+ * their metadata, headers and contents in memory.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef WARM_UP_H_
+#define WARM_UP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "thpool.h"
+
+/**
+ * Start warming up on the thread pool.
+ *
+ * @param pool the thread pool
+ * @param lane the pool lane for warm-up jobs
+ * @param root the content tree
+ * @param hitsPath the hit snapshot of the last run, or NULL if none
+ * @param hottest the most files of the snapshot to load
+ * @return true if started
+ */
+bool startWarmUp(threadpool pool, int lane, const char *root, const char *hitsPath, size_t hottest);
+
+/**
+ * Wait until the tree is scanned and a percentage of the hottest
+ * files are loaded, or a timeout passes.
+ *
+ * @param percent the percentage of the hottest files
+ * @param timeoutMs the most time to wait, or 0 for no limit
+ * @return true if warm-up reached the percentage
+ */
+bool awaitWarmUp(int percent, long timeoutMs);
+
+/**
+ * Get the progress of warm-up.
+ *
+ * @param files the number of files scanned
+ * @param loaded the number of hottest files loaded
+ * @param total the number of hottest files to load
+ */
+void warmUpProgress(size_t *files, size_t *loaded, size_t *total);
+
+#endif /* WARM_UP_H_ */
@@ -0,0 +1,191 @@
+/*
+ * xxh64.c
+ *
+ * The XXH64 hash of xxHash, for hashing file contents.
+ *
+ *  @since 2026-10-19
+ */
+
+#include <string.h>
+
+#include "xxh64.h"
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Read a 64-bit little-endian word.
+ */
+static inline uint64_t read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/**
+ * Read a 32-bit little-endian word.
+ */
+static inline uint32_t read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+	acc += input * PRIME2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+	acc ^= round64(0, val);
+	return acc * PRIME1 + PRIME4;
+}
+
+/**
+ * Consume whole stripes into the accumulators.
+ *
+ * @return the bytes consumed
+ */
+static size_t consumeStripes(uint64_t acc[4], const unsigned char *p, size_t len) {
+	uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+	const unsigned char *start = p, *limit = p + (len & ~(size_t)31);
+	while (p < limit) {
+		v1 = round64(v1, read64(p));
+		v2 = round64(v2, read64(p + 8));
+		v3 = round64(v3, read64(p + 16));
+		v4 = round64(v4, read64(p + 24));
+		p += 32;
+	}
+	acc[0] = v1;
+	acc[1] = v2;
+	acc[2] = v3;
+	acc[3] = v4;
+	return (size_t)(p - start);
+}
+
+/**
+ * Finish a hash: merge the accumulators, mix in the bytes of a
+ * partial stripe, and avalanche.
+ */
+static uint64_t finish(const uint64_t acc[4], uint64_t seed, uint64_t totalLen,
+					   const unsigned char *p, size_t len) {
+	uint64_t h;
+	if (totalLen >= 32) {
+		h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+		for (int i = 0; i < 4; i++) {
+			h = mergeRound(h, acc[i]);
+		}
+	} else {
+		h = seed + PRIME5;
+	}
+	h += totalLen;
+
+	while (len >= 8) {
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME1 + PRIME4;
+		p += 8;
+		len -= 8;
+	}
+	if (len >= 4) {
+		h ^= (uint64_t)read32(p) * PRIME1;
+		h = rotl64(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+		len -= 4;
+	}
+	while (len > 0) {
+		h ^= (*p++) * PRIME5;
+		h = rotl64(h, 11) * PRIME1;
+		len--;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+/**
+ * Hash a buffer.
+ *
+ * @param data the buffer
+ * @param len the length of the buffer
+ * @param seed the seed
+ * @return the hash
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+	const unsigned char *p = data;
+	uint64_t acc[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+	size_t n = consumeStripes(acc, p, len);
+	return finish(acc, seed, len, p + n, len - n);
+}
+
+/**
+ * Start a hash computed over several buffers.
+ *
+ * @param state the state
+ * @param seed the seed
+ */
+void xxh64Init(Xxh64State *state, uint64_t seed) {
+	memset(state, 0, sizeof(*state));
+	state->seed = seed;
+	state->acc[0] = seed + PRIME1 + PRIME2;
+	state->acc[1] = seed + PRIME2;
+	state->acc[2] = seed;
+	state->acc[3] = seed - PRIME1;
+}
+
+/**
+ * Add a buffer to a hash.
+ *
+ * @param state the state
+ * @param data the buffer
+ * @param len the length of the buffer
+ */
+void xxh64Update(Xxh64State *state, const void *data, size_t len) {
+	const unsigned char *p = data;
+	state->totalLen += len;
+
+	// complete a partial stripe first
+	if (state->memSize > 0) {
+		size_t fill = sizeof(state->mem) - state->memSize;
+		if (len < fill) {
+			memcpy(state->mem + state->memSize, p, len);
+			state->memSize += len;
+			return;
+		}
+		memcpy(state->mem + state->memSize, p, fill);
+		consumeStripes(state->acc, state->mem, sizeof(state->mem));
+		state->memSize = 0;
+		p += fill;
+		len -= fill;
+	}
+	size_t n = consumeStripes(state->acc, p, len);
+	memcpy(state->mem, p + n, len - n);
+	state->memSize = len - n;
+}
+
+/**
+ * Get the hash of the buffers added so far.
+ *
+ * @param state the state
+ * @return the hash
+ */
+uint64_t xxh64Digest(const Xxh64State *state) {
+	return finish(state->acc, state->seed, state->totalLen, state->mem, state->memSize);
+}
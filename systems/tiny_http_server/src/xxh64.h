@@ -0,0 +1,64 @@
+/*
+ * xxh64.h
+ *
+ * The XXH64 hash of xxHash, for hashing file contents.
+ *
+ * A portable scalar implementation: four independent accumulators
+ * consume 32-byte stripes, which compilers keep in registers, so it
+ * hashes at several GB/s without depending on an instruction set.
+ * Results match the reference implementation on any host.
+ *
+ *  @since 2026-10-19
+ */
+
+#ifndef XXH64_H_
+#define XXH64_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** State of a hash computed over several buffers */
+typedef struct Xxh64State {
+	uint64_t totalLen;			/** bytes hashed */
+	uint64_t acc[4];			/** stripe accumulators */
+	uint64_t seed;				/** the seed */
+	unsigned char mem[32];		/** bytes of a partial stripe */
+	size_t memSize;				/** bytes in mem */
+} Xxh64State;
+
+/**
+ * Hash a buffer.
+ *
+ * @param data the buffer
+ * @param len the length of the buffer
+ * @param seed the seed
+ * @return the hash
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+/**
+ * Start a hash computed over several buffers.
+ *
+ * @param state the state
+ * @param seed the seed
+ */
+void xxh64Init(Xxh64State *state, uint64_t seed);
+
+/**
+ * Add a buffer to a hash.
+ *
+ * @param state the state
+ * @param data the buffer
+ * @param len the length of the buffer
+ */
+void xxh64Update(Xxh64State *state, const void *data, size_t len);
+
+/**
+ * Get the hash of the buffers added so far.
+ *
+ * @param state the state
+ * @return the hash
+ */
+uint64_t xxh64Digest(const Xxh64State *state);
+
+#endif /* XXH64_H_ */